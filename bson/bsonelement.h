@@ -29,6 +29,7 @@ namespace mongo {
 
     class OpTime;
     class BSONElement;
+    class StringBuilder;
 
     /* l and r MUST have same type when called: check that first. */
     int compareElementValues(const BSONElement& l, const BSONElement& r);
@@ -87,6 +88,8 @@ public:
     string toString( bool includeFieldName = true ) const;
     operator string() const { return toString(); }
     string jsonString( JsonStringFormat format, bool includeFieldNames = true, int pretty = 0 ) const;
+    /** appends the jsonString() to s, without building any intermediate strings */
+    void jsonString( StringBuilder& s, JsonStringFormat format, bool includeFieldNames = true, int pretty = 0 ) const;
 
     /** Returns the type of the element */
     BSONType type() const { return (BSONType) *data; }
@@ -0,0 +1,110 @@
+// bsonfieldindex.h
+
+/*    Copyright 2009 10gen Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+namespace mongo {
+
+    /** Hash of field name to element offset for one object, so that looking up many fields
+        of a wide object need not scan it each time.  Built by a caller about to do that, and
+        only valid while the object's data is unchanged - an update in place moves elements.
+        An object narrower than minFields isn't indexed: lookups just scan it.
+
+        Open addressing with linear probing.  The first of several elements with the same
+        name is the one kept, as for the scan.
+    */
+    class BSONFieldIndex : boost::noncopyable {
+    public:
+        enum { DefaultMinFields = 16 };
+
+        explicit BSONFieldIndex( const BSONObj& o , int minFields = DefaultMinFields ) : _o( o ), _mask( 0 ) {
+            int n = o.nFields();
+            if ( n < minFields )
+                return;
+            unsigned size = 1;
+            while( size < 2 * (unsigned) n )
+                size <<= 1;
+            _mask = size - 1;
+            _slots.resize( size );
+            BSONObjIterator i( o );
+            while( i.more() ) {
+                BSONElement e = i.next();
+                const char *fn = e.fieldName();
+                unsigned h = hash( fn );
+                unsigned k = h & _mask;
+                while( _slots[ k ].offset && !( _slots[ k ].hash == h && strcmp( o.objdata() + _slots[ k ].offset + 1, fn ) == 0 ) )
+                    k = ( k + 1 ) & _mask;
+                if ( !_slots[ k ].offset ) {
+                    _slots[ k ].hash = h;
+                    _slots[ k ].offset = e.rawdata() - o.objdata();
+                }
+            }
+        }
+
+        /** as BSONObj::getField() */
+        BSONElement getField( const char *name ) const {
+            if ( _slots.empty() )
+                return _o.getField( name );
+            unsigned h = hash( name );
+            for( unsigned k = h & _mask; _slots[ k ].offset; k = ( k + 1 ) & _mask ) {
+                if ( _slots[ k ].hash != h )
+                    continue;
+                const char *p = _o.objdata() + _slots[ k ].offset;
+                if ( strcmp( p + 1, name ) == 0 )
+                    return BSONElement( p );
+            }
+            return BSONElement();
+        }
+
+        /** as BSONObj::getFieldDotted(): the index is used for the top level only */
+        BSONElement getFieldDotted( const char *name ) const {
+            BSONElement e = getField( name );
+            if ( e.eoo() ) {
+                const char *p = strchr( name , '.' );
+                if ( p ) {
+                    string left( name , p - name );
+                    BSONElement l = getField( left.c_str() );
+                    if ( l.type() == Object || l.type() == Array )
+                        return l.embeddedObject().getFieldDotted( p + 1 );
+                }
+            }
+            return e;
+        }
+
+        bool indexed() const { return ! _slots.empty(); }
+
+    private:
+        struct Slot {
+            Slot() : hash( 0 ) , offset( 0 ) {}
+            unsigned hash;
+            int offset; // 0 if empty
+        };
+
+        static unsigned hash( const char *name ) {
+            // FNV-1a
+            unsigned h = 2166136261U;
+            for( ; *name; ++name )
+                h = ( h ^ (unsigned char) *name ) * 16777619U;
+            return h;
+        }
+
+        BSONObj _o;
+        vector<Slot> _slots;
+        unsigned _mask;
+    };
+
+}
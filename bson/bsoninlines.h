@@ -43,9 +43,10 @@ namespace mongo {
     }
     
     inline BSONObj BSONObj::copy() const {
-        char *p = (char*) malloc(objsize());
-        memcpy(p, objdata(), objsize());
-        return BSONObj(p, true);
+        int size = objsize() + sizeof( Holder );
+        char *p = (char*) allocBuffer( size );
+        memcpy( p + sizeof( Holder ), objdata(), objsize() );
+        return BSONObj( new ( p ) Holder( size ) );
     }
 
     // wrap this element up as a singleton object.
@@ -504,6 +505,7 @@ namespace mongo {
         /* LITTLE ENDIAN */
         static char p[] = { 5, 0, 0, 0, 0 };
         _objdata = p;
+        _holder = 0;
     }
 
     inline BSONObj BSONElement::Obj() const { return embeddedObjectUserCheck(); }
@@ -21,6 +21,8 @@
 #include <list>
 #include <vector>
 #include "util/builder.h"
+#include <new>
+#include "util/atomic_int.h"
 
 namespace mongo {
 
@@ -33,9 +35,8 @@ namespace mongo {
        See bsonspec.org.
 
        Note that BSONObj's have a smart pointer capability built in -- so you can 
-       pass them around by value.  The reference counts used to implement this
-       do not use locking, so copying and destroying BSONObj's are not thread-safe
-       operations.
+       pass them around by value.  The reference count of an owned object is kept in
+       a small header ahead of its data (see Holder) and is updated atomically.
 
      BSON object format:
      
@@ -76,8 +77,25 @@ namespace mongo {
         BSONObj(const Record *r);
         /** Construct an empty BSONObj -- that is, {}. */
         BSONObj();
-        // defensive
-        ~BSONObj() { _objdata = 0; }
+        BSONObj(const BSONObj &o) : _objdata(o._objdata), _holder(o._holder) {
+            if ( _holder )
+                _holder->addRef();
+        }
+        BSONObj& operator=(const BSONObj &o) {
+            if ( o._holder )
+                o._holder->addRef();
+            if ( _holder )
+                _holder->release();
+            _objdata = o._objdata;
+            _holder = o._holder;
+            return *this;
+        }
+        ~BSONObj() {
+            if ( _holder )
+                _holder->release();
+            // defensive
+            _objdata = 0;
+        }
 
         void appendSelfToBufBuilder(BufBuilder& b) const {
             assert( objsize() );
@@ -95,6 +113,11 @@ namespace mongo {
         */
         string jsonString( JsonStringFormat format = Strict, int pretty = 0 ) const;
 
+        /** Appends the jsonString() to s.  Reusing s for many objects avoids allocating an
+            output buffer (and a string per element) for each.
+        */
+        void jsonString( StringBuilder& s, JsonStringFormat format = Strict, int pretty = 0 ) const;
+
         /** note: addFields always adds _id even if not specified */
         int addFields(BSONObj& from, set<string>& fields); /* returns n added */
 
@@ -285,7 +308,7 @@ namespace mongo {
                 return copy();
             return *this;
         }
-        bool isOwned() const { return _holder.get() != 0; }
+        bool isOwned() const { return _holder != 0; }
 
         /** @return A hash code for the object */
         int hash() const {
@@ -358,28 +381,54 @@ namespace mongo {
         void vals(list<T> &) const;
 
         friend class BSONObjIterator;
+        friend class BSONObjBuilder;
         typedef BSONObjIterator iterator;
         BSONObjIterator begin();
 
 private:
+        /* Reference count of a buffer owned by BSONObjs.  BSONObjBuilder::obj() and copy() build
+           the object right after the Holder in one buffer (from allocBuffer()), so an owned object
+           costs a single allocation.  A buffer passed to BSONObj( data, true ) gets a separate
+           Holder pointing at it.
+        */
         class Holder {
         public:
-            Holder( const char *objdata ) :
-            _objdata( objdata ) {
-            }
-            ~Holder() {
-                free((void *)_objdata);
-                _objdata = 0;
+            /** header of a buffer of capacity bytes, the object follows */
+            explicit Holder( int capacity ) : _refCount( 1 ), _capacity( capacity ), _external( 0 ) {}
+            /** for an object malloc()ed elsewhere */
+            explicit Holder( const char *external ) : _refCount( 1 ), _capacity( 0 ), _external( external ) {}
+            const char *data() const { return _external ? _external : (const char *) this + sizeof( Holder ); }
+            void addRef() { ++_refCount; }
+            void release() {
+                if ( --_refCount != 0 )
+                    return;
+                if ( _external ) {
+                    free( (void *) _external );
+                    delete this;
+                }
+                else {
+                    freeBuffer( this, _capacity );
+                }
             }
         private:
-            const char *_objdata;
+            AtomicUInt _refCount;
+            int _capacity;
+            const char *_external;
         };
+        /** takes over the reference of holder */
+        explicit BSONObj(Holder *holder) {
+            _objdata = holder->data();
+            _holder = holder;
+            assertValid();
+        }
         const char *_objdata;
-        boost::shared_ptr< Holder > _holder;
+        Holder *_holder;
         void init(const char *data, bool ifree) {
-            if ( ifree )
-                _holder.reset( new Holder( data ) );
             _objdata = data;
+            _holder = ifree ? new Holder( data ) : 0;
+            assertValid();
+        }
+        void assertValid() {
             if ( ! isValid() ){
                 stringstream ss;
                 ss << "Invalid BSONObj spec size: " << objsize() << " (" << hex << objsize() << dec << ")";
@@ -389,6 +438,9 @@ private:
                 }
                 catch ( ... ){}
                 string s = ss.str();
+                if ( _holder )
+                    _holder->release();
+                _holder = 0;
                 massert( 10334 , s , 0 );
             }
         }
@@ -81,7 +81,8 @@ namespace mongo {
     class BSONObjBuilder : boost::noncopyable {
     public:
         /** @param initsize this is just a hint as to the final size of the object */
-        BSONObjBuilder(int initsize=512) : _b(_buf), _buf(initsize), _offset( 0 ), _s( this ) , _tracker(0) , _doneCalled(false) {
+        BSONObjBuilder(int initsize=512) : _b(_buf), _buf(initsize), _offset( sizeof( BSONObj::Holder ) ), _s( this ) , _tracker(0) , _doneCalled(false) {
+            _b.skip(_offset); /*room for obj()'s reference count*/
             _b.skip(4); /*leave room for size field*/
         }
 
@@ -90,7 +91,8 @@ namespace mongo {
             _b.skip( 4 );
         }
         
-        BSONObjBuilder( const BSONSizeTracker & tracker ) : _b(_buf) , _buf(tracker.getSize() ), _offset(0), _s( this ) , _tracker( (BSONSizeTracker*)(&tracker) ) , _doneCalled(false) {
+        BSONObjBuilder( const BSONSizeTracker & tracker ) : _b(_buf) , _buf(tracker.getSize() ), _offset( sizeof( BSONObj::Holder ) ), _s( this ) , _tracker( (BSONSizeTracker*)(&tracker) ) , _doneCalled(false) {
+            _b.skip( _offset );
             _b.skip( 4 );
         }
 
@@ -502,8 +504,10 @@ namespace mongo {
         BSONObj obj() {
             bool own = owned();
             massert( 10335 , "builder does not own memory", own );
-            int l;
-            return BSONObj(decouple(l), true);
+            _done();
+            BSONObj::Holder *h = new ( _b.buf() ) BSONObj::Holder( _b.getSize() );
+            _b.decouple();
+            return BSONObj( h );
         }
 
         /** Fetch the object we have built.
@@ -530,7 +534,12 @@ namespace mongo {
         char* decouple(int& l) {
             char *x = _done();
             assert( x );
-            l = _b.len();
+            l = _b.len() - _offset;
+            if ( owned() ) {
+                // free() needs the object at the start of the buffer, where obj() puts its Holder
+                memmove( _b.buf(), x, l );
+                x = _b.buf();
+            }
             _b.decouple();
             return x;
         }
@@ -589,6 +598,9 @@ namespace mongo {
         /** @return true if we are using our own bufbuilder, and not an alternate that was given to us in our constructor */
         bool owned() const { return &_b == &_buf; }
 
+        /** the buffer elements are appended to, for writing raw elements */
+        BufBuilder &bb() { return _b; }
+
         BSONObjIterator iterator() const ;
         
     private:
@@ -28,11 +28,74 @@ namespace mongo {
 
     void msgasserted(int msgid, const char *msg);
 
+#if defined(MONGO_EXPOSE_MACROS)
+    /* mongo keeps a small per thread cache of BufBuilder buffers by power of two size, see
+       util/util.cpp.  They are plain malloc() blocks, so a decouple()d buffer may still be
+       free()d by its new owner.
+       allocBuffer() may round size up.
+       The out of line functions have names of their own: an inline allocBuffer() of a
+       client program built without MONGO_EXPOSE_MACROS must not resolve to them.
+    */
+    void* allocCachedBuffer( int& size );
+    void freeCachedBuffer( void *p, int size );
+    void* reallocCachedBuffer( void *p, int oldSize, int& newSize );
+    inline void* allocBuffer( int& size ) { return allocCachedBuffer( size ); }
+    inline void freeBuffer( void *p, int size ) { freeCachedBuffer( p, size ); }
+    /** number of allocBuffer() calls on this thread that had to malloc */
+    long long bufferMallocs();
+    /** like realloc() for a buffer of oldSize bytes from allocBuffer().  newSize may be rounded up. */
+    inline void* reallocBuffer( void *p, int oldSize, int& newSize ) { return reallocCachedBuffer( p, oldSize, newSize ); }
+
+    /* scratch memory for short-lived buffers, such as the index keys of one document.  while a
+       BufferArena::Scope is open on it, allocBuffer() calls of up to MaxBuffer bytes on this
+       thread are carved out of the arena's blocks.  freeBuffer() of those does nothing; the
+       blocks all go at once when the arena is destroyed.  So anything built in a scope must be
+       gone before its arena is, and its buffer must never be decouple()d.  Arenas on a thread
+       are destroyed in the reverse order of their creation -- declare them as locals.
+    */
+    class BufferArena {
+    public:
+        enum { BlockSize = 16 * 1024, MaxBuffer = 4 * 1024 };
+        BufferArena();
+        ~BufferArena();
+
+        /** allocBuffer() on this thread uses the arena while the scope is open */
+        class Scope {
+        public:
+            explicit Scope( BufferArena& a );
+            ~Scope();
+        private:
+            Scope( const Scope& );
+            void operator=( const Scope& );
+            BufferArena *_prev;
+        };
+
+        /** size <= MaxBuffer */
+        void* alloc( int size );
+        bool owns( const void *p ) const;
+    private:
+        BufferArena( const BufferArena& );
+        void operator=( const BufferArena& );
+        struct Block {
+            Block *next;
+            char *end;
+        };
+        Block *_blocks; // most recent first; allocation is from the front one
+        char *_next;
+        BufferArena *_outer; // arena created before this one on the thread
+        friend class BufferCache;
+    };
+#else
+    inline void* allocBuffer( int& size ) { return malloc( size ); }
+    inline void freeBuffer( void *p, int size ) { free( p ); }
+    inline void* reallocBuffer( void *p, int oldSize, int& newSize ) { return realloc( p, newSize ); }
+#endif
+
     class BufBuilder {
     public:
         BufBuilder(int initsize = 512) : size(initsize) {
             if ( size > 0 ) {
-                data = (char *) malloc(size);
+                data = (char *) allocBuffer(size);
                 if( data == 0 )
                     msgasserted(10000, "out of memory BufBuilder");
             } else {
@@ -46,7 +109,7 @@ namespace mongo {
 
         void kill() {
             if ( data ) {
-                free(data);
+                freeBuffer(data, size);
                 data = 0;
             }
         }
@@ -54,9 +117,9 @@ namespace mongo {
         void reset( int maxSize = 0 ){
             l = 0;
             if ( maxSize && size > maxSize ){
-                free(data);
-                data = (char*)malloc(maxSize);
+                freeBuffer(data, size);
                 size = maxSize;
+                data = (char*)allocBuffer(size);
             }            
         }
 
@@ -121,7 +184,7 @@ namespace mongo {
                     a = l + 16 * 1024;
                 if( a > 64 * 1024 * 1024 )
                     msgasserted(10000, "BufBuilder grow() > 64MB");
-                data = (char *) realloc(data, a);
+                data = (char *) reallocBuffer(data, size, a);
                 size= a;
             }
             return data + oldlen;
@@ -187,6 +250,9 @@ namespace mongo {
             int x = (int) strlen( str );
             memcpy( _buf.grow( x ) , str , x );
         }
+        void append( const char * str , int len ){
+            memcpy( _buf.grow( len ) , str , len );
+        }
         StringBuilder& operator<<( const char * str ){
             append( str );
             return *this;
@@ -206,6 +272,10 @@ namespace mongo {
             return std::string(_buf.data, _buf.l);
         }
 
+        /** the characters appended so far, not nul terminated */
+        const char * data() const { return _buf.data; }
+        int len() const { return _buf.l; }
+
     private:
         BufBuilder _buf;
     };
@@ -0,0 +1,368 @@
+// asyncclient.cpp
+
+/*    Copyright 2010 10gen Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "pch.h"
+#include "asyncclient.h"
+#include "../db/dbmessage.h"
+
+#if !defined(_WIN32)
+
+#include <fcntl.h>
+#include <poll.h>
+
+namespace mongo {
+
+    void assembleRequest( const string &ns, BSONObj query, int nToReturn, int nToSkip, const BSONObj *fieldsToReturn, int queryOptions, Message &toSend );
+
+    static void setNonBlocking( int fd ) {
+        int flags = fcntl( fd , F_GETFL );
+        fcntl( fd , F_SETFL , flags | O_NONBLOCK );
+    }
+
+    // --------  AsyncReply -----------
+
+    bool AsyncReply::isDone() {
+        scoped_lock lk( _m );
+        return _done;
+    }
+
+    bool AsyncReply::join() {
+        scoped_lock lk( _m );
+        while ( !_done )
+            _finished.wait( lk.boost() );
+        return _ok;
+    }
+
+    BSONObj AsyncReply::firstDocument() {
+        QueryResult *qr = (QueryResult *) response().singleData();
+        if ( qr->nReturned < 1 )
+            return BSONObj();
+        return BSONObj( qr->data() ).getOwned();
+    }
+
+    void AsyncReply::finish( Message *reply ) {
+        scoped_lock lk( _m );
+        if ( _done )
+            return;
+        if ( reply ) {
+            _response = *reply;
+            _ok = true;
+        }
+        _done = true;
+        _finished.notify_all();
+    }
+
+    // --------  AsyncConnection -----------
+
+    AsyncConnection::AsyncConnection( AsyncClient& loop, DBClientConnection *conn )
+        : _loop( loop ), _conn( conn ), _m( "AsyncConnection" ), _outPos( 0 ), _failed( false ),
+          _lenHave( 0 ), _in( 0 ), _inHave( 0 ) {
+        // anything queued by piggyBack() goes first
+        _conn->port().flush();
+        _sock = _conn->port().getSocket();
+        _serverAddress = _conn->getServerAddress();
+        setNonBlocking( _sock );
+    }
+
+    AsyncConnection::~AsyncConnection() {
+        if ( _in )
+            freeMessageBuffer( _in );
+    }
+
+    shared_ptr<AsyncReply> AsyncConnection::call( Message& toSend ) {
+        shared_ptr<AsyncReply> reply( new AsyncReply() );
+        _queue( toSend , reply );
+        return reply;
+    }
+
+    void AsyncConnection::say( Message& toSend ) {
+        _queue( toSend , shared_ptr<AsyncReply>() );
+    }
+
+    shared_ptr<AsyncReply> AsyncConnection::runCommand( const string& dbname, const BSONObj& cmd ) {
+        Message toSend;
+        assembleRequest( dbname + ".$cmd" , cmd , -1 , 0 , 0 , 0 , toSend );
+        return call( toSend );
+    }
+
+    void AsyncConnection::_queue( Message& toSend, const shared_ptr<AsyncReply>& reply ) {
+        toSend.header()->id = nextMessageId();
+        toSend.header()->responseTo = -1;
+        vector< pair< char *, int > > data;
+        toSend.gather( data );
+
+        bool ok = true;
+        bool watch = false;
+        {
+            scoped_lock lk( _m );
+            if ( _failed ) {
+                if ( reply )
+                    reply->finish( 0 );
+                return;
+            }
+            bool idle = _outPos == _out.size();
+            for( vector< pair< char *, int > >::const_iterator i = data.begin(); i != data.end(); ++i )
+                _out.append( i->first , i->second );
+            if ( reply )
+                _waiting[ toSend.header()->id ] = reply;
+            // write what the socket takes now rather than after a trip through the loop;
+            // if the loop is already waiting to write, it keeps the order
+            if ( idle )
+                ok = flushOutput();
+            watch = _outPos < _out.size();
+        }
+        if ( !ok )
+            fail();
+        else if ( watch )
+            _loop.wake();
+    }
+
+    bool AsyncConnection::isFailed() {
+        scoped_lock lk( _m );
+        return _failed;
+    }
+
+    int AsyncConnection::inFlight() {
+        scoped_lock lk( _m );
+        return _waiting.size();
+    }
+
+    bool AsyncConnection::pendingOutput() {
+        scoped_lock lk( _m );
+        return _outPos < _out.size();
+    }
+
+    bool AsyncConnection::flushOutput() {
+        while ( _outPos < _out.size() ) {
+            int sent = _send( _out.data() + _outPos , _out.size() - _outPos );
+            if ( sent < 0 )
+                return false;
+            if ( sent == 0 )
+                break;
+            _outPos += sent;
+        }
+        if ( _outPos == _out.size() ) {
+            _out.clear();
+            _outPos = 0;
+        }
+        return true;
+    }
+
+    bool AsyncConnection::readAvailable() {
+        // bounded so one busy connection can't starve the rest
+        for( int round = 0; round < 64; ++round ) {
+            if ( _lenHave < 4 ) {
+                int r = _recv( (char *) &_len + _lenHave , 4 - _lenHave );
+                if ( r <= 0 )
+                    return r == 0;
+                _lenHave += r;
+                if ( _lenHave < 4 )
+                    return true;
+                if ( _len < MsgDataHeaderSize || _len > 16000000 ) {
+                    log() << "AsyncConnection bad recv() len: " << _len << ' ' << _serverAddress << endl;
+                    return false;
+                }
+                _in = allocMessageBuffer( _len );
+                _in->len = _len;
+                _inHave = 4;
+                continue;
+            }
+            int r = _recv( (char *) _in + _inHave , _len - _inHave );
+            if ( r <= 0 )
+                return r == 0;
+            _inHave += r;
+            if ( _inHave == _len ) {
+                MsgData *reply = _in;
+                _in = 0;
+                _lenHave = 0;
+                if ( !received( reply ) )
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool AsyncConnection::received( MsgData *data ) {
+        Message m;
+        m.setPooledData( data );
+        if ( m.operation() == dbCompressed && !decompressMessage( m ) ) {
+            log() << "AsyncConnection bad compressed message from " << _serverAddress << endl;
+            return false;
+        }
+
+        shared_ptr<AsyncReply> reply;
+        {
+            scoped_lock lk( _m );
+            map< MSGID, shared_ptr<AsyncReply> >::iterator i = _waiting.find( m.header()->responseTo );
+            if ( i != _waiting.end() ) {
+                reply = i->second;
+                _waiting.erase( i );
+            }
+        }
+        if ( !reply ) {
+            log() << "AsyncConnection reply to nothing in flight, responseTo: " << (unsigned) m.header()->responseTo << ' ' << _serverAddress << endl;
+            return true;
+        }
+        reply->finish( &m );
+        return true;
+    }
+
+    void AsyncConnection::fail() {
+        map< MSGID, shared_ptr<AsyncReply> > waiting;
+        {
+            scoped_lock lk( _m );
+            _failed = true;
+            waiting.swap( _waiting );
+        }
+        for( map< MSGID, shared_ptr<AsyncReply> >::iterator i = waiting.begin(); i != waiting.end(); ++i )
+            i->second->finish( 0 );
+    }
+
+    int AsyncConnection::_recv( char *buf, int len ) {
+        int r = ::recv( _sock , buf , len , MSG_NOSIGNAL );
+        if ( r > 0 )
+            return r;
+        if ( r < 0 && ( errno == EAGAIN || errno == EINTR ) )
+            return 0;
+        if ( r < 0 )
+            log() << "AsyncConnection recv() " << errnoWithDescription() << ' ' << _serverAddress << endl;
+        return -1;
+    }
+
+    int AsyncConnection::_send( const char *buf, int len ) {
+        int r = ::send( _sock , buf , len , MSG_NOSIGNAL );
+        if ( r >= 0 )
+            return r;
+        if ( errno == EAGAIN || errno == EINTR )
+            return 0;
+        log() << "AsyncConnection send() " << errnoWithDescription() << ' ' << _serverAddress << endl;
+        return -1;
+    }
+
+    // --------  AsyncClient -----------
+
+    AsyncClient::AsyncClient() : _m( "AsyncClient" ), _stop( false ) {
+        massert( 13332 , string( "AsyncClient pipe() failed: " ) + errnoWithDescription() , pipe( _wake ) == 0 );
+        setNonBlocking( _wake[ 0 ] );
+        setNonBlocking( _wake[ 1 ] );
+        _thread = new boost::thread( boost::bind( &AsyncClient::run , this ) );
+    }
+
+    AsyncClient::~AsyncClient() {
+        {
+            scoped_lock lk( _m );
+            _stop = true;
+        }
+        wake();
+        _thread->join();
+        delete _thread;
+        for( unsigned i = 0; i < _conns.size(); ++i )
+            _conns[ i ]->fail();
+        close( _wake[ 0 ] );
+        close( _wake[ 1 ] );
+    }
+
+    AsyncClient& AsyncClient::global() {
+        static AsyncClient *loop = new AsyncClient();
+        return *loop;
+    }
+
+    shared_ptr<AsyncConnection> AsyncClient::connect( const string& host, string& errmsg ) {
+        auto_ptr<DBClientConnection> conn( new DBClientConnection() );
+        if ( !conn->connect( host , errmsg ) )
+            return shared_ptr<AsyncConnection>();
+        return adopt( conn.release() );
+    }
+
+    shared_ptr<AsyncConnection> AsyncClient::adopt( DBClientConnection *conn ) {
+        shared_ptr<AsyncConnection> c( new AsyncConnection( *this , conn ) );
+        {
+            scoped_lock lk( _m );
+            _conns.push_back( c );
+        }
+        wake();
+        return c;
+    }
+
+    void AsyncClient::wake() {
+        char c = 0;
+        // full means a wakeup is pending anyway
+        if ( write( _wake[ 1 ] , &c , 1 ) < 0 && errno != EAGAIN )
+            log() << "AsyncClient wake " << errnoWithDescription() << endl;
+    }
+
+    void AsyncClient::run() {
+        vector< shared_ptr<AsyncConnection> > conns;
+        vector< struct pollfd > fds;
+        while ( 1 ) {
+            conns.clear();
+            {
+                scoped_lock lk( _m );
+                if ( _stop )
+                    break;
+                for( vector< shared_ptr<AsyncConnection> >::iterator i = _conns.begin(); i != _conns.end(); ) {
+                    // unique(): nobody can send on it anymore
+                    if ( (*i)->isFailed() || ( i->unique() && (*i)->inFlight() == 0 ) )
+                        i = _conns.erase( i );
+                    else
+                        ++i;
+                }
+                conns = _conns;
+            }
+
+            fds.resize( conns.size() + 1 );
+            fds[ 0 ].fd = _wake[ 0 ];
+            fds[ 0 ].events = POLLIN;
+            for( unsigned i = 0; i < conns.size(); ++i ) {
+                fds[ i + 1 ].fd = conns[ i ]->sock();
+                fds[ i + 1 ].events = POLLIN;
+                if ( conns[ i ]->pendingOutput() )
+                    fds[ i + 1 ].events |= POLLOUT;
+            }
+
+            int n = poll( &fds[ 0 ] , fds.size() , 1000 );
+            if ( n < 0 ) {
+                if ( errno != EINTR )
+                    log() << "AsyncClient poll() " << errnoWithDescription() << endl;
+                continue;
+            }
+
+            if ( fds[ 0 ].revents ) {
+                char buf[ 64 ];
+                while ( read( _wake[ 0 ] , buf , sizeof( buf ) ) > 0 )
+                    ;
+            }
+            for( unsigned i = 0; i < conns.size(); ++i ) {
+                if ( fds[ i + 1 ].revents == 0 )
+                    continue;
+                AsyncConnection &c = *conns[ i ];
+                bool ok = true;
+                if ( fds[ i + 1 ].revents & POLLOUT ) {
+                    scoped_lock lk( c._m );
+                    ok = c.flushOutput();
+                }
+                if ( ok )
+                    ok = c.readAvailable();
+                if ( !ok )
+                    c.fail();
+            }
+        }
+    }
+
+} // namespace mongo
+
+#endif
@@ -0,0 +1,168 @@
+// asyncclient.h
+
+/*    Copyright 2010 10gen Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+/**
+   non-blocking client connections: requests are pipelined on the socket and their replies
+   come back as futures, matched by responseTo.  one AsyncClient thread does the i/o for all
+   of its connections.
+
+   posix only for now (poll() and a wakeup pipe).
+ */
+
+#pragma once
+
+#include "../pch.h"
+#include "dbclient.h"
+
+#if !defined(_WIN32)
+
+namespace mongo {
+
+    class AsyncClient;
+
+    /** the reply to one request sent through an AsyncConnection */
+    class AsyncReply : boost::noncopyable {
+    public:
+        AsyncReply() : _m( "AsyncReply" ), _done( false ), _ok( false ) {}
+
+        /** true once join() won't block */
+        bool isDone();
+
+        /** blocks until the reply is in.
+            @return false if the connection failed first
+        */
+        bool join();
+
+        /** the reply - after join() returned true */
+        Message& response() {
+            assert( _done && _ok );
+            return _response;
+        }
+
+        /** the first document of the reply, e.g. a command's result.  empty if there is none.
+            after join() returned true
+        */
+        BSONObj firstDocument();
+
+    private:
+        friend class AsyncConnection;
+        /* loop thread.  reply 0: the connection failed */
+        void finish( Message *reply );
+
+        mongo::mutex _m;
+        boost::condition _finished;
+        bool _done;
+        bool _ok;
+        Message _response;
+    };
+
+    /** a connection whose i/o is done by an AsyncClient's thread.  any number of requests
+        may be in flight at once, from any number of threads.
+    */
+    class AsyncConnection : boost::noncopyable {
+    public:
+        ~AsyncConnection();
+
+        /** queues toSend - stamping its id - and returns without waiting for the reply */
+        shared_ptr<AsyncReply> call( Message& toSend );
+
+        /** queues a message which gets no reply, e.g. an insert */
+        void say( Message& toSend );
+
+        shared_ptr<AsyncReply> runCommand( const string& dbname, const BSONObj& cmd );
+
+        /** once true, calls fail at once and every reply in flight failed */
+        bool isFailed();
+
+        /** requests sent and not yet answered */
+        int inFlight();
+
+        string getServerAddress() const { return _serverAddress; }
+
+    private:
+        friend class AsyncClient;
+        AsyncConnection( AsyncClient& loop, DBClientConnection *conn );
+
+        /* the rest is for the loop thread */
+        int sock() const { return _sock; }
+        bool pendingOutput();
+        /* writes what the socket takes.  @return false on error */
+        bool flushOutput();
+        /* reads what is available and hands out complete replies.  @return false on eof or error */
+        bool readAvailable();
+        bool received( MsgData *reply );
+        /* fails whatever is in flight */
+        void fail();
+        /* @return bytes, 0 if the socket isn't ready, -1 on eof or error */
+        int _recv( char *buf, int len );
+        int _send( const char *buf, int len );
+        void _queue( Message& toSend, const shared_ptr<AsyncReply>& reply );
+
+        AsyncClient& _loop;
+        auto_ptr<DBClientConnection> _conn; // owns the socket
+        int _sock;
+        string _serverAddress;
+
+        mongo::mutex _m; // _out, _outPos, _waiting and _failed
+        string _out;     // requests the socket hasn't taken yet
+        unsigned _outPos;
+        map< MSGID, shared_ptr<AsyncReply> > _waiting;
+        bool _failed;
+
+        int _len;        // of the reply being read
+        int _lenHave;
+        MsgData *_in;
+        int _inHave;
+    };
+
+    /** the event loop: one thread polls all of its connections */
+    class AsyncClient : boost::noncopyable {
+    public:
+        AsyncClient();
+        /** fails whatever is still in flight */
+        ~AsyncClient();
+
+        /** connects (blocking) and hands the connection to the loop.
+            @return empty on failure, with errmsg set
+        */
+        shared_ptr<AsyncConnection> connect( const string& host, string& errmsg );
+
+        /** takes over conn, e.g. after it was authenticated.  it must not be used directly
+            afterwards
+        */
+        shared_ptr<AsyncConnection> adopt( DBClientConnection *conn );
+
+        /** shared loop for the process - never destroyed */
+        static AsyncClient& global();
+
+    private:
+        friend class AsyncConnection;
+        void run();
+        /* gets the loop out of poll(), e.g. there's output to watch for */
+        void wake();
+
+        mongo::mutex _m;
+        /* a connection is dropped once only the loop holds it and nothing is in flight */
+        vector< shared_ptr<AsyncConnection> > _conns;
+        int _wake[ 2 ];
+        bool _stop;
+        boost::thread *_thread;
+    };
+
+} // namespace mongo
+
+#endif
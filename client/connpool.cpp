@@ -23,30 +23,231 @@
 #include "../db/commands.h"
 #include "syncclusterconnection.h"
 #include "../s/shard.h"
+#include "../util/background.h"
 
 namespace mongo {
 
     DBConnectionPool pool;
-    
-    DBClientBase* DBConnectionPool::_get(const string& ident) {
-        scoped_lock L(_mutex);
-        
-        PoolForHost& p = _pools[ident];
-        if ( p.pool.empty() )
-            return 0;
-        
-        DBClientBase *c = p.pool.top();
-        p.pool.pop();
-        return c;
+
+    int DBConnectionPool::maxPerHost = 0;
+    int DBConnectionPool::maxWaitMillis = 5000;
+    int DBConnectionPool::idleTimeoutSecs = 300;
+    int DBConnectionPool::pingSecs = 30;
+
+    // --------  PoolForHost -----------
+
+    PoolForHost::~PoolForHost(){
+        for ( deque<Idle>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+            delete i->conn;
+    }
+
+    DBClientBase* PoolForHost::get( const string& host ){
+        scoped_lock L(_m);
+        if ( _idle.empty() && DBConnectionPool::maxPerHost > 0 && _open >= DBConnectionPool::maxPerHost ){
+            Timer t;
+            _waits++;
+            _waiting++;
+            boost::system_time until = boost::get_system_time() + boost::posix_time::milliseconds( DBConnectionPool::maxWaitMillis );
+            bool timedOut = false;
+            while ( _idle.empty() && _open >= DBConnectionPool::maxPerHost ){
+                if ( ! _slotFree.timed_wait( L.boost() , until ) ){
+                    timedOut = _idle.empty() && _open >= DBConnectionPool::maxPerHost;
+                    break;
+                }
+            }
+            _waiting--;
+            _waitMillis += t.millis();
+            if ( timedOut ){
+                _timeouts++;
+                stringstream ss;
+                ss << "dbconnectionpool: no connection to " << host << " came free in "
+                   << DBConnectionPool::maxWaitMillis << "ms, " << _open << " open";
+                uasserted( 13335 , ss.str() );
+            }
+        }
+
+        if ( ! _idle.empty() ){
+            DBClientBase *c = _idle.back().conn;
+            _idle.pop_back();
+            return c;
+        }
+        _open++; // taken now so concurrent callers count it against the limit
+        return 0;
+    }
+
+    void PoolForHost::created(){
+        scoped_lock L(_m);
+        _created++;
+    }
+
+    void PoolForHost::createFailed(){
+        scoped_lock L(_m);
+        _open--;
+        _slotFree.notify_one();
+    }
+
+    void PoolForHost::done( DBClientBase* c ){
+        time_t now = time(0);
+        Idle i;
+        i.conn = c;
+        i.since = now;
+        i.checked = now;
+        scoped_lock L(_m);
+        _idle.push_back( i );
+        _slotFree.notify_one();
+    }
+
+    void PoolForHost::discard( DBClientBase* c ){
+        delete c;
+        forget();
     }
 
-    DBClientBase* DBConnectionPool::_finishCreate( const string& host , DBClientBase* conn ){
+    void PoolForHost::forget(){
+        scoped_lock L(_m);
+        _open--;
+        _slotFree.notify_one();
+    }
+
+    void PoolForHost::adopt(){
+        scoped_lock L(_m);
+        _open++;
+    }
+
+    void PoolForHost::failed(){
+        deque<Idle> all;
         {
-            scoped_lock L(_mutex);
-            PoolForHost& p = _pools[host];
-            p.created++;
+            scoped_lock L(_m);
+            all.swap( _idle );
+            _open -= all.size();
+            _slotFree.notify_all();
+        }
+        for ( deque<Idle>::iterator i = all.begin(); i != all.end(); ++i )
+            delete i->conn;
+    }
+
+    void PoolForHost::maintain(){
+        time_t now = time(0);
+        vector<DBClientBase*> reap;
+        vector<Idle> check;
+        {
+            scoped_lock L(_m);
+            // oldest first: they'd be handed out last anyway
+            while ( ! _idle.empty() && now - _idle.front().since > DBConnectionPool::idleTimeoutSecs ){
+                reap.push_back( _idle.front().conn );
+                _idle.pop_front();
+            }
+            for ( deque<Idle>::iterator i = _idle.begin(); i != _idle.end(); ){
+                if ( now - i->checked >= DBConnectionPool::pingSecs ){
+                    check.push_back( *i );
+                    i = _idle.erase( i );
+                }
+                else {
+                    ++i;
+                }
+            }
         }
 
+        // pinged without the lock: they are out of the pool meanwhile, but still count as open
+        vector<Idle> good;
+        int bad = 0;
+        for ( vector<Idle>::iterator i = check.begin(); i != check.end(); ++i ){
+            bool ok = false;
+            try {
+                BSONObj info;
+                ok = i->conn->simpleCommand( "admin" , &info , "ping" ) && ! i->conn->isFailed();
+            }
+            catch ( std::exception& e ){
+                log(1) << "dbconnectionpool: ping failed " << i->conn->toString() << ' ' << e.what() << endl;
+            }
+            if ( ok ){
+                i->checked = time(0);
+                good.push_back( *i );
+            }
+            else {
+                reap.push_back( i->conn );
+                bad++;
+            }
+        }
+
+        {
+            scoped_lock L(_m);
+            // back in front of the ones used meanwhile, as they are older
+            _idle.insert( _idle.begin() , good.begin() , good.end() );
+            _open -= reap.size();
+            _reaped += reap.size() - bad;
+            _badPings += bad;
+            if ( reap.size() || good.size() )
+                _slotFree.notify_all();
+        }
+        for ( vector<DBClientBase*>::iterator i = reap.begin(); i != reap.end(); ++i )
+            delete *i;
+    }
+
+    void PoolForHost::flush(){
+        vector<Idle> all;
+        {
+            scoped_lock L(_m);
+            all.assign( _idle.begin() , _idle.end() );
+            _idle.clear();
+        }
+        for ( vector<Idle>::iterator i = all.begin(); i != all.end(); ++i ){
+            bool res;
+            i->conn->isMaster( res );
+        }
+        scoped_lock L(_m);
+        _idle.insert( _idle.begin() , all.begin() , all.end() );
+        _slotFree.notify_all();
+    }
+
+    void PoolForHost::appendInfo( BSONObjBuilder& b ){
+        scoped_lock L(_m);
+        b.append( "available" , (int)_idle.size() );
+        b.append( "inUse" , (int)( _open - _idle.size() ) );
+        b.appendNumber( "created" , _created );
+        b.append( "waiting" , _waiting );
+        b.appendNumber( "waits" , _waits );
+        b.appendNumber( "waitMillis" , _waitMillis );
+        b.appendNumber( "waitTimeouts" , _timeouts );
+        b.appendNumber( "reaped" , _reaped );
+        b.appendNumber( "failedPings" , _badPings );
+    }
+
+    // --------  DBConnectionPool -----------
+
+    /* reaps and pings idle connections for the process' pool */
+    class PoolMaintainer : public BackgroundJob {
+    public:
+        string name() { return "PoolMaintainer"; }
+        void run(){
+            while ( ! inShutdown() ){
+                sleepsecs( 5 );
+                try {
+                    pool.maintain();
+                }
+                catch ( std::exception& e ){
+                    log() << "PoolMaintainer: " << e.what() << endl;
+                }
+            }
+        }
+    };
+
+    PoolForHost& DBConnectionPool::_pool( const string& ident ){
+        scoped_lock L(_mutex);
+        PoolForHost*& p = _pools[ident];
+        if ( ! p ){
+            p = new PoolForHost();
+            if ( this == &pool && _pools.size() == 1 ){
+                // "new"ed and never deleted: it may run while statics are destroyed
+                PoolMaintainer *m = new PoolMaintainer();
+                m->go();
+            }
+        }
+        return *p;
+    }
+
+    DBClientBase* DBConnectionPool::_finishCreate( PoolForHost& p , DBClientBase* conn ){
+        p.created();
+
         onCreate( conn );
         onHandedOut( conn );
         
@@ -54,21 +255,31 @@ namespace mongo {
     }
 
     DBClientBase* DBConnectionPool::get(const ConnectionString& url) {
-        DBClientBase * c = _get( url.toString() );
+        PoolForHost& p = _pool( url.toString() );
+        DBClientBase * c = p.get( url.toString() );
         if ( c ){
             onHandedOut( c );
             return c;
         }
         
         string errmsg;
-        c = url.connect( errmsg );
+        try {
+            c = url.connect( errmsg );
+        }
+        catch ( ... ){
+            p.createFailed();
+            throw;
+        }
+        if ( ! c )
+            p.createFailed();
         uassert( 13328 ,  (string)"dbconnectionpool: connect failed " + url.toString() + " : " + errmsg , c );
         
-        return _finishCreate( url.toString() , c );
+        return _finishCreate( p , c );
     }
     
     DBClientBase* DBConnectionPool::get(const string& host) {
-        DBClientBase * c = _get( host );
+        PoolForHost& p = _pool( host );
+        DBClientBase * c = p.get( host );
         if ( c ){
             onHandedOut( c );
             return c;
@@ -76,67 +287,91 @@ namespace mongo {
         
         int numCommas = DBClientBase::countCommas( host );
         
-        if( numCommas == 0 ) {
-            DBClientConnection *cc = new DBClientConnection(true);
-            log(2) << "creating new connection for pool to:" << host << endl;
-            string errmsg;
-            if ( !cc->connect(host.c_str(), errmsg) ) {
-                delete cc;
-                uassert( 11002 ,  (string)"dbconnectionpool: connect failed " + host , false);
-                return 0;
+        try {
+            if( numCommas == 0 ) {
+                DBClientConnection *cc = new DBClientConnection(true);
+                log(2) << "creating new connection for pool to:" << host << endl;
+                string errmsg;
+                if ( !cc->connect(host.c_str(), errmsg) ) {
+                    delete cc;
+                    uassert( 11002 ,  (string)"dbconnectionpool: connect failed " + host , false);
+                    return 0;
+                }
+                c = cc;
             }
-            c = cc;
-        }
-        else if ( numCommas == 1 ) { 
-            DBClientPaired *p = new DBClientPaired();
-            if( !p->connect(host) ) { 
-                delete p;
-                uassert( 11003 ,  (string)"dbconnectionpool: connect failed [2] " + host , false);
-                return 0;
+            else if ( numCommas == 1 ) { 
+                DBClientPaired *p = new DBClientPaired();
+                if( !p->connect(host) ) { 
+                    delete p;
+                    uassert( 11003 ,  (string)"dbconnectionpool: connect failed [2] " + host , false);
+                    return 0;
+                }
+                c = p;
+            }
+            else if ( numCommas == 2 ) {
+                c = new SyncClusterConnection( host );
+            }
+            else {
+                uassert( 13071 , (string)"invalid hostname [" + host + "]" , 0 );
+                c = 0; // prevents compiler warning
             }
-            c = p;
-        }
-        else if ( numCommas == 2 ) {
-            c = new SyncClusterConnection( host );
         }
-        else {
-            uassert( 13071 , (string)"invalid hostname [" + host + "]" , 0 );
-            c = 0; // prevents compiler warning
+        catch ( ... ){
+            p.createFailed();
+            throw;
         }
         
-        return _finishCreate( host , c );
+        return _finishCreate( p , c );
     }
 
-    DBConnectionPool::~DBConnectionPool(){
-        for ( map<string,PoolForHost>::iterator i = _pools.begin(); i != _pools.end(); i++ ){
-            PoolForHost& p = i->second;
+    void DBConnectionPool::release(const string& host, DBClientBase *c) {
+        PoolForHost& p = _pool( host );
+        if ( c->isFailed() ){
+            p.discard( c );
+            p.failed();
+            return;
+        }
+        p.done( c );
+    }
 
-            while ( ! p.pool.empty() ){
-                DBClientBase * c = p.pool.top();
-                delete c;
-                p.pool.pop();
-            }
+    void DBConnectionPool::discard(const string& host, DBClientBase *c) {
+        _pool( host ).discard( c );
+    }
+
+    void DBConnectionPool::forget(const string& host) {
+        _pool( host ).forget();
+    }
+
+    void DBConnectionPool::adopt(const string& host) {
+        _pool( host ).adopt();
+    }
+
+    DBConnectionPool::~DBConnectionPool(){
+        for ( map<string,PoolForHost*>::iterator i = _pools.begin(); i != _pools.end(); i++ ){
+            delete i->second;
         }
     }
 
     void DBConnectionPool::flush(){
-        scoped_lock L(_mutex);
-        for ( map<string,PoolForHost>::iterator i = _pools.begin(); i != _pools.end(); i++ ){
-            PoolForHost& p = i->second;
-
-            vector<DBClientBase*> all;
-            while ( ! p.pool.empty() ){
-                DBClientBase * c = p.pool.top();
-                p.pool.pop();
-                all.push_back( c );
-                bool res;
-                c->isMaster( res );
-            }
-            
-            for ( vector<DBClientBase*>::iterator i=all.begin(); i != all.end(); i++ ){
-                p.pool.push( *i );
-            }
+        vector<PoolForHost*> all;
+        {
+            scoped_lock L(_mutex);
+            for ( map<string,PoolForHost*>::iterator i = _pools.begin(); i != _pools.end(); i++ )
+                all.push_back( i->second );
         }
+        for ( vector<PoolForHost*>::iterator i = all.begin(); i != all.end(); i++ )
+            (*i)->flush();
+    }
+
+    void DBConnectionPool::maintain(){
+        vector<PoolForHost*> all;
+        {
+            scoped_lock L(_mutex);
+            for ( map<string,PoolForHost*>::iterator i = _pools.begin(); i != _pools.end(); i++ )
+                all.push_back( i->second );
+        }
+        for ( vector<PoolForHost*>::iterator i = all.begin(); i != all.end(); i++ )
+            (*i)->maintain();
     }
 
     void DBConnectionPool::addHook( DBConnectionHook * hook ){
@@ -162,16 +397,20 @@ namespace mongo {
     }
 
     void DBConnectionPool::appendInfo( BSONObjBuilder& b ){
-        scoped_lock lk( _mutex );
+        map<string,PoolForHost*> all;
+        {
+            scoped_lock lk( _mutex );
+            all = _pools;
+        }
         BSONObjBuilder bb( b.subobjStart( "hosts" ) );
-        for ( map<string,PoolForHost>::iterator i=_pools.begin(); i!=_pools.end(); ++i ){
+        for ( map<string,PoolForHost*>::iterator i=all.begin(); i!=all.end(); ++i ){
             string s = i->first;
             BSONObjBuilder temp( bb.subobjStart( s.c_str() ) );
-            temp.append( "available" , (int)(i->second.pool.size()) );
-            temp.appendNumber( "created" , i->second.created );
+            i->second->appendInfo( temp );
             temp.done();
         }
         bb.done();
+        b.append( "maxPerHost" , maxPerHost );
     }
 
     ScopedDbConnection * ScopedDbConnection::steal(){
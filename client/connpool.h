@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <deque>
 #include <stack>
 #include "dbclient.h"
 #include "redef_macros.h"
@@ -25,17 +26,63 @@ namespace mongo {
 
     class Shard;
     
-    struct PoolForHost {
+    /** the connections to one host.  has its own lock, so busy hosts don't hold up the
+        others, and a limit: at maxPerHost open connections get() waits for one to come back.
+    */
+    class PoolForHost : boost::noncopyable {
+    public:
         PoolForHost()
-            : created(0){}
-        PoolForHost( const PoolForHost& other ){
-            assert(other.pool.size() == 0);
-            created = other.created;
-            assert( created == 0 );
-        }
-            
-        std::stack<DBClientBase*> pool;
-        long long created;
+            : _m("PoolForHost"), _created(0), _open(0), _waiting(0),
+              _waits(0), _waitMillis(0), _timeouts(0), _reaped(0), _badPings(0){}
+        ~PoolForHost();
+
+        /** an idle connection, or 0: the caller creates one and then calls created() or
+            createFailed().  waits while the host has maxPerHost open, throws if that lasts
+            longer than maxWaitMillis.
+        */
+        DBClientBase* get( const string& host );
+        void created();
+        void createFailed();
+
+        /** c goes back to the idle ones */
+        void done( DBClientBase* c );
+        /** deletes c, which won't be used again */
+        void discard( DBClientBase* c );
+        /** a connection from get() was kept for good: it no longer counts as open */
+        void forget();
+        /** undoes forget(): the connection counts as open again */
+        void adopt();
+        /** a connection failed: the idle ones probably have too (failover, restart), so
+            they are dropped rather than handed out
+        */
+        void failed();
+
+        /** background: reaps idle connections and pings the ones that sat a while */
+        void maintain();
+
+        /** isMaster on every idle connection */
+        void flush();
+
+        void appendInfo( BSONObjBuilder& b );
+
+    private:
+        struct Idle {
+            DBClientBase* conn;
+            time_t since;   // back in the pool
+            time_t checked; // last pinged
+        };
+
+        mongo::mutex _m;
+        boost::condition _slotFree;
+        deque<Idle> _idle; // most recently used at the back
+        long long _created;
+        int _open;         // idle, in use or being created
+        int _waiting;
+        long long _waits;
+        long long _waitMillis;
+        long long _timeouts;
+        long long _reaped;
+        long long _badPings;
     };
     
     class DBConnectionHook {
@@ -61,35 +108,45 @@ namespace mongo {
         }
     */
     class DBConnectionPool {
-        mongo::mutex _mutex;
-        map<string,PoolForHost> _pools; // servername -> pool
+        mongo::mutex _mutex; // _pools; each PoolForHost has its own lock
+        map<string,PoolForHost*> _pools; // servername -> pool.  never erased
         list<DBConnectionHook*> _hooks;
 
-        DBClientBase* _get( const string& ident );
+        PoolForHost& _pool( const string& ident );
         
-        DBClientBase* _finishCreate( const string& ident , DBClientBase* conn );
+        DBClientBase* _finishCreate( PoolForHost& p , DBClientBase* conn );
 
     public:        
         DBConnectionPool() : _mutex("DBConnectionPool") { }
         ~DBConnectionPool();
 
+        /** most connections open to one host, 0 for no limit */
+        static int maxPerHost;
+        /** how long get() waits at maxPerHost before it throws */
+        static int maxWaitMillis;
+        /** idle connections are closed after this long */
+        static int idleTimeoutSecs;
+        /** idle connections are pinged this often, and closed if that fails */
+        static int pingSecs;
 
         void onCreate( DBClientBase * conn );
         void onHandedOut( DBClientBase * conn );
 
         void flush();
+        /** reaps and pings idle connections - the pool's background thread does this */
+        void maintain();
 
         DBClientBase *get(const string& host);
         DBClientBase *get(const ConnectionString& host);
 
-        void release(const string& host, DBClientBase *c) {
-            if ( c->isFailed() ){
-                delete c;
-                return;
-            }
-            scoped_lock L(_mutex);
-            _pools[host].pool.push(c);
-        }
+        void release(const string& host, DBClientBase *c);
+        /** deletes a connection from get() instead of releasing it */
+        void discard(const string& host, DBClientBase *c);
+        /** a connection from get() is kept for good, e.g. adopted by an AsyncClient */
+        void forget(const string& host);
+        /** a connection forget() was called for counts as open again, before it is released */
+        void adopt(const string& host);
+
         void addHook( DBConnectionHook * hook );
         void appendInfo( BSONObjBuilder& b );
     };
@@ -148,7 +205,8 @@ namespace mongo {
             a bad state.  Destructor will do this too, but it is verbose.
         */
         void kill() {
-            delete _conn;
+            if ( _conn )
+                pool.discard( _host , _conn );
             _conn = 0;
         }
 
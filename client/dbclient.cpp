@@ -28,6 +28,7 @@
 #include "connpool.h"
 #include "../s/util.h"
 #include "syncclusterconnection.h"
+#include "../util/message_shm.h"
 
 namespace mongo {
 
@@ -499,15 +500,33 @@ namespace mongo {
     bool DBClientConnection::connect(const string &_serverAddress, string& errmsg) {
         serverAddress = _serverAddress;
 
+        // the option stays in serverAddress for reconnects
+        string host = serverAddress;
+        bool sharedMemory = _sharedMemory;
+        size_t q = host.find( '?' );
+        if ( q != string::npos ) {
+            string option = host.substr( q + 1 );
+            host = host.substr( 0 , q );
+            if ( option == "sharedMemory=true" )
+                sharedMemory = true;
+            else if ( option == "sharedMemory=false" )
+                sharedMemory = false;
+            else {
+                errmsg = "unknown connection option: " + option;
+                failed = true;
+                return false;
+            }
+        }
+
         string ip;
         int port;
-        size_t idx = serverAddress.rfind( ":" );
+        size_t idx = host.rfind( ":" );
         if ( idx != string::npos ) {
-            port = strtol( serverAddress.substr( idx + 1 ).c_str(), 0, 10 );
-            ip = serverAddress.substr( 0 , idx );
+            port = strtol( host.substr( idx + 1 ).c_str(), 0, 10 );
+            ip = host.substr( 0 , idx );
         } else {
             port = CmdLine::DefaultDBPort;
-            ip = serverAddress;
+            ip = host;
         }
 
         // we keep around SockAddr for connection life -- maybe MessagingPort
@@ -520,6 +539,14 @@ namespace mongo {
             return false;
         }
 
+#if defined(__linux__)
+        if ( sharedMemory && server->isLocalHost() ) {
+            if ( connectSharedMemory( port ) )
+                return true;
+            p.reset(new MessagingPort( _timeout, _logLevel ));
+        }
+#endif
+
         if ( !p->connect(*server) ) {
             stringstream ss;
             ss << "couldn't connect to server {ip: \"" << ip <<  "\", port: " << port << '}';
@@ -527,9 +554,62 @@ namespace mongo {
             failed = true;
             return false;
         }
+
+        if ( _compression || cmdLine.compressNetwork )
+            negotiateCompression();
         return true;
     }
 
+    /* servers which don't know about compression just leave it out of their isMaster reply.
+       compression is only an optimization, so if asking fails the connection goes on without
+    */
+    void DBClientConnection::negotiateCompression() {
+        BSONObjBuilder b;
+        b.append( "ismaster", 1 );
+        appendWireCompression( b );
+        BSONObj res;
+        try {
+            // the reply can be ok:0 (e.g. a replica set still initializing) and still list it
+            runCommand( "admin", b.obj(), res );
+        }
+        catch ( DBException& e ) {
+            log(_logLevel + 1) << "not compressing traffic to " << serverAddress << ": " << e.what() << endl;
+            return;
+        }
+        if ( acceptsWireCompression( res ) ) {
+            p->setCompression();
+            log(_logLevel + 1) << "compressing traffic to " << serverAddress << endl;
+        }
+    }
+
+#if defined(__linux__)
+    /* over the server's unix socket, which also passes the memory.  false: use tcp */
+    bool DBClientConnection::connectSharedMemory( int port ) {
+        SockAddr local( makeUnixSockPath( port ).c_str() , port );
+        if ( !p->connect( local ) ) {
+            log(_logLevel + 1) << "no unix socket for " << serverAddress << ", using tcp" << endl;
+            return false;
+        }
+        try {
+            BSONObj res;
+            if ( !runCommand( "admin" , BSON( "shmTransport" << 1 ) , res ) ) {
+                // e.g. mongos --workers: the unix socket still skips tcp
+                log(_logLevel + 1) << "no shared memory transport to " << serverAddress << ": " << res << endl;
+                return true;
+            }
+        }
+        catch ( const SocketException& ) {
+            return false;
+        }
+        MessagingPort *shm = sharedMemoryPort( *p , _logLevel );
+        if ( !shm )
+            return false;
+        p.reset( shm );
+        log(_logLevel + 1) << "shared memory transport to " << serverAddress << endl;
+        return true;
+    }
+#endif
+
     void DBClientConnection::_checkConnection() {
         if ( !failed )
             return;
@@ -809,13 +889,29 @@ namespace mongo {
     }
 
     void DBClientConnection::sayPiggyBack( Message &toSend ) {
-        port().piggyBack( toSend );
+        try { 
+            port().piggyBack( toSend );
+        } catch( SocketException & ) { 
+            failed = true;
+            throw;
+        }
     }
 
     void DBClientConnection::recv( Message &m ) { 
         port().recv(m);
     }
 
+    bool DBClientConnection::callLazy( Message &toSend ) {
+        checkConnection();
+        try {
+            port().say( toSend );
+        } catch( SocketException & ) {
+            failed = true;
+            throw;
+        }
+        return true;
+    }
+
     bool DBClientConnection::call( Message &toSend, Message &response, bool assertOk ) {
         /* todo: this is very ugly messagingport::call returns an error code AND can throw 
                  an exception.  we should make it return void and just throw an exception anytime 
@@ -300,6 +300,11 @@ namespace mongo {
 
         /* used by QueryOption_Exhaust.  To use that your subclass must implement this. */
         virtual void recv( Message& m ) { assert(false); }
+
+        /* sends toSend at once without waiting for the reply, which is then taken with recv().
+           used by DBClientCursor::setReadAhead().  @return false if the subclass can't
+        */
+        virtual bool callLazy( Message& toSend ) { return false; }
     };
 
     /**
@@ -742,6 +747,10 @@ namespace mongo {
         void checkConnection() { if( failed ) _checkConnection(); }
 		map< string, pair<string,string> > authCache;
         int _timeout;
+        bool _compression;
+        void negotiateCompression();
+        bool _sharedMemory;
+        bool connectSharedMemory( int port );
     public:
 
         /**
@@ -751,7 +760,19 @@ namespace mongo {
            Connect timeout is fixed, but short, at 5 seconds.
          */
         DBClientConnection(bool _autoReconnect=false, DBClientPaired* cp=0, int timeout=0) :
-                clientPaired(cp), failed(false), autoReconnect(_autoReconnect), lastReconnectTry(0), _timeout(timeout) { }
+                clientPaired(cp), failed(false), autoReconnect(_autoReconnect), lastReconnectTry(0), _timeout(timeout), _compression(false), _sharedMemory(false) { }
+
+        /** ask the server to compress traffic on this connection (always asked with --compressNetwork).
+            takes effect on the next connect(), if the server supports it.
+        */
+        void setCompression( bool on ) { _compression = on; }
+
+        /** talk to a server on this host through shared memory, set up over its unix socket
+            (linux only; also asked with the host option ?sharedMemory=true).  a server which
+            doesn't offer it is still reached over the unix socket, one without the socket over
+            tcp.  takes effect on the next connect().
+        */
+        void setSharedMemory( bool on ) { _sharedMemory = on; }
 
         /** Connect to a Mongo database server.
 
@@ -760,6 +781,7 @@ namespace mongo {
 
            @param serverHostname host to connect to.  can include port number ( 127.0.0.1 , 127.0.0.1:5555 )
                                  If you use IPv6 you must add a port number ( ::1:27017 )
+                                 and an option: ?sharedMemory=true|false, see setSharedMemory()
            @param errmsg any relevant error message will appended to the string
            @return false if fails to connect.
         */
@@ -825,6 +847,7 @@ namespace mongo {
         friend class SyncClusterConnection;
         virtual void recv( Message& m );
         virtual bool call( Message &toSend, Message &response, bool assertOk = true );
+        virtual bool callLazy( Message &toSend );
         virtual void say( Message &toSend );
         virtual void sayPiggyBack( Message &toSend );
         virtual void checkResponse( const char *data, int nReturned );
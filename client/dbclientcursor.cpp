@@ -26,6 +26,11 @@ namespace mongo {
 
     void assembleRequest( const string &ns, BSONObj query, int nToReturn, int nToSkip, const BSONObj *fieldsToReturn, int queryOptions, Message &toSend );
 
+    int DBClientCursor::readAheadBatchBytes = 1024 * 1024;
+
+    /* smallest batch read ahead asks for: below this the getMores cost more than they save */
+    static const int MinReadAheadBatch = 16;
+
     int DBClientCursor::nextBatchSize(){
         if ( nToReturn == 0 )
             return batchSize;
@@ -47,10 +52,12 @@ namespace mongo {
             b.append( cursorId );
             toSend.setData( dbGetMore, b.buf(), b.len() );
         }
+        Timer t;
         if ( !connector->call( toSend, *m, false ) )
             return false;
         if ( m->empty() )
             return false;
+        _rttMicros = t.micros();
         dataReceived();
         return true;
     }
@@ -96,6 +103,84 @@ namespace mongo {
         auto_ptr<Message> response(new Message());
         assert( connector );
         connector->recv(*response);
+        uassert( 13333 , "exhaust stream ended early" , ! response->empty() );
+        m = response;
+        dataReceived();
+        if ( cursorId == 0 && _exhaustConn ){
+            // the stream is over: the connection is clean again
+            pool.release( _scopedHost , _exhaustConn );
+            _exhaustConn = 0;
+            connector = 0;
+        }
+    }
+
+    void DBClientCursor::readAhead() {
+        if ( _ahead || !cursorId || !connector || pos * 2 < nReturned )
+            return;
+        if ( opts & ( QueryOption_CursorTailable | QueryOption_Exhaust ) )
+            return;
+        if ( haveLimit && nToReturn <= nReturned )
+            return;
+
+        BufBuilder b;
+        b.append(opts);
+        b.append(ns.c_str());
+        b.append(aheadBatchSize());
+        b.append(cursorId);
+
+        Message toSend;
+        toSend.setData(dbGetMore, b.buf(), b.len());
+        try {
+            if ( !connector->callLazy( toSend ) ) {
+                _readAhead = false;
+                return;
+            }
+        }
+        catch ( SocketException& ) {
+            // next() still has the rest of the batch to give; more() fails asking for the next
+            _readAhead = false;
+            return;
+        }
+        _ahead = true;
+        _aheadId = toSend.header()->id;
+        _aheadTimer.reset();
+    }
+
+    /* half a batch should last a round trip: then the next one is in before it's needed */
+    int DBClientCursor::aheadBatchSize() {
+        int n = batchSize;
+        if ( n == 0 ) {
+            QueryResult *qr = (QueryResult *) m->singleData();
+            int docBytes = max( 1 , ( qr->len - (int) sizeof( QueryResult ) ) / max( 1 , nReturned ) );
+            int most = max( MinReadAheadBatch , readAheadBatchBytes / docBytes );
+            double microsPerDoc = max( 0.01 , (double) _batchTimer.micros() / max( 1 , pos ) );
+            // 3: two round trips' worth and then some, a round trip varies
+            double want = 3 * _rttMicros / microsPerDoc;
+            n = (int) min( (double) most , max( (double) MinReadAheadBatch , want ) );
+        }
+        if ( haveLimit )
+            n = min( n , nToReturn - nReturned );
+        return n;
+    }
+
+    void DBClientCursor::receiveAhead() {
+        assert( _ahead && pos == nReturned );
+        _ahead = false;
+        Timer wait;
+        auto_ptr<Message> response(new Message());
+        connector->recv(*response);
+        uassert( 13336 , "read ahead getMore got no reply" , ! response->empty() );
+        uassert( 13337 , "read ahead getMore got a reply to something else" , response->header()->responseTo == _aheadId );
+
+        // waiting for it: it took its full round trip.  otherwise it took less than that
+        long long sent = _aheadTimer.micros();
+        if ( (long long) wait.micros() * 10 > sent )
+            _rttMicros = sent;
+        else
+            _rttMicros = min( _rttMicros , sent );
+
+        if ( haveLimit )
+            nToReturn -= nReturned;
         m = response;
         dataReceived();
     }
@@ -121,6 +206,7 @@ namespace mongo {
         nReturned = qr->nReturned;
         pos = 0;
         data = qr->data();
+        _batchTimer.reset();
 
         connector->checkResponse( data, nReturned );
         /* this assert would fire the way we currently work:
@@ -142,7 +228,12 @@ namespace mongo {
         if ( cursorId == 0 )
             return false;
 
-        requestMore();
+        if ( _ahead )
+            receiveAhead();
+        else if ( opts & QueryOption_Exhaust )
+            exhaustReceiveMore();
+        else
+            requestMore();
         return pos < nReturned;
     }
 
@@ -156,6 +247,8 @@ namespace mongo {
         pos++;
         BSONObj o(data);
         data += o.objsize();
+        if ( _readAhead )
+            readAhead();
         return o;
     }
 
@@ -171,6 +264,10 @@ namespace mongo {
         assert( _scopedHost.size() == 0 );
         assert( connector == conn->get() );
         _scopedHost = conn->getHost();
+        if ( ( opts & QueryOption_Exhaust ) && cursorId ){
+            _exhaustConn = conn->release();
+            return;
+        }
         conn->done();
         connector = 0;
     }
@@ -180,7 +277,22 @@ namespace mongo {
     DBClientCursor::~DBClientCursor() {
         DESTRUCTOR_GUARD (
 
-            if ( cursorId && _ownCursor ) {
+            if ( _ahead && connector ) {
+                // its reply has to come off the connection before anything else is read
+                Message reply;
+                connector->recv( reply );
+                _ahead = false;
+                if ( !reply.empty() )
+                    cursorId = ( (QueryResult *) reply.singleData() )->cursorId;
+            }
+
+            if ( _exhaustConn ) {
+                // mid-stream: the server is still sending, so the connection can't be
+                // reused, and closing it is what stops the server
+                pool.discard( _scopedHost , _exhaustConn );
+                _exhaustConn = 0;
+            }
+            else if ( cursorId && _ownCursor ) {
                 BufBuilder b;
                 b.append( (int)0 ); // reserved
                 b.append( (int)1 ); // number
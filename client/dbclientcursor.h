@@ -26,6 +26,7 @@
 namespace mongo {
     
     class ShardConnection;
+    class DBClientBase;
     
 	/** Queries return a cursor object */
     class DBClientCursor : boost::noncopyable {
@@ -98,6 +99,21 @@ namespace mongo {
             return (resultFlags & flag) != 0;
         }
 
+        /** read ahead: once next() is half way through a batch, the getMore for the next one
+            goes out, so its reply travels while the rest of the batch is processed.  without
+            a batch size, batches are sized to about what next() gets through in two round
+            trips, at most readAheadBatchBytes.
+            only for a cursor on a DBClientConnection, not tailable nor exhaust.  nothing else
+            may be read from the connection while a getMore is out, i.e. until more() returned
+            false or the cursor is destroyed.
+        */
+        void setReadAhead( bool on ) { _readAhead = on; }
+
+        /** bound for read ahead batches: what the socket's receive buffer holds, so the next
+            batch is in by the time it is needed
+        */
+        static int readAheadBatchBytes;
+
         DBClientCursor( DBConnector *_connector, const string &_ns, BSONObj _query, int _nToReturn,
                         int _nToSkip, const BSONObj *_fieldsToReturn, int queryOptions , int bs ) :
                 connector(_connector),
@@ -114,7 +130,11 @@ namespace mongo {
                 nReturned(),
                 pos(),
                 data(),
-                _ownCursor( true ){
+                _ownCursor( true ),
+                _exhaustConn( 0 ),
+                _readAhead( false ),
+                _ahead( false ),
+                _rttMicros( 0 ){
         }
         
         DBClientCursor( DBConnector *_connector, const string &_ns, long long _cursorId, int _nToReturn, int options ) :
@@ -128,7 +148,11 @@ namespace mongo {
                 nReturned(),
                 pos(),
                 data(),
-                _ownCursor( true ){
+                _ownCursor( true ),
+                _exhaustConn( 0 ),
+                _readAhead( false ),
+                _ahead( false ),
+                _rttMicros( 0 ){
         }            
 
         virtual ~DBClientCursor();
@@ -141,6 +165,10 @@ namespace mongo {
         void decouple() { _ownCursor = false; }
         
         void attach( ScopedDbConnection * conn );
+        /** an exhaust cursor keeps the connection: the rest of the stream comes on it.  it
+            goes back to the pool once the server has sent everything, and is closed if the
+            cursor is destroyed before that
+        */
         void attach( ShardConnection * conn );
         
     private:
@@ -169,6 +197,18 @@ namespace mongo {
         void exhaustReceiveMore(); // for exhaust
         bool _ownCursor; // see decouple()
         string _scopedHost;
+        DBClientBase *_exhaustConn; // see attach()
+
+        // see setReadAhead()
+        void readAhead();
+        void receiveAhead();
+        int aheadBatchSize();
+        bool _readAhead;
+        bool _ahead;                // a getMore is out, its reply not read yet
+        MSGID _aheadId;
+        long long _rttMicros;       // of the last query or getMore, estimated
+        Timer _batchTimer;          // since the batch being read came in
+        Timer _aheadTimer;          // since the getMore went out
     };
     
     
@@ -32,6 +32,10 @@ namespace mongo {
         _ns = q.ns;
         _query = q.query.copy();
         _options = q.queryOptions;
+        if ( q.ntoreturn < 0 ){
+            // a hard limit: streaming whole shards would send mostly what gets thrown away
+            _options &= ~QueryOption_Exhaust;
+        }
         _fields = q.fields;
         _done = false;
     }
@@ -64,8 +68,14 @@ namespace mongo {
                 " _fields:" << _fields << " options: " << _options << endl;
         }
         
+        int options = _options;
+        if ( ! dynamic_cast< DBClientConnection* >( conn.get() ) ){
+            // only a plain connection can recv() a stream, others use getMore
+            options &= ~QueryOption_Exhaust;
+        }
+
         auto_ptr<DBClientCursor> cursor = 
-            conn->query( _ns , q , num , 0 , ( _fields.isEmpty() ? 0 : &_fields ) , _options );
+            conn->query( _ns , q , num , 0 , ( _fields.isEmpty() ? 0 : &_fields ) , options );
         
         if ( cursor->hasResultFlag( QueryResult::ResultFlag_ShardConfigStale ) ){
             conn.done();
@@ -382,6 +392,22 @@ namespace mongo {
     }
 
     bool Future::CommandResult::join(){
+#if !defined(_WIN32)
+        if ( _reply ){
+            if ( ! _done ){
+                if ( _reply->join() ){
+                    _res = _reply->firstDocument();
+                    _ok = _res["ok"].trueValue();
+                }
+                else {
+                    _res = BSON( "errmsg" << ( "connection to " + _server + " failed" ) );
+                    _ok = false;
+                }
+                _done = true;
+            }
+            return _ok;
+        }
+#endif
         while ( ! _done )
             sleepmicros( 50 );
         return _ok;
@@ -401,6 +427,12 @@ namespace mongo {
     shared_ptr<Future::CommandResult> Future::spawnCommand( const string& server , const string& db , const BSONObj& cmd ){
         shared_ptr<Future::CommandResult> res;
         res.reset( new Future::CommandResult( server , db , cmd ) );
+
+#if !defined(_WIN32)
+        res->_reply = asyncCommand( server , db , cmd );
+        if ( res->_reply )
+            return res;
+#endif
         
         _grab = &res;
         
@@ -413,6 +445,53 @@ namespace mongo {
     }
 
     shared_ptr<Future::CommandResult> * Future::_grab;
+
+#if !defined(_WIN32)
+    int Future::asyncConnsPerHost = 4;
+
+    static mongo::mutex asyncConnsMutex( "Future::asyncConns" );
+    static map< string , vector< shared_ptr<AsyncConnection> > > asyncConns;
+
+    shared_ptr<AsyncReply> Future::asyncCommand( const string& server , const string& db , const BSONObj& cmd ){
+        {
+            scoped_lock lk( asyncConnsMutex );
+            vector< shared_ptr<AsyncConnection> >& conns = asyncConns[ server ];
+            for ( vector< shared_ptr<AsyncConnection> >::iterator i = conns.begin(); i != conns.end(); ){
+                if ( (*i)->isFailed() ){
+                    i = conns.erase( i );
+                    continue;
+                }
+                // under the lock, so no other command takes it too
+                if ( (*i)->inFlight() == 0 )
+                    return (*i)->runCommand( db , cmd );
+                ++i;
+            }
+            if ( (int) conns.size() >= asyncConnsPerHost )
+                return shared_ptr<AsyncReply>();
+        }
+
+        // connecting blocks: not under asyncConnsMutex
+        DBClientBase *conn = pool.get( server );
+        DBClientConnection *single = dynamic_cast<DBClientConnection*>( conn );
+        if ( ! single || single->port().getSocket() < 0 ){
+            // paired / replica set / sync cluster, or a shared memory transport: stays with
+            // the thread per command
+            pool.release( server , conn );
+            return shared_ptr<AsyncReply>();
+        }
+        shared_ptr<AsyncConnection> c = AsyncClient::global().adopt( single );
+        // it stays open for the process, outside the pool's limit
+        pool.forget( server );
+        shared_ptr<AsyncReply> reply = c->runCommand( db , cmd );
+
+        scoped_lock lk( asyncConnsMutex );
+        vector< shared_ptr<AsyncConnection> >& conns = asyncConns[ server ];
+        // others connected meanwhile: the loop drops this one once its reply is in
+        if ( (int) conns.size() < asyncConnsPerHost )
+            conns.push_back( c );
+        return reply;
+    }
+#endif
     
     
 }
@@ -21,6 +21,7 @@
 
 #include "../pch.h"
 #include "dbclient.h"
+#include "asyncclient.h"
 #include "redef_macros.h"
 
 #include "../db/dbmessage.h"
@@ -229,8 +230,8 @@ namespace mongo {
 
     /**
      * tools for doing asynchronous operations
-     * right now uses underlying sync network ops and uses another thread
-     * should be changed to use non-blocking io
+     * commands go through AsyncClient::global() where it can take the connection (posix, a
+     * single server), otherwise they run on a thread of their own
      */
     class Future {
     public:
@@ -239,8 +240,16 @@ namespace mongo {
             
             string getServer() const { return _server; }
 
-            bool isDone() const { return _done; }
+            /** true once join() won't block */
+            bool isDone() const { 
+#if !defined(_WIN32)
+                if ( _reply )
+                    return _done || _reply->isDone();
+#endif
+                return _done; 
+            }
             
+            /* ok() and result() are for after join() */
             bool ok() const {
                 assert( _done );
                 return _ok;
@@ -270,6 +279,10 @@ namespace mongo {
             BSONObj _res;
             bool _done;
             bool _ok;
+
+#if !defined(_WIN32)
+            shared_ptr<AsyncReply> _reply;
+#endif
             
             friend class Future;
         };
@@ -278,8 +291,20 @@ namespace mongo {
         
         static shared_ptr<CommandResult> spawnCommand( const string& server , const string& db , const BSONObj& cmd );
 
+#if !defined(_WIN32)
+        /** connections per server kept with AsyncClient.  a command only goes on an idle one -
+            a server runs one connection's requests one at a time - so when all are busy it gets
+            a thread and a pooled connection of its own
+        */
+        static int asyncConnsPerHost;
+#endif
+
     private:
         static shared_ptr<CommandResult> * _grab;
+#if !defined(_WIN32)
+        /* sends cmd on an idle async connection to server.  empty if there is none to be had */
+        static shared_ptr<AsyncReply> asyncCommand( const string& server , const string& db , const BSONObj& cmd );
+#endif
     };
 
     
@@ -57,6 +57,18 @@ namespace mongo {
             ~GodScope();
         };
 
+        /* something referencing mapped records in place, e.g. a query reply which will be sent
+           straight from the data files.  only valid while we hold dbMutex: Context::unlocked()
+           calls unlocking() on every pin first so the holder can take a copy.
+        */
+        class RecordPin {
+        public:
+            virtual ~RecordPin() { }
+            virtual void unlocking() = 0;
+        };
+        void pin( RecordPin *p ) { _pins.push_back( p ); }
+        void unpin( RecordPin *p ) { _pins.remove( p ); }
+
         /* Set database we want to use, then, restores when we finish (are out of scope)
            Note this is also helpful if an exception happens as the state if fixed up.
         */
@@ -137,6 +149,8 @@ namespace mongo {
              * call before unlocking, so clear any non-thread safe state
              */
             void unlocked(){
+                for( list< RecordPin* >::const_iterator i = _client->_pins.begin(); i != _client->_pins.end(); ++i )
+                    (*i)->unlocking();
                 _db = 0;
             }
 
@@ -161,6 +175,7 @@ namespace mongo {
         ReplTime _lastOp;
         BSONObj _handshake;
         BSONObj _remoteId;
+        list< RecordPin* > _pins;
 
     public:
         string clientAddress() const;
@@ -257,11 +272,11 @@ namespace mongo {
 #endif
 
             _writelock = true;
-            dbMutex.unlock_shared();
-            dbMutex.lock();
-
             if ( cc().getContext() )
                 cc().getContext()->unlocked();
+
+            dbMutex.unlock_shared();
+            dbMutex.lock();
         }
     }
 
@@ -118,6 +118,16 @@ namespace mongo {
 
     /* must call this on a delete so we clean up the cursors. */
     void ClientCursor::aboutToDelete(const DiskLoc& dl) {
+        aboutToDelete(dl, 0);
+    }
+
+    void ClientCursor::aboutToDelete(const vector<DiskLoc>& dls) {
+        set<DiskLoc> batch( dls.begin(), dls.end() );
+        for ( set<DiskLoc>::const_iterator i = batch.begin(); i != batch.end(); ++i )
+            aboutToDelete(*i, &batch);
+    }
+
+    void ClientCursor::aboutToDelete(const DiskLoc& dl, const set<DiskLoc> *batch) {
         recursive_scoped_lock lock(ccmutex);
 
         CCByLoc::iterator j = byLoc.lower_bound(dl);
@@ -155,6 +165,10 @@ namespace mongo {
                 problem() << "warning: cursor loc " << tmp1 << " does not match byLoc position " << dl << " !" << endl;
             }
             c->advance();
+            // past the rest of the batch too: a cursor left on one of them would point at a
+            // freed record, as its aboutToDelete may have run already
+            while ( batch && !c->eof() && batch->count( c->refLoc() ) )
+                c->advance();
             if ( c->eof() ) {
                 // advanced to end -- delete cursor
                 delete cc;
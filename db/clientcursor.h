@@ -294,6 +294,12 @@ public:
 
         static void informAboutToDeleteBucket(const DiskLoc& b);
         static void aboutToDelete(const DiskLoc& dl);
+        /** for a batch deleted together: a cursor moved off one of them is moved past the
+            rest as well, as none of them is deleted yet
+        */
+        static void aboutToDelete(const vector<DiskLoc>& dls);
+    private:
+        static void aboutToDelete(const DiskLoc& dl, const set<DiskLoc> *batch);
     };
 
     class ClientCursorMonitor : public BackgroundJob {
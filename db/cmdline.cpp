@@ -19,6 +19,7 @@
 #include "pch.h"
 #include "cmdline.h"
 #include "commands.h"
+#include "../util/message.h"
 
 namespace po = boost::program_options;
 
@@ -43,6 +44,9 @@ namespace mongo {
             ("port", po::value<int>(&cmdLine.port), "specify port number")
             ("logpath", po::value<string>() , "file to send all output to instead of stdout" )
             ("logappend" , "append to logpath instead of over-writing" )
+            ("compressNetwork" , "compress traffic on connections to other servers which support it" )
+            ("writeBufferMillis" , po::value<int>(&MessagingPort::writeBufferMillis) , "longest a message queued to go out with the next one waits before it is sent, 0 sends at once (default 2)" )
+            ("writeBufferBytes" , po::value<int>(&MessagingPort::writeBufferBytes) , "size of each connection's queue of such messages, 0 sizes it from the socket's send buffer" )
 #ifndef _WIN32
             ("fork" , "fork server process" )
 #endif
@@ -114,6 +118,10 @@ namespace mongo {
             cmdLine.quiet = true;
         }
 
+        if (params.count("compressNetwork")) {
+            cmdLine.compressNetwork = true;
+        }
+
 #ifndef _WIN32
         if (params.count("fork")) {
             if ( ! params.count( "logpath" ) ){
@@ -44,6 +44,8 @@ namespace mongo {
         int defaultProfile;    // --profile
         int slowMS;            // --time in ms that is "slow"
 
+        bool compressNetwork;  // --compressNetwork
+
         enum { 
             DefaultDBPort = 27017,
 			ConfigServerPort = 27019,
@@ -52,7 +54,8 @@ namespace mongo {
 
         CmdLine() : 
             port(DefaultDBPort), rest(false), quiet(false), notablescan(false), prealloc(true), smallfiles(false),
-            quota(false), quotaFiles(8), cpu(false), oplogSize(0), defaultProfile(0), slowMS(100)
+            quota(false), quotaFiles(8), cpu(false), oplogSize(0), defaultProfile(0), slowMS(100),
+            compressNetwork(false)
         { } 
         
 
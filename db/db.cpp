@@ -24,6 +24,7 @@
 #include "../util/unittest.h"
 #include "../util/file_allocator.h"
 #include "../util/background.h"
+#include "../util/message_shm.h"
 #include "dbmessage.h"
 #include "instance.h"
 #include "clientcursor.h"
@@ -235,6 +236,10 @@ namespace mongo {
                     dbMsgPort->shutdown();
                     break;
                 }
+#if defined(__linux__)
+                if ( upgradeToSharedMemory( dbMsgPort , m ) )
+                    continue;
+#endif
 sendmore:
                 if ( inShutdown() ) {
                     log() << "got request after shutdown()" << endl;
@@ -244,7 +249,7 @@ sendmore:
                 lastError.startRequest( m , le );
 
                 DbResponse dbresponse;
-                if ( !assembleResponse( m, dbresponse, dbMsgPort->farEnd ) ) {
+                if ( !assembleResponse( m, dbresponse, dbMsgPort->farEnd, dbMsgPort.get() ) ) {
                     log() << curTimeMillis() % 10000 << "   end msg " << dbMsgPort->farEnd.toString() << endl;
                     /* todo: we may not wish to allow this, even on localhost: very low priv accounts could stop us. */
                     if ( dbMsgPort->farEnd.isLocalHost() ) {
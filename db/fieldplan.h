@@ -0,0 +1,193 @@
+// fieldplan.h
+
+/**
+*    Copyright (C) 2010 10gen Inc.
+*
+*    This program is free software: you can redistribute it and/or  modify
+*    it under the terms of the GNU Affero General Public License, version 3,
+*    as published by the Free Software Foundation.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "jsobj.h"
+
+namespace mongo {
+
+    /**
+       Resolves a fixed set of field names (which may be dotted) against an object
+       with a single pass over each embedded level, instead of one
+       getFieldDotted() scan per name.  Names sharing a prefix ( "a.x", "a.y" )
+       share the walk of the embedded object too.
+
+       Build once per query / index / sort spec, then call extract() per document.
+    */
+    class FieldExtractionPlan {
+    public:
+        FieldExtractionPlan() : _root( new Node() ) {}
+
+        /** @return index of the name's element in the output of extract().
+                    adding the same name twice returns the same index.
+        */
+        int add( const string& name ) {
+            for( unsigned i = 0; i < _names.size(); ++i )
+                if ( _names[ i ] == name )
+                    return i;
+            int idx = _names.size();
+            _names.push_back( name );
+            _add( *_root, name, 0, idx );
+            return idx;
+        }
+
+        /** adds each field name of pattern, in order */
+        void addFields( const BSONObj& pattern ) {
+            BSONObjIterator i( pattern );
+            while( i.more() )
+                add( i.next().fieldName() );
+        }
+
+        int size() const { return _names.size(); }
+        const string& name( int i ) const { return _names[ i ]; }
+
+        /** fields[ i ] = obj.getFieldDotted( name( i ) ) for each name - eoo if missing.
+            fields must have size() elements.
+        */
+        void extract( const BSONObj& obj, BSONElement *fields ) const {
+            for( int i = 0; i < size(); ++i )
+                fields[ i ] = BSONElement();
+            _extract( *_root, obj, fields, 0 );
+        }
+
+        /** like obj.getFieldDottedOrArray() for each name: traversal stops at the
+            first array on a path, and rest[ i ] is set to the offset in name( i ) of
+            the part of the path not consumed.
+        */
+        void extractOrArray( const BSONObj& obj, BSONElement *fields, int *rest ) const {
+            for( int i = 0; i < size(); ++i ) {
+                fields[ i ] = BSONElement();
+                rest[ i ] = _names[ i ].size();
+            }
+            _extract( *_root, obj, fields, rest );
+        }
+
+    private:
+        enum { MaxChildren = 16, Slow = -2 };
+
+        struct Node {
+            struct Entry {
+                string name;  // remainder of the path at this level
+                int idx;      // index into _names
+                int offset;   // where name starts in _names[ idx ]
+                int child;    // child for the first component of a dotted name, -1 if not dotted, or Slow
+            };
+            vector< Entry > entries;
+            vector< string > childNames;
+            vector< shared_ptr< Node > > children;
+        };
+
+        void _add( Node& n, const string& name, int offset, int idx ) {
+            Node::Entry e;
+            e.name = name.substr( offset );
+            e.idx = idx;
+            e.offset = offset;
+            e.child = -1;
+            size_t dot = name.find( '.', offset );
+            if ( dot != string::npos ) {
+                string left = name.substr( offset, dot - offset );
+                for( unsigned i = 0; i < n.childNames.size(); ++i )
+                    if ( n.childNames[ i ] == left )
+                        e.child = i;
+                if ( e.child == -1 ) {
+                    if ( n.children.size() >= MaxChildren ) {
+                        e.child = Slow;
+                    }
+                    else {
+                        e.child = n.children.size();
+                        n.childNames.push_back( left );
+                        n.children.push_back( shared_ptr< Node >( new Node() ) );
+                    }
+                }
+                if ( e.child != Slow )
+                    _add( *n.children[ e.child ], name, dot + 1, idx );
+            }
+            n.entries.push_back( e );
+        }
+
+        /* rest == 0 means getFieldDotted() semantics, otherwise getFieldDottedOrArray() */
+        void _extract( const Node& n, const BSONObj& obj, BSONElement *fields, int *rest ) const {
+            BSONElement sub[ MaxChildren ];
+            int nChildren = n.children.size();
+            int foundChildren = 0;
+            // entries which can still be matched by name at this level
+            int pending = 0;
+            for( vector< Node::Entry >::const_iterator i = n.entries.begin(); i != n.entries.end(); ++i )
+                if ( fields[ i->idx ].eoo() && ( !rest || i->child == -1 ) )
+                    ++pending;
+
+            BSONObjIterator i( obj );
+            while( i.more() && ( pending || foundChildren < nChildren ) ) {
+                BSONElement e = i.next();
+                const char *fn = e.fieldName();
+                for( vector< Node::Entry >::const_iterator j = n.entries.begin(); j != n.entries.end(); ++j ) {
+                    if ( rest && j->child != -1 )
+                        continue;
+                    if ( fields[ j->idx ].eoo() && strcmp( fn, j->name.c_str() ) == 0 ) {
+                        fields[ j->idx ] = e;
+                        --pending;
+                    }
+                }
+                for( int c = 0; c < nChildren; ++c ) {
+                    if ( sub[ c ].eoo() && strcmp( fn, n.childNames[ c ].c_str() ) == 0 ) {
+                        sub[ c ] = e;
+                        ++foundChildren;
+                    }
+                }
+            }
+
+            for( int c = 0; c < nChildren; ++c ) {
+                BSONType t = sub[ c ].type();
+                if ( t == Object || ( t == Array && !rest ) ) {
+                    _extract( *n.children[ c ], sub[ c ].embeddedObject(), fields, rest );
+                }
+                else if ( t == Array ) {
+                    const Node& child = *n.children[ c ];
+                    for( vector< Node::Entry >::const_iterator j = child.entries.begin(); j != child.entries.end(); ++j ) {
+                        if ( !fields[ j->idx ].eoo() )
+                            continue;
+                        fields[ j->idx ] = sub[ c ];
+                        rest[ j->idx ] = j->offset;
+                    }
+                }
+            }
+
+            for( vector< Node::Entry >::const_iterator j = n.entries.begin(); j != n.entries.end(); ++j ) {
+                if ( j->child != Slow || !fields[ j->idx ].eoo() )
+                    continue;
+                if ( rest ) {
+                    const char *base = _names[ j->idx ].c_str();
+                    const char *p = base + j->offset;
+                    BSONElement e = obj.getFieldDottedOrArray( p );
+                    if ( !e.isNull() ) {
+                        fields[ j->idx ] = e;
+                        rest[ j->idx ] = p - base;
+                    }
+                }
+                else {
+                    fields[ j->idx ] = obj.getFieldDotted( j->name.c_str() );
+                }
+            }
+        }
+
+        vector< string > _names;
+        shared_ptr< Node > _root;
+    };
+
+} // namespace mongo
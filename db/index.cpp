@@ -85,8 +85,16 @@ namespace mongo {
         wassert( n == 1 );
     }
     
-    void IndexDetails::getKeysFromObject( const BSONObj& obj, BSONObjSetDefaultOrder& keys) const {
-        getSpec().getKeys( obj, keys );
+    void IndexDetails::getKeysFromObject( const BSONObj& obj, BSONObjSetDefaultOrder& keys, BufferArena *arena ) const {
+        // the spec is cached, so it must not be built in the arena
+        const IndexSpec& spec = getSpec();
+        if ( arena ) {
+            BufferArena::Scope s( *arena );
+            spec.getKeys( obj, keys );
+        }
+        else {
+            spec.getKeys( obj, keys );
+        }
     }
 
     void setDifference(BSONObjSetDefaultOrder &l, BSONObjSetDefaultOrder &r, vector<BSONObj*> &diff) {
@@ -105,7 +113,7 @@ namespace mongo {
         }
     }
 
-    void getIndexChanges(vector<IndexChanges>& v, NamespaceDetails& d, BSONObj newObj, BSONObj oldObj, bool &changedId) { 
+    void getIndexChanges(vector<IndexChanges>& v, NamespaceDetails& d, BSONObj newObj, BSONObj oldObj, bool &changedId, BufferArena *arena) { 
         int z = d.nIndexesBeingBuilt();
         v.resize(z);
         NamespaceDetails::IndexIterator i = d.ii();
@@ -113,8 +121,8 @@ namespace mongo {
             IndexDetails& idx = d.idx(i);
             BSONObj idxKey = idx.info.obj().getObjectField("key"); // eg { ts : 1 }
             IndexChanges& ch = v[i];
-            idx.getKeysFromObject(oldObj, ch.oldkeys);
-            idx.getKeysFromObject(newObj, ch.newkeys);
+            idx.getKeysFromObject(oldObj, ch.oldkeys, arena);
+            idx.getKeysFromObject(newObj, ch.newkeys, arena);
             if( ch.newkeys.size() > 1 ) 
                 d.setIndexIsMultikey(i);
             setDifference(ch.oldkeys, ch.newkeys, ch.removed);
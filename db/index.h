@@ -60,8 +60,9 @@ namespace mongo {
            can index them.  Note that the set is multiple elements
            only when it's a "multikey" array.
            keys will be left empty if key not found in the object.
+           if arena is given the keys are built in it, so they must be gone before it is.
         */
-        void getKeysFromObject( const BSONObj& obj, BSONObjSetDefaultOrder& keys) const;
+        void getKeysFromObject( const BSONObj& obj, BSONObjSetDefaultOrder& keys, BufferArena *arena = 0 ) const;
 
         /* get the key pattern for this object.
            e.g., { lastname:1, firstname:1 }
@@ -156,7 +157,7 @@ namespace mongo {
     };
 
     class NamespaceDetails;
-    // changedId should be initialized to false
-    void getIndexChanges(vector<IndexChanges>& v, NamespaceDetails& d, BSONObj newObj, BSONObj oldObj, bool &cangedId);
+    // changedId should be initialized to false.  keys are built in arena if given (see getKeysFromObject).
+    void getIndexChanges(vector<IndexChanges>& v, NamespaceDetails& d, BSONObj newObj, BSONObj oldObj, bool &cangedId, BufferArena *arena = 0);
     void dupCheck(vector<IndexChanges>& v, NamespaceDetails& d, DiskLoc curObjLoc);
 } // namespace mongo
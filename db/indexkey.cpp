@@ -61,6 +61,7 @@ namespace mongo {
             BSONElement e = i.next();
             _fieldNames.push_back( e.fieldName() );
             _fixed.push_back( BSONElement() );
+            _fieldPlanIdx.push_back( _fieldPlan.add( e.fieldName() ) );
             nullKeyB.appendNull( "" );
             if ( e.type() == String ){
                 uassert( 13007 , "can only have 1 index plugin / bad index key pattern" , pluginName.size() == 0 );
@@ -96,18 +97,36 @@ namespace mongo {
         }
         vector<const char*> fieldNames( _fieldNames );
         vector<BSONElement> fixed( _fixed );
-        _getKeys( fieldNames , fixed , obj, keys );
+        _getKeys( fieldNames , fixed , obj, keys , true );
         if ( keys.empty() )
             keys.insert( _nullKey );
     }
 
-    void IndexSpec::_getKeys( vector<const char*> fieldNames , vector<BSONElement> fixed , const BSONObj &obj, BSONObjSetDefaultOrder &keys ) const {
+    void IndexSpec::_getKeys( vector<const char*> fieldNames , vector<BSONElement> fixed , const BSONObj &obj, BSONObjSetDefaultOrder &keys , bool topLevel ) const {
+        // compound keys: find all the top level fields in one pass
+        bool usePlan = topLevel && _fieldPlan.size() > 1;
+        vector<BSONElement> planned;
+        vector<int> plannedRest;
+        if ( usePlan ) {
+            planned.resize( _fieldPlan.size() );
+            plannedRest.resize( _fieldPlan.size() );
+            _fieldPlan.extractOrArray( obj, &planned[ 0 ], &plannedRest[ 0 ] );
+        }
+
         BSONElement arrElt;
         unsigned arrIdx = ~0;
         for( unsigned i = 0; i < fieldNames.size(); ++i ) {
             if ( *fieldNames[ i ] == '\0' )
                 continue;
-            BSONElement e = obj.getFieldDottedOrArray( fieldNames[ i ] );
+            BSONElement e;
+            if ( usePlan ) {
+                int k = _fieldPlanIdx[ i ];
+                e = planned[ k ];
+                fieldNames[ i ] += plannedRest[ k ];
+            }
+            else {
+                e = obj.getFieldDottedOrArray( fieldNames[ i ] );
+            }
             if ( e.eoo() )
                 e = _nullElt; // no matching field
             if ( e.type() != Array )
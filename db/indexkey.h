@@ -21,6 +21,7 @@
 #include "../pch.h"
 #include "diskloc.h"
 #include "jsobj.h"
+#include "fieldplan.h"
 #include <map>
 
 namespace mongo {
@@ -147,12 +148,15 @@ namespace mongo {
 
         IndexSuitability _suitability( const BSONObj& query , const BSONObj& order ) const ;
 
-        void _getKeys( vector<const char*> fieldNames , vector<BSONElement> fixed , const BSONObj &obj, BSONObjSetDefaultOrder &keys ) const;
+        void _getKeys( vector<const char*> fieldNames , vector<BSONElement> fixed , const BSONObj &obj, BSONObjSetDefaultOrder &keys , bool topLevel = false ) const;
         
         BSONSizeTracker _sizeTracker;
 
         vector<const char*> _fieldNames;
         vector<BSONElement> _fixed;
+        // resolves all of _fieldNames in one pass over the top level object
+        FieldExtractionPlan _fieldPlan;
+        vector<int> _fieldPlanIdx;
         BSONObj _nullKey;
         
         BSONObj _nullObj;
@@ -161,7 +161,7 @@ namespace mongo {
         replyToQuery(0, m, dbresponse, obj);
     }
 
-    static bool receivedQuery(Client& c, DbResponse& dbresponse, Message& m ){
+    static bool receivedQuery(Client& c, DbResponse& dbresponse, Message& m, MessagingPort *replyPort ){
         bool ok = true;
         MSGID responseTo = m.header()->id;
 
@@ -172,7 +172,7 @@ namespace mongo {
         CurOp& op = *(c.curop());
         
         try {
-            dbresponse.exhaust = runQuery(m, q, op, *resp);
+            dbresponse.exhaust = runQuery(m, q, op, *resp, replyPort);
             assert( !resp->empty() );
         }
         catch ( AssertionException& e ) {
@@ -218,7 +218,7 @@ namespace mongo {
     }
 
     // Returns false when request includes 'end'
-    bool assembleResponse( Message &m, DbResponse &dbresponse, const SockAddr &client ) {
+    bool assembleResponse( Message &m, DbResponse &dbresponse, const SockAddr &client, MessagingPort *replyPort ) {
 
         // before we lock...
         int op = m.operation();
@@ -282,7 +282,7 @@ namespace mongo {
         bool log = logLevel >= 1;
         
         if ( op == dbQuery ) {
-            receivedQuery(c , dbresponse, m ); //zzz
+            receivedQuery(c , dbresponse, m, replyPort ); //zzz
         }
         else if ( op == dbGetMore ) {
             //DEV log = true;
@@ -540,11 +540,27 @@ namespace mongo {
         writelock lk(ns);
         Client::Context ctx(ns);		
         while ( d.moreJSObjs() ) {
-            BSONObj js = d.nextJsObj();
-            uassert( 10059 , "object to insert too large", js.objsize() <= MaxBSONObjectSize);
-            theDataFileMgr.insertWithObjMod(ns, js, false);
-            logOp("i", ns, js);
-            globalOpCounters.gotInsert();
+            /* objects are inserted in batches so index maintenance for the batch can be done
+               in key order; see DataFileMgr::insertBatch */
+            const unsigned InsertBatchSize = 1000;
+            vector<BSONObj> batch;
+            bool tooLarge = false;
+            while ( d.moreJSObjs() && batch.size() < InsertBatchSize ) {
+                BSONObj js = d.nextJsObj();
+                if ( js.objsize() > MaxBSONObjectSize ) {
+                    tooLarge = true;
+                    break;
+                }
+                batch.push_back( js );
+            }
+            bool inserted = batch.size() > 1 && theDataFileMgr.insertBatch(ns, batch);
+            for ( unsigned i = 0; i < batch.size(); i++ ) {
+                if ( !inserted )
+                    theDataFileMgr.insertWithObjMod(ns, batch[i], false);
+                logOp("i", ns, batch[i]);
+                globalOpCounters.gotInsert();
+            }
+            uassert( 10059 , "object to insert too large", !tooLarge );
         }
     }
 
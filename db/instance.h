@@ -103,7 +103,10 @@ namespace mongo {
         ~DbResponse() { delete response; }
     };
     
-    bool assembleResponse( Message &m, DbResponse &dbresponse, const SockAddr &client = unknownAddress );
+    /* replyPort: where dbresponse.response will be sent.  a query reply may then be partly
+       written before this returns, see runQuery()
+    */
+    bool assembleResponse( Message &m, DbResponse &dbresponse, const SockAddr &client = unknownAddress, MessagingPort *replyPort = 0 );
 
     void getDatabaseNames( vector< string > &names , const string& usePath = dbpath );
 
@@ -48,77 +48,113 @@ namespace mongo {
 
     DateNowLabeler DATENOW;
 
-    string escape( string s , bool escape_slash=false) {
-        stringstream ret;
-        for ( string::iterator i = s.begin(); i != s.end(); ++i ) {
-            switch ( *i ) {
-            case '"':
-                ret << "\\\"";
-                break;
-            case '\\':
-                ret << "\\\\";
-                break;
-            case '/':
-                ret << (escape_slash ? "\\/" : "/");
-                break;
-            case '\b':
-                ret << "\\b";
-                break;
-            case '\f':
-                ret << "\\f";
-                break;
-            case '\n':
-                ret << "\\n";
-                break;
-            case '\r':
-                ret << "\\r";
-                break;
-            case '\t':
-                ret << "\\t";
-                break;
-            default:
-                if ( *i >= 0 && *i <= 0x1f ) {
-                    ret << "\\u";
-                    ret << hex;
-                    ret.width( 4 );
-                    ret.fill( '0' );
-                    ret << int( *i );
-                } else {
-                    ret << *i;
-                }
+    /* what follows the \ when a byte is escaped in a JSON string: 'u' for \u00XX, 0 if it
+       isn't escaped.  '/' is only escaped in a /regex/.
+    */
+    static struct JsonEscapes {
+        JsonEscapes() {
+            memset( e, 0, sizeof( e ) );
+            for( int c = 0; c < 0x20; ++c )
+                e[ c ] = 'u';
+            e[ (unsigned char) '"' ] = '"';
+            e[ (unsigned char) '\\' ] = '\\';
+            e[ (unsigned char) '/' ] = '/';
+            e[ (unsigned char) '\b' ] = 'b';
+            e[ (unsigned char) '\f' ] = 'f';
+            e[ (unsigned char) '\n' ] = 'n';
+            e[ (unsigned char) '\r' ] = 'r';
+            e[ (unsigned char) '\t' ] = 't';
+        }
+        char e[ 256 ];
+    } jsonEscapes;
+
+    static void jsonEscape( StringBuilder& s, const char *str, int len, bool escapeSlash = false ) {
+        static const char hexDigits[] = "0123456789abcdef";
+        const char *end = str + len;
+        while ( 1 ) {
+            const char *run = str;
+            char x = 0;
+            while ( str < end && ( !( x = jsonEscapes.e[ (unsigned char) *str ] ) || ( x == '/' && !escapeSlash ) ) )
+                ++str;
+            s.append( run, str - run );
+            if ( str == end )
+                return;
+            if ( x == 'u' ) {
+                s << "\\u00" << hexDigits[ *str >> 4 ] << hexDigits[ *str & 0xf ];
             }
+            else {
+                s << '\\' << x;
+            }
+            ++str;
         }
-        return ret.str();
+    }
+
+    static void jsonEscape( StringBuilder& s, const char *str, bool escapeSlash = false ) {
+        jsonEscape( s, str, strlen( str ), escapeSlash );
+    }
+
+    /* the digits of x, without going through sprintf() */
+    static void jsonInteger( StringBuilder& s, long long x ) {
+        char buf[ 24 ];
+        char *p = buf + sizeof( buf );
+        unsigned long long u = x < 0 ? 0ULL - (unsigned long long) x : x;
+        do {
+            *--p = '0' + u % 10;
+            u /= 10;
+        } while ( u );
+        if ( x < 0 )
+            *--p = '-';
+        s.append( p, buf + sizeof( buf ) - p );
+    }
+
+    static void jsonNumber( StringBuilder& s, double x ) {
+        if ( !( x >= -numeric_limits< double >::max() && x <= numeric_limits< double >::max() ) ) {
+            stringstream ss;
+            ss << "Number " << x << " cannot be represented in JSON";
+            string message = ss.str();
+            massert( 10311 ,  message.c_str(), false );
+        }
+        // integral values print as their digits with %.16g (0 may be -0 though)
+        if ( x != 0 && x > -1e15 && x < 1e15 && x == (double)(long long) x ) {
+            jsonInteger( s, (long long) x );
+            return;
+        }
+        char buf[ 32 ];
+        sprintf( buf, "%.16g", x );
+        s << buf;
     }
 
     string BSONElement::jsonString( JsonStringFormat format, bool includeFieldNames, int pretty ) const {
+        StringBuilder s;
+        jsonString( s, format, includeFieldNames, pretty );
+        return s.str();
+    }
+
+    void BSONElement::jsonString( StringBuilder& s, JsonStringFormat format, bool includeFieldNames, int pretty ) const {
         BSONType t = type();
         if ( t == Undefined )
-            return "";
+            return;
 
-        stringstream s;
-        if ( includeFieldNames )
-            s << '"' << escape( fieldName() ) << "\" : ";
+        if ( includeFieldNames ) {
+            s << '"';
+            jsonEscape( s, fieldName() );
+            s << "\" : ";
+        }
         switch ( type() ) {
         case mongo::String:
         case Symbol:
-            s << '"' << escape( string(valuestr(), valuestrsize()-1) ) << '"';
+            s << '"';
+            jsonEscape( s, valuestr(), valuestrsize()-1 );
+            s << '"';
             break;
         case NumberLong:
-            s << _numberLong();
+            jsonInteger( s, _numberLong() );
             break;
         case NumberInt:
+            jsonInteger( s, _numberInt() );
+            break;
         case NumberDouble:
-            if ( number() >= -numeric_limits< double >::max() &&
-                    number() <= numeric_limits< double >::max() ) {
-                s.precision( 16 );
-                s << number();
-            } else {
-                stringstream ss;
-                ss << "Number " << number() << " cannot be represented in JSON";
-                string message = ss.str();
-                massert( 10311 ,  message.c_str(), false );
-            }
+            jsonNumber( s, _numberDouble() );
             break;
         case mongo::Bool:
             s << ( boolean() ? "true" : "false" );
@@ -127,7 +163,7 @@ namespace mongo {
             s << "null";
             break;
         case Object:
-            s << embeddedObject().jsonString( format, pretty );
+            embeddedObject().jsonString( s, format, pretty );
             break;
         case mongo::Array: {
             if ( embeddedObject().isEmpty() ) {
@@ -144,7 +180,7 @@ namespace mongo {
                         for( int x = 0; x < pretty; x++ )
                             s << "  ";
                     }
-                    s << e.jsonString( format, false, pretty?pretty+1:0 );
+                    e.jsonString( s, format, false, pretty?pretty+1:0 );
                     e = i.next();
                     if ( e.eoo() )
                         break;
@@ -162,7 +198,7 @@ namespace mongo {
             s << '"' << valuestr() << "\", ";
             if ( format != TenGen )
                 s << "\"$id\" : ";
-            s << '"' << *x << "\" ";
+            s << '"' << x->str() << "\" ";
             if ( format == TenGen )
                 s << ')';
             else
@@ -175,7 +211,7 @@ namespace mongo {
             } else {
                 s << "{ \"$oid\" : ";
             }
-            s << '"' << __oid() << '"';
+            s << '"' << __oid().str() << '"';
             if ( format == TenGen ) {
                 s << " )";
             } else {
@@ -187,12 +223,10 @@ namespace mongo {
             BinDataType type = BinDataType( *(char *)( (int *)( value() ) + 1 ) );
             s << "{ \"$binary\" : \"";
             char *start = ( char * )( value() ) + sizeof( int ) + 1;
-            base64::encode( s , start , len );
-            s << "\", \"$type\" : \"" << hex;
-            s.width( 2 );
-            s.fill( '0' );
-            s << type << dec;
-            s << "\" }";
+            s << base64::encode( start , len );
+            char t[ 16 ];
+            sprintf( t, "%02x", (unsigned) type );
+            s << "\", \"$type\" : \"" << t << "\" }";
             break;
         }
         case mongo::Date:
@@ -206,7 +240,7 @@ namespace mongo {
                 else
                     s << '"' << date().toString() << '"';
             } else
-                s << date();
+                s << date().millis;
             if ( format == Strict )
                 s << " }";
             else
@@ -214,10 +248,13 @@ namespace mongo {
             break;
         case RegEx:
             if ( format == Strict ){
-                s << "{ \"$regex\" : \"" << escape( regex() );
+                s << "{ \"$regex\" : \"";
+                jsonEscape( s, regex() );
                 s << "\", \"$options\" : \"" << regexFlags() << "\" }";
             } else {
-                s << "/" << escape( regex() , true ) << "/";
+                s << "/";
+                jsonEscape( s, regex(), true );
+                s << "/";
                 // FIXME Worry about alpha order?
                 for ( const char *f = regexFlags(); *f; ++f ){
                     switch ( *f ) {
@@ -236,7 +273,9 @@ namespace mongo {
             BSONObj scope = codeWScopeObject();
             if ( ! scope.isEmpty() ){
                 s << "{ \"$code\" : " << _asCode() << " , "
-                  << " \"$scope\" : " << scope.jsonString() << " }";
+                  << " \"$scope\" : ";
+                scope.jsonString( s );
+                s << " }";
                 break;
             }
         }
@@ -247,7 +286,7 @@ namespace mongo {
             break;
             
         case Timestamp:
-            s << "{ \"t\" : " << timestampTime() << " , \"i\" : " << timestampInc() << " }";
+            s << "{ \"t\" : " << timestampTime().millis << " , \"i\" : " << timestampInc() << " }";
             break;
 
         case MinKey:
@@ -265,7 +304,6 @@ namespace mongo {
             string message = ss.str();
             massert( 10312 ,  message.c_str(), false );
         }
-        return s.str();
     }
 
     int BSONElement::getGtLtOp( int def ) const {
@@ -509,16 +547,24 @@ namespace mongo {
     }
 
     string BSONObj::jsonString( JsonStringFormat format, int pretty ) const {
+        StringBuilder s( objsize() * 2 );
+        jsonString( s, format, pretty );
+        return s.str();
+    }
 
-        if ( isEmpty() ) return "{}";
+    void BSONObj::jsonString( StringBuilder& s, JsonStringFormat format, int pretty ) const {
+
+        if ( isEmpty() ) {
+            s << "{}";
+            return;
+        }
 
-        stringstream s;
         s << "{ ";
         BSONObjIterator i(*this);
         BSONElement e = i.next();
         if ( !e.eoo() )
             while ( 1 ) {
-                s << e.jsonString( format, true, pretty?pretty+1:0 );
+                e.jsonString( s, format, true, pretty?pretty+1:0 );
                 e = i.next();
                 if ( e.eoo() )
                     break;
@@ -533,33 +579,116 @@ namespace mongo {
                 }
             }
         s << " }";
-        return s.str();
     }
 
-// todo: can be a little faster if we don't use toString() here.
-    bool BSONObj::valid() const {
-        try{
-            BSONObjIterator it(*this);
-            while( it.moreWithEOO() ){
-                // both throw exception on failure
-                BSONElement e = it.next(true);
-                e.validate();
-
-                if (e.eoo()){
-                    if (it.moreWithEOO())
-                        return false;
-                    return true;
-                }else if (e.isABSONObj()){
-                    if(!e.embeddedObject().valid())
-                        return false;
-                }else if (e.type() == CodeWScope){
-                    if(!e.codeWScopeObject().valid())
-                        return false;
-                }
+    /* Checks the object of at most maxLen bytes at p in one pass, without building BSONElements
+       or throwing.  Every length is checked against the bytes left before it is used, and the
+       NUL terminated parts (field names, regexes) are found with memchr(), which is vectorized
+       in the common C libraries.  Accepts exactly what the element by element walk did.
+    */
+    static bool validBSON( const char *p, int maxLen ) {
+        if ( maxLen < 5 )
+            return false;
+        int size = *(const int *) p;
+        if ( size < 5 || size > maxLen )
+            return false;
+        const char *end = p + size;
+        p += 4;
+        while ( 1 ) {
+            int type = (signed char) *p++;
+            if ( type == EOO )
+                return p == end;
+            const char *nul = (const char *) memchr( p, 0, end - p );
+            if ( !nul )
+                return false;
+            p = nul + 1;
+            int remain = (int) ( end - p );
+            int len;
+            switch ( type ) {
+            case Undefined:
+            case jstNULL:
+            case MaxKey:
+            case MinKey:
+                len = 0;
+                break;
+            case mongo::Bool:
+                len = 1;
+                break;
+            case NumberInt:
+                len = 4;
+                break;
+            case Timestamp:
+            case mongo::Date:
+            case NumberDouble:
+            case NumberLong:
+                len = 8;
+                break;
+            case jstOID:
+                len = 12;
+                break;
+            case Symbol:
+            case Code:
+            case mongo::String:
+            case DBRef: {
+                if ( remain < 4 )
+                    return false;
+                int x = *(const int *) p;
+                len = 4 + x + ( type == DBRef ? 12 : 0 );
+                if ( x <= 0 || x > remain - 4 || p[ 4 + x - 1 ] != 0 )
+                    return false;
+                break;
             }
-        } catch (...) {
+            case BinData: {
+                if ( remain < 5 )
+                    return false;
+                int x = *(const int *) p;
+                if ( x < 0 || x > remain - 5 )
+                    return false;
+                len = 5 + x;
+                break;
+            }
+            case RegEx: {
+                const char *n1 = (const char *) memchr( p, 0, remain );
+                const char *n2 = n1 ? (const char *) memchr( n1 + 1, 0, end - n1 - 1 ) : 0;
+                if ( !n2 )
+                    return false;
+                len = (int) ( n2 + 1 - p );
+                break;
+            }
+            case Object:
+            case mongo::Array:
+                if ( !validBSON( p, remain ) )
+                    return false;
+                len = *(const int *) p;
+                break;
+            case CodeWScope: {
+                if ( remain < 8 )
+                    return false;
+                int total = *(const int *) p;
+                int strSizeWNull = *(const int *) ( p + 4 );
+                if ( total < 8 || total > remain || strSizeWNull <= 0 || strSizeWNull > total - 4 - 4 - 4 )
+                    return false;
+                const char *code = p + 8;
+                if ( memchr( code, 0, strSizeWNull ) != code + strSizeWNull - 1 )
+                    return false;
+                const char *scope = code + strSizeWNull;
+                if ( *(const int *) scope != total - 4 - 4 - strSizeWNull || !validBSON( scope, total - 4 - 4 - strSizeWNull ) )
+                    return false;
+                len = total;
+                break;
+            }
+            default:
+                return false;
+            }
+            // the value, then at least the EOO
+            if ( len >= remain )
+                return false;
+            p += len;
         }
-        return false;
+    }
+
+    bool BSONObj::valid() const {
+        return validBSON( objdata(), objsize() );
     }
 
     int BSONObj::woCompare(const BSONObj& r, const Ordering &o, bool considerFieldName) const { 
@@ -893,10 +1022,8 @@ namespace mongo {
             }
         }
 
-        if ( n ) {
-            int len;
-            init( b.decouple(len), true );
-        }
+        if ( n )
+            *this = b.obj();
 
         return n;
     }
@@ -1221,7 +1348,11 @@ namespace mongo {
 */
 
     void OID::init() {
-        static AtomicUInt inc = getRandomNumber();
+        /* shared by all threads: a single atomic increment per oid keeps them unique and, within
+           a second, increasing in the order they were generated whichever thread made them.
+           a function static so an oid made during static initialization finds it set up
+        */
+        static AtomicUInt inc( (unsigned) security.getNonceInitSafe() );
         unsigned t = (unsigned) time(0);
         char *T = (char *) &t;
         data[0] = T[3];
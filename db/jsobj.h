@@ -42,5 +42,6 @@
 #include "../bson/bsonobjiterator.h"
 #include "../bson/bsoninlines.h"
 #include "../bson/ordering.h"
+#include "../bson/bsonfieldindex.h"
 
 #include "../bson/bson_db.h"
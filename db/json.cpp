@@ -17,544 +17,553 @@
 */
 
 #include "pch.h"
-
-#define BOOST_SPIRIT_THREADSAFE
-#if BOOST_VERSION >= 103800
-#define BOOST_SPIRIT_USE_OLD_NAMESPACE
-#include <boost/spirit/include/classic_core.hpp>
-#include <boost/spirit/include/classic_loops.hpp>
-#include <boost/spirit/include/classic_lists.hpp>
-#else
-#include <boost/spirit/core.hpp>
-#include <boost/spirit/utility/loops.hpp>
-#include <boost/spirit/utility/lists.hpp>
-#endif
-#undef assert
-#define assert MONGO_assert
-
 #include "json.h"
 #include "../bson/util/builder.h"
 #include "../util/base64.h"
 #include "../util/hex.h"
 
-
-using namespace boost::spirit;
-
 namespace mongo {
 
-    struct ObjectBuilder : boost::noncopyable {
-        ~ObjectBuilder(){
-            unsigned i = builders.size();
-            if ( i ){
-                i--;
-                for ( ; i>=1; i-- ){
-                    if ( builders[i] ){
-                        builders[i]->done();
+// NOTE s must be 24 characters.
+    OID stringToOid( const char *s ) {
+        OID oid;
+        char *oidP = (char *)( &oid );
+        for ( int i = 0; i < 12; ++i )
+            oidP[ i ] = fromHex( s + ( i * 2 ) );
+        return oid;
+    }
+
+    /* Recursive descent parser for the JSON dialect described in json.h.  Elements are written
+       straight into the BufBuilder of the object being built: the type byte is reserved before
+       the field name and filled in once the value has been parsed, strings are unescaped in
+       place and sizes are patched afterwards, so nothing is copied twice.
+
+       Whitespace may appear between tokens.
+
+         object    : '{' [ fieldName ':' value ( ',' fieldName ':' value )* ] '}'
+         fieldName : "str" | 'str' | [A-Za-z$_][A-Za-z0-9$_]*
+         value     : "str" | 'str' | number | true | false | null
+                   | '[' [ value ( ',' value )* ] ']'
+                   | { "$date" : <uint> } | [new] Date( <uint> )
+                   | { "$oid" : "<24 hex>" } | ObjectId( "<24 hex>" )
+                   | { "$binary" : "<base64>" , "$type" : "<2 hex>" }
+                   | { "$ref" : "str" , "$id" : "<24 hex>" } | Dbref( "str" , "<24 hex>" )
+                   | { "$regex" : "str" , "$options" : "<letters>" } | /regex/[igm]*
+                   | object
+
+       A { } which doesn't fully match one of the $ forms is parsed as an ordinary object, in
+       which quoted $oid, $binary, $type, $date, $regex and $options field names are refused.
+       A number with a '.' or an exponent is a double; otherwise it is an int, or a long long if
+       it doesn't fit in an int.
+    */
+    class JsonParser {
+    public:
+        JsonParser( const char *in ) : _p( in ) {}
+
+        /** where parsing stopped: just after the object, or where a syntax error was found */
+        const char *pos() const { return _p; }
+
+        /** parses an object, appending its elements (but not its size or EOO) to b */
+        bool object( BufBuilder &b ) {
+            return accept( '{' ) && members( b );
+        }
+
+    private:
+        static bool digit( char c ) { return '0' <= c && c <= '9'; }
+        static bool letter( char c ) { return ( 'a' <= c && c <= 'z' ) || ( 'A' <= c && c <= 'Z' ); }
+        static bool xdigit( char c ) { return digit( c ) || ( 'a' <= c && c <= 'f' ) || ( 'A' <= c && c <= 'F' ); }
+        static bool xdigits( const char *p, int n ) {
+            for( int i = 0; i < n; ++i )
+                if ( !xdigit( p[ i ] ) )
+                    return false;
+            return true;
+        }
+
+        void white() {
+            while( isspace( (unsigned char) *_p ) )
+                ++_p;
+        }
+        /** skips whitespace, then consumes c if it is next */
+        bool accept( char c ) {
+            white();
+            if ( *_p != c )
+                return false;
+            ++_p;
+            return true;
+        }
+        /** skips whitespace, then consumes s if it is next */
+        bool accept( const char *s ) {
+            white();
+            int n = strlen( s );
+            if ( strncmp( _p, s, n ) != 0 )
+                return false;
+            _p += n;
+            return true;
+        }
+
+        /* the rest of an object after its '{' */
+        bool members( BufBuilder &b ) {
+            if ( accept( '}' ) )
+                return true;
+            do {
+                int typePos = b.len();
+                b.append( (char) EOO );
+                if ( !fieldName( b ) || !accept( ':' ) || !value( b, typePos ) )
+                    return false;
+            } while( accept( ',' ) );
+            return accept( '}' );
+        }
+
+        bool fieldName( BufBuilder &b ) {
+            white();
+            int start = b.len();
+            char c = *_p;
+            if ( c == '"' || c == '\'' ) {
+                ++_p;
+                if ( !str( b, c ) )
+                    return false;
+                cString( b, start );
+                const char *name = b.buf() + start;
+                massert( 10338 ,  "Invalid use of reserved field name",
+                         strcmp( name, "$oid" ) != 0 &&
+                         strcmp( name, "$binary" ) != 0 &&
+                         strcmp( name, "$type" ) != 0 &&
+                         strcmp( name, "$date" ) != 0 &&
+                         strcmp( name, "$regex" ) != 0 &&
+                         strcmp( name, "$options" ) != 0 );
+                return true;
+            }
+            if ( !letter( c ) && c != '$' && c != '_' )
+                return false;
+            const char *s = _p;
+            while( letter( *_p ) || digit( *_p ) || *_p == '$' || *_p == '_' )
+                ++_p;
+            b.append( s, _p - s );
+            b.append( (char) 0 );
+            return true;
+        }
+
+        /** a \u0000 escape ends a string used as a c string (field name, regex, namespace) */
+        static void cString( BufBuilder &b, int start ) {
+            b.setlen( start + strlen( b.buf() + start ) + 1 );
+        }
+
+        /* the rest of a string after its opening quote, unescaped and nul terminated */
+        bool str( BufBuilder &b, char quote ) {
+            while( 1 ) {
+                const char *s = _p;
+                while( (unsigned char) *_p >= 0x20 && *_p != quote && *_p != '\\' )
+                    ++_p;
+                if ( _p != s )
+                    b.append( s, _p - s );
+                if ( *_p == quote ) {
+                    ++_p;
+                    b.append( (char) 0 );
+                    return true;
+                }
+                if ( *_p != '\\' ) // control character or end of input
+                    return false;
+                char c = *++_p;
+                switch( c ) {
+                case 'b': b.append( '\b' ); break;
+                case 'f': b.append( '\f' ); break;
+                case 'n': b.append( '\n' ); break;
+                case 'r': b.append( '\r' ); break;
+                case 't': b.append( '\t' ); break;
+                case 'v': b.append( '\v' ); break;
+                case 'u':
+                    if ( xdigits( _p + 1, 4 ) ) {
+                        utf8( b, _p + 1 );
+                        _p += 4;
+                        break;
                     }
+                    // otherwise just a 'u', like any other escaped character
+                default:
+                    // hex and octal aren't supported
+                    if ( c == 'x' || digit( c ) || c == '\0' )
+                        return false;
+                    b.append( c );
                 }
+                ++_p;
             }
         }
-        BSONObjBuilder *back() {
-            return builders.back().get();
-        }
-        // Storage for field names of elements within builders.back().
-        const char *fieldName() {
-            return fieldNames.back().c_str();
-        }
-        bool empty() const {
-            return builders.size() == 0;
-        }
-        void init() {
-            boost::shared_ptr< BSONObjBuilder > b( new BSONObjBuilder() );
-            builders.push_back( b );
-            fieldNames.push_back( "" );
-            indexes.push_back( 0 );
-        }
-        void pushObject( const char *fieldName ) {
-            boost::shared_ptr< BSONObjBuilder > b( new BSONObjBuilder( builders.back()->subobjStart( fieldName ) ) );
-            builders.push_back( b );
-            fieldNames.push_back( "" );
-            indexes.push_back( 0 );
-        }
-        void pushArray( const char *fieldName ) {
-            boost::shared_ptr< BSONObjBuilder > b( new BSONObjBuilder( builders.back()->subarrayStart( fieldName ) ) );
-            builders.push_back( b );
-            fieldNames.push_back( "" );
-            indexes.push_back( 0 );
-        }
-        BSONObj pop() {
-            BSONObj ret;
-            if ( back()->owned() )
-                ret = back()->obj();
-            else
-                ret = back()->done();
-            builders.pop_back();
-            fieldNames.pop_back();
-            indexes.pop_back();
-            return ret;
-        }
-        void nameFromIndex() {
-            fieldNames.back() = BSONObjBuilder::numStr( indexes.back() );
-        }
-        string popString() {
-            string ret = ss.str();
-            ss.str( "" );
-            return ret;
-        }
-        // Cannot use auto_ptr because its copy constructor takes a non const reference.
-        vector< boost::shared_ptr< BSONObjBuilder > > builders;
-        vector< string > fieldNames;
-        vector< int > indexes;
-        stringstream ss;
-        string ns;
-        OID oid;
-        string binData;
-        BinDataType binDataType;
-        string regex;
-        string regexOptions;
-        Date_t date;
-    };
 
-    struct objectStart {
-        objectStart( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char &c ) const {
-            if ( b.empty() )
-                b.init();
-            else
-                b.pushObject( b.fieldName() );
+        /* the rest of a /regex/ after the first '/', nul terminated */
+        bool regex( BufBuilder &b ) {
+            while( 1 ) {
+                const char *s = _p;
+                while( (unsigned char) *_p >= 0x20 && *_p != '/' && *_p != '\\' )
+                    ++_p;
+                if ( _p != s )
+                    b.append( s, _p - s );
+                if ( *_p == '/' ) {
+                    ++_p;
+                    b.append( (char) 0 );
+                    return true;
+                }
+                if ( *_p != '\\' )
+                    return false;
+                char c = *++_p;
+                switch( c ) {
+                case '"': case '\\': case '/': b.append( c ); break;
+                case 'b': b.append( '\b' ); break;
+                case 'f': b.append( '\f' ); break;
+                case 'n': b.append( '\n' ); break;
+                case 'r': b.append( '\r' ); break;
+                case 't': b.append( '\t' ); break;
+                case 'u':
+                    if ( !xdigits( _p + 1, 4 ) )
+                        return false;
+                    utf8( b, _p + 1 );
+                    _p += 4;
+                    break;
+                default:
+                    return false;
+                }
+                ++_p;
+            }
         }
-        ObjectBuilder &b;
-    };
 
-    struct arrayStart {
-        arrayStart( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char &c ) const {
-            b.pushArray( b.fieldName() );
-            b.nameFromIndex();
+        /* \uXXXX, from the 4 hex digits */
+        static void utf8( BufBuilder &b, const char *hex ) {
+            unsigned char first = fromHex( hex );
+            unsigned char second = fromHex( hex + 2 );
+            if ( first == 0 && second < 0x80 )
+                b.append( (char) second );
+            else if ( first < 0x08 ) {
+                b.append( char( 0xc0 | ( ( first << 2 ) | ( second >> 6 ) ) ) );
+                b.append( char( 0x80 | ( ~0xc0 & second ) ) );
+            } else {
+                b.append( char( 0xe0 | ( first >> 4 ) ) );
+                b.append( char( 0x80 | ( ~0xc0 & ( ( first << 2 ) | ( second >> 6 ) ) ) ) );
+                b.append( char( 0x80 | ( ~0xc0 & second ) ) );
+            }
         }
-        ObjectBuilder &b;
-    };
 
-    struct arrayNext {
-        arrayNext( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char &c ) const {
-            ++b.indexes.back();
-            b.nameFromIndex();
+        /** "<24 hex digits>" */
+        bool quotedOid( OID &oid ) {
+            if ( !accept( '"' ) || !xdigits( _p, 24 ) || _p[ 24 ] != '"' )
+                return false;
+            oid = stringToOid( _p );
+            _p += 25;
+            return true;
+        }
+
+        bool unsignedLong( unsigned long long &n ) {
+            white();
+            if ( !digit( *_p ) )
+                return false;
+            n = 0;
+            for( ; digit( *_p ); ++_p ) {
+                unsigned d = *_p - '0';
+                if ( n > ( numeric_limits< unsigned long long >::max() - d ) / 10 )
+                    return false;
+                n = n * 10 + d;
+            }
+            return true;
         }
-        ObjectBuilder &b;
-    };
 
-    struct ch {
-        ch( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char c ) const {
-            b.ss << c;
+        /** "str" written as a BSON string: length, then the nul terminated string */
+        bool stringValue( BufBuilder &b, char quote ) {
+            int sizePos = b.len();
+            b.skip( 4 );
+            if ( !str( b, quote ) )
+                return false;
+            *(int *)( b.buf() + sizePos ) = b.len() - sizePos - 4;
+            return true;
         }
-        ObjectBuilder &b;
-    };
 
-    struct chE {
-        chE( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char c ) const {
-            char o = '\0';
-            switch ( c ) {
-            case '\"':
-                o = '\"';
-                break;
+        bool value( BufBuilder &b, int typePos ) {
+            white();
+            BSONType t;
+            switch( *_p ) {
+            case '"':
             case '\'':
-                o = '\'';
+                if ( !stringValue( b, *_p++ ) )
+                    return false;
+                t = String;
                 break;
-            case '\\':
-                o = '\\';
+            case '[':
+                ++_p;
+                if ( !array( b ) )
+                    return false;
+                t = Array;
                 break;
-            case '/':
-                o = '/';
+            case '{': {
+                const char *start = _p++;
+                int len = b.len();
+                if ( !dollarObject( b, t ) ) {
+                    _p = start + 1;
+                    b.setlen( len );
+                    if ( !subobject( b ) )
+                        return false;
+                    t = Object;
+                }
                 break;
-            case 'b':
-                o = '\b';
+            }
+            case 't':
+                if ( !accept( "true" ) )
+                    return false;
+                b.append( (char) 1 );
+                t = Bool;
                 break;
             case 'f':
-                o = '\f';
+                if ( !accept( "false" ) )
+                    return false;
+                b.append( (char) 0 );
+                t = Bool;
                 break;
             case 'n':
-                o = '\n';
+                if ( accept( "null" ) ) {
+                    t = jstNULL;
+                    break;
+                }
+                if ( !accept( "new" ) || !date( b ) )
+                    return false;
+                t = Date;
                 break;
-            case 'r':
-                o = '\r';
+            case 'D':
+                if ( _p[ 1 ] == 'a' ) {
+                    if ( !date( b ) )
+                        return false;
+                    t = Date;
+                }
+                else {
+                    OID oid;
+                    if ( !accept( "Dbref" ) || !accept( '(' ) || !accept( '"' ) || !dbrefNs( b ) ||
+                         !accept( ',' ) || !quotedOid( oid ) || !accept( ')' ) )
+                        return false;
+                    b.append( (void *) &oid, 12 );
+                    t = DBRef;
+                }
                 break;
-            case 't':
-                o = '\t';
+            case 'O': {
+                OID oid;
+                if ( !accept( "ObjectId" ) || !accept( '(' ) || !quotedOid( oid ) || !accept( ')' ) )
+                    return false;
+                b.append( (void *) &oid, 12 );
+                t = jstOID;
                 break;
-            case 'v':
-                o = '\v';
+            }
+            case '/':
+                ++_p;
+                if ( !regex( b ) )
+                    return false;
+                while( *_p == 'i' || *_p == 'g' || *_p == 'm' )
+                    b.append( *_p++ );
+                b.append( (char) 0 );
+                t = RegEx;
                 break;
             default:
-                assert( false );
+                if ( !number( b, t ) )
+                    return false;
             }
-            b.ss << o;
-        }
-        ObjectBuilder &b;
-    };
-
-    struct chU {
-        chU( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            unsigned char first = fromHex( start );
-            unsigned char second = fromHex( start + 2 );
-            if ( first == 0 && second < 0x80 )
-                b.ss << second;
-            else if ( first < 0x08 ) {
-                b.ss << char( 0xc0 | ( ( first << 2 ) | ( second >> 6 ) ) );
-                b.ss << char( 0x80 | ( ~0xc0 & second ) );
-            } else {
-                b.ss << char( 0xe0 | ( first >> 4 ) );
-                b.ss << char( 0x80 | ( ~0xc0 & ( ( first << 2 ) | ( second >> 6 ) ) ) );
-                b.ss << char( 0x80 | ( ~0xc0 & second ) );
+            b.buf()[ typePos ] = (char) t;
+            return true;
+        }
+
+        /** Date( <uint> ) */
+        bool date( BufBuilder &b ) {
+            unsigned long long date;
+            if ( !accept( "Date" ) || !accept( '(' ) || !unsignedLong( date ) || !accept( ')' ) )
+                return false;
+            b.append( date );
+            return true;
+        }
+
+        bool array( BufBuilder &b ) {
+            int sizePos = b.len();
+            b.skip( 4 );
+            if ( !accept( ']' ) ) {
+                int i = 0;
+                do {
+                    int typePos = b.len();
+                    b.append( (char) EOO );
+                    index( b, i++ );
+                    if ( !value( b, typePos ) )
+                        return false;
+                } while( accept( ',' ) );
+                if ( !accept( ']' ) )
+                    return false;
+            }
+            b.append( (char) EOO );
+            *(int *)( b.buf() + sizePos ) = b.len() - sizePos;
+            return true;
+        }
+
+        /** field name of array element i */
+        static void index( BufBuilder &b, int i ) {
+            char buf[ 12 ];
+            char *p = buf + sizeof( buf );
+            *--p = 0;
+            do {
+                *--p = '0' + i % 10;
+                i /= 10;
+            } while( i );
+            b.append( p, buf + sizeof( buf ) - p );
+        }
+
+        bool subobject( BufBuilder &b ) {
+            int sizePos = b.len();
+            b.skip( 4 );
+            if ( !members( b ) )
+                return false;
+            b.append( (char) EOO );
+            *(int *)( b.buf() + sizePos ) = b.len() - sizePos;
+            return true;
+        }
+
+        /* the rest of a { "$..." : ... } value after its '{'.  false (and possibly some
+           garbage in b) if it isn't one.
+        */
+        bool dollarObject( BufBuilder &b, BSONType &t ) {
+            white();
+            if ( _p[ 0 ] != '"' || _p[ 1 ] != '$' )
+                return false;
+            if ( accept( "\"$date\"" ) ) {
+                unsigned long long date;
+                if ( !accept( ':' ) || !unsignedLong( date ) || !accept( '}' ) )
+                    return false;
+                b.append( date );
+                t = Date;
+                return true;
+            }
+            if ( accept( "\"$oid\"" ) ) {
+                OID oid;
+                if ( !accept( ':' ) || !quotedOid( oid ) || !accept( '}' ) )
+                    return false;
+                b.append( (void *) &oid, 12 );
+                t = jstOID;
+                return true;
+            }
+            if ( accept( "\"$binary\"" ) ) {
+                if ( !accept( ':' ) || !accept( '"' ) )
+                    return false;
+                const char *s = _p;
+                while( letter( *_p ) || digit( *_p ) || *_p == '+' || *_p == '/' )
+                    ++_p;
+                while( *_p == '=' )
+                    ++_p;
+                massert( 10339 ,  "Badly formatted bindata", ( _p - s ) % 4 == 0 );
+                const char *e = _p;
+                if ( !accept( '"' ) || !accept( ',' ) || !accept( "\"$type\"" ) || !accept( ':' ) ||
+                     !accept( '"' ) || !xdigits( _p, 2 ) || _p[ 2 ] != '"' )
+                    return false;
+                char type = fromHex( _p );
+                _p += 3;
+                if ( !accept( '}' ) )
+                    return false;
+                string data = base64::decode( string( s, e ) );
+                b.append( (int) data.size() );
+                b.append( type );
+                b.append( data.data(), data.size() );
+                t = BinData;
+                return true;
+            }
+            if ( accept( "\"$ref\"" ) ) {
+                OID oid;
+                if ( !accept( ':' ) || !accept( '"' ) || !dbrefNs( b ) || !accept( ',' ) ||
+                     !accept( "\"$id\"" ) || !accept( ':' ) || !quotedOid( oid ) || !accept( '}' ) )
+                    return false;
+                b.append( (void *) &oid, 12 );
+                t = DBRef;
+                return true;
+            }
+            if ( accept( "\"$regex\"" ) ) {
+                if ( !accept( ':' ) || !accept( '"' ) )
+                    return false;
+                int start = b.len();
+                if ( !str( b, '"' ) )
+                    return false;
+                cString( b, start );
+                if ( !accept( ',' ) || !accept( "\"$options\"" ) || !accept( ':' ) || !accept( '"' ) )
+                    return false;
+                const char *s = _p;
+                while( letter( *_p ) )
+                    ++_p;
+                if ( *_p != '"' )
+                    return false;
+                b.append( s, _p - s );
+                b.append( (char) 0 );
+                ++_p;
+                if ( !accept( '}' ) )
+                    return false;
+                t = RegEx;
+                return true;
+            }
+            return false;
+        }
+
+        /* the rest of a DBRef's quoted namespace, written as a BSON string */
+        bool dbrefNs( BufBuilder &b ) {
+            int sizePos = b.len();
+            b.skip( 4 );
+            if ( !str( b, '"' ) )
+                return false;
+            cString( b, sizePos + 4 );
+            *(int *)( b.buf() + sizePos ) = b.len() - sizePos - 4;
+            return true;
+        }
+
+        /* a double if there is a '.' or an exponent, else an int or long long */
+        bool number( BufBuilder &b, BSONType &t ) {
+            const char *s = _p;
+            const char *p = s;
+            bool neg = *p == '-';
+            if ( *p == '+' || *p == '-' )
+                ++p;
+            const char *digits = p;
+            while( digit( *p ) )
+                ++p;
+            bool whole = p != digits;
+            bool real = false;
+            bool dot = *p == '.';
+            if ( dot ) {
+                const char *frac = ++p;
+                while( digit( *p ) )
+                    ++p;
+                real = whole || p != frac;
+            }
+            if ( ( real || ( whole && !dot ) ) && ( *p == 'e' || *p == 'E' ) ) {
+                // the exponent must be there
+                const char *q = p + 1;
+                if ( *q == '+' || *q == '-' )
+                    ++q;
+                real = digit( *q );
+                if ( real ) {
+                    while( digit( *q ) )
+                        ++q;
+                    p = q;
+                }
+            }
+            if ( real ) {
+                b.append( strtod( s, 0 ) );
+                t = NumberDouble;
+                _p = p;
+                return true;
             }
-        }
-        ObjectBuilder &b;
-    };
-
-    struct chClear {
-        chClear( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char c ) const {
-            b.popString();
-        }
-        ObjectBuilder &b;
-    };
-
-    struct fieldNameEnd {
-        fieldNameEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            string name = b.popString();
-            massert( 10338 ,  "Invalid use of reserved field name",
-                     name != "$oid" &&
-                     name != "$binary" &&
-                     name != "$type" &&
-                     name != "$date" &&
-                     name != "$regex" &&
-                     name != "$options" );
-            b.fieldNames.back() = name;
-        }
-        ObjectBuilder &b;
-    };
-
-    struct unquotedFieldNameEnd {
-        unquotedFieldNameEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            string name( start, end );
-            b.fieldNames.back() = name;
-        }
-        ObjectBuilder &b;
-    };
-
-    struct stringEnd {
-        stringEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->append( b.fieldName(), b.popString() );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct numberValue {
-        numberValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( double d ) const {
-            b.back()->append( b.fieldName(), d );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct intValue {
-        intValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( long long num ) const {
-            if (num >= numeric_limits<int>::min() && num <= numeric_limits<int>::max())
-                b.back()->append( b.fieldName(), (int)num );
-            else
-                b.back()->append( b.fieldName(), num );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct subobjectEnd {
-        subobjectEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.pop();
-        }
-        ObjectBuilder &b;
-    };
-
-    struct arrayEnd {
-        arrayEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.pop();
-        }
-        ObjectBuilder &b;
-    };
-
-    struct trueValue {
-        trueValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendBool( b.fieldName(), true );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct falseValue {
-        falseValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendBool( b.fieldName(), false );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct nullValue {
-        nullValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendNull( b.fieldName() );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct dbrefNS {
-        dbrefNS( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.ns = b.popString();
-        }
-        ObjectBuilder &b;
-    };
-
-// NOTE s must be 24 characters.
-    OID stringToOid( const char *s ) {
-        OID oid;
-        char *oidP = (char *)( &oid );
-        for ( int i = 0; i < 12; ++i )
-            oidP[ i ] = fromHex( s + ( i * 2 ) );
-        return oid;
-    }
-
-    struct oidValue {
-        oidValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.oid = stringToOid( start );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct dbrefEnd {
-        dbrefEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendDBRef( b.fieldName(), b.ns.c_str(), b.oid );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct oidEnd {
-        oidEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendOID( b.fieldName(), &b.oid );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct binDataBinary {
-        binDataBinary( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            massert( 10339 ,  "Badly formatted bindata", ( end - start ) % 4 == 0 );
-            string encoded( start, end );
-            b.binData = base64::decode( encoded );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct binDataType {
-        binDataType( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.binDataType = BinDataType( fromHex( start ) );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct binDataEnd {
-        binDataEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendBinData( b.fieldName(), b.binData.length(),
-                                     b.binDataType, b.binData.data() );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct dateValue {
-        dateValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( Date_t v ) const {
-            b.date = v;
-        }
-        ObjectBuilder &b;
-    };
-
-    struct dateEnd {
-        dateEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendDate( b.fieldName(), b.date );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct regexValue {
-        regexValue( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.regex = b.popString();
-        }
-        ObjectBuilder &b;
-    };
-
-    struct regexOptions {
-        regexOptions( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.regexOptions = string( start, end );
-        }
-        ObjectBuilder &b;
-    };
-
-    struct regexEnd {
-        regexEnd( ObjectBuilder &_b ) : b( _b ) {}
-        void operator() ( const char *start, const char *end ) const {
-            b.back()->appendRegex( b.fieldName(), b.regex.c_str(),
-                                   b.regexOptions.c_str() );
-        }
-        ObjectBuilder &b;
-    };
 
-// One gotcha with this parsing library is probably best ilustrated with an
-// example.  Say we have a production like this:
-// z = ( ch_p( 'a' )[ foo ] >> ch_p( 'b' ) ) | ( ch_p( 'a' )[ foo ] >> ch_p( 'c' ) );
-// On input "ac", action foo() will be called twice -- once as the parser tries
-// to match "ab", again as the parser successfully matches "ac".  Sometimes
-// the grammar can be modified to eliminate these situations.  Here, for example:
-// z = ch_p( 'a' )[ foo ] >> ( ch_p( 'b' ) | ch_p( 'c' ) );
-// However, this is not always possible.  In my implementation I've tried to
-// stick to the following pattern: store fields fed to action callbacks
-// temporarily as ObjectBuilder members, then append to a BSONObjBuilder once
-// the parser has completely matched a nonterminal and won't backtrack.  It's
-// worth noting here that this parser follows a short-circuit convention.  So,
-// in the original z example on line 3, if the input was "ab", foo() would only
-// be called once.
-    struct JsonGrammar : public grammar< JsonGrammar > {
-public:
-        JsonGrammar( ObjectBuilder &_b ) : b( _b ) {}
-
-        template < typename ScannerT >
-        struct definition {
-            definition( JsonGrammar const &self ) {
-                object = ch_p( '{' )[ objectStart( self.b ) ] >> !members >> '}';
-                members = list_p((fieldName >> ':' >> value) , ',');
-                fieldName =
-                    str[ fieldNameEnd( self.b ) ] |
-                    singleQuoteStr[ fieldNameEnd( self.b ) ] |
-                    unquotedFieldName[ unquotedFieldNameEnd( self.b ) ];
-                array = ch_p( '[' )[ arrayStart( self.b ) ] >> !elements >> ']';
-                elements = list_p(value, ch_p(',')[arrayNext( self.b )]);
-                value =
-                    str[ stringEnd( self.b ) ] |
-                    number |
-                    integer |
-                    array[ arrayEnd( self.b ) ] |
-                    lexeme_d[ str_p( "true" ) ][ trueValue( self.b ) ] |
-                    lexeme_d[ str_p( "false" ) ][ falseValue( self.b ) ] |
-                    lexeme_d[ str_p( "null" ) ][ nullValue( self.b ) ] |
-                    singleQuoteStr[ stringEnd( self.b ) ] |
-                    date[ dateEnd( self.b ) ] |
-                    oid[ oidEnd( self.b ) ] |
-                    bindata[ binDataEnd( self.b ) ] |
-                    dbref[ dbrefEnd( self.b ) ] |
-                    regex[ regexEnd( self.b ) ] |
-                    object[ subobjectEnd( self.b ) ] ;
-                // NOTE lexeme_d and rules don't mix well, so we have this mess.
-                // NOTE We use range_p rather than cntrl_p, because the latter is locale dependent.
-                str = lexeme_d[ ch_p( '"' )[ chClear( self.b ) ] >>
-                                *( ( ch_p( '\\' ) >>
-                                     (
-                                       ch_p( 'b' )[ chE( self.b ) ] |
-                                       ch_p( 'f' )[ chE( self.b ) ] |
-                                       ch_p( 'n' )[ chE( self.b ) ] |
-                                       ch_p( 'r' )[ chE( self.b ) ] |
-                                       ch_p( 't' )[ chE( self.b ) ] |
-                                       ch_p( 'v' )[ chE( self.b ) ] |
-                                       ( ch_p( 'u' ) >> ( repeat_p( 4 )[ xdigit_p ][ chU( self.b ) ] ) ) |
-                                       ( ~ch_p('x') & (~range_p('0','9'))[ ch( self.b ) ] ) // hex and octal aren't supported
-                                     )
-                                   ) |
-                                   ( ~range_p( 0x00, 0x1f ) & ~ch_p( '"' ) & ( ~ch_p( '\\' ) )[ ch( self.b ) ] ) ) >> '"' ];
-
-                singleQuoteStr = lexeme_d[ ch_p( '\'' )[ chClear( self.b ) ] >>
-                                *( ( ch_p( '\\' ) >>
-                                     (
-                                       ch_p( 'b' )[ chE( self.b ) ] |
-                                       ch_p( 'f' )[ chE( self.b ) ] |
-                                       ch_p( 'n' )[ chE( self.b ) ] |
-                                       ch_p( 'r' )[ chE( self.b ) ] |
-                                       ch_p( 't' )[ chE( self.b ) ] |
-                                       ch_p( 'v' )[ chE( self.b ) ] |
-                                       ( ch_p( 'u' ) >> ( repeat_p( 4 )[ xdigit_p ][ chU( self.b ) ] ) ) |
-                                       ( ~ch_p('x') & (~range_p('0','9'))[ ch( self.b ) ] ) // hex and octal aren't supported
-                                     )
-                                   ) |
-                                   ( ~range_p( 0x00, 0x1f ) & ~ch_p( '\'' ) & ( ~ch_p( '\\' ) )[ ch( self.b ) ] ) ) >> '\'' ];
-
-                // real_p accepts numbers with nonsignificant zero prefixes, which
-                // aren't allowed in JSON.  Oh well.
-                number = strict_real_p[ numberValue( self.b ) ];
-
-                static int_parser<long long, 10,  1, numeric_limits<long long>::digits10 + 1> long_long_p;
-                integer = long_long_p[ intValue(self.b) ];
-
-                // We allow a subset of valid js identifier names here.
-                unquotedFieldName = lexeme_d[ ( alpha_p | ch_p( '$' ) | ch_p( '_' ) ) >> *( ( alnum_p | ch_p( '$' ) | ch_p( '_'  )) ) ];
-
-                dbref = dbrefS | dbrefT;
-                dbrefS = ch_p( '{' ) >> "\"$ref\"" >> ':' >>
-                         str[ dbrefNS( self.b ) ] >> ',' >> "\"$id\"" >> ':' >> quotedOid >> '}';
-                dbrefT = str_p( "Dbref" ) >> '(' >> str[ dbrefNS( self.b ) ] >> ',' >>
-                         quotedOid >> ')';
-
-                oid = oidS | oidT;
-                oidS = ch_p( '{' ) >> "\"$oid\"" >> ':' >> quotedOid >> '}';
-                oidT = str_p( "ObjectId" ) >> '(' >> quotedOid >> ')';
-
-                quotedOid = lexeme_d[ '"' >> ( repeat_p( 24 )[ xdigit_p ] )[ oidValue( self.b ) ] >> '"' ];
-
-                bindata = ch_p( '{' ) >> "\"$binary\"" >> ':' >>
-                          lexeme_d[ '"' >> ( *( range_p( 'A', 'Z' ) | range_p( 'a', 'z' ) | range_p( '0', '9' ) | ch_p( '+' ) | ch_p( '/' ) ) >> *ch_p( '=' ) )[ binDataBinary( self.b ) ] >> '"' ] >> ',' >> "\"$type\"" >> ':' >>
-                          lexeme_d[ '"' >> ( repeat_p( 2 )[ xdigit_p ] )[ binDataType( self.b ) ] >> '"' ] >> '}';
-
-                // TODO: this will need to use a signed parser at some point
-                date = dateS | dateT;
-                dateS = ch_p( '{' ) >> "\"$date\"" >> ':' >> uint_parser< Date_t >()[ dateValue( self.b ) ] >> '}';
-                dateT = !str_p("new") >> str_p( "Date" ) >> '(' >> uint_parser< Date_t >()[ dateValue( self.b ) ] >> ')';
-
-                regex = regexS | regexT;
-                regexS = ch_p( '{' ) >> "\"$regex\"" >> ':' >> str[ regexValue( self.b ) ] >> ',' >> "\"$options\"" >> ':' >> lexeme_d[ '"' >> ( *( alpha_p ) )[ regexOptions( self.b ) ] >> '"' ] >> '}';
-                // FIXME Obviously it would be nice to unify this with str.
-                regexT = lexeme_d[ ch_p( '/' )[ chClear( self.b ) ] >>
-                                   *( ( ch_p( '\\' ) >>
-                                        ( ch_p( '"' )[ chE( self.b ) ] |
-                                          ch_p( '\\' )[ chE( self.b ) ] |
-                                          ch_p( '/' )[ chE( self.b ) ] |
-                                          ch_p( 'b' )[ chE( self.b ) ] |
-                                          ch_p( 'f' )[ chE( self.b ) ] |
-                                          ch_p( 'n' )[ chE( self.b ) ] |
-                                          ch_p( 'r' )[ chE( self.b ) ] |
-                                          ch_p( 't' )[ chE( self.b ) ] |
-                                          ( ch_p( 'u' ) >> ( repeat_p( 4 )[ xdigit_p ][ chU( self.b ) ] ) ) ) ) |
-                                      ( ~range_p( 0x00, 0x1f ) & ~ch_p( '/' ) & ( ~ch_p( '\\' ) )[ ch( self.b ) ] ) ) >> str_p( "/" )[ regexValue( self.b ) ]
-                                   >> ( *( ch_p( 'i' ) | ch_p( 'g' ) | ch_p( 'm' ) ) )[ regexOptions( self.b ) ] ];
+            // at most 19 digits, like a long long
+            p = digits;
+            unsigned long long n = 0;
+            for( int i = 0; i < 19 && digit( *p ); ++i )
+                n = n * 10 + ( *p++ - '0' );
+            if ( p == digits || n > ( neg ? 9223372036854775808ULL : 9223372036854775807ULL ) )
+                return false;
+            long long x = neg && n ? -(long long)( n - 1 ) - 1 : (long long) n;
+            if ( x >= numeric_limits< int >::min() && x <= numeric_limits< int >::max() ) {
+                b.append( (int) x );
+                t = NumberInt;
             }
-            rule< ScannerT > object, members, array, elements, value, str, number, integer,
-            dbref, dbrefS, dbrefT, oid, oidS, oidT, bindata, date, dateS, dateT,
-            regex, regexS, regexT, quotedOid, fieldName, unquotedFieldName, singleQuoteStr;
-            const rule< ScannerT > &start() const {
-                return object;
+            else {
+                b.append( x );
+                t = NumberLong;
             }
-        };
-        ObjectBuilder &b;
+            _p = p;
+            return true;
+        }
+
+        const char *_p;
     };
 
     BSONObj fromjson( const char *str , int* len) {
@@ -563,18 +572,15 @@ public:
             return BSONObj();
         }
 
-        ObjectBuilder b;
-        JsonGrammar parser( b );
-        parse_info<> result = parse( str, parser, space_p );
-        if (len) {
-            *len = result.stop - str;
-        } else if ( !result.full ) {
-            int limit = strnlen(result.stop , 10);
-            msgasserted(10340, "Failure parsing JSON string near: " + string( result.stop, limit ));
+        BSONObjBuilder b;
+        JsonParser parser( str );
+        if ( !parser.object( b.bb() ) || ( !len && *parser.pos() ) ) {
+            int limit = strnlen(parser.pos() , 10);
+            msgasserted(10340, "Failure parsing JSON string near: " + string( parser.pos(), limit ));
         }
-        BSONObj ret = b.pop();
-        assert( b.empty() );
-        return ret;
+        if (len)
+            *len = parser.pos() - str;
+        return b.obj();
     }
 
     BSONObj fromjson( const string &str ) {
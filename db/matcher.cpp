@@ -85,6 +85,145 @@ namespace mongo {
         where = 0;
     }
 
+    inline int cmp3( int x ) {
+        return x < 0 ? -1 : ( x == 0 ? 0 : 1 );
+    }
+
+    /* numbers: same ordering as compareElementValues(), including its NaN handling */
+    class NumberPredicate : public ElementPredicate {
+    public:
+        NumberPredicate( const BSONElement& r, int op ) : ElementPredicate( op ), 
+            _isInt( r.type() == NumberInt ), _isLong( r.type() == NumberLong ), 
+            _i( _isInt ? r._numberInt() : 0 ), _l( _isLong ? r._numberLong() : 0 ), _d( r.number() ) {
+            _nan = !( _d <= numeric_limits< double >::max() && _d >= -numeric_limits< double >::max() );
+        }
+    protected:
+        virtual bool compare( const BSONElement& e, int& c ) const {
+            switch( e.type() ) {
+            case NumberInt:
+                if ( _isInt ) {
+                    int l = e._numberInt();
+                    c = l < _i ? -1 : ( l == _i ? 0 : 1 );
+                    return true;
+                }
+                break;
+            case NumberLong:
+                if ( _isLong ) {
+                    long long l = e._numberLong();
+                    c = l < _l ? -1 : ( l == _l ? 0 : 1 );
+                    return true;
+                }
+                break;
+            case NumberDouble:
+                break;
+            default:
+                return false;
+            }
+            double l = e.number();
+            bool lNan = !( l <= numeric_limits< double >::max() && l >= -numeric_limits< double >::max() );
+            if ( lNan || _nan )
+                c = lNan ? ( _nan ? 0 : -1 ) : 1;
+            else
+                c = l < _d ? -1 : ( l == _d ? 0 : 1 );
+            return true;
+        }
+    private:
+        bool _isInt, _isLong, _nan;
+        int _i;
+        long long _l;
+        double _d;
+    };
+
+    class StringPredicate : public ElementPredicate {
+    public:
+        StringPredicate( const BSONElement& r, int op ) : ElementPredicate( op ), _s( r.valuestr() ) {}
+    protected:
+        virtual bool compare( const BSONElement& e, int& c ) const {
+            if ( e.type() != String && e.type() != Symbol )
+                return false;
+            c = cmp3( strcmp( e.valuestr(), _s ) );
+            return true;
+        }
+    private:
+        const char *_s; // points into the query pattern, which the Matcher owns
+    };
+
+    class OIDPredicate : public ElementPredicate {
+    public:
+        OIDPredicate( const BSONElement& r, int op ) : ElementPredicate( op ), _oid( r.__oid() ) {}
+    protected:
+        virtual bool compare( const BSONElement& e, int& c ) const {
+            if ( e.type() != jstOID )
+                return false;
+            c = cmp3( memcmp( e.value(), &_oid, 12 ) );
+            return true;
+        }
+    private:
+        OID _oid;
+    };
+
+    class DatePredicate : public ElementPredicate {
+    public:
+        DatePredicate( const BSONElement& r, int op ) : ElementPredicate( op ), _d( r.date() ) {}
+    protected:
+        virtual bool compare( const BSONElement& e, int& c ) const {
+            if ( e.type() != Date && e.type() != Timestamp )
+                return false;
+            Date_t l = e.date();
+            c = l < _d ? -1 : ( l == _d ? 0 : 1 );
+            return true;
+        }
+    private:
+        Date_t _d;
+    };
+
+    class BoolPredicate : public ElementPredicate {
+    public:
+        BoolPredicate( const BSONElement& r, int op ) : ElementPredicate( op ), _b( *r.value() ) {}
+    protected:
+        virtual bool compare( const BSONElement& e, int& c ) const {
+            if ( e.type() != Bool )
+                return false;
+            c = cmp3( *e.value() - _b );
+            return true;
+        }
+    private:
+        char _b;
+    };
+
+    ElementPredicate * ElementPredicate::make( const BSONElement& toMatch, int op ) {
+        switch( op ) {
+        case BSONObj::Equality:
+        case BSONObj::LT:
+        case BSONObj::LTE:
+        case BSONObj::GT:
+        case BSONObj::GTE:
+            break;
+        default:
+            return 0;
+        }
+        if ( strchr( toMatch.fieldName(), '.' ) )
+            return 0;
+        switch( toMatch.type() ) {
+        case NumberInt:
+        case NumberLong:
+        case NumberDouble:
+            return new NumberPredicate( toMatch, op );
+        case String:
+        case Symbol:
+            return new StringPredicate( toMatch, op );
+        case jstOID:
+            return new OIDPredicate( toMatch, op );
+        case Date:
+        case Timestamp:
+            return new DatePredicate( toMatch, op );
+        case Bool:
+            return new BoolPredicate( toMatch, op );
+        default:
+            return 0;
+        }
+    }
+
     ElementMatcher::ElementMatcher( BSONElement _e , int _op, bool _isNot ) : toMatch( _e ) , compareOp( _op ), isNot( _isNot ) {
         if ( _op == BSONObj::opMOD ){
             BSONObj o = _e.embeddedObject();
@@ -101,6 +240,161 @@ namespace mongo {
             uassert( 12517 , "$elemMatch needs an Object" , m.type() == Object );
             subMatcher.reset( new Matcher( m.embeddedObject() ) );
         }
+        fast.reset( ElementPredicate::make( _e, _op ) );
+    }
+
+    RegexLiteralFilter::RegexLiteralFilter( const string& literal, bool caseInsensitive ) :
+        _literal( literal ), _caseInsensitive( caseInsensitive ) {
+        int m = _literal.size();
+        for( int i = 0; i < 256; ++i )
+            _skip[ i ] = m;
+        for( int i = 0; i < m; ++i ) {
+            unsigned char c = _literal[ i ];
+            if ( _caseInsensitive ) {
+                c = tolower( c );
+                _literal[ i ] = c;
+            }
+            if ( i == m - 1 )
+                continue;
+            _skip[ c ] = m - 1 - i;
+            if ( _caseInsensitive )
+                _skip[ (unsigned char) toupper( c ) ] = m - 1 - i;
+        }
+    }
+
+    bool RegexLiteralFilter::mayMatch( const char *s, int len ) const {
+        int m = _literal.size();
+        const char *lit = _literal.c_str();
+        if ( m > len )
+            return false;
+        if ( !_caseInsensitive ) {
+            if ( m == 1 )
+                return memchr( s, lit[ 0 ], len ) != 0;
+            const unsigned char last = lit[ m - 1 ];
+            for( int pos = 0; pos <= len - m; ) {
+                unsigned char c = s[ pos + m - 1 ];
+                if ( c == last && memcmp( s + pos, lit, m - 1 ) == 0 )
+                    return true;
+                pos += _skip[ c ];
+            }
+            return false;
+        }
+        for( int pos = 0; pos <= len - m; ) {
+            int i = m - 1;
+            while( i >= 0 && tolower( (unsigned char) s[ pos + i ] ) == (unsigned char) lit[ i ] )
+                --i;
+            if ( i < 0 )
+                return true;
+            pos += _skip[ (unsigned char) s[ pos + m - 1 ] ];
+        }
+        return false;
+    }
+
+    ElementHashSet::ElementHashSet( Kind kind, unsigned n ) : _kind( kind ) {
+        unsigned size = 16;
+        while( size < n * 2 )
+            size *= 2;
+        _mask = size - 1;
+        _slots.resize( size );
+    }
+
+    // longs beyond 2^53 don't convert to double exactly, and are compared
+    // exactly against other longs
+    static const long long maxExactLong = 1LL << 53;
+
+    bool ElementHashSet::hashable( const BSONElement& e ) {
+        if ( e.type() != NumberLong )
+            return true;
+        long long l = e._numberLong();
+        return l <= maxExactLong && l >= -maxExactLong;
+    }
+
+    ElementHashSet * ElementHashSet::make( const set< BSONElement, element_lt >& s ) {
+        if ( s.size() < 16 )
+            return 0;
+        int kind = s.begin()->canonicalType();
+        // set is ordered by canonical type
+        if ( s.rbegin()->canonicalType() != kind )
+            return 0;
+        if ( kind != Numbers && kind != Strings && kind != OIDs && kind != Dates )
+            return 0;
+        auto_ptr< ElementHashSet > h( new ElementHashSet( (Kind) kind, s.size() ) );
+        for( set< BSONElement, element_lt >::const_iterator i = s.begin(); i != s.end(); ++i ) {
+            if ( !hashable( *i ) )
+                return 0;
+            h->insert( *i );
+        }
+        return h.release();
+    }
+
+    unsigned ElementHashSet::hash( const BSONElement& e ) const {
+        const char *p;
+        int len;
+        double d;
+        switch( _kind ) {
+        case Numbers:
+            d = e.number();
+            if ( d == 0 )
+                d = 0; // -0 == 0
+            else if ( !( d <= numeric_limits< double >::max() && d >= -numeric_limits< double >::max() ) )
+                return 0; // compareElementValues() has NaN and both infinities equal
+            p = (const char *) &d;
+            len = sizeof( d );
+            break;
+        case Strings:
+            p = e.valuestr();
+            len = strlen( p ); // compareElementValues() uses strcmp
+            break;
+        case OIDs:
+            p = e.value();
+            len = 12;
+            break;
+        default:
+            p = e.value();
+            len = sizeof( Date_t );
+        }
+        // FNV-1a
+        unsigned h = 2166136261U;
+        for( int i = 0; i < len; ++i ) {
+            h ^= (unsigned char) p[ i ];
+            h *= 16777619U;
+        }
+        return h;
+    }
+
+    void ElementHashSet::insert( const BSONElement& e ) {
+        unsigned i = hash( e ) & _mask;
+        while( !_slots[ i ].eoo() )
+            i = ( i + 1 ) & _mask;
+        _slots[ i ] = e;
+    }
+
+    int ElementHashSet::contains( const BSONElement& e ) const {
+        if ( e.canonicalType() != _kind )
+            return 0;
+        if ( !hashable( e ) )
+            return -1;
+        unsigned i = hash( e ) & _mask;
+        while( !_slots[ i ].eoo() ) {
+            if ( compareElementValues( e, _slots[ i ] ) == 0 )
+                return 1;
+            i = ( i + 1 ) & _mask;
+        }
+        return 0;
+    }
+
+    /* prefix and literal checks done before (or instead of) running pcre */
+    static void initRegexShortcuts( RegexMatcher& rm, bool usePrefix ) {
+        bool purePrefix;
+        string prefix = simpleRegex(rm.regex, rm.flags, &purePrefix);
+        if ( purePrefix ) {
+            if ( usePrefix )
+                rm.prefix = prefix;
+            return;
+        }
+        string literal = requiredRegexLiteral( rm.regex, rm.flags );
+        if ( !literal.empty() )
+            rm.literal.reset( new RegexLiteralFilter( literal, strchr( rm.flags, 'i' ) != 0 ) );
     }
 
     ElementMatcher::ElementMatcher( BSONElement _e , int _op , const BSONObj& array, bool _isNot ) 
@@ -126,10 +420,7 @@ namespace mongo {
                 rm.regex = ie.regex();
                 rm.flags = ie.regexFlags();
                 rm.isNot = false;
-                bool purePrefix;
-                string prefix = simpleRegex(rm.regex, rm.flags, &purePrefix);
-                if (purePrefix)
-                    rm.prefix = prefix;
+                initRegexShortcuts( rm, true );
             } else {
                 myset->insert(ie);
             }
@@ -138,6 +429,9 @@ namespace mongo {
         if ( allMatchers.size() ){
             uassert( 13020 , "with $all, can't mix $elemMatch and others" , myset->size() == 0 && !myregex.get());
         }
+
+        if ( _op == BSONObj::opIN || _op == BSONObj::NIN )
+            myhash.reset( ElementHashSet::make( *myset ) );
         
     }
     
@@ -156,12 +450,7 @@ namespace mongo {
             rm.isNot = isNot;
             nRegex++;
 
-            if (!isNot){ //TODO something smarter
-                bool purePrefix;
-                string prefix = simpleRegex(regex, flags, &purePrefix);
-                if (purePrefix)
-                    rm.prefix = prefix;
-            }
+            initRegexShortcuts( rm, !isNot ); //TODO something smarter
         }        
     }
     
@@ -389,6 +678,7 @@ namespace mongo {
             // normal, simple case e.g. { a : "foo" }
             addBasic(e, BSONObj::Equality, false);
         }
+        orderBasics();
     }
     
     Matcher::Matcher( const Matcher &other, const BSONObj &key ) :
@@ -418,14 +708,65 @@ namespace mongo {
         for( list< shared_ptr< Matcher > >::const_iterator i = other._orMatchers.begin(); i != other._orMatchers.end(); ++i ) {
             _orMatchers.push_back( shared_ptr< Matcher >( new Matcher( **i, key ) ) );
         }
+        orderBasics();
+    }
+
+    /* rough estimate of how expensive a criterion is to evaluate, weighted by
+       how likely it is to reject a document.  lower is checked first.
+    */
+    static int basicCost( const ElementMatcher& bm ) {
+        switch( bm.compareOp ) {
+            case BSONObj::Equality:
+                return bm.fast ? 0 : 2;
+            case BSONObj::LT:
+            case BSONObj::LTE:
+            case BSONObj::GT:
+            case BSONObj::GTE:
+                return bm.fast ? 1 : 3;
+            case BSONObj::opIN:
+            case BSONObj::opTYPE:
+            case BSONObj::opMOD:
+                return 4;
+            case BSONObj::opEXISTS:
+            case BSONObj::NE:
+            case BSONObj::opSIZE:
+                return 5;
+            case BSONObj::NIN:
+                return 6;
+            default: // $all, $elemMatch
+                return 7;
+        }
+    }
+
+    struct BasicCostLess {
+        BasicCostLess( const vector< ElementMatcher >& basics ) : _basics( basics ) {}
+        bool operator()( int l, int r ) const {
+            return basicCost( _basics[ l ] ) < basicCost( _basics[ r ] );
+        }
+        const vector< ElementMatcher >& _basics;
+    };
+
+    void Matcher::orderBasics() {
+        _basicsOrder.clear();
+        for( unsigned i = 0; i < basics.size(); ++i )
+            _basicsOrder.push_back( i );
+        stable_sort( _basicsOrder.begin(), _basicsOrder.end(), BasicCostLess( basics ) );
+
+        _fastPlanIdx.clear();
+        for( unsigned i = 0; i < basics.size(); ++i )
+            _fastPlanIdx.push_back( basics[ i ].fast ? _fastPlan.add( basics[ i ].toMatch.fieldName() ) : -1 );
+        _fastFields.resize( _fastPlan.size() );
     }
     
     inline bool regexMatches(const RegexMatcher& rm, const BSONElement& e) {
         switch (e.type()){
             case String:
             case Symbol:
-                if (rm.prefix.empty())
+                if (rm.prefix.empty()) {
+                    if ( rm.literal.get() && !rm.literal->mayMatch( e.valuestr(), e.valuestrsize() - 1 ) )
+                        return false;
                     return rm.re->PartialMatch(e.valuestr());
+                }
                 else
                     return !strncmp(e.valuestr(), rm.prefix.c_str(), rm.prefix.size());
             case RegEx:
@@ -444,7 +785,9 @@ namespace mongo {
         
         if ( op == BSONObj::opIN ) {
             // { $in : [1,2,3] }
-            int count = bm.myset->count(l);
+            int count = bm.myhash.get() ? bm.myhash->contains(l) : -1;
+            if ( count < 0 )
+                count = bm.myset->count(l);
             if ( count )
                 return count;
             if ( bm.myregex.get() ) {
@@ -593,6 +936,11 @@ namespace mongo {
         if ( compareOp == BSONObj::NE )
             return matchesNe( fieldName, toMatch, obj, em , details );
         if ( compareOp == BSONObj::NIN ) {
+            if ( em.myhash.get() && !em.myregex.get() ) {
+                // no nulls in a hashed list, so this is the same as checking the
+                // values one by one with matchesNe() - but a single lookup
+                return matchesDotted( fieldName, toMatch, obj, BSONObj::opIN, em, false, details ) == 1 ? 0 : 1;
+            }
             for( set<BSONElement,element_lt>::const_iterator i = em.myset->begin(); i != em.myset->end(); ++i ) {
                 int ret = matchesNe( fieldName, *i, obj, em , details );
                 if ( ret != 1 )
@@ -719,6 +1067,17 @@ namespace mongo {
         return -1;
     }
 
+    /* matchesDotted() for a compiled ElementMatcher, in the non-indexed case.
+       e is obj's field for bm
+    */
+    inline int Matcher::matchesFast( const ElementMatcher& bm, const BSONElement& e, const BSONObj& obj ) {
+        if ( e.eoo() )
+            return 0;
+        if ( e.type() == Array )
+            return matchesDotted( bm.toMatch.fieldName(), bm.toMatch, obj, bm.compareOp, bm, false, 0 );
+        return bm.fast->matches( e );
+    }
+
     extern int dump;
 
     /* See if an object matches the query.
@@ -727,12 +1086,29 @@ namespace mongo {
         /* assuming there is usually only one thing to match.  if more this
         could be slow sometimes. */
 
+        // when details are requested keep the query's order, as the last array
+        // match determines elemMatchKey
+        bool compiled = !details && constrainIndexKey_.isEmpty();
+        bool extracted = false;
+
         // check normal non-regex cases:
         for ( unsigned i = 0; i < basics.size(); i++ ) {
-            ElementMatcher& bm = basics[i];
+            int b = compiled ? _basicsOrder[i] : i;
+            ElementMatcher& bm = basics[b];
             BSONElement& m = bm.toMatch;
             // -1=mismatch. 0=missing element. 1=match
-            int cmp = matchesDotted(m.fieldName(), m, jsobj, bm.compareOp, bm , false , details );
+            int cmp;
+            if ( compiled && bm.fast ) {
+                // fast criteria come first - look up all their fields in one pass
+                if ( !extracted ) {
+                    _fastPlan.extract( jsobj, &_fastFields[ 0 ] );
+                    extracted = true;
+                }
+                cmp = matchesFast( bm, _fastFields[ _fastPlanIdx[ b ] ], jsobj );
+            }
+            else {
+                cmp = matchesDotted(m.fieldName(), m, jsobj, bm.compareOp, bm , false , details );
+            }
             if ( bm.compareOp != BSONObj::opEXISTS && bm.isNot )
                 cmp = -cmp;
             if ( cmp < 0 )
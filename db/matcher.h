@@ -21,6 +21,7 @@
 #pragma once
 
 #include "jsobj.h"
+#include "fieldplan.h"
 #include <pcrecpp.h>
 
 namespace mongo {
@@ -29,6 +30,21 @@ namespace mongo {
     class CoveredIndexMatcher;
     class Matcher;
 
+    /* Boyer-Moore-Horspool search for a literal which every match of a regex
+       must contain (see requiredRegexLiteral()), so strings which can't match
+       are rejected without running pcre.
+    */
+    class RegexLiteralFilter : boost::noncopyable {
+    public:
+        RegexLiteralFilter( const string& literal, bool caseInsensitive );
+        /* @return false if s (of length len) can't match the regex */
+        bool mayMatch( const char *s, int len ) const;
+    private:
+        string _literal; // lower case if _caseInsensitive
+        bool _caseInsensitive;
+        int _skip[ 256 ];
+    };
+
     class RegexMatcher {
     public:
         const char *fieldName;
@@ -36,10 +52,44 @@ namespace mongo {
         const char *flags;
         string prefix;
         shared_ptr< pcrecpp::RE > re;
+        shared_ptr< RegexLiteralFilter > literal;
         bool isNot;
         RegexMatcher() : isNot() {}
     };
     
+    /* A comparison against a constant, specialized for the type of the constant.
+       Compiled from simple { a : 5 } / { a : { $gt : 5 } } criteria so the common
+       case doesn't go through compareElementValues() and its type switch.
+    */
+    class ElementPredicate : boost::noncopyable {
+    public:
+        ElementPredicate( int op ) : _op( op ) {}
+        virtual ~ElementPredicate() {}
+
+        /* e must not be EOO or an Array - caller handles those.
+           @return -1 mismatch, 1 match
+        */
+        int matches( const BSONElement& e ) const {
+            int c;
+            if ( !compare( e, c ) )
+                return -1;
+            if ( _op == BSONObj::Equality )
+                return c == 0 ? 1 : -1;
+            return ( _op & ( 1 << ( c + 1 ) ) ) ? 1 : -1;
+        }
+
+        /* @return a predicate for toMatch/op, or 0 if there is no specialized form */
+        static ElementPredicate * make( const BSONElement& toMatch, int op );
+
+    protected:
+        /* @return false if e's type can't be compared to our constant, otherwise
+                   c is set to -1, 0 or 1
+        */
+        virtual bool compare( const BSONElement& e, int& c ) const = 0;
+    private:
+        int _op;
+    };
+
     struct element_lt
     {
         bool operator()(const BSONElement& l, const BSONElement& r) const
@@ -51,7 +101,32 @@ namespace mongo {
         }
     };
 
-    
+
+    /* Open addressing hash set used for large $in / $nin lists, so a probe is O(1)
+       rather than O(log n) woCompare() calls.  Only built when all values are of
+       one kind (numbers, strings, ObjectIds or dates) which we can hash consistently
+       with element_lt equality.
+    */
+    class ElementHashSet : boost::noncopyable {
+    public:
+        /* @return 0 if s is too small or not homogeneous */
+        static ElementHashSet * make( const set< BSONElement, element_lt >& s );
+
+        /* @return 1 if e is in the set, 0 if not, -1 if we can't tell (use the set) */
+        int contains( const BSONElement& e ) const;
+
+    private:
+        enum Kind { Numbers = 10, Strings = 15, OIDs = 35, Dates = 45 }; // canonicalType()
+        ElementHashSet( Kind kind, unsigned n );
+        static bool hashable( const BSONElement& e );
+        unsigned hash( const BSONElement& e ) const;
+        void insert( const BSONElement& e );
+
+        Kind _kind;
+        unsigned _mask;
+        vector< BSONElement > _slots; // eoo if empty
+    };
+
     class ElementMatcher {
     public:
     
@@ -68,6 +143,7 @@ namespace mongo {
         int compareOp;
         bool isNot;
         shared_ptr< set<BSONElement,element_lt> > myset;
+        shared_ptr< ElementHashSet > myhash; // for large $in / $nin lists
         shared_ptr< vector<RegexMatcher> > myregex;
         
         // these are for specific operators
@@ -78,6 +154,9 @@ namespace mongo {
         shared_ptr<Matcher> subMatcher;
 
         vector< shared_ptr<Matcher> > allMatchers;
+
+        // set for non-dotted field comparisons against a scalar, see ElementPredicate
+        shared_ptr< ElementPredicate > fast;
     };
 
     class Where; // used for $where javascript eval
@@ -128,6 +207,8 @@ namespace mongo {
             const char *fieldName,
             const BSONElement &toMatch, const BSONObj &obj,
             const ElementMatcher&bm, MatchDetails * details );
+
+        int matchesFast( const ElementMatcher& bm, const BSONElement& e, const BSONObj& obj );
         
     public:
         static int opDirection(int op) {
@@ -177,12 +258,17 @@ namespace mongo {
         int valuesMatch(const BSONElement& l, const BSONElement& r, int op, const ElementMatcher& bm);
 
         bool parseOrNor( const BSONElement &e, bool subMatcher );
+        void orderBasics();
         void parseOr( const BSONElement &e, bool subMatcher, list< shared_ptr< Matcher > > &matchers );
 
         Where *where;                    // set if query uses $where
         BSONObj jsobj;                  // the query pattern.  e.g., { name: "joe" }
         BSONObj constrainIndexKey_;
         vector<ElementMatcher> basics;
+        vector<int> _basicsOrder;       // indexes into basics, cheapest / most selective first
+        FieldExtractionPlan _fastPlan;  // fields of the basics with a fast predicate
+        vector<int> _fastPlanIdx;       // basics index -> _fastPlan index
+        vector<BSONElement> _fastFields;
         bool haveSize;
         bool all;
         bool hasArray;
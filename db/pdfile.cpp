@@ -737,34 +737,69 @@ namespace mongo {
     
     int nUnindexes = 0;
 
+    static void _unindexKey(IndexDetails& id, const BSONObj& obj, BSONObj j, const DiskLoc& dl, bool logMissing) {
+        if ( otherTraceLevel >= 5 ) {
+            out() << "_unindexRecord() " << obj.toString();
+            out() << "\n  unindex:" << j.toString() << endl;
+        }
+        nUnindexes++;
+        bool ok = false;
+        try {
+            ok = id.head.btree()->unindex(id.head, id, j, dl);
+        }
+        catch (AssertionException& e) {
+            problem() << "Assertion failure: _unindex failed " << id.indexNamespace() << endl;
+            out() << "Assertion failure: _unindex failed: " << e.what() << '\n';
+            out() << "  obj:" << obj.toString() << '\n';
+            out() << "  key:" << j.toString() << '\n';
+            out() << "  dl:" << dl.toString() << endl;
+            sayDbContext();
+        }
+
+        if ( !ok && logMissing ) {
+            out() << "unindex failed (key too big?) " << id.indexNamespace() << '\n';
+        }
+    }
+
     /* unindex all keys in index for this record. */
     static void _unindexRecord(IndexDetails& id, BSONObj& obj, const DiskLoc& dl, bool logMissing = true) {
+        BufferArena arena;
         BSONObjSetDefaultOrder keys;
-        id.getKeysFromObject(obj, keys);
-        for ( BSONObjSetDefaultOrder::iterator i=keys.begin(); i != keys.end(); i++ ) {
-            BSONObj j = *i;
-            if ( otherTraceLevel >= 5 ) {
-                out() << "_unindexRecord() " << obj.toString();
-                out() << "\n  unindex:" << j.toString() << endl;
-            }
-            nUnindexes++;
-            bool ok = false;
-            try {
-                ok = id.head.btree()->unindex(id.head, id, j, dl);
-            }
-            catch (AssertionException& e) {
-                problem() << "Assertion failure: _unindex failed " << id.indexNamespace() << endl;
-                out() << "Assertion failure: _unindex failed: " << e.what() << '\n';
-                out() << "  obj:" << obj.toString() << '\n';
-                out() << "  key:" << j.toString() << '\n';
-                out() << "  dl:" << dl.toString() << endl;
-                sayDbContext();
-            }
+        id.getKeysFromObject(obj, keys, &arena);
+        for ( BSONObjSetDefaultOrder::iterator i=keys.begin(); i != keys.end(); i++ )
+            _unindexKey(id, obj, *i, dl, logMissing);
+    }
 
-            if ( !ok && logMissing ) {
-                out() << "unindex failed (key too big?) " << id.indexNamespace() << '\n';
-            }
+    /* unindex the keys of a batch of records, in the index's key order so neighbouring keys
+       are removed from the same buckets one after the other.
+    */
+    typedef pair<BSONObj, DiskLoc> KeyAndLoc;
+
+    struct KeyAndLocOrder {
+        KeyAndLocOrder( const Ordering& o ) : _o( o ) {}
+        bool operator()( const KeyAndLoc& l, const KeyAndLoc& r ) const {
+            int x = l.first.woCompare( r.first, _o, false );
+            return x < 0 || ( x == 0 && l.second < r.second );
         }
+        const Ordering& _o;
+    };
+
+    static void _unindexRecords(IndexDetails& id, const vector<DiskLoc>& locs, bool logMissing) {
+        BufferArena arena;
+        vector<KeyAndLoc> all;
+        for ( vector<DiskLoc>::const_iterator i = locs.begin(); i != locs.end(); ++i ) {
+            BSONObj obj(i->rec());
+            BSONObjSetDefaultOrder keys;
+            id.getKeysFromObject(obj, keys, &arena);
+            for ( BSONObjSetDefaultOrder::iterator j = keys.begin(); j != keys.end(); ++j )
+                all.push_back( make_pair( *j, *i ) );
+        }
+
+        Ordering ordering = Ordering::make(id.keyPattern());
+        sort( all.begin(), all.end(), KeyAndLocOrder( ordering ) );
+
+        for ( vector<KeyAndLoc>::iterator i = all.begin(); i != all.end(); ++i )
+            _unindexKey(id, BSONObj(i->second.rec()), i->first, i->second, logMissing);
     }
 
     /* unindex all keys in all indexes for this record. */
@@ -849,6 +884,24 @@ namespace mongo {
     }
 
 
+    void DataFileMgr::deleteRecords(const char *ns, const vector<DiskLoc>& locs, bool noWarn)
+    {
+        NamespaceDetails* d = nsdetails(ns);
+        uassert( 10089 ,  "can't remove from a capped collection" , !d->capped );
+
+        ClientCursor::aboutToDelete(locs);
+
+        int n = d->nIndexes;
+        for ( int i = 0; i < n; i++ )
+            _unindexRecords(d->idx(i), locs, !noWarn);
+        if( d->backgroundIndexBuildInProgress )
+            _unindexRecords(d->idx(n), locs, false);
+
+        for ( vector<DiskLoc>::const_iterator i = locs.begin(); i != locs.end(); ++i )
+            _deleteRecord(d, ns, i->rec(), *i);
+        NamespaceDetailsTransient::get_w( ns ).notifyOfWriteOp();
+    }
+
     /** Note: if the object shrinks a lot, we don't free up space, we leave extra at end of the record.
      */
     const DiskLoc DataFileMgr::updateRecord(
@@ -882,8 +935,9 @@ namespace mongo {
         /* duplicate key check. we descend the btree twice - once for this check, and once for the actual inserts, further  
            below.  that is suboptimal, but it's pretty complicated to do it the other way without rollbacks...
         */
+        BufferArena arena; // for the keys in changes
         vector<IndexChanges> changes;
-        getIndexChanges(changes, *d, objNew, objOld, changedId);
+        getIndexChanges(changes, *d, objNew, objOld, changedId, &arena);
         dupCheck(changes, *d, dl);
 
         if ( toupdate->netLength() < objNew.objsize() ) {
@@ -957,11 +1011,33 @@ namespace mongo {
         return sz;
     }
 
+    /* add one key to index idxNo for a new record */
+    static inline void _indexKey(NamespaceDetails *d, int idxNo, const BSONObj& key, const DiskLoc& recordLoc, const Ordering& ordering, bool dupsAllowed) {
+        IndexDetails& idx = d->idx(idxNo);
+        assert( !recordLoc.isNull() );
+        try {
+            idx.head.btree()->bt_insert(idx.head, recordLoc,
+                                        key, ordering, dupsAllowed, idx);
+        }
+        catch (AssertionException& e) {
+            if( e.getCode() == 10287 && idxNo == d->nIndexes ) { 
+                DEV log() << "info: caught key already in index on bg indexing (ok)" << endl;
+                return;
+            }
+            if( !dupsAllowed ) {
+                // dup key exception, presumably.
+                throw;
+            }
+            problem() << " caught assertion _indexRecord " << idx.indexNamespace() << endl;
+        }
+    }
+
     /* add keys to index idxNo for a new record */
     static inline void  _indexRecord(NamespaceDetails *d, int idxNo, BSONObj& obj, DiskLoc recordLoc, bool dupsAllowed) {
         IndexDetails& idx = d->idx(idxNo);
+        BufferArena arena;
         BSONObjSetDefaultOrder keys;
-        idx.getKeysFromObject(obj, keys);
+        idx.getKeysFromObject(obj, keys, &arena);
         BSONObj order = idx.keyPattern();
         Ordering ordering = Ordering::make(order);
         int n = 0;
@@ -969,23 +1045,32 @@ namespace mongo {
             if( ++n == 2 ) { 
                 d->setIndexIsMultikey(idxNo);
             }
-            assert( !recordLoc.isNull() );
-            try {
-                idx.head.btree()->bt_insert(idx.head, recordLoc,
-                                            *i, ordering, dupsAllowed, idx);
-            }
-            catch (AssertionException& e) {
-                if( e.getCode() == 10287 && idxNo == d->nIndexes ) { 
-                    DEV log() << "info: caught key already in index on bg indexing (ok)" << endl;
-                    continue;
-                }
-                if( !dupsAllowed ) {
-                    // dup key exception, presumably.
-                    throw;
-                }
-                problem() << " caught assertion _indexRecord " << idx.indexNamespace() << endl;
-            }
+            _indexKey(d, idxNo, *i, recordLoc, ordering, dupsAllowed);
+        }
+    }
+
+    /* add the keys of a batch of new records to index idxNo, in key order, so consecutive
+       inserts descend to the same (already cached) buckets rather than all over the tree.
+    */
+    static void _indexRecords(NamespaceDetails *d, int idxNo, const vector<DiskLoc>& locs, bool dupsAllowed) {
+        IndexDetails& idx = d->idx(idxNo);
+        BufferArena arena;
+        vector<KeyAndLoc> all;
+        for ( vector<DiskLoc>::const_iterator i = locs.begin(); i != locs.end(); ++i ) {
+            BSONObj obj(i->rec());
+            BSONObjSetDefaultOrder keys;
+            idx.getKeysFromObject(obj, keys, &arena);
+            if ( keys.size() > 1 )
+                d->setIndexIsMultikey(idxNo);
+            for ( BSONObjSetDefaultOrder::iterator j = keys.begin(); j != keys.end(); ++j )
+                all.push_back( make_pair( *j, *i ) );
         }
+
+        Ordering ordering = Ordering::make(idx.keyPattern());
+        sort( all.begin(), all.end(), KeyAndLocOrder( ordering ) );
+
+        for ( vector<KeyAndLoc>::iterator i = all.begin(); i != all.end(); ++i )
+            _indexKey(d, idxNo, i->first, i->second, ordering, dupsAllowed);
     }
 
     void testSorting() 
@@ -1356,7 +1441,43 @@ namespace mongo {
     /* note: if god==true, you may pass in obuf of NULL and then populate the returned DiskLoc 
              after the call -- that will prevent a double buffer copy in some cases (btree.cpp).
     */
-    DiskLoc DataFileMgr::insert(const char *ns, const void *obuf, int len, bool god, const BSONElement &writeId, bool mayAddIndex) {
+    bool DataFileMgr::insertBatch(const char *ns, vector<BSONObj>& objs) {
+        NamespaceDetails *d = nsdetails(ns);
+        if ( d == 0 || d->capped || strstr(ns, ".system.") )
+            return false;
+
+        vector<DiskLoc> locs;
+        int indexing = -1;
+        try {
+            for ( vector<BSONObj>::iterator i = objs.begin(); i != objs.end(); ++i ) {
+                DiskLoc loc = insert(ns, i->objdata(), i->objsize(), false, BSONElement(), false, false);
+                massert( 13330 , "batch insert failed to allocate record", !loc.isNull() );
+                locs.push_back(loc);
+            }
+            int n = d->nIndexesBeingBuilt();
+            for ( indexing = 0; indexing < n; indexing++ )
+                _indexRecords(d, indexing, locs, !d->idx(indexing).unique());
+        }
+        catch( DBException& ) {
+            /* undo the whole batch; the caller inserts it again one object at a time, which
+               stops at the offending object with the usual error.  <= as in indexRecord().
+            */
+            for ( int j = 0; j <= indexing && j < d->nIndexesBeingBuilt(); j++ )
+                _unindexRecords(d->idx(j), locs, false);
+            for ( vector<DiskLoc>::iterator i = locs.begin(); i != locs.end(); ++i ) {
+                ClientCursor::aboutToDelete(*i);
+                _deleteRecord(d, ns, i->rec(), *i);
+            }
+            NamespaceDetailsTransient::get_w( ns ).notifyOfWriteOp();
+            return false;
+        }
+
+        for ( unsigned i = 0; i < objs.size(); i++ )
+            objs[i] = BSONObj( locs[i].rec() );
+        return true;
+    }
+
+    DiskLoc DataFileMgr::insert(const char *ns, const void *obuf, int len, bool god, const BSONElement &writeId, bool mayAddIndex, bool addToIndexes) {
         bool wouldAddIndex = false;
         massert( 10093 , "cannot insert into reserved $ collection", god || nsDollarCheck( ns ) );
         uassert( 10094 , "invalid ns", strchr( ns , '.' ) > 0 );
@@ -1541,7 +1662,7 @@ namespace mongo {
         }
 
         /* add this record to our indexes */
-        if ( d->nIndexes ) {
+        if ( d->nIndexes && addToIndexes ) {
             try { 
                 BSONObj obj(r->data);
                 indexRecord(d, obj, loc);
@@ -59,6 +59,7 @@ namespace mongo {
     class MongoDataFile {
         friend class DataFileMgr;
         friend class BasicCursor;
+        friend class ParallelCollectionScan;
     public:
         MongoDataFile(int fn) : fileNo(fn) { }
         void open(const char *filename, int requestedDataSize = 0, bool preallocateOnly = false);
@@ -116,8 +117,19 @@ namespace mongo {
         /** @param obj in value only for this version. */
         void insertNoReturnVal(const char *ns, BSONObj o, bool god = false);
 
-        DiskLoc insert(const char *ns, const void *buf, int len, bool god = false, const BSONElement &writeId = BSONElement(), bool mayAddIndex = true);
+        /** @param addToIndexes false leaves index maintenance to the caller (see insertBatch). */
+        DiskLoc insert(const char *ns, const void *buf, int len, bool god = false, const BSONElement &writeId = BSONElement(), bool mayAddIndex = true, bool addToIndexes = true);
+
+        /** inserts objs into an existing, uncapped, non-system collection: the records are written
+            first, then each index gets the keys of the whole batch in key order.
+            @param objs in/out -- on success each is replaced by its inserted record (as insertWithObjMod).
+            @return false, having inserted nothing, if the batch must be inserted one object at a time
+                    instead (collection not eligible, or some object failed to insert or index).
+        */
+        bool insertBatch(const char *ns, vector<BSONObj>& objs);
         void deleteRecord(const char *ns, Record *todelete, const DiskLoc& dl, bool cappedOK = false, bool noWarn = false);
+        /* deletes locs, which must be distinct.  keys are removed from each index in key order. */
+        void deleteRecords(const char *ns, const vector<DiskLoc>& locs, bool noWarn = false);
         static shared_ptr<Cursor> findAll(const char *ns, const DiskLoc &startLoc = DiskLoc());
 
         /* special version of insert for transaction logging -- streamlined a bit.
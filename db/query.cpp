@@ -35,6 +35,7 @@
 #include "queryoptimizer.h"
 #include "lasterror.h"
 #include "../s/d_logic.h"
+#include "../util/concurrency/thread_pool.h"
 
 namespace mongo {
 
@@ -100,6 +101,9 @@ namespace mongo {
         shared_ptr<Cursor> c_;
     };
     
+    /* documents examined by deleteObjects() between deletes */
+    const int DeleteBatchSize = 128;
+
     /* ns:      namespace, e.g. <database>.<collection>
        pattern: the "where" clause / criteria
        justOne: stop after 1 match
@@ -142,6 +146,7 @@ namespace mongo {
             
         bool justOne = justOneOrig;
         bool canYield = !god && !creal->matcher()->docMatcher().atomic();
+        vector< DiskLoc > batch;
         do {
             if ( canYield && ! cc->yieldSometimes() ){
                 cc.release(); // has already been deleted elsewhere
@@ -151,43 +156,63 @@ namespace mongo {
             // this way we can avoid calling updateLocation() every time (expensive)
             // as well as some other nuances handled
             cc->setDoingDeletes( true );
-                
-            DiskLoc rloc = cc->c->currLoc();
-            BSONObj key = cc->c->currKey();
 
-            // NOTE Calling advance() may change the matcher, so it's important 
-            // to try to match first.
-            bool match = creal->matcher()->matches( key , rloc );
+            /* gather the matches among the next DeleteBatchSize documents, then delete them together:
+               the cursor position is noted once per batch instead of once per document, and the
+               index keys of the whole batch are removed in key order.
+            */
+            batch.clear();
+            for ( int n = 0; n < DeleteBatchSize && cc->c->ok(); n++ ) {
+                DiskLoc rloc = cc->c->currLoc();
+                BSONObj key = cc->c->currKey();
+
+                // NOTE Calling advance() may change the matcher, so it's important 
+                // to try to match first.
+                bool match = creal->matcher()->matches( key , rloc );
             
-            if ( ! cc->c->advance() )
-                justOne = true;
+                if ( ! cc->c->advance() )
+                    justOne = true;
                 
-            if ( ! match )
+                // a multikey document may be seen again before it is deleted
+                if ( ! match || cc->c->getsetdup( rloc ) )
+                    continue;
+
+                batch.push_back( rloc );
+                if ( justOne )
+                    break;
+            }
+            if ( batch.empty() )
                 continue;
-                            
-            assert( !cc->c->getsetdup(rloc) ); // can't be a dup, we deleted it!
+
+            // a document can match more than one $or clause
+            sort( batch.begin() , batch.end() );
+            batch.erase( unique( batch.begin() , batch.end() ) , batch.end() );
+
+            // or be where the cursor is now
+            while ( cc->c->ok() && binary_search( batch.begin() , batch.end() , cc->c->currLoc() ) ) {
+                if ( ! cc->c->advance() )
+                    justOne = true;
+            }
                 
-            if ( !justOne ) {
-                /* NOTE: this is SLOW.  this is not good, noteLocation() was designed to be called across getMore
-                    blocks.  here we might call millions of times which would be bad.
-                    */
+            if ( !justOne )
                 cc->c->noteLocation();
-            }
                 
             if ( logop ) {
-                BSONElement e;
-                if( BSONObj( rloc.rec() ).getObjectID( e ) ) {
-                    BSONObjBuilder b;
-                    b.append( e );
-                    bool replJustOne = true;
-                    logOp( "d", ns, b.done(), 0, &replJustOne );
-                } else {
-                    problem() << "deleted object without id, not logging" << endl;
+                for ( vector< DiskLoc >::iterator i = batch.begin(); i != batch.end(); ++i ) {
+                    BSONElement e;
+                    if( BSONObj( i->rec() ).getObjectID( e ) ) {
+                        BSONObjBuilder b;
+                        b.append( e );
+                        bool replJustOne = true;
+                        logOp( "d", ns, b.done(), 0, &replJustOne );
+                    } else {
+                        problem() << "deleted object without id, not logging" << endl;
+                    }
                 }
             }
 
-            theDataFileMgr.deleteRecord(ns, rloc.rec(), rloc);
-            nDeleted++;
+            theDataFileMgr.deleteRecords(ns, batch);
+            nDeleted += batch.size();
             if ( justOne ) {
                 break;
             }
@@ -450,9 +475,392 @@ namespace mongo {
         BSONObj firstMatch_;
     };
     
+    /* Scans all the extents of a collection on several threads, for queries no index can help.
+
+       Each pool thread claims an extent nobody is scanning and matches its records with a
+       Matcher of its own (Matcher::matches() keeps per call state).  Pool threads have no
+       Client, so extents and data files are resolved up front by the requesting thread, which
+       holds the read lock and waits.  Matches are passed to gotMatch() under _m and so arrive
+       in no particular order.
+
+       Every YieldMillis the threads stop where they are and the requester yields, unless the
+       query is $atomic.  Meanwhile ClientCursors keep the place in the extents the threads
+       were part way through, so deletes move it along as for any cursor.
+    */
+    class ParallelCollectionScan : boost::noncopyable {
+    public:
+        enum { MinBytes = 4 * 1024 * 1024, MaxThreads = 16, YieldMillis = 20 };
+
+        /** true if the optimizer would only consider a table scan for query, and ns is big enough to split */
+        static bool candidate( const char *ns, NamespaceDetails *d, const BSONObj &query ) {
+            if ( !d || d->capped || d->datasize < MinBytes || threads() < 2 )
+                return false;
+            if ( query.isEmpty() || query.hasField( "$where" ) || query.hasField( "$or" ) || query.hasField( "$nor" ) )
+                return false;
+            FieldRangeSet frs( ns, query );
+            if ( !frs.getSpecial().empty() )
+                return false;
+            if ( frs.nNontrivialRanges() == 0 || !frs.matchPossible() )
+                return true;
+            BSONObj simple = frs.simplifiedQuery();
+            for( int i = 0; i < d->nIndexes; ++i ) {
+                if ( d->idx( i ).getSpec().suitability( simple, BSONObj() ) == USELESS )
+                    continue;
+                QueryPlan p( d, i, frs, query, BSONObj() );
+                if ( !p.unhelpful() )
+                    return false;
+            }
+            return true;
+        }
+
+        ParallelCollectionScan( const char *ns, NamespaceDetails *d, const BSONObj &query ) :
+            _m( "ParallelCollectionScan" ), _ns( ns ), _running(), _nscanned(), _halted(), _pausing(), _errorCode() {
+            Database *db = cc().database();
+            for( DiskLoc l = d->firstExtent; !l.isNull(); ) {
+                Extent *e = l.ext();
+                if ( !e->firstRecord.isNull() ) {
+                    ExtentRef x;
+                    x.loc = l;
+                    x.e = e;
+                    x.f = db->getFile( l.a() );
+                    x.busy = false;
+                    x.done = false;
+                    _extents.push_back( x );
+                }
+                l = e->xnext;
+            }
+            int n = min( threads(), (int) _extents.size() );
+            for( int i = 0; i < max( n, 1 ); ++i )
+                _matchers.push_back( shared_ptr< Matcher >( new Matcher( query ) ) );
+        }
+
+        virtual ~ParallelCollectionScan() {}
+
+        /** scans until every extent is done or gotMatch() returns false.  an exception from a
+            pool thread is rethrown with its code
+        */
+        void run() {
+            bool canYield = !_matchers[ 0 ]->atomic();
+            while( 1 ) {
+                {
+                    scoped_lock lk( _m );
+                    _pausing = false;
+                    _running = _matchers.size();
+                }
+                for( unsigned i = 0; i < _matchers.size(); ++i )
+                    pool().schedule( &ParallelCollectionScan::work, this, i );
+                try {
+                    while( !waitForWorkers( YieldMillis ) ) {
+                        killCurrentOp.checkForInterrupt();
+                        if ( canYield ) {
+                            _pausing = true;
+                            waitForWorkers( -1 );
+                        }
+                    }
+                }
+                catch( ... ) {
+                    _halted = true;
+                    waitForWorkers( -1 );
+                    throw;
+                }
+                if ( _errorCode )
+                    uasserted( _errorCode , _error );
+                if ( _halted || !_pausing )
+                    return;
+                yield();
+            }
+        }
+
+        long long nscanned() const { return _nscanned; }
+
+        /** the extents scanned to the end, with every match passed to gotMatch() */
+        set< DiskLoc > doneExtents() const {
+            set< DiskLoc > s;
+            for( unsigned i = 0; i < _extents.size(); ++i )
+                if ( _extents[ i ].done )
+                    s.insert( _extents[ i ].loc );
+            return s;
+        }
+
+    protected:
+        /** called with _m locked for each matching object.  @return false to end the scan */
+        virtual bool gotMatch( const DiskLoc &loc, const BSONObj &o ) = 0;
+
+    private:
+        struct ExtentRef {
+            DiskLoc loc;
+            Extent *e;
+            MongoDataFile *f;
+            DiskLoc next; // where a scan stopped, null if none started
+            bool busy;
+            bool done;
+            bool contains( const DiskLoc &l ) const {
+                return l.a() == loc.a() && l.getOfs() >= loc.getOfs() && l.getOfs() < loc.getOfs() + e->length;
+            }
+        };
+
+        static int threads() {
+            return min( (int) boost::thread::hardware_concurrency(), (int) MaxThreads );
+        }
+
+        /* created on first use, shared by all parallel scans */
+        static ThreadPool& pool() {
+            scoped_lock lk( _poolMutex );
+            if ( !_pool )
+                _pool = new ThreadPool( threads() );
+            return *_pool;
+        }
+        static mongo::mutex _poolMutex;
+        static ThreadPool *_pool;
+
+        /* an extent nobody is scanning, or -1 */
+        int claim() {
+            scoped_lock lk( _m );
+            if ( _halted || _pausing )
+                return -1;
+            for( unsigned i = 0; i < _extents.size(); ++i ) {
+                ExtentRef &x = _extents[ i ];
+                if ( !x.busy && !x.done ) {
+                    x.busy = true;
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void scan( int i, Matcher &m ) {
+            ExtentRef &x = _extents[ i ];
+            long long n = 0;
+            bool done = false;
+            DiskLoc loc = x.next.isNull() ? x.e->firstRecord : x.next;
+            while( !_halted && !_pausing ) {
+                Record *r = x.f->recordAt( loc );
+                BSONObj o( r );
+                ++n;
+                if ( m.matches( o ) ) {
+                    scoped_lock lk( _m );
+                    if ( _halted ) // not passed on, so the extent isn't done
+                        break;
+                    if ( !gotMatch( loc, o ) )
+                        _halted = true;
+                }
+                if ( r->nextOfs == DiskLoc::NullOfs ) {
+                    done = true;
+                    break;
+                }
+                loc = DiskLoc( loc.a(), r->nextOfs );
+            }
+            scoped_lock lk( _m );
+            _nscanned += n;
+            x.next = loc;
+            x.done = done;
+            x.busy = false;
+        }
+
+        void work( int i ) {
+            try {
+                int x;
+                while( ( x = claim() ) >= 0 )
+                    scan( x, *_matchers[ i ] );
+            }
+            catch( DBException &e ) {
+                failed( e.getCode(), e.what() );
+            }
+            catch( std::exception &e ) {
+                failed( 13329, string( "parallel collection scan failed: " ) + e.what() );
+            }
+            scoped_lock lk( _m );
+            if ( --_running == 0 )
+                _done.notify_all();
+        }
+
+        void failed( int code, const string &msg ) {
+            scoped_lock lk( _m );
+            _halted = true;
+            if ( !_errorCode ) {
+                _errorCode = code;
+                _error = msg;
+            }
+        }
+
+        /* true once no pool thread is in work().  waits at most millis, or for good if negative */
+        bool waitForWorkers( int millis ) {
+            scoped_lock lk( _m );
+            if ( millis < 0 ) {
+                while( _running > 0 )
+                    _done.wait( lk.boost() );
+                return true;
+            }
+            boost::system_time until = boost::get_system_time() + boost::posix_time::milliseconds( millis );
+            while( _running > 0 )
+                if ( !_done.timed_wait( lk.boost(), until ) )
+                    return _running == 0;
+            return true;
+        }
+
+        /* a ClientCursor holding loc, which deletes move along; one on nothing notices a drop */
+        CursorId holdPlace( const DiskLoc &loc ) {
+            shared_ptr< Cursor > c( new BasicCursor( loc ) );
+            ClientCursor *cc = new ClientCursor( QueryOption_NoCursorTimeout, c, _ns.c_str() );
+            cc->updateLocation();
+            return cc->cursorid;
+        }
+
+        /* lets others at the lock while no thread is scanning */
+        void yield() {
+            vector< CursorId > ids;
+            vector< int > parts;
+            ids.push_back( holdPlace( DiskLoc() ) );
+            for( unsigned i = 0; i < _extents.size(); ++i ) {
+                if ( !_extents[ i ].done && !_extents[ i ].next.isNull() ) {
+                    parts.push_back( i );
+                    ids.push_back( holdPlace( _extents[ i ].next ) );
+                }
+            }
+
+            {
+                dbtempreleasecond unlock;
+                if ( unlock.unlocked() ) {
+                    int micros = Client::recommendedYieldMicros();
+                    if ( micros > 0 )
+                        sleepmicros( micros );
+                }
+            }
+
+            bool dropped = false;
+            // a cursor deletes got to the end of is gone too, so only the first tells of a drop
+            vector< DiskLoc > places;
+            for( unsigned j = 0; j < ids.size(); ++j ) {
+                ClientCursor *c = ClientCursor::find( ids[ j ], false );
+                places.push_back( c ? c->c->currLoc() : DiskLoc() );
+                if ( c )
+                    ClientCursor::erase( ids[ j ] );
+                else if ( j == 0 )
+                    dropped = true;
+            }
+            uassert( 13338, "collection dropped during parallel collection scan", !dropped );
+            for( unsigned k = 0; k < parts.size(); ++k ) {
+                ExtentRef &x = _extents[ parts[ k ] ];
+                const DiskLoc &l = places[ k + 1 ];
+                // past the extent's end if the rest of it was deleted
+                if ( l.isNull() || !x.contains( l ) )
+                    x.done = true;
+                else
+                    x.next = l;
+            }
+        }
+
+        mongo::mutex _m;
+        boost::condition _done;
+        string _ns;
+        vector< ExtentRef > _extents;
+        vector< shared_ptr< Matcher > > _matchers;
+        int _running;
+        long long _nscanned;
+        volatile bool _halted;
+        volatile bool _pausing;
+        int _errorCode;
+        string _error;
+    };
+    mongo::mutex ParallelCollectionScan::_poolMutex( "ParallelCollectionScan::pool" );
+    ThreadPool *ParallelCollectionScan::_pool = 0;
+
+    class ParallelCount : public ParallelCollectionScan {
+    public:
+        ParallelCount( const char *ns, NamespaceDetails *d, const BSONObj &query, long long skip, long long limit ) :
+            ParallelCollectionScan( ns, d, query ), _n(), _skip( skip ), _limit( limit ) {}
+        /** same result as CountOp */
+        long long count() const {
+            long long n = max( _n - _skip, 0LL );
+            return _limit > 0 ? min( n, _limit ) : n;
+        }
+    protected:
+        virtual bool gotMatch( const DiskLoc &loc, const BSONObj &o ) {
+            ++_n;
+            return _limit <= 0 || _n < _skip + _limit;
+        }
+    private:
+        long long _n;
+        long long _skip;
+        long long _limit;
+    };
+
+    /* Builds a single reply batch.  If the batch fills up and the query could want a cursor
+       for the rest, overflowed() is set and the caller goes on with a ParallelScanRestCursor.
+    */
+    class ParallelQuery : public ParallelCollectionScan {
+    public:
+        ParallelQuery( const char *ns, NamespaceDetails *d, const ParsedQuery &pq, BufBuilder &b ) :
+            ParallelCollectionScan( ns, d, pq.getFilter() ), _pq( pq ), _b( b ), _n(), _skip( pq.getSkip() ), _overflowed(),
+            _mayCreateCursor( pq.wantMore() && pq.getNumToReturn() != 1 && useCursors ) {}
+        int n() const { return _n; }
+        bool overflowed() const { return _overflowed; }
+        /** the matches skipped or returned */
+        const set< DiskLoc >& passed() const { return _passed; }
+    protected:
+        virtual bool gotMatch( const DiskLoc &loc, const BSONObj &o ) {
+            _passed.insert( loc );
+            if ( _skip > 0 ) {
+                _skip--;
+                return true;
+            }
+            BSONObj js = o;
+            fillQueryResultFromObj( _b, _pq.getFields(), js );
+            _n++;
+            if ( _pq.enoughForFirstBatch( _n, _b.len() ) ) {
+                _overflowed = _mayCreateCursor;
+                return false;
+            }
+            return true;
+        }
+    private:
+        const ParsedQuery &_pq;
+        BufBuilder &_b;
+        int _n;
+        int _skip;
+        bool _overflowed;
+        bool _mayCreateCursor;
+        set< DiskLoc > _passed;
+    };
+
+    /* The rest of a ParallelQuery which filled its first batch, in $natural order: the extents
+       it didn't finish, less the matches it passed on.  The threads were part way through
+       several extents, so those are scanned again from their start.
+    */
+    class ParallelScanRestCursor : public BasicCursor, public AdvanceStrategy {
+    public:
+        ParallelScanRestCursor( NamespaceDetails *d, const set< DiskLoc > &doneExtents, const set< DiskLoc > &passed ) :
+            _done( doneExtents ), _passed( passed ) {
+            curr = firstFrom( d->firstExtent );
+            s = this;
+        }
+        virtual DiskLoc next( const DiskLoc &prev ) const {
+            Record *r = prev.rec();
+            if ( r->nextOfs != DiskLoc::NullOfs )
+                return DiskLoc( prev.a(), r->nextOfs );
+            return firstFrom( r->myExtent( prev )->xnext );
+        }
+        virtual bool getsetdup( DiskLoc loc ) {
+            return _passed.count( loc ) > 0;
+        }
+        virtual string toString() {
+            return "ParallelScanRestCursor";
+        }
+    private:
+        /* the first record of an extent from l on that wasn't done */
+        DiskLoc firstFrom( DiskLoc l ) const {
+            for( ; !l.isNull(); l = l.ext()->xnext )
+                if ( !_done.count( l ) && !l.ext()->firstRecord.isNull() )
+                    return l.ext()->firstRecord;
+            return DiskLoc();
+        }
+        set< DiskLoc > _done;
+        set< DiskLoc > _passed;
+    };
+
     /* { count: "collectionname"[, query: <query>] }
        returns -1 on ns does not exist error.
-    */    
+    */
     long long runCount( const char *ns, const BSONObj &cmd, string &err ) {
         NamespaceDetails *d = nsdetails( ns );
         if ( !d ) {
@@ -476,6 +884,12 @@ namespace mongo {
             }
             return num;
         }
+        long long skip = cmd["skip"].numberLong();
+        if ( skip >= 0 && ParallelCollectionScan::candidate( ns, d, query ) ) {
+            ParallelCount c( ns, d, query, skip, cmd["limit"].numberLong() );
+            c.run();
+            return c.count();
+        }
         MultiPlanScanner mps( ns, query, BSONObj() );
         CountOp original( cmd );
         shared_ptr< CountOp > res = mps.runOp( original );
@@ -554,12 +968,20 @@ namespace mongo {
         int _i;
     };
     
-    // Implements database 'query' requests using the query optimizer's QueryOp interface
-    class UserQueryOp : public QueryOp {
+    /* Implements database 'query' requests using the query optimizer's QueryOp interface
+
+       inPlace: documents returned unmodified are referenced where they are in the data files
+       rather than copied into the reply - see runQuery().  they are copied if we yield first.
+    */
+    class UserQueryOp : public QueryOp, public Client::RecordPin {
     public:
         
-        UserQueryOp( const ParsedQuery& pq, Message &response, ExplainBuilder &eb, CurOp &curop ) :
+        UserQueryOp( const ParsedQuery& pq, Message &response, ExplainBuilder &eb, CurOp &curop, bool inPlace = false ) :
             _buf( 32768 ) , // TODO be smarter here
+            _inPlace( inPlace ) ,
+            _gather( false ) ,
+            _gatheredLen( 0 ) ,
+            _pinned( 0 ) ,
             _pq( pq ) ,
             _ntoskip( pq.getSkip() ) ,
             _nscanned(0), _oldNscanned(0), _nscannedObjects(0), _oldNscannedObjects(0),
@@ -575,6 +997,10 @@ namespace mongo {
             _eb( eb ),
             _curop( curop )
         {}
+
+        ~UserQueryOp() {
+            unpin();
+        }
         
         virtual void _init() {
             // only need to put the QueryResult fields there if we're building the first buffer in the message.
@@ -596,6 +1022,16 @@ namespace mongo {
             if ( _pq.isExplain() ) {
                 _eb.noteCursor( _c.get() );
             }
+
+            _gather = _inPlace && !_inMemSort && !_pq.isExplain() && !_pq.getFields() && !_pq.showDiskLoc() && !_pq.returnKey();
+        }
+
+        /* the lock is about to be released and records may move - copy what we referenced */
+        virtual void unlocking() {
+            for( vector< pair< char*, int > >::const_iterator i = _gathered.begin(); i != _gathered.end(); ++i )
+                _buf.append( (const void *) i->first, i->second );
+            _gathered.clear();
+            _gatheredLen = 0;
         }
         
         virtual void next() {
@@ -680,16 +1116,19 @@ namespace mongo {
                             else {
                                 BSONObj js = _c->current();
                                 assert( js.isValid() );
-                                fillQueryResultFromObj( _buf , _pq.getFields() , js , (_pq.showDiskLoc() ? &cl : 0));
+                                if ( _gather && !js.isOwned() )
+                                    gather( js );
+                                else
+                                    fillQueryResultFromObj( _buf , _pq.getFields() , js , (_pq.showDiskLoc() ? &cl : 0));
                             }
                             _n++;
                             if ( ! _c->supportGetMore() ){
-                                if ( _pq.enough( n() ) || _buf.len() >= MaxBytesToReturnToClientAtOnce ){
+                                if ( _pq.enough( n() ) || bufLen() >= MaxBytesToReturnToClientAtOnce ){
                                     finish( true );
                                     return;
                                 }
                             }
-                            else if ( _pq.enoughForFirstBatch( n() , _buf.len() ) ){
+                            else if ( _pq.enoughForFirstBatch( n() , bufLen() ) ){
                                 /* if only 1 requested, no cursor saved for efficiency...we assume it is findOne() */
                                 if ( mayCreateCursor1 ) {
                                     _wouldSaveClientCursor = true;
@@ -729,6 +1168,11 @@ namespace mongo {
             } else {
                 _response.appendData( _buf.buf(), _buf.len() );
                 _buf.decouple();
+                for( vector< pair< char*, int > >::const_iterator i = _gathered.begin(); i != _gathered.end(); ++i )
+                    _response.appendBorrowed( i->first, i->second );
+                _gathered.clear();
+                _gatheredLen = 0;
+                unpin();
             }
             if ( stop ) {
                 setStop();
@@ -752,7 +1196,7 @@ namespace mongo {
             if ( _pq.isExplain() ) {
                 _eb.ensureStartScan();
             }
-            UserQueryOp *ret = new UserQueryOp( _pq, _response, _eb, _curop );
+            UserQueryOp *ret = new UserQueryOp( _pq, _response, _eb, _curop, _inPlace );
             ret->_oldN = n();
             ret->_oldNscanned = nscanned();
             ret->_oldNscannedObjects = nscannedObjects();
@@ -769,7 +1213,32 @@ namespace mongo {
         bool wouldSaveClientCursor() const { return _wouldSaveClientCursor; }
         
     private:
+        /* reply bytes so far, including documents referenced in place */
+        int bufLen() const { return _buf.len() + _gatheredLen; }
+
+        void gather( const BSONObj& js ) {
+            if ( !_pinned ) {
+                _pinned = &cc();
+                _pinned->pin( this );
+            }
+            _gathered.push_back( make_pair( (char *) js.objdata(), js.objsize() ) );
+            _gatheredLen += js.objsize();
+        }
+
+        void unpin() {
+            if ( _pinned ) {
+                _pinned->unpin( this );
+                _pinned = 0;
+            }
+        }
+
         BufBuilder _buf;
+        bool _inPlace;
+        bool _gather;
+        // documents following _buf in the reply, still in their records
+        vector< pair< char*, int > > _gathered;
+        int _gatheredLen;
+        Client *_pinned;
         const ParsedQuery& _pq;
 
         long long _ntoskip;
@@ -801,8 +1270,18 @@ namespace mongo {
         CurOp &_curop;
     };
     
+    /* a reply holding documents in place stays valid across yields by taking copies */
+    class InPlaceReply : public Client::RecordPin {
+    public:
+        InPlaceReply( Message &m ) : _m( m ) { cc().pin( this ); }
+        ~InPlaceReply() { cc().unpin( this ); }
+        virtual void unlocking() { _m.own(); }
+    private:
+        Message &_m;
+    };
+
     /* run a query -- includes checking for and running a Command */
-    const char *runQuery(Message& m, QueryMessage& q, CurOp& curop, Message &result) {
+    const char *runQuery(Message& m, QueryMessage& q, CurOp& curop, Message &result, MessagingPort *replyPort) {
         StringBuilder& ss = curop.debug().str;
         shared_ptr<ParsedQuery> pq_shared( new ParsedQuery(q) );
         ParsedQuery& pq( *pq_shared );
@@ -937,6 +1416,53 @@ namespace mongo {
             }     
         }
         
+        if ( ! (explain || snapshot || pq.showDiskLoc() || pq.returnKey() || pq.hasIndexSpecifier() || pq.getMaxScan() ) &&
+             order.isEmpty() && !( queryOptions & ( QueryOption_CursorTailable | QueryOption_OplogReplay ) ) &&
+             !shardingState.getChunkMatcher( ns ) ) {
+            NamespaceDetails *d = nsdetails( ns );
+            if ( ParallelCollectionScan::candidate( ns, d, query ) ) {
+                BufBuilder bb( 32768 );
+                bb.skip( sizeof( QueryResult ) );
+                ParallelQuery pqs( ns, d, pq, bb );
+                pqs.run();
+                ss << " parallelScan nscanned:" << pqs.nscanned();
+                long long cursorid = 0;
+                const char *exhaust = 0;
+                if ( pqs.overflowed() ) {
+                    // a cursor goes on from where the scan stopped
+                    shared_ptr< Cursor > c( new ParallelScanRestCursor( d, pqs.doneExtents(), pqs.passed() ) );
+                    if ( c->ok() ) {
+                        c->setMatcher( shared_ptr< CoveredIndexMatcher >( new CoveredIndexMatcher( query, BSONObj() ) ) );
+                        ClientCursor *cc = new ClientCursor( queryOptions, c, ns );
+                        cursorid = cc->cursorid;
+                        cc->query = jsobj.getOwned();
+                        cc->pos = pqs.n();
+                        cc->pq = pq_shared;
+                        cc->fields = pq.getFieldPtr();
+                        cc->originalMessage = m;
+                        cc->updateLocation();
+                        if( queryOptions & QueryOption_Exhaust ) {
+                            exhaust = ns;
+                            ss << " exhaust ";
+                        }
+                    }
+                }
+                auto_ptr< QueryResult > qr;
+                qr.reset( (QueryResult *) bb.buf() );
+                bb.decouple();
+                qr->setResultFlagsToOk();
+                qr->len = bb.len();
+                ss << " reslen:" << bb.len();
+                qr->setOperation(opReply);
+                qr->cursorId = cursorid;
+                qr->startingFrom = 0;
+                qr->nReturned = pqs.n();
+                result.setData( qr.release(), true );
+                ss << " nreturned:" << pqs.n();
+                return exhaust;
+            }
+        }
+
         // regular, not QO bypass query
         
         BSONObj oldPlan;
@@ -954,7 +1480,9 @@ namespace mongo {
             explainSuffix = bb.obj();
         }
         ExplainBuilder eb;
-        UserQueryOp original( pq, result, eb, curop );
+        InPlaceReply inPlace( result );
+        // compressed replies can't be written from the records
+        UserQueryOp original( pq, result, eb, curop, replyPort && !replyPort->compressing() );
         shared_ptr< UserQueryOp > o = mps->runOp( original );
         UserQueryOp &dqo = *o;
         if ( ! dqo.complete() )
@@ -1006,6 +1534,17 @@ namespace mongo {
         qr->startingFrom = 0;
         qr->nReturned = n;
 
+        if ( result.hasBorrowed() ) {
+            /* the documents are only stable while we hold the lock: write what the socket
+               will take now, copy the rest for the caller to send as usual */
+            qr->id = nextMessageId();
+            qr->responseTo = m.header()->id;
+            result.sendAvailable( *replyPort );
+            result.own();
+            if ( result.sentBytes() )
+                ss << " inPlace:" << result.sentBytes();
+        }
+
         int duration = curop.elapsedMillis();
         bool dbprofile = curop.shouldDBProfile( duration );
         if ( dbprofile || duration >= cmdLine.slowMS ) {
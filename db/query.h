@@ -108,7 +108,11 @@ namespace mongo {
 
     long long runCount(const char *ns, const BSONObj& cmd, string& err);
     
-    const char * runQuery(Message& m, QueryMessage& q, CurOp& curop, Message &result);
+    /* replyPort: the connection the reply goes back on, if known.  documents are then sent
+       straight from the data files where possible (see UserQueryOp), and result may come back
+       with some of its bytes already written - see Message::sentBytes().
+    */
+    const char * runQuery(Message& m, QueryMessage& q, CurOp& curop, Message &result, MessagingPort *replyPort = 0);
     
     /* This is for languages whose "objects" are not well ordered (JSON is well ordered).
        [ { a : ... } , { b : ... } ] -> { a : ..., b : ... }
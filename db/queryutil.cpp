@@ -119,16 +119,216 @@ namespace mongo {
         }
     }
 
+    static bool regexCaseInsensitiveRange( const BSONElement& e, string& lower, string& upper ) {
+        if ( e.type() == RegEx )
+            return simpleRegexCaseInsensitiveRange( e.regex(), e.regexFlags(), lower, upper );
+        BSONObj o = e.embeddedObject();
+        return simpleRegexCaseInsensitiveRange( o["$regex"].valuestrsafe(), o["$options"].valuestrsafe(), lower, upper );
+    }
+
     string simpleRegexEnd( string regex ) {
         ++regex[ regex.length() - 1 ];
         return regex;
     }    
+
+    bool simpleRegexCaseInsensitiveRange( const char* regex, const char* flags, string& lower, string& upper ) {
+        if ( !strchr( flags, 'i' ) )
+            return false;
+        string otherFlags;
+        for( const char *f = flags; *f; ++f )
+            if ( *f != 'i' )
+                otherFlags += *f;
+        string r = simpleRegex( regex, otherFlags.c_str() );
+        if ( r.empty() )
+            return false;
+        // for ascii, 'A' < 'a', so the all upper case variant is the smallest string
+        // with the prefix and the all lower case variant the largest.
+        lower = r;
+        upper = r;
+        for( unsigned i = 0; i < r.size(); ++i ) {
+            unsigned char c = r[ i ];
+            if ( c >= 0x80 )
+                return false;
+            lower[ i ] = toupper( c );
+            upper[ i ] = tolower( c );
+        }
+        upper = simpleRegexEnd( upper );
+        return true;
+    }
+
+    // drop the last (utf8) character of s
+    static void popChar( string& s ) {
+        while( !s.empty() && ( s[ s.size() - 1 ] & 0xc0 ) == 0x80 )
+            s.erase( s.size() - 1 );
+        if ( !s.empty() )
+            s.erase( s.size() - 1 );
+    }
+
+    // skip a [] class, p points after the '['
+    static const char * skipClass( const char *p ) {
+        if ( *p == '^' )
+            ++p;
+        if ( *p == ']' )
+            ++p;
+        while( *p && *p != ']' ) {
+            if ( *p == '\\' && p[ 1 ] )
+                ++p;
+            ++p;
+        }
+        return *p ? p + 1 : p;
+    }
+
+    string requiredRegexLiteral( const char* regex, const char* flags ) {
+        bool extended = false;
+        bool caseless = false;
+        for( ; *flags; ++flags ) {
+            if ( *flags == 'x' )
+                extended = true;
+            else if ( *flags == 'i' )
+                caseless = true;
+        }
+
+        // with alternation no literal is required (conservative: also trips on \|)
+        if ( strchr( regex, '|' ) )
+            return "";
+
+        string best;
+        string cur;
+        const char *p = regex;
+        bool done = false;
+        while( *p && !done ) {
+            char c = *(p++);
+            bool flush = false;
+            if ( extended && isspace( (unsigned char) c ) )
+                continue;
+            if ( extended && c == '#' )
+                break;
+            switch( c ) {
+            case '\\': {
+                char n = *p;
+                if ( n == 0 ) {
+                    done = true;
+                    break;
+                }
+                if ( n & 0x80 ) // escaped non ascii character - handle as unescaped
+                    break;
+                ++p;
+                if ( isalnum( (unsigned char) n ) ) {
+                    // character types and assertions with no arguments - anything
+                    // else (\x41, \Q, \p{L}, backreferences) ends the scan
+                    if ( !strchr( "dDwWsSbBAzZG", n ) )
+                        done = true;
+                    flush = true;
+                }
+                else {
+                    cur += n;
+                }
+                break;
+            }
+            case '.':
+            case '^':
+            case '$':
+                flush = true;
+                break;
+            case '[':
+                p = skipClass( p );
+                flush = true;
+                break;
+            case '(': {
+                if ( *p == '?' ) {
+                    // inline options such as (?i) can change the meaning of what follows
+                    done = true;
+                    flush = true;
+                    break;
+                }
+                int depth = 1;
+                while( *p && depth ) {
+                    if ( *p == '\\' && p[ 1 ] )
+                        ++p;
+                    else if ( *p == '[' ) {
+                        p = skipClass( p + 1 );
+                        continue;
+                    }
+                    else if ( *p == '(' )
+                        ++depth;
+                    else if ( *p == ')' )
+                        --depth;
+                    ++p;
+                }
+                flush = true;
+                break;
+            }
+            case ')':
+                done = true;
+                flush = true;
+                break;
+            case '*':
+            case '?':
+                // previous atom is optional
+                popChar( cur );
+                flush = true;
+                break;
+            case '+':
+                flush = true;
+                break;
+            case '{': {
+                // {n}, {n,} or {n,m} quantifier - otherwise a literal '{'
+                const char *q = p;
+                int n = 0;
+                bool digits = false;
+                while( isdigit( (unsigned char) *q ) ) {
+                    n = n * 10 + ( *q - '0' );
+                    digits = true;
+                    ++q;
+                }
+                if ( digits && *q == ',' ) {
+                    ++q;
+                    while( isdigit( (unsigned char) *q ) )
+                        ++q;
+                }
+                if ( digits && *q == '}' ) {
+                    if ( n == 0 )
+                        popChar( cur );
+                    p = q + 1;
+                    flush = true;
+                }
+                else {
+                    cur += c;
+                }
+                break;
+            }
+            default:
+                if ( caseless && ( c & 0x80 ) ) {
+                    // non ascii characters may have case variants of other byte lengths
+                    while( ( *p & 0xc0 ) == 0x80 )
+                        ++p;
+                    flush = true;
+                }
+                else {
+                    cur += c;
+                }
+            }
+            if ( flush ) {
+                // lazy / possessive quantifier suffix
+                if ( ( c == '*' || c == '?' || c == '+' || c == '{' ) && ( *p == '?' || *p == '+' ) )
+                    ++p;
+                if ( cur.size() > best.size() )
+                    best = cur;
+                cur.clear();
+            }
+        }
+        if ( cur.size() > best.size() )
+            best = cur;
+        return best;
+    }
     
     
     FieldRange::FieldRange( const BSONElement &e, bool isNot, bool optimize ) {
         // NOTE with $not, we could potentially form a complementary set of intervals.
         if ( !isNot && !e.eoo() && e.type() != RegEx && e.getGtLtOp() == BSONObj::opIN ) {
-            set< BSONElement, element_lt > vals;
+            // $in lists can be huge, so sort and de-duplicate in one go rather than
+            // building a set
+            vector< BSONElement > vals;
             vector< FieldRange > regexes;
             uassert( 12580 , "invalid query" , e.isABSONObj() );
             BSONObjIterator i( e.embeddedObject() );
@@ -137,15 +337,24 @@ namespace mongo {
                 if ( ie.type() == RegEx ) {
                     regexes.push_back( FieldRange( ie, false, optimize ) );
                 } else {
-                    vals.insert( ie );
+                    vals.push_back( ie );
                 }
             }
 
-            for( set< BSONElement, element_lt >::const_iterator i = vals.begin(); i != vals.end(); ++i )
-                _intervals.push_back( FieldInterval(*i) );
+            stable_sort( vals.begin(), vals.end(), element_lt() );
+            _intervals.reserve( vals.size() );
+            element_lt lt;
+            for( vector< BSONElement >::const_iterator i = vals.begin(); i != vals.end(); ++i )
+                if ( _intervals.empty() || lt( _intervals.back()._upper._bound, *i ) )
+                    _intervals.push_back( FieldInterval(*i) );
 
-            for( vector< FieldRange >::const_iterator i = regexes.begin(); i != regexes.end(); ++i )
-                *this |= *i;
+            // merge the regexes among themselves first, then a single pass over the values
+            if ( !regexes.empty() ) {
+                FieldRange r = regexes[ 0 ];
+                for( unsigned j = 1; j < regexes.size(); ++j )
+                    r |= regexes[ j ];
+                *this |= r;
+            }
             
             return;
         }
@@ -184,10 +393,15 @@ namespace mongo {
         {
             if ( !isNot ) { // no optimization for negated regex - we could consider creating 2 intervals comprising all nonmatching prefixes
                 const string r = simpleRegex(e);
+                string ciLower, ciUpper;
                 if ( r.size() ) {
                     lower = addObj( BSON( "" << r ) ).firstElement();
                     upper = addObj( BSON( "" << simpleRegexEnd( r ) ) ).firstElement();
                     upperInclusive = false;
+                } else if ( regexCaseInsensitiveRange( e, ciLower, ciUpper ) ) {
+                    lower = addObj( BSON( "" << ciLower ) ).firstElement();
+                    upper = addObj( BSON( "" << ciUpper ) ).firstElement();
+                    upperInclusive = false;
                 } else {
                     BSONObjBuilder b1(32), b2(32);
                     b1.appendMinForType( "" , String );
@@ -1043,4 +1257,29 @@ namespace mongo {
             }
         }
     } simple_regex_unittest;
+
+    struct RequiredRegexLiteralUnitTest : UnitTest {
+        void run(){
+            assert( requiredRegexLiteral( "error.*timeout", "" ) == "timeout" );
+            assert( requiredRegexLiteral( "abcd.*ef", "" ) == "abcd" );
+            assert( requiredRegexLiteral( "abcd?e", "" ) == "abc" );
+            assert( requiredRegexLiteral( "abcd{0,2}", "" ) == "abc" );
+            assert( requiredRegexLiteral( "ab{2}c", "" ) == "ab" );
+            assert( requiredRegexLiteral( "x+yz", "" ) == "yz" );
+            assert( requiredRegexLiteral( "a|bcd", "" ) == "" );
+            assert( requiredRegexLiteral( "(foo)?barx", "" ) == "barx" );
+            assert( requiredRegexLiteral( "[abc]de\\.fg", "" ) == "de.fg" );
+            assert( requiredRegexLiteral( "\\d+abc\\x41aaaaaaa", "" ) == "abc" );
+            assert( requiredRegexLiteral( "ab(?i)cdef", "" ) == "ab" );
+            assert( requiredRegexLiteral( "a b c # abcdef", "x" ) == "abc" );
+            assert( requiredRegexLiteral( "ABC\xc3\xa9" "def", "i" ) == "ABC" );
+            assert( requiredRegexLiteral( "abc\xc3\xa9?", "" ) == "abc" );
+
+            string lower, upper;
+            assert( simpleRegexCaseInsensitiveRange( "^aB1", "i", lower, upper ) );
+            assert( lower == "AB1" && upper == "ab2" );
+            assert( !simpleRegexCaseInsensitiveRange( "^ab", "", lower, upper ) );
+            assert( !simpleRegexCaseInsensitiveRange( "ab", "i", lower, upper ) );
+        }
+    } required_regex_literal_unittest;
 } // namespace mongo
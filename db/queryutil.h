@@ -369,4 +369,17 @@ namespace mongo {
     /** returns the upper bound of a query that matches prefix */
     string simpleRegexEnd( string prefix );
 
+    /** for a case insensitive regex with a literal prefix, e.g. /^abc/i, sets lower
+        and upper (exclusive) to a string range containing every case variant of the
+        prefix.  returns false if there is no such prefix or it isn't ascii.
+    */
+    bool simpleRegexCaseInsensitiveRange( const char* regex, const char* flags, string& lower, string& upper );
+
+    /** returns the longest literal substring every match of regex must contain,
+        or "" if none can be determined.  with the 'i' flag the literal is only
+        returned if it's ascii, and must then be compared case insensitively.
+        used to skip running pcre on strings which can't match.
+    */
+    string requiredRegexLiteral( const char* regex, const char* flags );
+
 } // namespace mongo
@@ -359,6 +359,9 @@ namespace mongo {
 			   one is not authenticated for admin db to be safe.
 			*/
 
+            if ( acceptsWireCompression( cmdObj ) )
+                appendWireCompression( result );
+
             if( replSet ) {
                 if( theReplSet == 0 ) { 
                     result.append("ismaster", false);
@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include "fieldplan.h"
+
 namespace mongo {
 
     /* todo:
@@ -36,12 +38,34 @@ namespace mongo {
         KeyType(BSONObj _keyPattern) {
             pattern = _keyPattern;
             assert( !pattern.isEmpty() );
+            BSONObjIterator i( pattern );
+            while ( i.more() ) {
+                const char *name = i.next().fieldName();
+                _names.push_back( name );
+                _idx.push_back( _plan.add( name ) );
+            }
+            _fields.resize( _plan.size() );
         }
 
         // returns the key value for o
+        // same as o.extractFields(pattern,true), but walks o only once
         BSONObj getKeyFromObject(BSONObj o) {
-            return o.extractFields(pattern,true);
+            _plan.extract( o, &_fields[ 0 ] );
+            BSONObjBuilder b(32);
+            for ( unsigned i = 0; i < _idx.size(); i++ ) {
+                const BSONElement &x = _fields[ _idx[ i ] ];
+                if ( ! x.eoo() )
+                    b.appendAs( x, _names[ i ] );
+                else
+                    b.appendNull( _names[ i ] );
+            }
+            return b.obj();
         }
+    private:
+        FieldExtractionPlan _plan;
+        vector<const char *> _names; // point into pattern
+        vector<int> _idx;
+        vector<BSONElement> _fields;
     };
 
     /* todo:
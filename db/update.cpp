@@ -49,8 +49,7 @@ namespace mongo {
         return matcher->matches( toMatch.embeddedObject() );
     }
 
-    template< class Builder >
-    void Mod::appendIncremented( Builder& bb , const BSONElement& in, ModState& ms ) const {
+    void Mod::computeIncrement( const BSONElement& in, ModState& ms ) const {
         BSONType a = in.type();
         BSONType b = elt.type();
         
@@ -66,7 +65,11 @@ namespace mongo {
             ms.incType = NumberInt;
             ms.incint = elt.numberInt() + in.numberInt();
         }
-        
+    }
+
+    template< class Builder >
+    void Mod::appendIncremented( Builder& bb , const BSONElement& in, ModState& ms ) const {
+        computeIncrement( in , ms );
         ms.appendIncValue( bb , false );
     }
 
@@ -309,6 +312,10 @@ namespace mongo {
         DEBUGUPDATE( "\t start prepare" );
         ModSetState * mss = new ModSetState( obj );
         
+        // several mods on a wide object: look their fields up without a scan each
+        auto_ptr<BSONFieldIndex> fields;
+        if ( _mods.size() > 2 )
+            fields.reset( new BSONFieldIndex( obj ) );
         
         // Perform this check first, so that we don't leave a partially modified object on uassert.
         for ( ModHolder::const_iterator i = _mods.begin(); i != _mods.end(); ++i ) {
@@ -316,7 +323,7 @@ namespace mongo {
             ModState& ms = mss->_mods[i->first];
 
             const Mod& m = i->second;
-            BSONElement e = obj.getFieldDotted(m.fieldName);
+            BSONElement e = fields.get() ? fields->getFieldDotted(m.fieldName) : obj.getFieldDotted(m.fieldName);
             
             ms.m = &m;
             ms.old = e;
@@ -329,25 +336,40 @@ namespace mongo {
             switch( m.op ) {
             case Mod::INC:
                 uassert( 10140 ,  "Cannot apply $inc modifier to non-number", e.isNumber() || e.eoo() );
-                if ( mss->amIInPlacePossible( e.isNumber() ) ){
-                    // check more typing info here
-                    if ( m.elt.type() != e.type() ){
-                        // if i'm incrememnting with a double, then the storage has to be a double
-                        mss->amIInPlacePossible( m.elt.type() != NumberDouble ); 
-                    }
+                if ( m.elt.type() != e.type() ){
+                    // the result may need a wider type: int + long is a long, anything + double a double
+                    if ( e.type() == NumberInt && m.elt.type() != NumberInt )
+                        mss->resizeInPlace( 4 );
                 }
                 break;
 
             case Mod::SET:
-                mss->amIInPlacePossible( m.elt.type() == e.type() &&
-                                         m.elt.valuesize() == e.valuesize() );
+                if ( m.elt.type() != e.type() || m.elt.valuesize() != e.valuesize() ){
+                    m._checkForAppending( m.elt );
+                    mss->resizeInPlace( m.elt.valuesize() - e.valuesize() );
+                }
                 break;
             
             case Mod::PUSH:
-            case Mod::PUSH_ALL:
+            case Mod::PUSH_ALL: {
                 uassert( 10141 ,  "Cannot apply $push/$pushAll modifier to non-array", e.type() == Array || e.eoo() );
-                mss->amIInPlacePossible( false );
+                if ( ! mss->amIInPlacePossible( m.op == Mod::PUSH || m.elt.type() == Array ) )
+                    break;
+                // the new elements go at the end of the array
+                int n = e.embeddedObject().nFields();
+                ms.pushStartSize = n;
+                int delta = 0;
+                if ( m.op == Mod::PUSH ){
+                    delta = 2 + BSONObjBuilder::numStr( n ).size() + m.elt.valuesize();
+                }
+                else {
+                    BSONObjIterator i( m.elt.embeddedObject() );
+                    while ( i.more() )
+                        delta += 2 + BSONObjBuilder::numStr( n++ ).size() + i.next().valuesize();
+                }
+                mss->resizeInPlace( delta );
                 break;
+            }
 
             case Mod::PULL:
             case Mod::PULL_ALL: {
@@ -445,31 +467,125 @@ namespace mongo {
         return ss.str();
     }
     
-    void ModSetState::applyModsInPlace() {
-        for ( ModStateHolder::iterator i = _mods.begin(); i != _mods.end(); ++i ) {
-            ModState& m = i->second;
-            
-            switch ( m.m->op ){
-            case Mod::UNSET:
-            case Mod::PULL:
-            case Mod::PULL_ALL:
-            case Mod::ADDTOSET:
-                // this should have been handled by prepare
-                break;
+    void ModSetState::splice( const ModState& ms , bool intoField , const char *at , int oldLen , const char *data , int newLen ){
+        char *top = const_cast< char * >( _obj.objdata() );
+        char *p = const_cast< char * >( at );
+        int delta = newLen - oldLen;
+        if ( delta ){
+            memmove( p + newLen , p + oldLen , ( top + _obj.objsize() ) - ( p + oldLen ) );
+            *reinterpret_cast< int * >( top ) += delta;
+        }
+        memcpy( p , data , newLen );
+        if ( ! delta )
+            return;
 
-            // [dm] the BSONElementManipulator statements below are for replication (correct?)
-            case Mod::INC:
-                m.m->incrementMe( m.old );
-                m.fixedOpName = "$set";
-                m.fixed = &(m.old);
+        // everything on the path lies before 'at', so can still be found by name
+        BSONObj o( top );
+        const char *name = ms.fieldName();
+        while ( 1 ){
+            const char *dot = strchr( name , '.' );
+            if ( ! dot && ! intoField )
                 break;
-            case Mod::SET:
-                BSONElementManipulator( m.old ).replaceTypeAndValue( m.m->elt );
+            BSONElement e = dot ? o.getField( string( name , dot - name ) ) : o.getField( name );
+            assert( e.isABSONObj() );
+            char *sub = const_cast< char * >( e.value() );
+            *reinterpret_cast< int * >( sub ) += delta;
+            if ( ! dot )
                 break;
-            default:
-                uassert( 10144 ,  "can't apply mod in place - shouldn't have gotten here" , 0 );
+            o = BSONObj( sub );
+            name = dot + 1;
+        }
+    }
+
+    void ModSetState::applyModInPlace( ModState& m ){
+        switch ( m.m->op ){
+        case Mod::UNSET:
+        case Mod::PULL:
+        case Mod::PULL_ALL:
+        case Mod::ADDTOSET:
+            // this should have been handled by prepare
+            break;
+
+        // [dm] the BSONElementManipulator statements below are for replication (correct?)
+        case Mod::INC:
+            m.m->computeIncrement( m.old , m );
+            if ( m.incType == m.old.type() ){
+                BSONElementManipulator manip( m.old );
+                switch ( m.incType ){
+                case NumberDouble: manip.setNumber( m.incdouble ); break;
+                case NumberLong: manip.setLong( m.inclong ); break;
+                default: manip.setInt( m.incint ); break;
+                }
             }
+            else {
+                // widened to a long or double
+                char buf[ 9 ];
+                buf[ 0 ] = (char) m.incType;
+                if ( m.incType == NumberDouble )
+                    memcpy( buf + 1 , &m.incdouble , 8 );
+                else
+                    memcpy( buf + 1 , &m.inclong , 8 );
+                splice( m , false , m.old.value() , m.old.valuesize() , buf + 1 , 8 );
+                splice( m , false , m.old.rawdata() , 1 , buf , 1 );
+            }
+            break;
+        case Mod::SET:
+            if ( m.m->elt.type() == m.old.type() && m.m->elt.valuesize() == m.old.valuesize() ){
+                BSONElementManipulator( m.old ).replaceTypeAndValue( m.m->elt );
+            }
+            else {
+                // the value first - its old size depends on the old type
+                char type = m.m->elt.type();
+                splice( m , false , m.old.value() , m.old.valuesize() , m.m->elt.value() , m.m->elt.valuesize() );
+                splice( m , false , m.old.rawdata() , 1 , &type , 1 );
+            }
+            break;
+        case Mod::PUSH:
+        case Mod::PUSH_ALL: {
+            BSONObj arr = m.old.embeddedObject();
+            int n = m.pushStartSize;
+            BSONObjBuilder b;
+            if ( m.m->op == Mod::PUSH ){
+                b.appendAs( m.m->elt , b.numStr( n ) );
+            }
+            else {
+                BSONObjIterator i( m.m->elt.embeddedObject() );
+                while ( i.more() )
+                    b.appendAs( i.next() , b.numStr( n++ ) );
+            }
+            BSONObj added = b.done();
+            // insert before the array's terminating eoo
+            splice( m , true , arr.objdata() + arr.objsize() - 1 , 0 , added.objdata() + 4 , added.objsize() - 5 );
+            break;
+        }
+        default:
+            uassert( 10144 ,  "can't apply mod in place - shouldn't have gotten here" , 0 );
+        }
+    }
+
+    namespace {
+        struct LaterInObj {
+            bool operator()( const ModState *l , const ModState *r ) const {
+                return l->old.rawdata() > r->old.rawdata();
+            }
+        };
+    }
+
+    void ModSetState::applyModsInPlace() {
+        if ( ! _resize ){
+            for ( ModStateHolder::iterator i = _mods.begin(); i != _mods.end(); ++i )
+                applyModInPlace( i->second );
+            return;
         }
+
+        // resizing a value moves everything after it, so work from the end of the object back
+        // to keep the elements found by prepare() valid
+        vector< ModState * > mods;
+        for ( ModStateHolder::iterator i = _mods.begin(); i != _mods.end(); ++i )
+            mods.push_back( &i->second );
+        sort( mods.begin() , mods.end() , LaterInObj() );
+        for ( unsigned i = 0; i < mods.size(); i++ )
+            applyModInPlace( *mods[ i ] );
     }
 
     void ModSet::extractFields( map< string, BSONElement > &fields, const BSONElement &top, const string &base ) {
@@ -761,6 +877,9 @@ namespace mongo {
         MatchDetails _details;
     };
 
+    /* documents examined by _updateObjects() between updates */
+    const int UpdateBatchSize = 128;
+
     UpdateResult _updateObjects(bool god, const char *ns, const BSONObj& updateobj, BSONObj patternOrig, bool upsert, bool multi, bool logop , OpDebug& debug) {
         DEBUGUPDATE( "update: " << ns << " update: " << updateobj << " query: " << patternOrig << " upsert: " << upsert << " multi: " << multi );
         int profile = cc().database()->profile;
@@ -799,169 +918,180 @@ namespace mongo {
         shared_ptr< MultiCursor > c( new MultiCursor( ns, patternOrig, BSONObj(), opPtr ) );
         
         auto_ptr<ClientCursor> cc;
+
+        /* the matches among the next UpdateBatchSize documents are found before any of them is
+           updated.  for a multi update the cursor is then past the whole batch, so its position
+           is noted and checked once per batch rather than around each document that may move.
+        */
+        vector< pair< DiskLoc , string > > batch; // matches and their elemMatchKey
             
         while ( c->ok() ) {
-            nscanned++;
-
             bool atomic = c->matcher()->docMatcher().atomic();
+
+            batch.clear();
+            for ( int n = 0; n < UpdateBatchSize && c->ok(); n++ ) {
+                nscanned++;
+                atomic = c->matcher()->docMatcher().atomic();
                 
-            // May have already matched in UpdateOp, but do again to get details set correctly
-            if ( ! c->matcher()->matches( c->currKey(), c->currLoc(), &details ) ){
-                c->advance();
-                    
-                if ( nscanned % 256 == 0 && ! atomic ){
-                    if ( cc.get() == 0 ) {
-                        shared_ptr< Cursor > cPtr = c;
-                        cc.reset( new ClientCursor( QueryOption_NoCursorTimeout , cPtr , ns ) );
-                    }
-                    if ( ! cc->yield() ){
-                        cc.release();
-                        break;
-                    }
+                // May have already matched in UpdateOp, but do again to get details set correctly
+                if ( ! c->matcher()->matches( c->currKey(), c->currLoc(), &details ) ){
+                    c->advance();
+                    continue;
                 }
-                continue;
-            }
             
-            Record *r = c->_current();
-            DiskLoc loc = c->currLoc();
+                DiskLoc loc = c->currLoc();
                 
-            // TODO Maybe this is unnecessary since we have seenObjects
-            if ( c->getsetdup( loc ) ){
-                c->advance();
-                continue;
+                // TODO Maybe this is unnecessary since we have seenObjects
+                if ( c->getsetdup( loc ) || seenObjects.count( loc ) ){
+                    c->advance();
+                    continue;
+                }
+
+                batch.push_back( make_pair( loc , string( details.elemMatchKey ? details.elemMatchKey : "" ) ) );
+                if ( ! multi )
+                    break;
+                c->advance(); // go to next record in case this one moves
+            }
+
+            bool noted = multi && ! batch.empty() && c->ok();
+            if ( noted ){
+                if ( cc.get() )
+                    cc->updateLocation();
+                else
+                    c->noteLocation();
             }
+
+            for ( unsigned b = 0; b < batch.size(); b++ ) {
+                DiskLoc loc = batch[ b ].first;
+                const string& elemMatchKey = batch[ b ].second;
+                Record *r = loc.rec();
                 
-            BSONObj js(r);
+                BSONObj js(r);
                 
-            BSONObj pattern = patternOrig;
+                BSONObj pattern = patternOrig;
                 
-            if ( logop ) {
-                BSONObjBuilder idPattern;
-                BSONElement id;
-                // NOTE: If the matching object lacks an id, we'll log
-                // with the original pattern.  This isn't replay-safe.
-                // It might make sense to suppress the log instead
-                // if there's no id.
-                if ( js.getObjectID( id ) ) {
-                    idPattern.append( id );
-                    pattern = idPattern.obj();
-                }
-                else {
-                    uassert( 10157 ,  "multi-update requires all modified objects to have an _id" , ! multi );
+                if ( logop ) {
+                    BSONObjBuilder idPattern;
+                    BSONElement id;
+                    // NOTE: If the matching object lacks an id, we'll log
+                    // with the original pattern.  This isn't replay-safe.
+                    // It might make sense to suppress the log instead
+                    // if there's no id.
+                    if ( js.getObjectID( id ) ) {
+                        idPattern.append( id );
+                        pattern = idPattern.obj();
+                    }
+                    else {
+                        uassert( 10157 ,  "multi-update requires all modified objects to have an _id" , ! multi );
+                    }
                 }
-            }
                 
-            if ( profile )
-                ss << " nscanned:" << nscanned;
+                if ( profile )
+                    ss << " nscanned:" << nscanned;
                 
-            /* look for $inc etc.  note as listed here, all fields to inc must be this type, you can't set some
-                regular ones at the moment. */
-            if ( isOperatorUpdate ) {
-                    
-                if ( multi ){
-                    c->advance(); // go to next record in case this one moves
-                    if ( seenObjects.count( loc ) )
-                        continue;
-                }
-                    
-                const BSONObj& onDisk = loc.obj();
+                /* look for $inc etc.  note as listed here, all fields to inc must be this type, you can't set some
+                    regular ones at the moment. */
+                if ( isOperatorUpdate ) {
                     
-                ModSet * useMods = mods.get();
-                bool forceRewrite = false;
+                    const BSONObj& onDisk = loc.obj();
                     
-                auto_ptr<ModSet> mymodset;
-                if ( details.elemMatchKey && mods->hasDynamicArray() ){
-                    useMods = mods->fixDynamicArray( details.elemMatchKey );
-                    mymodset.reset( useMods );
-                    forceRewrite = true;
-                }
+                    ModSet * useMods = mods.get();
+                    bool forceRewrite = false;
                     
-                auto_ptr<ModSetState> mss = useMods->prepare( onDisk );
+                    auto_ptr<ModSet> mymodset;
+                    if ( ! elemMatchKey.empty() && mods->hasDynamicArray() ){
+                        useMods = mods->fixDynamicArray( elemMatchKey.c_str() );
+                        mymodset.reset( useMods );
+                        forceRewrite = true;
+                    }
                     
-                bool indexHack = multi && ( modsIsIndexed || ! mss->canApplyInPlace() );
+                    auto_ptr<ModSetState> mss = useMods->prepare( onDisk );
+
+                    // values may grow in place into the record's padding, but not past the
+                    // object size limit: createNewFromMods() below reports that
+                    int oldSize = onDisk.objsize();
+                    bool inPlace = mss->canApplyInPlace( r->netLength() - oldSize ) &&
+                        oldSize + mss->growth() <= 4 * 1024 * 1024;
                     
-                if ( indexHack ){
-                    if ( cc.get() )
-                        cc->updateLocation();
-                    else
-                        c->noteLocation();
-                }
+                    if ( modsIsIndexed <= 0 && inPlace ){
+                        mss->applyModsInPlace();// const_cast<BSONObj&>(onDisk) );
                     
-                if ( modsIsIndexed <= 0 && mss->canApplyInPlace() ){
-                    mss->applyModsInPlace();// const_cast<BSONObj&>(onDisk) );
+                        if ( onDisk.objsize() != oldSize )
+                            d->paddingFits();
                         
-                    if ( profile )
-                        ss << " fastmod ";
+                        if ( profile )
+                            ss << " fastmod ";
                         
-                    if ( modsIsIndexed ){
-                        seenObjects.insert( loc );
-                    }
-                } 
-                else {
-                    BSONObj newObj = mss->createNewFromMods();
-                    uassert( 12522 , "$ operator made object too large" , newObj.objsize() <= ( 4 * 1024 * 1024 ) );
-                    bool changedId;
-                    DiskLoc newLoc = theDataFileMgr.updateRecord(ns, d, nsdt, r, loc , newObj.objdata(), newObj.objsize(), debug, changedId);
-                    if ( newLoc != loc || modsIsIndexed ) {
-                        // object moved, need to make sure we don' get again
-                        seenObjects.insert( newLoc );
-                    }
+                        if ( modsIsIndexed ){
+                            seenObjects.insert( loc );
+                        }
+                    } 
+                    else {
+                        BSONObj newObj = mss->createNewFromMods();
+                        uassert( 12522 , "$ operator made object too large" , newObj.objsize() <= ( 4 * 1024 * 1024 ) );
+                        bool changedId;
+                        DiskLoc newLoc = theDataFileMgr.updateRecord(ns, d, nsdt, r, loc , newObj.objdata(), newObj.objsize(), debug, changedId);
+                        if ( newLoc != loc || modsIsIndexed ) {
+                            // object moved, need to make sure we don' get again
+                            seenObjects.insert( newLoc );
+                        }
                         
-                }
+                    }
                     
-                if ( logop ) {
-                    DEV assert( mods->size() );
+                    if ( logop ) {
+                        DEV assert( mods->size() );
                         
-                    if ( mss->haveArrayDepMod() ) {
-                        BSONObjBuilder patternBuilder;
-                        patternBuilder.appendElements( pattern );
-                        mss->appendSizeSpecForArrayDepMods( patternBuilder );
-                        pattern = patternBuilder.obj();                        
-                    }
+                        if ( mss->haveArrayDepMod() ) {
+                            BSONObjBuilder patternBuilder;
+                            patternBuilder.appendElements( pattern );
+                            mss->appendSizeSpecForArrayDepMods( patternBuilder );
+                            pattern = patternBuilder.obj();                        
+                        }
                         
-                    if ( forceRewrite || mss->needOpLogRewrite() ){
-                        DEBUGUPDATE( "\t rewrite update: " << mss->getOpLogRewrite() );
-                        logOp("u", ns, mss->getOpLogRewrite() , &pattern );
+                        if ( forceRewrite || mss->needOpLogRewrite() ){
+                            DEBUGUPDATE( "\t rewrite update: " << mss->getOpLogRewrite() );
+                            logOp("u", ns, mss->getOpLogRewrite() , &pattern );
+                        }
+                        else {
+                            logOp("u", ns, updateobj, &pattern );
+                        }
                     }
-                    else {
+                    numModded++;
+                    if ( ! multi )
+                        return UpdateResult( 1 , 1 , numModded );
+                    continue;
+                } 
+                
+                uassert( 10158 ,  "multi update only works with $ operators" , ! multi );
+                
+                BSONElementManipulator::lookForTimestamps( updateobj );
+                checkNoMods( updateobj );
+                bool changedId = false;
+                theDataFileMgr.updateRecord(ns, d, nsdt, r, loc , updateobj.objdata(), updateobj.objsize(), debug, changedId);
+                if ( logop ) {
+                    if ( !changedId ) {
                         logOp("u", ns, updateobj, &pattern );
+                    } else {
+                        logOp("d", ns, pattern );
+                        logOp("i", ns, updateobj );                    
                     }
                 }
-                numModded++;
-                if ( ! multi )
-                    return UpdateResult( 1 , 1 , numModded );
-                if ( indexHack )
-                    c->checkLocation();
-                    
-                if ( nscanned % 64 == 0 && ! atomic ){
-                    if ( cc.get() == 0 ) {
-                        shared_ptr< Cursor > cPtr = c;
-                        cc.reset( new ClientCursor( QueryOption_NoCursorTimeout , cPtr , ns ) );
-                    }
-                    if ( ! cc->yield() ){
-                        cc.release();
-                        break;
-                    }
+                return UpdateResult( 1 , 0 , 1 );
+            }
+
+            if ( noted )
+                c->checkLocation();
+
+            if ( ! atomic && c->ok() ){
+                if ( cc.get() == 0 ) {
+                    shared_ptr< Cursor > cPtr = c;
+                    cc.reset( new ClientCursor( QueryOption_NoCursorTimeout , cPtr , ns ) );
                 }
-                
-                continue;
-            } 
-                
-            uassert( 10158 ,  "multi update only works with $ operators" , ! multi );
-                
-            BSONElementManipulator::lookForTimestamps( updateobj );
-            checkNoMods( updateobj );
-            bool changedId = false;
-            theDataFileMgr.updateRecord(ns, d, nsdt, r, loc , updateobj.objdata(), updateobj.objsize(), debug, changedId);
-            if ( logop ) {
-                if ( !changedId ) {
-                    logOp("u", ns, updateobj, &pattern );
-                } else {
-                    logOp("d", ns, pattern );
-                    logOp("i", ns, updateobj );                    
+                if ( ! cc->yield() ){
+                    cc.release();
+                    break;
                 }
             }
-            return UpdateResult( 1 , 0 , 1 );
         }
         
         if ( numModded )
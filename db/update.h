@@ -61,26 +61,9 @@ namespace mongo {
         }
         
         /**
-         * @param in incrememnts the actual value inside in
+         * sets ms.incType and the matching inc value to in + elt, widening the type as needed
          */
-        void incrementMe( BSONElement& in ) const {
-            BSONElementManipulator manip( in );
-            
-            switch ( in.type() ){
-            case NumberDouble:
-                manip.setNumber( elt.numberDouble() + in.numberDouble() );
-                break;
-            case NumberLong:
-                manip.setLong( elt.numberLong() + in.numberLong() );
-                break;
-            case NumberInt:
-                manip.setInt( elt.numberInt() + in.numberInt() );
-                break;
-            default:
-                assert(0);
-            }
-            
-        }
+        void computeIncrement( const BSONElement& in, ModState& ms ) const;
         
         template< class Builder >
         void appendIncremented( Builder& bb , const BSONElement& in, ModState& ms ) const;
@@ -450,9 +433,11 @@ namespace mongo {
         const BSONObj& _obj;
         ModStateHolder _mods;
         bool _inPlacePossible;
+        bool _resize; // some mod changes the size of a value, so the bytes after it have to move
+        int _growth;  // sum of the sizes by which values grow
         
         ModSetState( const BSONObj& obj ) 
-            : _obj( obj ) , _inPlacePossible(true){
+            : _obj( obj ) , _inPlacePossible(true) , _resize(false) , _growth(0){
         }
         
         /**
@@ -464,6 +449,25 @@ namespace mongo {
             return _inPlacePossible;
         }
 
+        /**
+         * a mod which can be applied in place by changing the stored value's size by delta bytes
+         */
+        void resizeInPlace( int delta ){
+            if ( delta )
+                _resize = true;
+            if ( delta > 0 )
+                _growth += delta;
+        }
+
+        /**
+         * replaces the oldLen bytes at 'at' with the newLen bytes of data, moving the rest of _obj
+         * and fixing the sizes of _obj and of each object on the path to ms's field
+         * @param intoField ms's field is itself an object or array that 'at' is inside of
+         */
+        void splice( const ModState& ms , bool intoField , const char *at , int oldLen , const char *data , int newLen );
+
+        void applyModInPlace( ModState& ms );
+
         template< class Builder >
         void createNewFromMods( const string& root , Builder& b , const BSONObj &obj );
 
@@ -518,12 +522,19 @@ namespace mongo {
 
     public:
         
-        bool canApplyInPlace() const {
-            return _inPlacePossible;
+        /**
+         * @param padding bytes free after _obj that mods which grow a value may use
+         */
+        bool canApplyInPlace( int padding = 0 ) const {
+            return _inPlacePossible && _growth <= padding;
         }
+
+        /** bytes by which the object grows if the mods are applied in place */
+        int growth() const { return _growth; }
         
         /**
          * modified underlying _obj
+         * if values change size the rest of the object is moved, so check canApplyInPlace( padding ) first
          */
         void applyModsInPlace();
 
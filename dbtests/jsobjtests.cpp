@@ -20,6 +20,7 @@
 #include "pch.h"
 #include "../db/jsobj.h"
 #include "../db/jsobjmanipulator.h"
+#include "../db/fieldplan.h"
 #include "../db/json.h"
 #include "../db/repl.h"
 #include "../db/extsort.h"
@@ -551,6 +552,78 @@ namespace JsobjTests {
                 };
             };
 
+            class SubobjectSizePastEnd : public Base {
+                BSONObj valid() const {
+                    return fromjson( "{\"a\":{\"b\":1},\"c\":2}" );
+                }
+                BSONObj invalid() const {
+                    BSONObj ret = valid();
+                    set( ret, 7, get( ret, 7 ) + 30 );
+                    return ret;
+                }
+            };
+
+            class SubobjectEooMissing : public Base {
+                BSONObj valid() const {
+                    return fromjson( "{\"a\":{\"b\":1},\"c\":2}" );
+                }
+                BSONObj invalid() const {
+                    BSONObj ret = valid();
+                    // the embedded object ends a byte early, on its last value byte
+                    set( ret, 7, get( ret, 7 ) - 1 );
+                    return ret;
+                }
+            };
+
+            class TruncatedSubobject : public Base {
+                BSONObj valid() const {
+                    return fromjson( "{\"a\":{\"b\":1,\"c\":{\"d\":\"e\"}}}" );
+                }
+                BSONObj invalid() const {
+                    BSONObj ret = valid();
+                    // cut off inside the innermost object: the sizes of the two above now overrun
+                    int size = ret.objsize() - 6;
+                    set( ret, 0, get( ret, 0 ) - 6 );
+                    set( ret, size - 1, 0 );
+                    return ret.copy();
+                }
+            };
+
+            class StringSizePastEnd : public Base {
+                BSONObj valid() const {
+                    return fromjson( "{\"a\":\"b\"}" );
+                }
+                BSONObj invalid() const {
+                    BSONObj ret = valid();
+                    set( ret, 7, 100 );
+                    return ret;
+                }
+            };
+
+            class EmbeddedStringSizePastEnd : public Base {
+                BSONObj valid() const {
+                    return fromjson( "{\"a\":{\"b\":\"c\"},\"d\":\"e\"}" );
+                }
+                BSONObj invalid() const {
+                    BSONObj ret = valid();
+                    // within the outer object, but not the embedded one
+                    set( ret, 14, 10 );
+                    return ret;
+                }
+            };
+
+            class HugeStringSize : public Base {
+                BSONObj valid() const {
+                    return fromjson( "{\"a\":\"b\"}" );
+                }
+                BSONObj invalid() const {
+                    BSONObj ret = valid();
+                    // a length which would wrap around when added to a pointer
+                    set( ret, 10, 0x7f );
+                    return ret;
+                }
+            };
+
             class NoFieldNameEnd : public Base {
                 BSONObj valid() const {
                     return fromjson( "{\"a\":1}" );
@@ -637,6 +710,29 @@ namespace JsobjTests {
                 }
             };
 
+            class CodeWScopeSizePastEnd : public CodeWScopeBase {
+                void modify( BSONObj &o ) const {
+                    set( o, 8, 1 );
+                }
+            };
+
+            class CodeWScopeSwallowsNext : public Base {
+                BSONObj valid() const {
+                    BSONObjBuilder b;
+                    BSONObjBuilder scope;
+                    scope.append( "a", "b" );
+                    b.appendCodeWScope( "c", "d", scope.done() );
+                    b.append( "e", 1 );
+                    return b.obj();
+                }
+                BSONObj invalid() const {
+                    BSONObj ret = valid();
+                    // still within the object, but the scope no longer fills what's left
+                    set( ret, 7, get( ret, 7 ) + 7 );
+                    return ret;
+                }
+            };
+
             class NoSize {
             public:
                 NoSize( BSONType type ) : type_( type ) {}
@@ -997,6 +1093,74 @@ namespace JsobjTests {
         }
     };
 
+    class FieldExtractionPlanTest {
+    public:
+        void run(){
+            BSONObj x = fromjson( "{a:1,b:{c:2,d:[3,4],e:{f:5}},'b.c':6,g:[{h:7}],i:{}}" );
+            const char *names[] = { "a", "b.c", "b.d", "b.e.f", "b.x", "g.h", "g.0.h", "i.j", "z", "a.b", 0 };
+
+            FieldExtractionPlan plan;
+            for( int i = 0; names[ i ]; ++i )
+                ASSERT_EQUALS( i, plan.add( names[ i ] ) );
+            ASSERT_EQUALS( 1, plan.add( "b.c" ) );
+
+            vector< BSONElement > fields( plan.size() );
+            vector< int > rest( plan.size() );
+            plan.extract( x, &fields[ 0 ] );
+            for( int i = 0; names[ i ]; ++i ) {
+                BSONElement e = x.getFieldDotted( names[ i ] );
+                ASSERT_EQUALS( e.eoo(), fields[ i ].eoo() );
+                ASSERT_EQUALS( e.rawdata(), fields[ i ].rawdata() );
+            }
+            ASSERT_EQUALS( 6, fields[ 1 ].number() );
+
+            plan.extractOrArray( x, &fields[ 0 ], &rest[ 0 ] );
+            for( int i = 0; names[ i ]; ++i ) {
+                const char *p = names[ i ];
+                BSONElement e = x.getFieldDottedOrArray( p );
+                if ( e.isNull() ) {
+                    ASSERT( fields[ i ].eoo() || fields[ i ].isNull() );
+                    continue;
+                }
+                ASSERT_EQUALS( e.rawdata(), fields[ i ].rawdata() );
+                if ( e.type() == Array )
+                    ASSERT_EQUALS( string( p ), string( names[ i ] + rest[ i ] ) );
+            }
+        }
+    };
+
+    class FieldIndex {
+    public:
+        void run(){
+            BSONObjBuilder b;
+            for( int i = 0; i < 100; ++i )
+                b.append( BSONObjBuilder::numStr( i ), i );
+            b.append( "5", "dup" );
+            b.append( "", "empty" );
+            b.append( "a", BSON( "b" << 1 ) );
+            BSONObj x = b.obj();
+
+            BSONFieldIndex idx( x );
+            ASSERT( idx.indexed() );
+            for( int i = 0; i < 100; ++i )
+                ASSERT_EQUALS( i, idx.getField( BSONObjBuilder::numStr( i ).c_str() ).number() );
+            ASSERT_EQUALS( 5, idx.getField( "5" ).number() );
+            ASSERT_EQUALS( "empty", idx.getField( "" ).str() );
+            ASSERT( idx.getField( "100" ).eoo() );
+            ASSERT_EQUALS( 1, idx.getFieldDotted( "a.b" ).number() );
+            ASSERT( idx.getFieldDotted( "a.c" ).eoo() );
+            ASSERT( idx.getFieldDotted( "5.c" ).eoo() );
+
+            // too narrow to index: lookups scan
+            BSONObj y = BSON( "z" << 1 << "a" << BSON( "b" << 2 ) );
+            BSONFieldIndex small( y );
+            ASSERT( !small.indexed() );
+            ASSERT( small.getField( "b" ).eoo() );
+            ASSERT_EQUALS( 1, small.getField( "z" ).number() );
+            ASSERT_EQUALS( 2, small.getFieldDotted( "a.b" ).number() );
+        }
+    };
+
     class ComparatorTest {
     public:
         BSONObj one( string s ){
@@ -1597,6 +1761,12 @@ namespace JsobjTests {
             add< BSONObjTests::Validation::NegativeStringSize >();
             add< BSONObjTests::Validation::WrongSubobjectSize >();
             add< BSONObjTests::Validation::WrongDbrefNsSize >();
+            add< BSONObjTests::Validation::SubobjectSizePastEnd >();
+            add< BSONObjTests::Validation::SubobjectEooMissing >();
+            add< BSONObjTests::Validation::TruncatedSubobject >();
+            add< BSONObjTests::Validation::StringSizePastEnd >();
+            add< BSONObjTests::Validation::EmbeddedStringSizePastEnd >();
+            add< BSONObjTests::Validation::HugeStringSize >();
             add< BSONObjTests::Validation::NoFieldNameEnd >();
             add< BSONObjTests::Validation::BadRegex >();
             add< BSONObjTests::Validation::BadRegexOptions >();
@@ -1606,6 +1776,8 @@ namespace JsobjTests {
             add< BSONObjTests::Validation::CodeWScopeNoSizeForObj >();
             add< BSONObjTests::Validation::CodeWScopeSmallObjSize >();
             add< BSONObjTests::Validation::CodeWScopeBadObject >();
+            add< BSONObjTests::Validation::CodeWScopeSizePastEnd >();
+            add< BSONObjTests::Validation::CodeWScopeSwallowsNext >();
             add< BSONObjTests::Validation::NoSize >( Symbol );
             add< BSONObjTests::Validation::NoSize >( Code );
             add< BSONObjTests::Validation::NoSize >( String );
@@ -1640,6 +1812,8 @@ namespace JsobjTests {
             add< MinMaxElementTest >();
             add< ComparatorTest >();
             add< ExtractFieldsTest >();
+            add< FieldExtractionPlanTest >();
+            add< FieldIndex >();
             add< external_sort::Basic1 >();
             add< external_sort::Basic2 >();
             add< external_sort::Basic3 >();
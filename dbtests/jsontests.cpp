@@ -389,6 +389,21 @@ namespace JsonTests {
                 cout << o.jsonString() << endl;
             }
         };
+
+        class Appended {
+        public:
+            void run(){
+                BSONObj a = BSON( "a" << 1 << "b" << BSON_ARRAY( "x\ty" << 2.5 ) );
+                BSONObj b = BSON( "c" << BSON( "d" << -3 ) );
+                StringBuilder s;
+                a.jsonString( s );
+                b.firstElement().jsonString( s, TenGen, false, 1 );
+                b.jsonString( s, JS, 1 );
+                ASSERT_EQUALS( a.jsonString() + b.firstElement().jsonString( TenGen, false, 1 ) +
+                               b.jsonString( JS, 1 ), s.str() );
+                ASSERT_EQUALS( "{ \"a\" : 1, \"b\" : [ \"x\\ty\", 2.5 ] }", a.jsonString() );
+            }
+        };
         
     } // namespace JsonStringTests
 
@@ -516,6 +531,25 @@ namespace JsonTests {
             }
         };
 
+        class DoublePrecision {
+        public:
+            void run() {
+                const char *nums[] = { "0.1", "-4.4433e-2", "1.7976931348623157e308",
+                                       "2.2250738585072014e-308", ".5", "5.", "-.95", "81E-5", 0 };
+                for( int i = 0; nums[ i ]; ++i ) {
+                    BSONObj o = fromjson( string( "{ \"a\" : " ) + nums[ i ] + " }" );
+                    ASSERT_EQUALS( NumberDouble, o.firstElement().type() );
+                    ASSERT_EQUALS( strtod( nums[ i ], 0 ), o.firstElement().number() );
+                }
+            }
+        };
+
+        class IntegerTooLong : public Bad {
+            virtual string json() const {
+                return "{ \"a\" : 12345678901234567890 }";
+            }
+        };
+
         class TwoElements : public Base {
             virtual BSONObj bson() const {
                 BSONObjBuilder b;
@@ -1116,6 +1150,7 @@ namespace JsonTests {
             add< JsonStringTests::TimestampTests >();
             add< JsonStringTests::NullString >();
             add< JsonStringTests::AllTypes >();
+            add< JsonStringTests::Appended >();
             
             add< FromJsonTests::Empty >();
             add< FromJsonTests::EmptyWithSpace >();
@@ -1125,6 +1160,8 @@ namespace JsonTests {
             add< FromJsonTests::OkDollarFieldName >();
             add< FromJsonTests::SingleNumber >();
             add< FromJsonTests::FancyNumber >();
+            add< FromJsonTests::DoublePrecision >();
+            add< FromJsonTests::IntegerTooLong >();
             add< FromJsonTests::TwoElements >();
             add< FromJsonTests::Subobject >();
             add< FromJsonTests::ArrayEmpty >();
@@ -116,6 +116,128 @@ namespace MatcherTests {
         }        
     };
     
+    
+    /** compiled scalar comparisons must agree with the generic matcher */
+    class TypedComparisons {
+    public:
+        void run() {
+            Matcher gt( fromjson( "{a:{$gt:4}}" ) );
+            ASSERT( gt.matches( BSON( "a" << 5LL ) ) );
+            ASSERT( gt.matches( BSON( "a" << 4.5 ) ) );
+            ASSERT( !gt.matches( BSON( "a" << 4 ) ) );
+            ASSERT( !gt.matches( BSON( "a" << "5" ) ) );
+            ASSERT( !gt.matches( BSON( "b" << 5 ) ) );
+            ASSERT( gt.matches( fromjson( "{a:[1,2,5]}" ) ) );
+
+            Matcher s( fromjson( "{a:{$lte:'b'}}" ) );
+            ASSERT( s.matches( BSON( "a" << "abc" ) ) );
+            ASSERT( s.matches( BSON( "a" << "b" ) ) );
+            ASSERT( !s.matches( BSON( "a" << "bb" ) ) );
+            ASSERT( !s.matches( BSON( "a" << 1 ) ) );
+
+            OID o;
+            o.init();
+            Matcher id( BSON( "_id" << o ) );
+            ASSERT( id.matches( BSON( "_id" << o ) ) );
+            OID p;
+            p.init();
+            ASSERT( !id.matches( BSON( "_id" << p ) ) );
+
+            Matcher b( BSON( "a" << true ) );
+            ASSERT( b.matches( BSON( "a" << true ) ) );
+            ASSERT( !b.matches( BSON( "a" << false ) ) );
+            ASSERT( !b.matches( BSON( "a" << 1 ) ) );
+
+            Matcher nan( BSON( "a" << numeric_limits< double >::quiet_NaN() ) );
+            ASSERT( nan.matches( BSON( "a" << numeric_limits< double >::quiet_NaN() ) ) );
+            ASSERT( !nan.matches( BSON( "a" << 1 ) ) );
+
+            Matcher n( fromjson( "{a:{$not:{$gt:4}}}" ) );
+            ASSERT( n.matches( BSON( "a" << 3 ) ) );
+            ASSERT( n.matches( BSON( "b" << 3 ) ) );
+            ASSERT( !n.matches( BSON( "a" << 5 ) ) );
+        }
+    };
+
+    /** criteria are reordered by cost, the result mustn't change */
+    class CostOrder {
+    public:
+        void run() {
+            Matcher m( fromjson( "{a:{$exists:true},b:{$ne:3},c:{$in:[1,2]},d:5}" ) );
+            ASSERT( m.matches( fromjson( "{a:1,b:2,c:1,d:5}" ) ) );
+            ASSERT( !m.matches( fromjson( "{a:1,b:3,c:1,d:5}" ) ) );
+            ASSERT( !m.matches( fromjson( "{a:1,b:2,c:3,d:5}" ) ) );
+            ASSERT( !m.matches( fromjson( "{b:2,c:1,d:5}" ) ) );
+            ASSERT( !m.matches( fromjson( "{a:1,b:2,c:1,d:6}" ) ) );
+        }
+    };
+
+    /** unanchored regexes are prefiltered on their required literal */
+    class RegexLiteral {
+    public:
+        void run() {
+            Matcher m( fromjson( "{a:/error.*timeout/}" ) );
+            ASSERT( m.matches( BSON( "a" << "disk error: read timeout" ) ) );
+            ASSERT( !m.matches( BSON( "a" << "timeout then error" ) ) );
+            ASSERT( !m.matches( BSON( "a" << "error" ) ) );
+
+            Matcher i( fromjson( "{a:/err.*TimeOut/i}" ) );
+            ASSERT( i.matches( BSON( "a" << "ERR: timeout" ) ) );
+            ASSERT( !i.matches( BSON( "a" << "ERR: time out" ) ) );
+
+            Matcher n( fromjson( "{a:{$not:/b+ccc/}}" ) );
+            ASSERT( n.matches( BSON( "a" << "bcc" ) ) );
+            ASSERT( !n.matches( BSON( "a" << "abbccc" ) ) );
+        }
+    };
+
+    /** large homogeneous $in / $nin lists are hashed */
+    class LargeIn {
+    public:
+        void run() {
+            BSONArrayBuilder ints;
+            BSONArrayBuilder strs;
+            for( int i = 0; i < 100; i += 2 ) {
+                ints.append( i );
+                strs.append( BSONObjBuilder::numStr( i ) );
+            }
+            BSONArray a = ints.arr();
+            Matcher in( BSON( "a" << BSON( "$in" << a ) ) );
+            ASSERT( in.matches( BSON( "a" << 4 ) ) );
+            ASSERT( in.matches( BSON( "a" << 4.0 ) ) );
+            ASSERT( in.matches( BSON( "a" << 4LL ) ) );
+            ASSERT( !in.matches( BSON( "a" << 5 ) ) );
+            ASSERT( !in.matches( BSON( "a" << "4" ) ) );
+            ASSERT( in.matches( fromjson( "{a:[1,3,98]}" ) ) );
+            ASSERT( !in.matches( fromjson( "{b:4}" ) ) );
+
+            Matcher nin( BSON( "a" << BSON( "$nin" << a ) ) );
+            ASSERT( !nin.matches( BSON( "a" << 4.0 ) ) );
+            ASSERT( nin.matches( BSON( "a" << 5 ) ) );
+            ASSERT( nin.matches( BSON( "b" << 4 ) ) );
+            ASSERT( !nin.matches( fromjson( "{a:[1,3,98]}" ) ) );
+            ASSERT( nin.matches( fromjson( "{a:[1,3,99]}" ) ) );
+
+            Matcher s( BSON( "a" << BSON( "$in" << strs.arr() ) ) );
+            ASSERT( s.matches( BSON( "a" << "42" ) ) );
+            ASSERT( !s.matches( BSON( "a" << "43" ) ) );
+            ASSERT( !s.matches( BSON( "a" << 42 ) ) );
+
+            // non finite numbers are all equal, as when the $in is too small to hash
+            double inf = numeric_limits< double >::infinity();
+            BSONArrayBuilder big;
+            for( int i = 0; i < 20; ++i )
+                big.append( i );
+            big.append( inf );
+            Matcher f( BSON( "a" << BSON( "$in" << big.arr() ) ) );
+            Matcher small( BSON( "a" << BSON( "$in" << BSON_ARRAY( inf ) ) ) );
+            ASSERT( small.matches( BSON( "a" << -inf ) ) );
+            ASSERT( f.matches( BSON( "a" << inf ) ) );
+            ASSERT( f.matches( BSON( "a" << -inf ) ) );
+            ASSERT( f.matches( BSON( "a" << numeric_limits< double >::quiet_NaN() ) ) );
+            ASSERT( !f.matches( BSON( "a" << 20 ) ) );
+        }
+    };
 
     class All : public Suite {
     public:
@@ -130,6 +252,10 @@ namespace MatcherTests {
             add< MixedNumericIN >();
             add< Size >();
             add< MixedNumericEmbedded >();
+            add< TypedComparisons >();
+            add< CostOrder >();
+            add< RegexLiteral >();
+            add< LargeIn >();
         }
     } dball;
     
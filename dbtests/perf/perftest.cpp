@@ -24,9 +24,14 @@
 #include "../../db/query.h"
 #include "../../db/queryoptimizer.h"
 #include "../../util/file_allocator.h"
+#include "../../util/message.h"
+#include "../../util/message_server.h"
 
 #include "../framework.h"
 #include <boost/date_time/posix_time/posix_time.hpp>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 
 namespace mongo {
     extern string dbpath;
@@ -166,6 +171,22 @@ namespace Insert {
         string ns_;
     };
 
+    class BatchTwoIndex {
+    public:
+        BatchTwoIndex() : ns_( testNs( this ) ) {
+            client_->ensureIndex( ns_, BSON( "a" << 1 ) );
+        }
+        void run() {
+            for( int i = 0; i < 100; ++i ) {
+                vector< BSONObj > v;
+                for( int j = 0; j < 1000; ++j )
+                    v.push_back( BSON( "_id" << i * 1000 + j << "a" << ( j * 7919 ) % 1000 ) );
+                client_->insert( ns_.c_str(), v );
+            }
+        }
+        string ns_;
+    };
+
     class All : public RunnerSuite {
     public:
         All() : RunnerSuite( "insert" ){}
@@ -177,6 +198,7 @@ namespace Insert {
             add< Capped >();
             add< OneIndexReverse >();
             add< OneIndexHighLow >();
+            add< BatchTwoIndex >();
         }
     } all;
 } // namespace Insert
@@ -250,6 +272,48 @@ namespace Update {
         string ns_;
     };
 
+    class IncToLong {
+    public:
+        IncToLong() : ns_( testNs( this ) ) {
+            for( int i = 0; i < 10000; ++i )
+                client_->insert( ns_.c_str(), BSON( "_id" << i << "i" << 0 << "s" << "abcdefghij" ) );
+        }
+        void run() {
+            for( int j = 0; j < 10; ++j )
+                for( int i = 0; i < 10000; ++i )
+                    client_->update( ns_.c_str(), QUERY( "_id" << i ), BSON( "$inc" << BSON( "i" << 5000000000LL ) ) );
+        }
+        string ns_;
+    };
+
+    class SetShrink {
+    public:
+        SetShrink() : ns_( testNs( this ) ) {
+            for( int i = 0; i < 10000; ++i )
+                client_->insert( ns_.c_str(), BSON( "_id" << i << "i" << "aaaaaaaaaa" << "j" << 0 ) );
+        }
+        void run() {
+            for( int j = 9; j > -1; --j )
+                for( int i = 0; i < 10000; ++i )
+                    client_->update( ns_.c_str(), QUERY( "_id" << i ), BSON( "$set" << BSON( "i" << string( j, 'a' ) ) ) );
+        }
+        string ns_;
+    };
+
+    class Push {
+    public:
+        Push() : ns_( testNs( this ) ) {
+            for( int i = 0; i < 1000; ++i )
+                client_->insert( ns_.c_str(), BSON( "_id" << i << "a" << BSONArray() ) );
+        }
+        void run() {
+            for( int j = 0; j < 100; ++j )
+                for( int i = 0; i < 1000; ++i )
+                    client_->update( ns_.c_str(), QUERY( "_id" << i ), BSON( "$push" << BSON( "a" << j ) ) );
+        }
+        string ns_;
+    };
+
     class All : public RunnerSuite {
     public:
         All() : RunnerSuite( "update" ){}
@@ -259,6 +323,9 @@ namespace Update {
             add< Inc >();
             add< Set >();
             add< SetGrow >();
+            add< IncToLong >();
+            add< SetShrink >();
+            add< Push >();
         }
     } all;
 } // namespace Update
@@ -687,6 +754,143 @@ namespace Plan {
 
 } // namespace Plan
 
+namespace Alloc {
+
+    // Reports BufBuilder buffers which had to be malloc()ed rather than taken from the
+    // thread's cache, per operation.
+    template< class T >
+    void report( T *t, long long mallocs, int n ) {
+        cout << "{'" << testDb( t ) << "__mallocsPerOp': " << double( mallocs ) / n << "}" << endl;
+    }
+
+    class Insert {
+    public:
+        Insert() : ns_( testNs( this ) ) {
+            client_->insert( ns_.c_str(), BSON( "_id" << -1 ) );
+        }
+        void run() {
+            long long before = bufferMallocs();
+            for( int i = 0; i < 100000; ++i )
+                client_->insert( ns_.c_str(), BSON( "_id" << i << "a" << "b" ) );
+            report( this, bufferMallocs() - before, 100000 );
+        }
+        string ns_;
+    };
+
+    class FindOne {
+    public:
+        FindOne() : ns_( testNs( this ) ) {
+            for( int i = 0; i < 1000; ++i )
+                client_->insert( ns_.c_str(), BSON( "_id" << i << "a" << i ) );
+            client_->ensureIndex( ns_, BSON( "a" << 1 ) );
+        }
+        void run() {
+            long long before = bufferMallocs();
+            for( int i = 0; i < 100000; ++i )
+                ASSERT( !client_->findOne( ns_.c_str(), QUERY( "a" << i % 1000 ) ).isEmpty() );
+            report( this, bufferMallocs() - before, 100000 );
+        }
+        string ns_;
+    };
+
+    class All : public RunnerSuite {
+    public:
+        All() : RunnerSuite( "alloc" ){}
+        void setupTests(){
+            add< Insert >();
+            add< FindOne >();
+        }
+    } all;
+
+} // namespace Alloc
+
+namespace Conn {
+
+    // Replies to each dbMsg with its own text.
+    class EchoHandler : public MessageHandler {
+    public:
+        virtual void process( Message& m , AbstractMessagingPort* p ) {
+            if ( m.operation() != dbMsg )
+                return;
+            Message r;
+            r.setData( opReply, m.singleData()->_data, m.header()->dataLen() );
+            p->reply( m, r );
+        }
+        virtual void disconnected( AbstractMessagingPort* p ) {}
+    } echoHandler;
+
+    void serve( MessageServer::Options opts ) {
+        createServer( opts, &echoHandler )->run();
+    }
+
+    // Opens nIdle connections that send nothing, then times nActive clients each making
+    // 1000 round trips.  Servers are started once and live for the rest of the run.
+    template< int workers >
+    class IdleAndActive {
+    public:
+        enum { Port = 27950 + workers, nActive = 100, Calls = 1000 };
+        IdleAndActive() {
+            static bool started = false;
+            if ( !started ) {
+                MessageServer::Options opts;
+                opts.port = Port;
+                opts.ipList = "127.0.0.1";
+                opts.workers = workers;
+                boost::thread t( boost::bind( serve, opts ) );
+                sleepmillis( 500 );
+                started = true;
+            }
+            int nIdle = 10000;
+#if !defined(_WIN32)
+            // both ends of every connection are in this process
+            struct rlimit limit;
+            getrlimit( RLIMIT_NOFILE, &limit );
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit( RLIMIT_NOFILE, &limit );
+            getrlimit( RLIMIT_NOFILE, &limit );
+            if ( limit.rlim_cur < 2 * 10000 + 1000 )
+                nIdle = int( limit.rlim_cur / 2 ) - 2 * nActive - 100;
+#endif
+            for( int i = 0; i < nIdle; ++i ) {
+                shared_ptr< MessagingPort > p( new MessagingPort() );
+                SockAddr a( "127.0.0.1", Port );
+                ASSERT( p->connect( a ) );
+                idle_.push_back( p );
+            }
+        }
+        void run() {
+            boost::thread_group g;
+            for( int i = 0; i < nActive; ++i )
+                g.create_thread( boost::bind( &IdleAndActive::active, this ) );
+            g.join_all();
+            cout << "{'" << testDb( this ) << "__idle': " << idle_.size() << "}" << endl;
+        }
+    private:
+        void active() {
+            MessagingPort p;
+            SockAddr a( "127.0.0.1", Port );
+            ASSERT( p.connect( a ) );
+            for( int i = 0; i < Calls; ++i ) {
+                Message m;
+                m.setData( dbMsg, "ping" );
+                Message r;
+                ASSERT( p.call( m, r ) );
+            }
+        }
+        vector< shared_ptr< MessagingPort > > idle_;
+    };
+
+    class All : public RunnerSuite {
+    public:
+        All() : RunnerSuite( "conn" ){}
+        void setupTests(){
+            add< IdleAndActive< 0 > >(); // a thread per connection
+            add< IdleAndActive< 8 > >(); // epoll
+        }
+    } all;
+
+} // namespace Conn
+
 int main( int argc, char **argv ) {
     logLevel = -1;
     client_ = new DBDirectClient();
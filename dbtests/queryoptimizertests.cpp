@@ -178,6 +178,20 @@ namespace QueryOptimizerTests {
             BSONObj o1_, o2_;
         };
         
+        class CaseInsensitiveRegex : public RegexBase {
+        public:
+            CaseInsensitiveRegex() : o1_( BSON( "" << "ABC" ) ), o2_( BSON( "" << "abd" ) ) {}
+            virtual BSONObj query() {
+                BSONObjBuilder b;
+                b.appendRegex( "a", "^aBc", "i" );
+                return b.obj();
+            }
+            virtual BSONElement lower() { return o1_.firstElement(); }
+            virtual BSONElement upper() { return o2_.firstElement(); }
+            virtual bool upperInclusive() { return false; }
+            BSONObj o1_, o2_;
+        };
+
         class UnhelpfulRegex : public RegexBase {
         public:
             UnhelpfulRegex() {
@@ -1611,6 +1625,7 @@ namespace QueryOptimizerTests {
             add< FieldRangeTests::EqGteInvalid >();
             add< FieldRangeTests::Regex >();
             add< FieldRangeTests::RegexObj >();
+            add< FieldRangeTests::CaseInsensitiveRegex >();
             add< FieldRangeTests::UnhelpfulRegex >();
             add< FieldRangeTests::In >();
             add< FieldRangeTests::Equality >();
@@ -29,6 +29,7 @@
 
 namespace mongo {
     extern int __findingStartInitialTimeout;
+    void assembleRequest( const string &ns, BSONObj query, int nToReturn, int nToSkip, const BSONObj *fieldsToReturn, int queryOptions, Message &toSend );
 }
 
 namespace QueryTests {
@@ -434,6 +435,166 @@ namespace QueryTests {
         }
     };
 
+    class MultikeyRemove : public ClientBase {
+    public:
+        ~MultikeyRemove() {
+            client().dropCollection( "unittests.querytests.MultikeyRemove" );
+        }
+        void run() {
+            const char *ns = "unittests.querytests.MultikeyRemove";
+            client().ensureIndex( ns, BSON( "a" << 1 ) );
+            // more documents than are deleted in one batch, each with several keys
+            for( int i = 0; i < 1000; ++i )
+                insert( ns, BSON( "_id" << i << "a" << BSON_ARRAY( i << i + 1 << i + 2 ) ) );
+            client().remove( ns, fromjson( "{a:{$gte:500}}" ) );
+            ASSERT( !error() );
+            ASSERT_EQUALS( 498U, client().count( ns ) );
+            ASSERT_EQUALS( 0U, client().count( ns, BSON( "a" << 600 ) ) );
+            ASSERT_EQUALS( 2U, client().count( ns, BSON( "a" << 498 ) ) );
+            client().remove( ns, BSONObj() );
+            ASSERT_EQUALS( 0U, client().count( ns ) );
+            ASSERT_EQUALS( 0U, client().count( ns, fromjson( "{a:{$gte:0}}" ) ) );
+        }
+    };
+
+    /** an open cursor going the other way than a batched remove: moved off its position, it
+        lands on documents of the same batch, and must end up past all of them
+    */
+    class RemoveUnderOpenCursor : public ClientBase {
+    public:
+        ~RemoveUnderOpenCursor() {
+            client().dropCollection( "unittests.querytests.RemoveUnderOpenCursor" );
+        }
+        void run() {
+            const char *ns = "unittests.querytests.RemoveUnderOpenCursor";
+            for( int i = 0; i < 100; ++i )
+                insert( ns, BSON( "_id" << i ) );
+            auto_ptr< DBClientCursor > c = client().query( ns, Query().sort( BSON( "$natural" << -1 ) ), 2 );
+            ASSERT_EQUALS( 99, c->next()[ "_id" ].numberInt() );
+            ASSERT_EQUALS( 98, c->next()[ "_id" ].numberInt() );
+            long long cursorId = c->getCursorId();
+            ASSERT( cursorId );
+            c->decouple();
+            // the server's cursor rests on 97, and all it would move to up to 40 goes together
+            client().remove( ns, fromjson( "{_id:{$gte:40,$lte:97}}" ) );
+            ASSERT( !error() );
+            c = client().getMore( ns, cursorId );
+            for( int i = 39; i >= 0; --i )
+                ASSERT_EQUALS( i, c->next()[ "_id" ].numberInt() );
+            ASSERT( !c->more() );
+        }
+    };
+
+    class BatchInsert : public ClientBase {
+    public:
+        ~BatchInsert() {
+            client().dropCollection( "unittests.querytests.BatchInsert" );
+        }
+        void run() {
+            const char *ns = "unittests.querytests.BatchInsert";
+            client().ensureIndex( ns, BSON( "a" << 1 ) );
+            client().ensureIndex( ns, BSON( "b" << 1 ), true );
+            insert( ns, BSON( "a" << -1 << "b" << -1 ) );
+            // keys inserted out of order, one document multikey
+            vector< BSONObj > v;
+            for( int i = 0; i < 1500; ++i )
+                v.push_back( BSON( "a" << ( i * 7 ) % 1500 << "b" << i ) );
+            v.push_back( BSON( "a" << BSON_ARRAY( 2000 << 2001 ) << "b" << 1500 ) );
+            client().insert( ns, v );
+            ASSERT( !error() );
+            ASSERT_EQUALS( 1502U, client().count( ns ) );
+            ASSERT_EQUALS( 1502U, client().count( ns, fromjson( "{a:{$gte:-1,$lte:2000}}" ) ) );
+            ASSERT_EQUALS( 1U, client().count( ns, BSON( "a" << 2001 ) ) );
+            ASSERT_EQUALS( 1U, client().count( ns, BSON( "b" << 700 ) ) );
+            ASSERT_EQUALS( 1502U, client().count( ns, fromjson( "{_id:{$exists:true}}" ) ) );
+        }
+    };
+
+    class BatchInsertDupKey : public ClientBase {
+    public:
+        ~BatchInsertDupKey() {
+            client().dropCollection( "unittests.querytests.BatchInsertDupKey" );
+        }
+        void run() {
+            const char *ns = "unittests.querytests.BatchInsertDupKey";
+            client().ensureIndex( ns, BSON( "a" << 1 ), true );
+            insert( ns, BSON( "a" << 5 ) );
+            // as with one object at a time, the objects before the duplicate are inserted
+            vector< BSONObj > v;
+            for( int i = 0; i < 10; ++i )
+                v.push_back( BSON( "a" << i ) );
+            client().insert( ns, v );
+            ASSERT( error() );
+            ASSERT_EQUALS( 6U, client().count( ns ) );
+            ASSERT_EQUALS( 6U, client().count( ns, fromjson( "{a:{$gte:0}}" ) ) );
+            ASSERT_EQUALS( 0U, client().count( ns, BSON( "a" << 6 ) ) );
+        }
+    };
+
+#if !defined(_WIN32)
+    /** a query answered over a socket, with documents sent straight from their records */
+    class InPlaceReply : public ClientBase {
+    public:
+        InPlaceReply() : _ns( "unittests.querytests.InPlaceReply" ) {}
+        ~InPlaceReply() {
+            client().dropCollection( _ns );
+        }
+        void run() {
+            check( 50, 100, 0 );
+            client().dropCollection( _ns );
+            // the socket takes only part of the reply, the rest is copied and sent after unlocking
+            check( 100, 2000, 4096 );
+        }
+    private:
+        void check( int n, int size, int sndbuf ) {
+            for( int i = 0; i < n; ++i )
+                insert( _ns, BSON( "_id" << i << "s" << string( size, 'x' ) ) );
+
+            int fds[ 2 ];
+            ASSERT_EQUALS( 0, socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+            if ( sndbuf )
+                setsockopt( fds[ 0 ], SOL_SOCKET, SO_SNDBUF, (char *) &sndbuf, sizeof( sndbuf ) );
+            MessagingPort server( fds[ 0 ], SockAddr() );
+            MessagingPort remote( fds[ 1 ], SockAddr() );
+
+            Message m;
+            assembleRequest( _ns, BSONObj(), 0, 0, 0, 0, m );
+            DbMessage d( m );
+            QueryMessage q( d );
+            Message result;
+            {
+                CurOp op( &cc() );
+                op.ensureStarted();
+                runQuery( m, q, op, result, &server );
+            }
+            ASSERT( result.sentBytes() > 0 );
+            ASSERT( !result.hasBorrowed() );
+
+            Message got;
+            boost::thread reader( boost::bind( &InPlaceReply::read, &remote, &got ) );
+            server.reply( m, result );
+            reader.join();
+
+            ASSERT( !got.empty() );
+            ASSERT_EQUALS( m.header()->id, got.header()->responseTo );
+            QueryResult *qr = (QueryResult *) got.header();
+            ASSERT_EQUALS( n, qr->nReturned );
+            const char *p = qr->data();
+            for( int i = 0; i < n; ++i ) {
+                BSONObj o( p );
+                ASSERT_EQUALS( i, o[ "_id" ].numberInt() );
+                ASSERT_EQUALS( size, (int) o[ "s" ].String().size() );
+                p += o.objsize();
+            }
+            ASSERT_EQUALS( p, (const char *) qr + qr->len );
+        }
+        static void read( MessagingPort *p, Message *m ) {
+            p->recv( *m );
+        }
+        const char *_ns;
+    };
+#endif
+
     class UnderscoreNs : public ClientBase {
     public:
         ~UnderscoreNs() {
@@ -738,6 +899,47 @@ namespace QueryTests {
         }
     };
 
+    class ParallelScan : public ClientBase {
+    public:
+        ~ParallelScan() {
+            client().dropCollection( ns() );
+        }
+        void run() {
+            string big( 1000, 'x' );
+            for( int i = 0; i < 6000; ++i )
+                insert( ns(), BSON( "i" << i << "b" << big ) );
+            ASSERT_EQUALS( 2000U, client().count( ns(), fromjson( "{i:{$mod:[3,0]}}" ) ) );
+
+            auto_ptr< DBClientCursor > c = client().query( ns(), fromjson( "{i:{$gte:5990}}" ) );
+            set< int > found;
+            while( c->more() )
+                found.insert( c->next()[ "i" ].numberInt() );
+            ASSERT_EQUALS( 10U, found.size() );
+            ASSERT_EQUALS( 5990, *found.begin() );
+            ASSERT_EQUALS( 0, c->getCursorId() );
+
+            ASSERT_EQUALS( 3, client().query( ns(), fromjson( "{i:{$mod:[2,0]}}" ), -3 )->itcount() );
+            // too many for one batch, the rest comes from a cursor picking up where the scan stopped
+            ASSERT_EQUALS( 3000U, distinct( client().query( ns(), fromjson( "{i:{$mod:[2,0]}}" ) ) ) );
+            // a soft limit overflows too, getMore returns the rest
+            ASSERT_EQUALS( 3000U, distinct( client().query( ns(), fromjson( "{i:{$mod:[2,0]}}" ), 10 ) ) );
+            ASSERT_EQUALS( 2995U, distinct( client().query( ns(), fromjson( "{i:{$mod:[2,0]}}" ), 0, 5 ) ) );
+        }
+    private:
+        static const char *ns() { return "unittests.querytests.ParallelScan"; }
+        /** number of documents the cursor returned, asserting none came twice */
+        static unsigned distinct( auto_ptr< DBClientCursor > c ) {
+            set< int > found;
+            int n = 0;
+            while( c->more() ) {
+                found.insert( c->next()[ "i" ].numberInt() );
+                ++n;
+            }
+            ASSERT_EQUALS( (unsigned) n, found.size() );
+            return found.size();
+        }
+    };
+
     class EmbeddedArray : public ClientBase {
     public:
         ~EmbeddedArray() {
@@ -1150,6 +1352,13 @@ namespace QueryTests {
             add< TailableQueryOnId >();
             add< OplogReplayMode >();
             add< ArrayId >();
+            add< MultikeyRemove >();
+            add< RemoveUnderOpenCursor >();
+            add< BatchInsert >();
+            add< BatchInsertDupKey >();
+#if !defined(_WIN32)
+            add< InPlaceReply >();
+#endif
             add< UnderscoreNs >();
             add< EmptyFieldSpec >();
             add< MultiNe >();
@@ -1167,6 +1376,7 @@ namespace QueryTests {
             add< MinMax >();
             add< DirectLocking >();
             add< FastCountIn >();
+            add< ParallelScan >();
             add< EmbeddedArray >();
             add< DifferentNumbers >();
             add< SymbolStringSame >();
@@ -19,9 +19,23 @@
 
 #include "pch.h"
 #include "../util/sock.h"
+#include "../util/message.h"
+#include "../util/message_shm.h"
+#include "../client/asyncclient.h"
+#include "../client/connpool.h"
+#include "../s/shard.h"
+#include "../db/dbmessage.h"
 
 #include "dbtests.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace mongo {
+    void assembleRequest( const string &ns, BSONObj query, int nToReturn, int nToSkip, const BSONObj *fieldsToReturn, int queryOptions, Message &toSend );
+}
+
 namespace SockTests {
 
     class HostByName {
@@ -33,11 +47,692 @@ namespace SockTests {
         }
     };
     
+#if !defined(_WIN32)
+    /** say() / recv() between ports which negotiated compression */
+    class CompressedMessages {
+    public:
+        void run() {
+            int fds[ 2 ];
+            ASSERT_EQUALS( 0, socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+            MessagingPort a( fds[ 0 ], SockAddr() );
+            MessagingPort b( fds[ 1 ], SockAddr() );
+            a.setCompression();
+            ASSERT( !b.compressing() );
+
+            string body;
+            for( int i = 0; i < 1000; ++i )
+                body += "{ name: \"something\", n: 1 } ";
+
+            // the first message after setCompression() is compressed even when small...
+            Message small;
+            small.setData( dbQuery, "small" );
+            a.say( small, 1 );
+            Message r;
+            ASSERT( b.recv( r ) );
+            ASSERT_EQUALS( dbQuery, r.operation() );
+            ASSERT_EQUALS( 1, (int) r.header()->responseTo );
+            ASSERT_EQUALS( string( "small" ), r.header()->_data );
+            // ...so the other side compresses its replies too
+            ASSERT( b.compressing() );
+
+            Message reply;
+            reply.setData( opReply, body.c_str() );
+            b.say( reply, 2 );
+            r.reset();
+            ASSERT( a.recv( r ) );
+            ASSERT_EQUALS( opReply, r.operation() );
+            ASSERT_EQUALS( reply.header()->len, r.header()->len );
+            ASSERT_EQUALS( reply.header()->id, r.header()->id );
+            ASSERT_EQUALS( body, r.header()->_data );
+
+            Message compressed;
+            ASSERT( compressMessage( reply, compressed ) );
+            ASSERT( compressed.header()->len < reply.header()->len / 4 );
+            ASSERT( !compressMessage( small, compressed ) );
+        }
+    };
+
+    /** piggyBack() holds messages back for the next write, or until writeBufferMillis pass */
+    class CoalescedWrites {
+    public:
+        void run() {
+            int fds[ 2 ];
+            ASSERT_EQUALS( 0, socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+            MessagingPort a( fds[ 0 ], SockAddr() );
+            MessagingPort b( fds[ 1 ], SockAddr() );
+
+            Message insert;
+            insert.setData( dbInsert, "insert" );
+            a.piggyBack( insert );
+            ASSERT( !readable( fds[ 1 ] ) );
+
+            // say() takes the queue along
+            Message gle;
+            gle.setData( dbQuery, "getlasterror" );
+            a.say( gle );
+            Message r;
+            ASSERT( b.recv( r ) );
+            ASSERT_EQUALS( string( "insert" ), r.header()->_data );
+            r.reset();
+            ASSERT( b.recv( r ) );
+            ASSERT_EQUALS( string( "getlasterror" ), r.header()->_data );
+            ASSERT( !readable( fds[ 1 ] ) );
+
+            // nothing follows: the flusher sends it
+            Message late;
+            late.setData( dbInsert, "late" );
+            a.piggyBack( late );
+            ASSERT( !readable( fds[ 1 ] ) );
+            sleepmillis( MessagingPort::writeBufferMillis + 50 );
+            ASSERT( readable( fds[ 1 ] ) );
+            r.reset();
+            ASSERT( b.recv( r ) );
+            ASSERT_EQUALS( string( "late" ), r.header()->_data );
+        }
+    private:
+        static bool readable( int fd ) {
+            fd_set fds;
+            FD_ZERO( &fds );
+            FD_SET( fd, &fds );
+            struct timeval tv = { 0, 0 };
+            return select( fd + 1, &fds, 0, 0, &tv ) == 1;
+        }
+    };
+
+    /** the compressed first message after setCompression() can be bigger than the whole write
+        buffer, even though the message itself fit: it is sent at once
+    */
+    class PiggyBackForcedCompression {
+    public:
+        void run() {
+            int bytes = MessagingPort::writeBufferBytes;
+            MessagingPort::writeBufferBytes = 64 * 1024;
+            int fds[ 2 ];
+            ASSERT_EQUALS( 0, socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+            MessagingPort a( fds[ 0 ], SockAddr() );
+            MessagingPort b( fds[ 1 ], SockAddr() );
+            a.setCompression();
+
+            string body( MessagingPort::writeBufferBytes - 100, 0 );
+            for( unsigned i = 0; i < body.size(); ++i )
+                body[ i ] = (char) rand();
+            Message m;
+            m.setData( dbInsert, body.data(), body.size() );
+            a.piggyBack( m );
+            Message r;
+            ASSERT( b.recv( r ) );
+            ASSERT_EQUALS( (int) body.size(), r.header()->dataLen() );
+            ASSERT( memcmp( r.header()->_data, body.data(), body.size() ) == 0 );
+            MessagingPort::writeBufferBytes = bytes;
+        }
+    };
+#endif
+
+#if !defined(_WIN32)
+    /** recv() into recycled buffers against recv() mallocing every message: mallocs, and
+        time per message (logged)
+    */
+    class RecvBufferRecycling {
+    public:
+        void run() {
+            bool old = MessagingPort::recycleRecvBuffers;
+            long long mallocs;
+
+            MessagingPort::recycleRecvBuffers = false;
+            double plainSmall = receive( 200, 20000, mallocs );
+            ASSERT_EQUALS( 0, mallocs );
+            double plainLarge = receive( 256 * 1024, 200, mallocs );
+
+            MessagingPort::recycleRecvBuffers = true;
+            // at most the first one: from then on recv() gets the buffer the last message freed
+            double small = receive( 200, 20000, mallocs );
+            ASSERT( mallocs <= 1 );
+            long long largeMallocs;
+            double large = receive( 256 * 1024, 200, largeMallocs );
+            ASSERT( largeMallocs <= 1 );
+
+            log() << "recv() 200 byte messages: " << plainSmall << "us each, 20000 mallocs; recycled "
+                  << small << "us each, " << mallocs << " mallocs" << endl;
+            log() << "recv() 256KB messages: " << plainLarge << "us each, 200 mallocs; recycled "
+                  << large << "us each, " << largeMallocs << " mallocs" << endl;
+            MessagingPort::recycleRecvBuffers = old;
+        }
+    private:
+        /* @return micros per message received */
+        static double receive( int size, int n, long long& mallocs ) {
+            int fds[ 2 ];
+            ASSERT_EQUALS( 0, socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+            MessagingPort a( fds[ 0 ], SockAddr() );
+            MessagingPort b( fds[ 1 ], SockAddr() );
+            boost::thread sender( boost::bind( &RecvBufferRecycling::send, &a, size, n ) );
+
+            long long before = messageBufferMallocs();
+            Timer t;
+            Message m;
+            for( int i = 0; i < n; ++i ) {
+                m.reset();
+                ASSERT( b.recv( m ) );
+                ASSERT_EQUALS( size + MsgDataHeaderSize, m.header()->len );
+            }
+            double micros = (double) t.micros() / n;
+            mallocs = messageBufferMallocs() - before;
+            sender.join();
+            return micros;
+        }
+        static void send( MessagingPort *p, int size, int n ) {
+            string body( size, 'x' );
+            for( int i = 0; i < n; ++i ) {
+                Message m;
+                m.setData( dbInsert, body.data(), size );
+                p->say( m );
+            }
+        }
+    };
+
+    /** AsyncConnection: requests in flight together, replies matched out of order */
+    class AsyncPipelining {
+    public:
+        void run() {
+            int listener = socket( AF_INET, SOCK_STREAM, 0 );
+            ASSERT( listener >= 0 );
+            SockAddr any( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, ::bind( listener, any.raw(), any.addressSize ) );
+            ASSERT_EQUALS( 0, listen( listener, 1 ) );
+            SockAddr bound( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, getsockname( listener, bound.raw(), &bound.addressSize ) );
+
+            boost::thread server( boost::bind( &AsyncPipelining::reverseServer, listener ) );
+            AsyncClient loop;
+            string errmsg;
+            shared_ptr<AsyncConnection> c = loop.connect( bound.toString(), errmsg );
+            ASSERT( c );
+
+            vector< shared_ptr<AsyncReply> > replies;
+            for( int i = 0; i < N; ++i )
+                replies.push_back( c->runCommand( "admin", BSON( "n" << i ) ) );
+            for( int i = 0; i < N; ++i ) {
+                ASSERT( replies[ i ]->join() );
+                ASSERT_EQUALS( i, replies[ i ]->firstDocument()[ "n" ].numberInt() );
+            }
+
+            // the server hangs up after N: whatever is sent next fails
+            server.join();
+            shared_ptr<AsyncReply> r = c->runCommand( "admin", BSON( "n" << N ) );
+            ASSERT( !r->join() );
+            ASSERT( c->isFailed() );
+            closesocket( listener );
+        }
+    private:
+        enum { N = 5 };
+        /* answers only once all N queries are in, last first, echoing each */
+        static void reverseServer( int listener ) {
+            MessagingPort p( accept( listener, 0, 0 ), SockAddr() );
+            Message m[ N ];
+            for( int i = 0; i < N; ++i )
+                if ( !p.recv( m[ i ] ) )
+                    return;
+            for( int i = N - 1; i >= 0; --i ) {
+                DbMessage d( m[ i ] );
+                QueryMessage q( d );
+                BSONObj echo = BSON( "ok" << 1 << "n" << q.query[ "n" ].numberInt() );
+                BufBuilder b;
+                b.skip( sizeof( QueryResult ) );
+                b.append( (void *) echo.objdata(), echo.objsize() );
+                QueryResult *qr = (QueryResult *) b.buf();
+                qr->_resultFlags() = 0;
+                qr->cursorId = 0;
+                qr->startingFrom = 0;
+                qr->nReturned = 1;
+                qr->len = b.len();
+                qr->setOperation( opReply );
+                b.decouple();
+                Message reply;
+                reply.setData( qr, true );
+                p.reply( m[ i ], reply );
+            }
+        }
+    };
+
+    class PoolLimit {
+    public:
+        void run() {
+            // nothing accepts: connect() completes on the listen backlog, which is all the
+            // pool needs here
+            int listener = socket( AF_INET, SOCK_STREAM, 0 );
+            ASSERT( listener >= 0 );
+            SockAddr any( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, ::bind( listener, any.raw(), any.addressSize ) );
+            ASSERT_EQUALS( 0, listen( listener, 8 ) );
+            SockAddr bound( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, getsockname( listener, bound.raw(), &bound.addressSize ) );
+            string host = bound.toString();
+
+            int oldMax = DBConnectionPool::maxPerHost;
+            int oldWait = DBConnectionPool::maxWaitMillis;
+            DBConnectionPool::maxPerHost = 2;
+            DBConnectionPool::maxWaitMillis = 50;
+            {
+                DBConnectionPool p;
+                DBClientBase *a = p.get( host );
+                DBClientBase *b = p.get( host );
+                ASSERT_EXCEPTION( p.get( host ), UserException );
+
+                // a connection coming back is handed out again, most recent first
+                p.release( host, b );
+                ASSERT( p.get( host ) == b );
+
+                // a discarded one frees its slot
+                p.discard( host, a );
+                DBClientBase *c = p.get( host );
+                ASSERT( c != b );
+
+                BSONObjBuilder bb;
+                p.appendInfo( bb );
+                BSONObj stats = bb.obj()[ "hosts" ].Obj()[ host ].Obj();
+                ASSERT_EQUALS( 2, stats[ "inUse" ].numberInt() );
+                ASSERT_EQUALS( 0, stats[ "available" ].numberInt() );
+                ASSERT_EQUALS( 3, stats[ "created" ].numberInt() );
+                ASSERT_EQUALS( 1, stats[ "waitTimeouts" ].numberInt() );
+
+                p.release( host, b );
+                p.release( host, c );
+            }
+            DBConnectionPool::maxPerHost = oldMax;
+            DBConnectionPool::maxWaitMillis = oldWait;
+            closesocket( listener );
+        }
+    };
+
+    /** each client thread keeps its shard connections: more threads than maxPerHost must
+        not wait for each other's
+    */
+    class ThreadConnectionsOverLimit {
+    public:
+        void run() {
+            int listener = socket( AF_INET, SOCK_STREAM, 0 );
+            ASSERT( listener >= 0 );
+            SockAddr any( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, ::bind( listener, any.raw(), any.addressSize ) );
+            ASSERT_EQUALS( 0, listen( listener, 8 ) );
+            SockAddr bound( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, getsockname( listener, bound.raw(), &bound.addressSize ) );
+            string host = bound.toString();
+
+            int oldMax = DBConnectionPool::maxPerHost;
+            int oldWait = DBConnectionPool::maxWaitMillis;
+            DBConnectionPool::maxPerHost = 2;
+            DBConnectionPool::maxWaitMillis = 50;
+            holding = 0;
+            failures = 0;
+            vector< shared_ptr<boost::thread> > threads;
+            for( int i = 0; i < N; ++i )
+                threads.push_back( shared_ptr<boost::thread>( new boost::thread( boost::bind( &ThreadConnectionsOverLimit::client, host ) ) ) );
+            for( int i = 0; i < N; ++i )
+                threads[ i ]->join();
+            ASSERT_EQUALS( 0, failures );
+
+            // the threads are gone: their connections are back in the pool
+            BSONObjBuilder bb;
+            pool.appendInfo( bb );
+            BSONObj stats = bb.obj()[ "hosts" ].Obj()[ host ].Obj();
+            ASSERT_EQUALS( 0, stats[ "inUse" ].numberInt() );
+            ASSERT_EQUALS( N, stats[ "available" ].numberInt() );
+            ASSERT_EQUALS( 0, stats[ "waitTimeouts" ].numberInt() );
+
+            DBConnectionPool::maxPerHost = oldMax;
+            DBConnectionPool::maxWaitMillis = oldWait;
+            closesocket( listener );
+        }
+    private:
+        enum { N = 4 };
+        static mongo::mutex m;
+        static int holding;
+        static int failures;
+        /* two requests, keeping the connection in between, until every thread has one */
+        static void client( string host ) {
+            try {
+                ShardConnection a( host, "" );
+                a.done();
+                {
+                    scoped_lock lk( m );
+                    ++holding;
+                }
+                while( true ) {
+                    {
+                        scoped_lock lk( m );
+                        if ( holding == N )
+                            break;
+                    }
+                    sleepmillis( 1 );
+                }
+                ShardConnection b( host, "" );
+                b.done();
+            }
+            catch ( std::exception& e ) {
+                log() << "ThreadConnectionsOverLimit: " << e.what() << endl;
+                scoped_lock lk( m );
+                ++failures;
+                ++holding;
+            }
+        }
+    };
+    mongo::mutex ThreadConnectionsOverLimit::m( "ThreadConnectionsOverLimit" );
+    int ThreadConnectionsOverLimit::holding;
+    int ThreadConnectionsOverLimit::failures;
+#endif
+
+#if defined(__linux__)
+    /** the shmTransport handshake over a unix socket, then messages larger than the rings
+        through them both ways; time per round trip against the socket (logged)
+    */
+    class ShmTransport {
+    public:
+        void run() {
+            int oldRing = ShmMessagingPort::ringBytes;
+            ShmMessagingPort::ringBytes = 4096;
+
+            int fds[ 2 ];
+            ASSERT_EQUALS( 0, socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+            SockAddr local( "/tmp/mongodb-shm-test.sock", 0 );
+            boost::thread server( boost::bind( &ShmTransport::echoServer, fds[ 0 ], local ) );
+            MessagingPort c( fds[ 1 ], local );
+            double socketMicros = roundTrips( c, 200, 2000 );
+
+            Message toSend;
+            assembleRequest( "admin.$cmd", BSON( "shmTransport" << 1 ), -1, 0, 0, 0, toSend );
+            Message response;
+            ASSERT( c.call( toSend, response ) );
+            QueryResult *qr = (QueryResult *) response.singleData();
+            ASSERT_EQUALS( 1, qr->nReturned );
+            ASSERT( BSONObj( qr->data() )[ "ok" ].trueValue() );
+            auto_ptr<MessagingPort> shm( sharedMemoryPort( c, 0 ) );
+            ASSERT( shm.get() );
+            ASSERT_EQUALS( -1, shm->getSocket() );
+            c.shutdown();
+
+            // wraps around the ring several times within one message
+            roundTrips( *shm, 10000, 20 );
+            double shmMicros = roundTrips( *shm, 200, 2000 );
+            log() << "200 byte round trips: unix socket " << socketMicros << "us, shared memory "
+                  << shmMicros << "us" << endl;
+
+            // the server sees the hang up
+            shm->shutdown();
+            server.join();
+            ShmMessagingPort::ringBytes = oldRing;
+        }
+    private:
+        /* @return micros per round trip */
+        static double roundTrips( MessagingPort& p, int size, int n ) {
+            string body( size, 'x' );
+            Timer t;
+            for( int i = 0; i < n; ++i ) {
+                body[ i % size ] = (char) i;
+                Message m;
+                m.setData( dbMsg, body.data(), size );
+                Message response;
+                ASSERT( p.call( m, response ) );
+                ASSERT_EQUALS( size + MsgDataHeaderSize, response.header()->len );
+                ASSERT( memcmp( response.singleData()->_data, body.data(), size ) == 0 );
+            }
+            return (double) t.micros() / n;
+        }
+        static void echoServer( int sock, SockAddr farEnd ) {
+            auto_ptr<MessagingPort> p( new MessagingPort( sock, farEnd ) );
+            Message m;
+            while ( 1 ) {
+                m.reset();
+                if ( !p->recv( m ) )
+                    return;
+                if ( upgradeToSharedMemory( p, m ) )
+                    continue;
+                Message echo;
+                echo.setData( dbMsg, m.singleData()->_data, m.header()->dataLen() );
+                p->reply( m, echo );
+            }
+        }
+    };
+
+    /** a peer scribbling over the shared ring headers: the port closes instead of copying
+        outside the rings
+    */
+    class ShmCorruptRing {
+    public:
+        void run() {
+            // the server reading: the size and the bytes in the ring are the peer's to lie about
+            {
+                Pair p;
+                sendOne( *p.client );
+                Message m;
+                ASSERT( p.server->recv( m ) );
+                ShmRing *toServer = (ShmRing *) p.clientMem;
+                toServer->size = 0x7fffffff;
+                toServer->head = toServer->tail + 0x10000000;
+                m.reset();
+                ASSERT( !p.server->recv( m ) );
+                ASSERT( toServer->closed );
+            }
+            // the server writing: a tail which makes the ring look overfull
+            {
+                Pair p;
+                ShmRing *toClient = (ShmRing *) ( p.clientMem + sizeof( ShmRing ) + RingSize );
+                toClient->tail = toClient->head - 0x10000000;
+                ASSERT_EXCEPTION( sendOne( *p.server ), SocketException );
+                ASSERT( toClient->closed );
+            }
+        }
+    private:
+        enum { RingSize = 4096 };
+        /* two ports on a socketpair, each with its own mapping of the rings */
+        struct Pair {
+            Pair() {
+                int fds[ 2 ];
+                ASSERT_EQUALS( 0, socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+                int size = ShmMessagingPort::memBytes( RingSize );
+                char name[] = "/tmp/mongodb-shmtest-XXXXXX";
+                int fd = mkstemp( name );
+                ASSERT( fd >= 0 );
+                unlink( name );
+                ASSERT_EQUALS( 0, ftruncate( fd, size ) );
+                char *serverMem = (char *) mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+                clientMem = (char *) mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+                close( fd );
+                ASSERT( serverMem != MAP_FAILED && clientMem != MAP_FAILED );
+                ShmMessagingPort::initRings( serverMem, RingSize );
+                SockAddr local( "/tmp/mongodb-shm-test.sock", 0 );
+                server.reset( new ShmMessagingPort( fds[ 0 ], local, serverMem, RingSize, true ) );
+                client.reset( new ShmMessagingPort( fds[ 1 ], local, clientMem, RingSize, false ) );
+            }
+            auto_ptr<ShmMessagingPort> server;
+            auto_ptr<ShmMessagingPort> client;
+            char *clientMem; // unmapped by client
+        };
+        static void sendOne( MessagingPort& p ) {
+            string body( 100, 'x' );
+            Message m;
+            m.setData( dbMsg, body.data(), body.size() );
+            p.say( m );
+        }
+    };
+#endif
+
+#if !defined(_WIN32)
+    /* serves one cursor on n : 0 .. Total - 1, FirstBatch in the query's reply */
+    class CursorServer {
+    public:
+        enum { FirstBatch = 10, Total = 1000 };
+        CursorServer( int delayMillis = 0 ) : _delayMillis( delayMillis ), _getMores() {
+            _listener = socket( AF_INET, SOCK_STREAM, 0 );
+            ASSERT( _listener >= 0 );
+            SockAddr any( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, ::bind( _listener, any.raw(), any.addressSize ) );
+            ASSERT_EQUALS( 0, listen( _listener, 1 ) );
+            SockAddr bound( "127.0.0.1", 0 );
+            ASSERT_EQUALS( 0, getsockname( _listener, bound.raw(), &bound.addressSize ) );
+            _address = bound.toString();
+            _thread.reset( new boost::thread( boost::bind( &CursorServer::serve, this ) ) );
+        }
+        ~CursorServer() {
+            _thread->join();
+            closesocket( _listener );
+        }
+        string address() const { return _address; }
+        int getMores() const { return _getMores; }
+        /** the batch size each getMore asked for.  only once the client disconnected */
+        const vector< int >& getMoreSizes() const { return _sizes; }
+    private:
+        void serve() {
+            MessagingPort p( accept( _listener, 0, 0 ), SockAddr() );
+            int sent = 0;
+            Message m;
+            while ( 1 ) {
+                m.reset();
+                if ( !p.recv( m ) )
+                    return;
+                int n;
+                if ( m.operation() == dbQuery ) {
+                    n = FirstBatch;
+                }
+                else if ( m.operation() == dbGetMore ) {
+                    DbMessage d( m );
+                    d.getns();
+                    n = d.pullInt();
+                    ASSERT( n > 0 );
+                    _sizes.push_back( n );
+                    _getMores = _getMores + 1;
+                }
+                else {
+                    continue;
+                }
+                if ( _delayMillis )
+                    sleepmillis( _delayMillis );
+                n = min( n, (int) Total - sent );
+                BufBuilder b;
+                b.skip( sizeof( QueryResult ) );
+                for( int i = 0; i < n; ++i ) {
+                    BSONObj o = BSON( "n" << sent++ );
+                    b.append( (void *) o.objdata(), o.objsize() );
+                }
+                QueryResult *qr = (QueryResult *) b.buf();
+                qr->_resultFlags() = 0;
+                qr->cursorId = sent < Total ? 1 : 0;
+                qr->startingFrom = sent - n;
+                qr->nReturned = n;
+                qr->len = b.len();
+                qr->setOperation( opReply );
+                b.decouple();
+                Message reply;
+                reply.setData( qr, true );
+                p.reply( m, reply );
+            }
+        }
+        int _listener;
+        string _address;
+        int _delayMillis;
+        volatile int _getMores;
+        vector< int > _sizes;
+        auto_ptr< boost::thread > _thread;
+    };
+
+    /** DBClientCursor::setReadAhead(): the getMore is out before the batch is used up, and
+        the documents still come in order
+    */
+    class ReadAhead {
+    public:
+        void run() {
+            CursorServer server;
+            DBClientConnection c;
+            string errmsg;
+            ASSERT( c.connect( server.address(), errmsg ) );
+            auto_ptr<DBClientCursor> cursor = c.query( "test.readahead", Query() );
+            cursor->setReadAhead( true );
+            int n = 0;
+            for( ; n < CursorServer::FirstBatch / 2; ++n )
+                ASSERT_EQUALS( n, cursor->next()[ "n" ].numberInt() );
+            // half way: the getMore went out without more() waiting for it
+            sleepmillis( 100 );
+            ASSERT_EQUALS( 1, server.getMores() );
+            ASSERT( cursor->moreInCurrentBatch() );
+            for( ; cursor->more(); ++n )
+                ASSERT_EQUALS( n, cursor->next()[ "n" ].numberInt() );
+            ASSERT_EQUALS( (int) CursorServer::Total, n );
+        }
+    };
+
+    /** read ahead batches are sized by how fast next() is called against the round trip */
+    class ReadAheadBatchSize {
+    public:
+        void run() {
+            int bytes = DBClientCursor::readAheadBatchBytes;
+            DBClientCursor::readAheadBatchBytes = 1200;
+            // a slow server and a fast reader: as big as readAheadBatchBytes lets it be
+            ASSERT_EQUALS( 1200 / DocBytes, firstGetMore( 20, 0 ) );
+            // a reader slower than the round trip: the least there is
+            ASSERT_EQUALS( 16, firstGetMore( 0, 5 ) );
+            DBClientCursor::readAheadBatchBytes = bytes;
+        }
+    private:
+        enum { DocBytes = 12 }; // { n : <int> }
+        static int firstGetMore( int serverDelayMillis, int millisPerDoc ) {
+            CursorServer server( serverDelayMillis );
+            {
+                DBClientConnection c;
+                string errmsg;
+                ASSERT( c.connect( server.address(), errmsg ) );
+                auto_ptr<DBClientCursor> cursor = c.query( "test.readahead", Query() );
+                cursor->setReadAhead( true );
+                for( int i = 0; i < CursorServer::FirstBatch / 2; ++i ) {
+                    sleepmillis( millisPerDoc );
+                    cursor->next();
+                }
+            }
+            ASSERT( !server.getMoreSizes().empty() );
+            return server.getMoreSizes()[ 0 ];
+        }
+    };
+
+    /** a read ahead getMore which can't be sent leaves the batch to finish, then more() fails */
+    class ReadAheadSendFails {
+    public:
+        void run() {
+            CursorServer server;
+            DBClientConnection c;
+            string errmsg;
+            ASSERT( c.connect( server.address(), errmsg ) );
+            auto_ptr<DBClientCursor> cursor = c.query( "test.readahead", Query() );
+            cursor->setReadAhead( true );
+            ASSERT_EQUALS( 0, shutdown( c.port().getSocket(), SHUT_WR ) );
+            int n = 0;
+            for( ; n < CursorServer::FirstBatch; ++n )
+                ASSERT_EQUALS( n, cursor->next()[ "n" ].numberInt() );
+            ASSERT_EXCEPTION( cursor->more(), SocketException );
+        }
+    };
+#endif
+
     class All : public Suite {
     public:
         All() : Suite( "sock" ){}
         void setupTests(){
             add< HostByName >();
+#if !defined(_WIN32)
+            add< CompressedMessages >();
+            add< CoalescedWrites >();
+            add< PiggyBackForcedCompression >();
+            add< RecvBufferRecycling >();
+            add< AsyncPipelining >();
+            add< PoolLimit >();
+            add< ThreadConnectionsOverLimit >();
+#endif
+#if defined(__linux__)
+            add< ShmTransport >();
+            add< ShmCorruptRing >();
+#endif
+#if !defined(_WIN32)
+            add< ReadAhead >();
+            add< ReadAheadBatchSize >();
+            add< ReadAheadSendFails >();
+#endif
         }
     } myall;
     
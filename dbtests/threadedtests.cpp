@@ -83,6 +83,37 @@ namespace ThreadedTests {
         }
     };
 
+    class OIDGeneration : public ThreadedTest<> {
+        static const int iterations = 100000;
+        mongo::mutex _m;
+        set< string > _all;
+        int _outOfOrder;
+
+        void subthread(){
+            vector< OID > mine;
+            mine.reserve( iterations );
+            for(int i=0; i < iterations; i++)
+                mine.push_back( OID::gen() );
+            // within a second a thread's oids increase (barring the counter wrapping)
+            int outOfOrder = 0;
+            for(int i=1; i < iterations; i++){
+                if ( mine[i].asTimeT() == mine[i-1].asTimeT() &&
+                     memcmp( mine[i-1].getData(), mine[i].getData(), 12 ) >= 0 )
+                    outOfOrder++;
+            }
+            scoped_lock lk( _m );
+            for(int i=0; i < iterations; i++)
+                _all.insert( string( (const char *) mine[i].getData(), 12 ) );
+            _outOfOrder += outOfOrder;
+        }
+        void validate(){
+            ASSERT_EQUALS( _all.size(), unsigned(nthreads * iterations) );
+            ASSERT( _outOfOrder <= nthreads );
+        }
+    public:
+        OIDGeneration() : _m( "OIDGeneration" ), _outOfOrder() {}
+    };
+
     class MVarTest : public ThreadedTest<> {
         static const int iterations = 10000;
         MVar<int> target;
@@ -144,6 +175,7 @@ namespace ThreadedTests {
 
         void setupTests(){
             add< IsAtomicUIntAtomic >();
+            add< OIDGeneration >();
             add< MVarTest >();
             add< ThreadPoolTest >();
             add< LockTest >();
@@ -274,6 +274,44 @@ namespace UpdateTests {
         }
     };
 
+    class MultiIncMoves : public SetBase {
+    public:
+        void run(){
+            client().ensureIndex( ns(), BSON( "y" << 1 ) );
+            for( int i = 0; i < 1000; ++i )
+                client().insert( ns(), BSON( "_id" << i << "x" << 0 << "y" << i ) );
+
+            // growing every document moves most of them, each must still be updated once
+            client().update( ns() , BSONObj() , BSON( "$inc" << BSON( "x" << 1 ) << "$set" << BSON( "s" << string( 500, 'a' ) ) ) , false , true );
+            ASSERT_EQUALS( 1000U , client().count( ns() , BSON( "x" << 1 ) ) );
+
+            // and through an index on a modified field
+            client().update( ns() , fromjson( "{y:{$gte:0}}" ) , BSON( "$inc" << BSON( "y" << 1000 ) ) , false , true );
+            ASSERT_EQUALS( 1000U , client().count( ns() , fromjson( "{y:{$gte:1000}}" ) ) );
+            ASSERT_EQUALS( 0U , client().count( ns() , fromjson( "{y:{$gte:2000}}" ) ) );
+        }
+    };
+
+    /** growing in place into a big record's padding stops at the object size limit as a move does */
+    class GrowInPlaceSizeLimit : public SetBase {
+    public:
+        void run() {
+            client().insert( ns(), BSON( "_id" << 0 ) );
+            {
+                dblock lk;
+                Client::Context ctx( ns() );
+                nsdetails( ns() )->paddingFactor = 1.5;
+            }
+            client().insert( ns(), BSON( "_id" << 1 << "a" << string( 3584 * 1024, 'a' ) ) );
+            client().update( ns(), BSON( "_id" << 1 ), BSON( "$set" << BSON( "b" << string( 600 * 1024, 'b' ) ) ) );
+            ASSERT( error() );
+            ASSERT( !client().findOne( ns(), BSON( "_id" << 1 ) ).hasField( "b" ) );
+            client().update( ns(), BSON( "_id" << 1 ), BSON( "$set" << BSON( "b" << string( 400 * 1024, 'b' ) ) ) );
+            ASSERT( !error() );
+            ASSERT( client().findOne( ns(), BSON( "_id" << 1 ) ).hasField( "b" ) );
+        }
+    };
+
     class UnorderedNewSet : public SetBase {
     public:
         void run() {
@@ -555,6 +593,23 @@ namespace UpdateTests {
                 BSONObj out = set.prepare(in)->createNewFromMods();
                 ASSERT_EQUALS( wanted , out );
             }
+
+            /* applies the mods in place, with padding bytes free after the object */
+            void testInPlace( BSONObj morig , BSONObj in , BSONObj wanted , int padding ){
+                BSONObj m = morig.copy();
+                ModSet set(m);
+
+                BufBuilder b;
+                char *p = b.skip( in.objsize() + padding );
+                memcpy( p , in.objdata() , in.objsize() );
+                BSONObj target( p );
+
+                auto_ptr<ModSetState> mss = set.prepare( target );
+                ASSERT( mss->canApplyInPlace( padding ) );
+                mss->applyModsInPlace();
+                ASSERT( target.valid() );
+                ASSERT_EQUALS( wanted , target );
+            }
         };
         
         class inc1 : public Base {
@@ -598,6 +653,53 @@ namespace UpdateTests {
             }
         };
 
+        class inplace1 : public Base {
+        public:
+            void run(){
+                // $inc widening an int
+                BSONObj m = BSON( "$inc" << BSON( "x" << 5000000000LL ) );
+                testInPlace( m , BSON( "x" << 1 << "y" << 2 ) , BSON( "x" << 5000000001LL << "y" << 2 ) , 4 );
+                m = BSON( "$inc" << BSON( "a.x" << 1.5 ) );
+                testInPlace( m , BSON( "a" << BSON( "x" << 1 ) << "y" << 2 ) , BSON( "a" << BSON( "x" << 2.5 ) << "y" << 2 ) , 4 );
+                m = BSON( "$inc" << BSON( "x" << 1.5 ) );
+                testInPlace( m , BSON( "x" << 1LL << "y" << 2 ) , BSON( "x" << 2.5 << "y" << 2 ) , 0 );
+
+                m = BSON( "$inc" << BSON( "x" << 5000000000LL ) );
+                ASSERT( ! ModSet( m ).prepare( BSON( "x" << 1 ) )->canApplyInPlace( 3 ) );
+            }
+        };
+
+        class inplace2 : public Base {
+        public:
+            void run(){
+                // $set of a value with a different size or type
+                BSONObj m = BSON( "$set" << BSON( "x" << "abcdef" ) );
+                testInPlace( m , BSON( "x" << "abc" << "y" << 2 ) , BSON( "x" << "abcdef" << "y" << 2 ) , 3 );
+                testInPlace( m , BSON( "x" << "abcdefghi" << "y" << 2 ) , BSON( "x" << "abcdef" << "y" << 2 ) , 0 );
+                testInPlace( m , BSON( "x" << 5 << "y" << 2 ) , BSON( "x" << "abcdef" << "y" << 2 ) , 7 );
+                m = BSON( "$set" << BSON( "a.b.x" << 5.5 ) );
+                testInPlace( m , fromjson( "{a:{b:{x:'abcdefghijk',y:1},c:2},d:3}" ) , fromjson( "{a:{b:{x:5.5,y:1},c:2},d:3}" ) , 0 );
+
+                m = BSON( "$set" << BSON( "x" << "abcdef" ) );
+                ASSERT( ! ModSet( m ).prepare( BSON( "x" << "abc" ) )->canApplyInPlace( 2 ) );
+            }
+        };
+
+        class inplace3 : public Base {
+        public:
+            void run(){
+                // $push and $pushAll onto an existing array
+                BSONObj m = BSON( "$push" << BSON( "a" << 5 ) );
+                testInPlace( m , fromjson( "{a:[1],b:2}" ) , fromjson( "{a:[1,5],b:2}" ) , 7 );
+                m = BSON( "$pushAll" << BSON( "a.b" << BSON_ARRAY( 5 << "x" ) ) );
+                testInPlace( m , fromjson( "{a:{b:[]},c:2}" ) , fromjson( "{a:{b:[5,'x']},c:2}" ) , 64 );
+
+                // several mods, each moving what follows
+                m = fromjson( "{$set:{a:'abc',c:{x:1}},$inc:{b:1.5},$push:{d:4}}" );
+                testInPlace( m , fromjson( "{a:'',b:1,c:1,d:[1,2,3],e:1}" ) , fromjson( "{a:'abc',b:2.5,c:{x:1},d:[1,2,3,4],e:1}" ) , 64 );
+            }
+        };
+
     };
 
     namespace basic {
@@ -788,6 +890,8 @@ namespace UpdateTests {
             add< SetAdjacentDotted >();
             add< IncMissing >();
             add< MultiInc >();
+            add< MultiIncMoves >();
+            add< GrowInPlaceSizeLimit >();
             add< UnorderedNewSet >();
             add< UnorderedNewSetAdjacent >();
             add< ArrayEmbeddedSet >();
@@ -821,6 +925,9 @@ namespace UpdateTests {
             add< ModSetTests::inc2 >();
             add< ModSetTests::set1 >();
             add< ModSetTests::push1 >();
+            add< ModSetTests::inplace1 >();
+            add< ModSetTests::inplace2 >();
+            add< ModSetTests::inplace3 >();
             
             add< basic::inc1 >();
             add< basic::inc2 >();
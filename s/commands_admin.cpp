@@ -781,6 +781,8 @@ namespace mongo {
             virtual bool run(const string& , BSONObj& cmdObj, string& errmsg, BSONObjBuilder& result, bool) {
                 result.append("ismaster", 1.0 );
                 result.append("msg", "isdbgrid");
+                if ( acceptsWireCompression( cmdObj ) )
+                    appendWireCompression( result );
                 return true;
             }
         } ismaster;
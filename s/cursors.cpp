@@ -57,6 +57,7 @@ namespace mongo {
             maxSize *= 3;
         
         BufBuilder b(32768);
+        b.skip( sizeof( QueryResult ) );
         
         int num = 0;
         bool sendMore = true;
@@ -67,7 +68,7 @@ namespace mongo {
             b.append( (void*)o.objdata() , o.objsize() );
             num++;
             
-            if ( b.len() > maxSize ){
+            if ( b.len() - (int)sizeof( QueryResult ) > maxSize ){
                 break;
             }
 
@@ -86,7 +87,17 @@ namespace mongo {
         bool hasMore = sendMore && _cursor->more();
         log(6) << "\t hasMore:" << hasMore << " wouldSendMoreIfHad: " << sendMore << " id:" << _id << " totalSent: " << _totalSent << endl;
         
-        replyToQuery( 0 , r.p() , r.m() , b.buf() , b.len() , num , _totalSent , hasMore ? _id : 0 );
+        QueryResult *qr = (QueryResult *) b.buf();
+        qr->_resultFlags() = 0;
+        qr->len = b.len();
+        qr->setOperation( opReply );
+        qr->cursorId = hasMore ? _id : 0;
+        qr->startingFrom = _totalSent;
+        qr->nReturned = num;
+        b.decouple();
+        Message resp( qr , true );
+        // through Request so an exhaust stream chains its replies
+        r.reply( resp );
         _totalSent += num;
         _done = ! hasMore;
         
@@ -41,6 +41,8 @@ namespace mongo {
         
         assert( _d.getns() );
         _id = _m.header()->id;
+        _responseTo = _id;
+        _exhaust = _m.operation() == dbQuery && ( _d.reservedField() & QueryOption_Exhaust );
         
         _clientId = p ? p->getClientId() : 0;
         _clientInfo = ClientInfo::get( _clientId );
@@ -147,7 +149,13 @@ namespace mongo {
         if ( cursor ){
             cursorCache.storeRef( fromServer , cursor );
         }
-        _p->reply( _m , response , _id );
+        reply( response );
+    }
+
+    void Request::reply( Message & response ){
+        _p->reply( _m , response , _responseTo );
+        if ( _exhaust )
+            _responseTo = response.header()->id;
     }
     
     ClientInfo::ClientInfo( int clientId ) : _id( clientId ){
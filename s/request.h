@@ -48,6 +48,13 @@ namespace mongo {
         }
         bool isCommand() const;
 
+        /** a query with QueryOption_Exhaust: answered by a stream of replies, each answering
+            the one before as mongod's do, with no getMore in between
+        */
+        bool isExhaust() const {
+            return _exhaust;
+        }
+
         MSGID id() const {
             return _id;
         }
@@ -78,6 +85,8 @@ namespace mongo {
         // ---- low level access ----
 
         void reply( Message & response , const string& fromServer );
+        /** for replies mongos makes itself */
+        void reply( Message & response );
         
         Message& m() { return _m; }
         DbMessage& d() { return _d; }
@@ -96,6 +105,8 @@ namespace mongo {
         AbstractMessagingPort* _p;
         
         MSGID _id;
+        MSGID _responseTo; // _id, or the last reply of an exhaust stream
+        bool _exhaust;
         DBConfigPtr _config;
         ChunkManagerPtr _chunkManager;
         
@@ -168,6 +168,8 @@ int main(int argc, char* argv[], char *envp[] ) {
         ( "test" , "just run unit tests" )
         ( "upgrade" , "upgrade meta data version" )
         ( "chunkSize" , po::value<int>(), "maximum amount of data per chunk" )
+        ( "workers" , po::value<int>(), "linux: serve connections from one epoll thread and this many worker threads, instead of a thread per connection" )
+        ( "maxConnsPerHost" , po::value<int>(), "most connections to open to one server; beyond that requests wait for one to come free" )
         ;
     
 
@@ -190,6 +192,10 @@ int main(int argc, char* argv[], char *envp[] ) {
         Chunk::MaxChunkSize = params["chunkSize"].as<int>() * 1024 * 1024;
     }
 
+    if ( params.count( "maxConnsPerHost" ) ){
+        DBConnectionPool::maxPerHost = params["maxConnsPerHost"].as<int>();
+    }
+
     if ( params.count( "test" ) ){
         logLevel = 5;
         UnitTest::runTests();
@@ -264,6 +270,8 @@ int main(int argc, char* argv[], char *envp[] ) {
     MessageServer::Options opts;
     opts.port = cmdLine.port;
     opts.ipList = params["bind_ip"].as<string>();
+    if ( params.count( "workers" ) )
+        opts.workers = params["workers"].as<int>();
     start(opts);
 
     dbexit( EXIT_CLEAN );
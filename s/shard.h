@@ -192,6 +192,9 @@ namespace mongo {
         void done();
         void kill();
 
+        /** the caller takes the connection over: it discards it or releases it to the pool */
+        DBClientBase* release();
+
         DBClientBase& conn(){
             assert( _conn );
             return *_conn;
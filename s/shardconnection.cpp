@@ -63,7 +63,7 @@ namespace mongo {
                 assert( ss );
                 std::stack<DBClientBase*>& s = ss->avail;
                 while ( ! s.empty() ){
-                    pool.release( addr , s.top() );
+                    release( addr , s.top() );
                     s.pop();
                 }
                 delete ss;
@@ -71,6 +71,12 @@ namespace mongo {
             _hosts.clear();
         }
         
+        /* a client's thread keeps its connections across requests - getLastError has to go
+           to the connection the write went on - and there is a thread per client, so they
+           are kept out of the pool's maxPerHost: counted, more clients than that would wait
+           for connections that only come back when a client goes away.
+           forget() on the way in, adopt() on the way back to the pool.
+        */
         DBClientBase * get( const string& addr ){
             scoped_lock lk( _mutex );
             Status* &s = _hosts[addr];
@@ -89,7 +95,9 @@ namespace mongo {
 
             debug() << "CREATING NEW CONNECTION" << endl;
             s->created++;
-            return pool.get( addr );
+            DBClientBase* c = pool.get( addr );
+            pool.forget( addr );
+            return c;
         }
         
         void done( const string& addr , DBClientBase* conn ){
@@ -114,7 +122,7 @@ namespace mongo {
                 while ( ! s.empty() ){
                     DBClientBase* conn = s.top();
                     conn->getLastError();
-                    pool.release( addr , conn );
+                    release( addr , conn );
                     s.pop();
                 }
                 delete ss;
@@ -122,6 +130,11 @@ namespace mongo {
             _hosts.clear();
         }
         
+        static void release( const string& addr , DBClientBase* conn ){
+            pool.adopt( addr );
+            pool.release( addr , conn );
+        }
+
         map<string,Status*> _hosts;
         mongo::mutex _mutex;
 
@@ -175,11 +188,20 @@ namespace mongo {
 
     void ShardConnection::kill(){
         if ( _conn ){
+            // not counted by the pool, see ClientConnections::get()
             delete _conn;
             _conn = 0;
         }
     }
 
+    DBClientBase* ShardConnection::release(){
+        DBClientBase* c = _conn;
+        _conn = 0;
+        if ( c )
+            pool.adopt( _addr );
+        return c;
+    }
+
     void ShardConnection::sync(){
         ClientConnections::get()->sync();
     }
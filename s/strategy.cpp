@@ -42,9 +42,18 @@ namespace mongo {
         try{
             ShardConnection dbcon( shard , r.getns() );
             DBClientBase &c = dbcon.conn();
+
+            // only a plain connection can recv() a stream, others are sent getMores
+            bool stream = r.isExhaust() && dynamic_cast< DBClientConnection* >( &c );
+            Message toSend;
+            if ( r.isExhaust() && ! stream ){
+                MsgData *d = r.m().singleData();
+                toSend.setData( dbQuery , d->_data , d->dataLen() );
+                *( (int *) toSend.singleData()->_data ) &= ~QueryOption_Exhaust;
+            }
             
             Message response;
-            bool ok = c.call( r.m(), response);
+            bool ok = c.call( toSend.empty() ? r.m() : toSend , response);
 
             {
                 QueryResult *qr = (QueryResult *) response.singleData();
@@ -55,7 +64,37 @@ namespace mongo {
             }
 
             uassert( 10200 , "mongos: error calling db", ok);
-            r.reply( response , c.getServerAddress() );
+            if ( ! r.isExhaust() ){
+                r.reply( response , c.getServerAddress() );
+                dbcon.done();
+                return;
+            }
+
+            // relay the shard's stream as it comes; the client doesn't ask for more, so the
+            // cursor isn't cached.  if this throws the connection is killed, not pooled mid-stream
+            while ( 1 ){
+                long long cursor = response.header()->getCursor();
+                r.reply( response );
+                if ( ! cursor )
+                    break;
+                Message more;
+                if ( stream ){
+                    c.recv( more );
+                }
+                else {
+                    BufBuilder b;
+                    b.append( 0 );
+                    b.append( r.getns() );
+                    b.append( 0 );
+                    b.append( cursor );
+                    Message getMore;
+                    getMore.setData( dbGetMore , b.buf() , b.len() );
+                    uassert( 10200 , "mongos: error calling db" , c.call( getMore , more ) );
+                }
+                uassert( 13334 , "mongos: exhaust stream from db ended early" , ! more.empty() );
+                response.reset();
+                response = more;
+            }
             dbcon.done();
         }
         catch ( AssertionException& e ) {
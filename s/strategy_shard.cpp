@@ -86,6 +86,12 @@ namespace mongo {
             }
 
             ShardedClientCursorPtr cc (new ShardedClientCursor( q , cursor ));
+            if ( r.isExhaust() ){
+                // the client gets every batch without asking, so the cursor is never cached
+                while ( cc->sendNextBatch( r ) )
+                    ;
+                return;
+            }
             if ( ! cc->sendNextBatch( r ) ){
                 return;
             }
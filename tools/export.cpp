@@ -106,6 +106,7 @@ public:
             out << '[';
 
         long long num = 0;
+        StringBuilder buf;
         while ( cursor->more() ) {
             num++;
             BSONObj obj = cursor->next();
@@ -115,7 +116,9 @@ public:
                         out << ",";
                     const BSONElement & e = obj.getFieldDotted(i->c_str());
                     if ( ! e.eoo() ){
-                        out << e.jsonString( Strict , false );
+                        buf.reset();
+                        e.jsonString( buf , Strict , false );
+                        out.write( buf.data() , buf.len() );
                     }
                 }
                 out << endl;
@@ -124,7 +127,9 @@ public:
                 if (jsonArray && num != 1)
                     out << ',';
 
-                out << obj.jsonString();
+                buf.reset();
+                obj.jsonString( buf );
+                out.write( buf.data() , buf.len() );
 
                 if (!jsonArray)
                     out << endl;
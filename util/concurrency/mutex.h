@@ -166,6 +166,14 @@ namespace mongo {
         private:
             boost::mutex::scoped_lock _l;
         };
+        /* locks only if nobody holds the mutex - check locked() */
+        class try_lock : boost::noncopyable {
+        public:
+            try_lock( mongo::mutex &m ) : _l( m.boost(), boost::try_to_lock ) { }
+            bool locked() const { return _l.owns_lock(); }
+        private:
+            boost::mutex::scoped_try_lock _l;
+        };
     private:
         boost::mutex &boost() { return *_m; }
         boost::mutex *_m;
@@ -402,6 +402,36 @@ namespace mongo {
         boost::thread_specific_ptr<T> _val;
     };
 
+    /* a T per thread, made on its first use there and deleted when the thread exits.  for
+       caches which static constructors and destructors may use too, e.g. of buffers.
+       declare it at namespace scope and init() it from a static initializer:
+         static ThreadLocalCache<Foo> foos;
+         static bool foosReady = foos.init();
+       it has no constructor, so it is zero until the first use, however early, makes its
+       thread_specific_ptr - at the latest while static initialization still runs on one
+       thread.  that is never deleted, as a static destructor may use it late.
+    */
+    template<class T>
+    struct ThreadLocalCache {
+        bool init() {
+            if ( ! _slot )
+                _slot = new boost::thread_specific_ptr<T>();
+            return true;
+        }
+
+        T& get() {
+            init();
+            T *t = _slot->get();
+            if ( ! t ) {
+                t = new T();
+                _slot->reset( t );
+            }
+            return *t;
+        }
+
+        boost::thread_specific_ptr<T> *_slot;
+    };
+
     class ProgressMeter : boost::noncopyable {
     public:
         ProgressMeter( long long total , int secondsBetween = 3 , int checkInterval = 100 ){
@@ -0,0 +1,217 @@
+// util/lz4.cpp
+
+/*    Copyright 2009 10gen Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "pch.h"
+#include "lz4.h"
+#include "unittest.h"
+
+namespace mongo {
+    namespace lz4 {
+
+        enum {
+            MinMatch = 4,
+            LastLiterals = 5,   // the block always ends with this many literals
+            MatchLimit = 12,    // a match may not start closer than this to the end
+            MaxOffset = 65535,
+            HashLog = 12
+        };
+
+        inline unsigned read32( const unsigned char *p ) {
+            unsigned x;
+            memcpy( &x, p, 4 );
+            return x;
+        }
+
+        inline unsigned hash( unsigned seq ) {
+            return ( seq * 2654435761U ) >> ( 32 - HashLog );
+        }
+
+        /* lengths of 15 or more continue in the bytes after the token */
+        inline unsigned char *writeLength( unsigned char *op, int len ) {
+            for( len -= 15; len >= 255; len -= 255 )
+                *op++ = 255;
+            *op++ = (unsigned char) len;
+            return op;
+        }
+
+        inline unsigned char *writeLiterals( unsigned char *op, const unsigned char *lit, int len, unsigned char **token ) {
+            *token = op++;
+            **token = (unsigned char) ( ( len < 15 ? len : 15 ) << 4 );
+            if ( len >= 15 )
+                op = writeLength( op, len );
+            memcpy( op, lit, len );
+            return op + len;
+        }
+
+        int compress( const char *in, int n, char *out ) {
+            const unsigned char *src = (const unsigned char *) in;
+            unsigned char *op = (unsigned char *) out;
+            unsigned char *token;
+            int anchor = 0;
+
+            if ( n > MatchLimit ) {
+                int table[ 1 << HashLog ];
+                for( int i = 0; i < ( 1 << HashLog ); ++i )
+                    table[ i ] = -1;
+
+                const int lastStart = n - MatchLimit;
+                const int matchEnd = n - LastLiterals;
+                int ip = 0;
+                int misses = 0;
+                while( ip <= lastStart ) {
+                    unsigned seq = read32( src + ip );
+                    unsigned h = hash( seq );
+                    int ref = table[ h ];
+                    table[ h ] = ip;
+                    if ( ref < 0 || ip - ref > MaxOffset || read32( src + ref ) != seq ) {
+                        // skip faster through data which doesn't compress
+                        ip += 1 + ( misses++ >> 6 );
+                        continue;
+                    }
+                    misses = 0;
+
+                    int len = MinMatch;
+                    while( ip + len < matchEnd && src[ ref + len ] == src[ ip + len ] )
+                        ++len;
+
+                    op = writeLiterals( op, src + anchor, ip - anchor, &token );
+                    int offset = ip - ref;
+                    *op++ = (unsigned char) offset;
+                    *op++ = (unsigned char) ( offset >> 8 );
+                    int m = len - MinMatch;
+                    *token |= (unsigned char) ( m < 15 ? m : 15 );
+                    if ( m >= 15 )
+                        op = writeLength( op, m );
+
+                    ip += len;
+                    anchor = ip;
+                }
+            }
+
+            op = writeLiterals( op, src + anchor, n - anchor, &token );
+            return op - (unsigned char *) out;
+        }
+
+        /* @return false if the length runs off the end of the input or is absurd */
+        inline bool readLength( const unsigned char *&ip, const unsigned char *end, int &len, int max ) {
+            unsigned s;
+            do {
+                if ( ip >= end )
+                    return false;
+                s = *ip++;
+                len += s;
+                if ( len > max )
+                    return false;
+            } while( s == 255 );
+            return true;
+        }
+
+        int decompress( const char *in, int n, char *out, int outSize ) {
+            const unsigned char *ip = (const unsigned char *) in;
+            const unsigned char *end = ip + n;
+            unsigned char *op = (unsigned char *) out;
+            unsigned char *opEnd = op + outSize;
+
+            while( ip < end ) {
+                unsigned token = *ip++;
+
+                int lit = token >> 4;
+                if ( lit == 15 && !readLength( ip, end, lit, outSize ) )
+                    return -1;
+                if ( lit > end - ip || lit > opEnd - op )
+                    return -1;
+                memcpy( op, ip, lit );
+                ip += lit;
+                op += lit;
+                if ( ip == end )
+                    break; // the last sequence has literals only
+
+                if ( end - ip < 2 )
+                    return -1;
+                int offset = ip[ 0 ] | ( ip[ 1 ] << 8 );
+                ip += 2;
+                if ( offset == 0 || offset > op - (unsigned char *) out )
+                    return -1;
+
+                int len = token & 15;
+                if ( len == 15 && !readLength( ip, end, len, outSize ) )
+                    return -1;
+                len += MinMatch;
+                if ( len > opEnd - op )
+                    return -1;
+
+                const unsigned char *match = op - offset;
+                if ( offset >= len ) {
+                    memcpy( op, match, len );
+                    op += len;
+                }
+                else {
+                    // overlapping: a run repeating the last offset bytes
+                    while( len-- )
+                        *op++ = *match++;
+                }
+            }
+            return op - (unsigned char *) out;
+        }
+
+        struct LZ4UnitTest : public UnitTest {
+            void roundTrip( const string& s ) {
+                vector< char > c( maxCompressedLength( s.size() ) );
+                int clen = compress( s.data(), s.size(), &c[ 0 ] );
+                assert( clen <= (int) c.size() );
+                vector< char > d( s.size() + 1 );
+                assert( decompress( &c[ 0 ], clen, &d[ 0 ], d.size() ) == (int) s.size() );
+                assert( memcmp( &d[ 0 ], s.data(), s.size() ) == 0 );
+                if ( s.size() > 0 ) {
+                    // too small an output buffer is an error, not an overrun
+                    assert( decompress( &c[ 0 ], clen, &d[ 0 ], s.size() - 1 ) == -1 );
+                    // nor is truncated input
+                    assert( decompress( &c[ 0 ], clen - 1, &d[ 0 ], d.size() ) != (int) s.size() );
+                }
+            }
+            void run() {
+                roundTrip( "" );
+                roundTrip( "a" );
+                roundTrip( "abcdefghijklm" );
+                roundTrip( string( 1000, 'x' ) );
+                string s;
+                for( int i = 0; i < 2000; ++i )
+                    s += "{ _id: " + string( 1, 'a' + i % 26 ) + ", name: \"something\" }";
+                roundTrip( s );
+                string r;
+                unsigned x = 1;
+                for( int i = 0; i < 100000; ++i ) {
+                    x = x * 1103515245 + 12345;
+                    r += (char) ( x >> 16 );
+                }
+                roundTrip( r );
+                {
+                    vector< char > c( maxCompressedLength( s.size() ) );
+                    int clen = compress( s.data(), s.size(), &c[ 0 ] );
+                    assert( clen < (int) s.size() / 4 );
+                }
+                {
+                    // offset pointing before the start of the output
+                    const char bad[] = { 0x10, 'a', 0x05, 0x00 };
+                    char out[ 64 ];
+                    assert( decompress( bad, sizeof( bad ), out, sizeof( out ) ) == -1 );
+                }
+            }
+        } lz4UnitTest;
+
+    }
+}
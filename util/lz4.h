@@ -0,0 +1,40 @@
+// util/lz4.h
+
+/*    Copyright 2009 10gen Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+namespace mongo {
+    /* the LZ4 block format: byte oriented LZ77, fast enough to compress messages on the wire
+       without becoming the bottleneck.  see http://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+    */
+    namespace lz4 {
+
+        /** size of a buffer big enough for compress() of n bytes */
+        inline int maxCompressedLength( int n ) {
+            return n + n / 255 + 16;
+        }
+
+        /** @return compressed size.  out must have maxCompressedLength( n ) bytes */
+        int compress( const char *in, int n, char *out );
+
+        /** in may come off the network: every length and offset is checked.
+            @return decompressed size, or -1 if in is malformed or doesn't fit in outSize bytes
+        */
+        int decompress( const char *in, int n, char *out, int outSize );
+
+    }
+}
@@ -27,6 +27,7 @@
 #include <errno.h>
 #include "../db/cmdline.h"
 #include "../client/dbclient.h"
+#include "lz4.h"
 
 namespace mongo {
 
@@ -203,52 +204,272 @@ namespace mongo {
         accepted( new MessagingPort(sock, from) );
     }
 
+    /* received message buffers ------------------------------------------------------- */
+
+    /* kept just ahead of the MsgData: the buffer's size class, -1 for one too big to keep */
+    struct MessageBufferPrefix {
+        int sizeClass;
+        int pad;
+    };
+
+    enum { MessageBufferMinShift = 10, MessageBufferMaxShift = 24,
+           MessageBufferClasses = MessageBufferMaxShift - MessageBufferMinShift + 1 };
+
+    /* smallest power of two class holding size, or -1 */
+    static int messageBufferClass( int size ) {
+        int c = 0;
+        while( ( 1 << ( c + MessageBufferMinShift ) ) < size )
+            if ( ++c >= MessageBufferClasses )
+                return -1;
+        return c;
+    }
+
+    /* a thread's buffers.  with a thread per connection, that is the connection's */
+    class ThreadMessageBuffers : boost::noncopyable {
+    public:
+        enum { PerClass = 4, MaxShift = 16 }; // only up to 64KB: a thread keeps at most ~500KB
+        ThreadMessageBuffers() : _mallocs( 0 ) {
+            for( int i = 0; i < MessageBufferClasses; ++i )
+                _n[ i ] = 0;
+        }
+        ~ThreadMessageBuffers() {
+            for( int i = 0; i < MessageBufferClasses; ++i )
+                while( _n[ i ] )
+                    free( _bufs[ i ][ --_n[ i ] ] );
+        }
+        void* take( int c ) {
+            return _n[ c ] ? _bufs[ c ][ --_n[ c ] ] : 0;
+        }
+        bool keep( int c, void *p ) {
+            if ( c > MaxShift - MessageBufferMinShift || _n[ c ] == PerClass )
+                return false;
+            _bufs[ c ][ _n[ c ]++ ] = p;
+            return true;
+        }
+        long long _mallocs;
+    private:
+        void *_bufs[ MessageBufferClasses ][ PerClass ];
+        int _n[ MessageBufferClasses ];
+    };
+
+    /* what threads' caches don't hold, e.g. the large buffers, or ones received by the epoll
+       thread and freed by a worker
+    */
+    class SharedMessageBuffers : boost::noncopyable {
+    public:
+        enum { MaxBytes = 32 * 1024 * 1024 };
+        SharedMessageBuffers() : _m( "SharedMessageBuffers" ), _bytes( 0 ) {}
+        void* take( int c ) {
+            scoped_lock lk( _m );
+            if ( _bufs[ c ].empty() )
+                return 0;
+            void *p = _bufs[ c ].back();
+            _bufs[ c ].pop_back();
+            _bytes -= 1 << ( c + MessageBufferMinShift );
+            return p;
+        }
+        bool keep( int c, void *p ) {
+            int size = 1 << ( c + MessageBufferMinShift );
+            scoped_lock lk( _m );
+            if ( _bytes + size > MaxBytes )
+                return false;
+            _bufs[ c ].push_back( p );
+            _bytes += size;
+            return true;
+        }
+    private:
+        mongo::mutex _m;
+        vector< void* > _bufs[ MessageBufferClasses ];
+        long long _bytes;
+    };
+
+    // "new"ed and never deleted: messages may be freed by other static destructors
+    static SharedMessageBuffers& sharedMessageBuffers = *( new SharedMessageBuffers() );
+    static ThreadLocalCache< ThreadMessageBuffers > threadMessageBuffers;
+    static bool threadMessageBuffersReady = threadMessageBuffers.init();
+
+    static ThreadMessageBuffers& messageBuffers() {
+        return threadMessageBuffers.get();
+    }
+
+    MsgData* allocMessageBuffer( int len ) {
+        int size = len + sizeof( MessageBufferPrefix );
+        int c = messageBufferClass( size );
+        ThreadMessageBuffers& t = messageBuffers();
+        void *p = 0;
+        if ( c >= 0 ) {
+            p = t.take( c );
+            if ( !p )
+                p = sharedMessageBuffers.take( c );
+            size = 1 << ( c + MessageBufferMinShift );
+        }
+        if ( !p ) {
+            t._mallocs++;
+            p = malloc( size );
+            assert( p );
+        }
+        MessageBufferPrefix *prefix = (MessageBufferPrefix *) p;
+        prefix->sizeClass = c;
+        return (MsgData *) ( prefix + 1 );
+    }
+
+    void freeMessageBuffer( MsgData *d ) {
+        MessageBufferPrefix *prefix = ( (MessageBufferPrefix *) d ) - 1;
+        int c = prefix->sizeClass;
+        if ( c < 0 || !( messageBuffers().keep( c, prefix ) || sharedMessageBuffers.keep( c, prefix ) ) )
+            free( prefix );
+    }
+
+    long long messageBufferMallocs() {
+        return messageBuffers()._mallocs;
+    }
+
     /* messagingport -------------------------------------------------------------- */
 
-    class PiggyBackData {
+    /* messages queued by MessagingPort::piggyBack().  the port's thread appends and sends;
+       the flusher thread below sends what has waited writeBufferMillis - _m is for the two.
+    */
+    class WriteBuffer {
     public:
-        PiggyBackData( MessagingPort * port ) {
-            _port = port;
-            _buf = new char[1300];
-            _cur = _buf;
+        WriteBuffer( MessagingPort * port ) : _m( "WriteBuffer" ), _port( port ), _len( 0 ), _since( 0 ), _failed( false ) {
+            _size = MessagingPort::writeBufferBytes;
+            if ( _size <= 0 ) {
+                // no point queueing more than the kernel takes at once
+                int sndbuf = 0;
+                socklen_t optLen = sizeof( sndbuf );
+                if ( getsockopt( port->sock, SOL_SOCKET, SO_SNDBUF, (char*)&sndbuf, &optLen ) != 0 )
+                    sndbuf = 0;
+                _size = max( (int)MinSize, min( sndbuf, (int)MaxSize ) );
+            }
+            _buf = (char *) malloc( _size );
         }
 
-        ~PiggyBackData() {
-            DESTRUCTOR_GUARD (
-                flush();
-                delete[]( _cur );
-            );
+        ~WriteBuffer() {
+            free( _buf );
         }
 
-        void append( Message& m ) {
-            assert( m.header()->len <= 1300 );
+        mongo::mutex _m;
 
-            if ( len() + m.header()->len > 1300 )
-                flush();
+        int len() const { return _len; }
+        int capacity() const { return _size; }
+        bool fits( int n ) const { return n <= _size - _len; }
 
-            memcpy( _cur , m.singleData() , m.header()->len );
-            _cur += m.header()->len;
+        void append( Message& m ) {
+            vector< pair< char *, int > > v;
+            m.gather( v );
+            if ( _len == 0 )
+                _since = curTimeMillis();
+            for( vector< pair< char *, int > >::const_iterator i = v.begin(); i != v.end(); ++i ) {
+                assert( fits( i->second ) );
+                memcpy( _buf + _len, i->first, i->second );
+                _len += i->second;
+            }
         }
 
-        void flush() {
-            if ( _buf == _cur )
-                return;
+        /* sends the queue followed by m, if given, with one send() */
+        void flush( Message *m = 0 ) {
+            vector< pair< char *, int > > v;
+            if ( _len )
+                v.push_back( make_pair( _buf, _len ) );
+            if ( m )
+                m->gather( v );
+            _len = 0;
+            if ( !v.empty() )
+                _port->send( v, "flush" );
+        }
 
-            _port->send( _buf , len(), "flush" );
-            _cur = _buf;
+        /* flusher thread.  @return true if nothing is left queued */
+        bool flushIfDue( unsigned now ) {
+            mongo::mutex::try_lock lk( _m );
+            if ( !lk.locked() )
+                return false; // the port's thread is here and will flush, or come back next round
+            if ( _len == 0 )
+                return true;
+            if ( tdiff( _since, now ) < MessagingPort::writeBufferMillis )
+                return false;
+            try {
+                flush();
+            }
+            catch ( SocketException& ) {
+                _failed = true;
+            }
+            return true;
         }
 
-        int len() {
-            return _cur - _buf;
+        /* a flush from the flusher thread failed: the port's next write reports it */
+        void check() {
+            if ( _failed )
+                throw SocketException();
         }
 
     private:
-
+        enum { MinSize = 4096, MaxSize = 256 * 1024 };
         MessagingPort* _port;
-
         char * _buf;
-        char * _cur;
+        int _size;
+        int _len;
+        unsigned _since; // curTimeMillis() when the oldest queued message went in
+        bool _failed;
+    };
+
+    /* sends what piggyBack() queued once nothing else has for writeBufferMillis */
+    class WriteFlusher : public BackgroundJob {
+        set<WriteBuffer*> _queued;
+        set<WriteBuffer*> _flushing; // taken out of _queued by run(), which sends from them unlocked
+        mongo::mutex _m;
+        boost::condition _notEmpty;
+        boost::condition _flushed;
+        bool _started;
+    public:
+        WriteFlusher() : _m("WriteFlusher"), _started(false) {}
+        void add( WriteBuffer *b ) {
+            scoped_lock lk( _m );
+            if ( !_started ) {
+                _started = true;
+                go();
+            }
+            _queued.insert( b );
+            _notEmpty.notify_one();
+        }
+        /* once this returns, the flusher thread won't touch b */
+        void erase( WriteBuffer *b ) {
+            scoped_lock lk( _m );
+            while( _flushing.count( b ) )
+                _flushed.wait( lk.boost() );
+            _queued.erase( b );
+        }
+        string name() { return "WriteFlusher"; }
+        void run() {
+            vector<WriteBuffer*> due;
+            vector<WriteBuffer*> left;
+            while( 1 ) {
+                {
+                    scoped_lock lk( _m );
+                    while( _queued.empty() )
+                        _notEmpty.wait( lk.boost() );
+                    due.assign( _queued.begin(), _queued.end() );
+                    _queued.clear();
+                    _flushing.insert( due.begin(), due.end() );
+                }
+                // sent without _m: a stalled peer mustn't hold up add() for every other port
+                left.clear();
+                unsigned now = curTimeMillis();
+                for( vector<WriteBuffer*>::iterator i = due.begin(); i != due.end(); ++i ) {
+                    if ( !(*i)->flushIfDue( now ) )
+                        left.push_back( *i );
+                }
+                {
+                    scoped_lock lk( _m );
+                    _queued.insert( left.begin(), left.end() );
+                    _flushing.clear();
+                    _flushed.notify_all();
+                }
+                sleepmillis( 1 );
+            }
+        }
     };
+    // "new"ed and never deleted, like ports below: ports may still be destroyed after statics
+    WriteFlusher& writeFlusher = *(new WriteFlusher());
 
     class Ports { 
         set<MessagingPort*>& ports;
@@ -278,7 +499,7 @@ namespace mongo {
         ports.closeAll();
     }
 
-    MessagingPort::MessagingPort(int _sock, const SockAddr& _far) : sock(_sock), piggyBackData(0), farEnd(_far), _timeout() {
+    MessagingPort::MessagingPort(int _sock, const SockAddr& _far) : sock(_sock), _out(0), _compress(false), _announce(false), farEnd(_far), _timeout() {
         _logLevel = 0;
         ports.insert(this);
     }
@@ -287,7 +508,9 @@ namespace mongo {
         _logLevel = ll;
         ports.insert(this);
         sock = -1;
-        piggyBackData = 0;
+        _out = 0;
+        _compress = false;
+        _announce = false;
         _timeout = timeout;
     }
 
@@ -299,8 +522,13 @@ namespace mongo {
     }
 
     MessagingPort::~MessagingPort() {
-        if ( piggyBackData )
-            delete( piggyBackData );
+        if ( _out ) {
+            writeFlusher.erase( _out );
+            if ( sock >= 0 ) {
+                DESTRUCTOR_GUARD( _out->flush(); );
+            }
+            delete _out;
+        }
         shutdown();
         ports.erase(this);
     }
@@ -364,6 +592,8 @@ namespace mongo {
 
     bool MessagingPort::recv(Message& m) {
         try {
+            // whatever we recv may be the reply to something queued
+            flush();
         again:
             mmm( out() << "*  recv() sock:" << this->sock << endl; )
             int len = -1;
@@ -394,22 +624,38 @@ namespace mongo {
                 return false;
             }
             
-            int z = (len+1023)&0xfffffc00;
-            assert(z>=len);
-            MsgData *md = (MsgData *) malloc(z);
-            assert(md);
-            md->len = len;
-            
             if ( len <= 0 ) {
                 out() << "got a length of " << len << ", something is wrong" << endl;
                 return false;
             }
             
+            MsgData *md;
+            if ( recycleRecvBuffers ) {
+                md = allocMessageBuffer( len );
+                m.setPooledData( md );
+            }
+            else {
+                int z = (len+1023)&0xfffffc00;
+                assert(z>=len);
+                md = (MsgData *) malloc(z);
+                assert(md);
+                m.setData( md, true );
+            }
+            md->len = len;
+            
             char *p = (char *) &md->id;
             int left = len -4;
             recv( p, left );
-            
-            m.setData(md, true);
+
+            if ( m.operation() == dbCompressed ) {
+                if ( !decompressMessage( m ) ) {
+                    log(_logLevel) << "bad compressed message from " << farEnd.toString() << endl;
+                    m.reset();
+                    return false;
+                }
+                // the peer decodes what it sends
+                _compress = true;
+            }
             return true;
 
         } catch ( const SocketException & ) {
@@ -454,23 +700,39 @@ namespace mongo {
     void MessagingPort::say(Message& toSend, int responseTo) {
         assert( !toSend.empty() );
         mmm( out() << "*  say() sock:" << this->sock << " thr:" << GetCurrentThreadId() << endl; )
+        if ( toSend.sentBytes() ) {
+            // started with sendAvailable() - the header has gone out already
+            toSend.send( *this, "say" );
+            return;
+        }
         toSend.header()->id = nextMessageId();
         toSend.header()->responseTo = responseTo;
 
-        if ( piggyBackData && piggyBackData->len() ) {
-            mmm( out() << "*     have piggy back" << endl; )
-            if ( ( piggyBackData->len() + toSend.header()->len ) > 1300 ) {
-                // won't fit in a packet - so just send it off
-                piggyBackData->flush();
-            }
-            else {
-                piggyBackData->append( toSend );
-                piggyBackData->flush();
+        Message compressed;
+        if ( _compress && compressMessage( toSend, compressed, _announce ) ) {
+            _announce = false;
+        }
+        Message &m = compressed.empty() ? toSend : compressed;
+
+        if ( _out ) {
+            scoped_lock lk( _out->_m );
+            _out->check();
+            if ( _out->len() ) {
+                mmm( out() << "*     have piggy back" << endl; )
+                _out->flush( &m );
                 return;
             }
         }
 
-        toSend.send( *this, "say" );
+        m.send( *this, "say" );
+    }
+
+    void MessagingPort::flush() {
+        if ( !_out )
+            return;
+        scoped_lock lk( _out->_m );
+        _out->check();
+        _out->flush();
     }
 
     // sends all data or throws an exception    
@@ -495,6 +757,24 @@ namespace mongo {
         }        
     }
     
+#if !defined(_WIN32)
+    /* advance meta.msg_iov past ret bytes written by sendmsg() */
+    static void skipSent( struct msghdr &meta, int ret ) {
+        struct iovec *& i = meta.msg_iov;
+        while( ret > 0 ) {
+            if ( i->iov_len > unsigned( ret ) ) {
+                i->iov_len -= ret;
+                i->iov_base = (char*)(i->iov_base) + ret;
+                ret = 0;
+            } else {
+                ret -= i->iov_len;
+                ++i;
+                --(meta.msg_iovlen);
+            }
+        }
+    }
+#endif
+
     // sends all data or throws an exception
     void MessagingPort::send( const vector< pair< char *, int > > &data, const char *context ){
 #if defined(_WIN32)
@@ -517,7 +797,7 @@ namespace mongo {
         struct msghdr meta;
         memset( &meta, 0, sizeof( meta ) );
         meta.msg_iov = &d[ 0 ];
-        meta.msg_iovlen = d.size();
+        meta.msg_iovlen = i;
     
         while( meta.msg_iovlen > 0 ) {
             int ret = ::sendmsg( sock , &meta , portSendFlags );
@@ -532,23 +812,44 @@ namespace mongo {
                     }
                 }
             } else {
-                struct iovec *& i = meta.msg_iov;
-                while( ret > 0 ) {
-                    if ( i->iov_len > unsigned( ret ) ) {
-                        i->iov_len -= ret;
-                        i->iov_base = (char*)(i->iov_base) + ret;
-                        ret = 0;
-                    } else {
-                        ret -= i->iov_len;
-                        ++i;
-                        --(meta.msg_iovlen);
-                    }
-                }
+                skipSent( meta, ret );
             }
         }
 #endif
     }
 
+    int MessagingPort::sendAvailable( const vector< pair< char *, int > > &data ) {
+#if defined(_WIN32) || !defined(MSG_DONTWAIT)
+        return 0;
+#else
+        vector< struct iovec > d( data.size() );
+        int i = 0;
+        for( vector< pair< char *, int > >::const_iterator j = data.begin(); j != data.end(); ++j ) {
+            if ( j->second > 0 ) {
+                d[ i ].iov_base = j->first;
+                d[ i ].iov_len = j->second;
+                ++i;
+            }
+        }
+        if ( i == 0 )
+            return 0;
+        struct msghdr meta;
+        memset( &meta, 0, sizeof( meta ) );
+        meta.msg_iov = &d[ 0 ];
+        meta.msg_iovlen = i;
+
+        int sent = 0;
+        while( meta.msg_iovlen > 0 ) {
+            int ret = ::sendmsg( sock , &meta , portSendFlags | MSG_DONTWAIT );
+            if ( ret <= 0 )
+                break;
+            sent += ret;
+            skipSent( meta, ret );
+        }
+        return sent;
+#endif
+    }
+
     void MessagingPort::recv( char * buf , int len ){
         while( len > 0 ) {
             int ret = ::recv( sock , buf , len , portRecvFlags );
@@ -580,11 +881,21 @@ namespace mongo {
         return ::recv( sock , buf , max , portRecvFlags );        
     }
     
+    int MessagingPort::writeBufferBytes = 0;
+    int MessagingPort::writeBufferMillis = 2;
+    bool MessagingPort::recycleRecvBuffers = true;
+
     void MessagingPort::piggyBack( Message& toSend , int responseTo ) {
+        if ( writeBufferMillis <= 0 ) {
+            say( toSend, responseTo );
+            return;
+        }
+        if ( !_out )
+            _out = new WriteBuffer( this );
 
-        if ( toSend.header()->len > 1300 ) {
-            // not worth saving because its almost an entire packet
-            say( toSend );
+        if ( toSend.size() > _out->capacity() ) {
+            // would never fit - goes out now, along with anything queued
+            say( toSend, responseTo );
             return;
         }
 
@@ -592,10 +903,31 @@ namespace mongo {
         toSend.header()->id = nextMessageId();
         toSend.header()->responseTo = responseTo;
 
-        if ( ! piggyBackData )
-            piggyBackData = new PiggyBackData( this );
-
-        piggyBackData->append( toSend );
+        Message compressed;
+        if ( _compress && compressMessage( toSend, compressed, _announce ) ) {
+            _announce = false;
+        }
+        Message &m = compressed.empty() ? toSend : compressed;
+
+        bool first;
+        {
+            scoped_lock lk( _out->_m );
+            _out->check();
+            if ( m.size() > _out->capacity() ) {
+                // forced compression can come out bigger: send it as say() would, after anything queued
+                if ( _out->len() )
+                    _out->flush( &m );
+                else
+                    m.send( *this, "say" );
+                return;
+            }
+            if ( !_out->fits( m.size() ) )
+                _out->flush();
+            first = _out->len() == 0;
+            _out->append( m );
+        }
+        if ( first )
+            writeFlusher.add( _out );
     }
 
     unsigned MessagingPort::remotePort() const {
@@ -607,6 +939,74 @@ namespace mongo {
     }
 
 
+    bool compressMessage( Message& m, Message& out, bool force ) {
+        int size = m.header()->dataLen();
+        if ( size < MessagingPort::CompressMinSize && !force )
+            return false;
+        m.concat();
+        MsgData *md = m.header();
+
+        const int envelope = 9; // operation, size, compressor
+        MsgData *c = (MsgData *) malloc( MsgDataHeaderSize + envelope + lz4::maxCompressedLength( size ) );
+        char *p = c->_data;
+        *(int *) p = md->operation();
+        *(int *) ( p + 4 ) = size;
+        p[ 8 ] = WireCompressorLZ4;
+        int clen = lz4::compress( md->_data, size, p + envelope );
+        if ( clen + envelope >= size && !force ) {
+            free( c );
+            return false;
+        }
+        c->len = MsgDataHeaderSize + envelope + clen;
+        c->id = md->id;
+        c->responseTo = md->responseTo;
+        c->setOperation( dbCompressed );
+        out.setData( c, true );
+        return true;
+    }
+
+    bool decompressMessage( Message& m ) {
+        MsgData *c = m.header();
+        int clen = c->dataLen() - 9;
+        if ( clen < 0 )
+            return false;
+        const char *p = c->_data;
+        int op = *(const int *) p;
+        int size = *(const int *) ( p + 4 );
+        if ( p[ 8 ] != WireCompressorLZ4 || op == dbCompressed || size < 0 || size > 16000000 )
+            return false;
+
+        MsgData *md = allocMessageBuffer( MsgDataHeaderSize + size );
+        if ( lz4::decompress( p + 9, clen, md->_data, size ) != size ) {
+            freeMessageBuffer( md );
+            return false;
+        }
+        md->len = MsgDataHeaderSize + size;
+        md->id = c->id;
+        md->responseTo = c->responseTo;
+        md->setOperation( op );
+        m.reset();
+        m.setPooledData( md );
+        return true;
+    }
+
+    void appendWireCompression( BSONObjBuilder& b ) {
+        b.append( "compression", BSON_ARRAY( "lz4" ) );
+    }
+
+    bool acceptsWireCompression( const BSONObj& isMaster ) {
+        BSONElement e = isMaster[ "compression" ];
+        if ( e.type() != Array )
+            return false;
+        BSONObjIterator i( e.embeddedObject() );
+        while( i.more() ) {
+            BSONElement c = i.next();
+            if ( c.type() == String && strcmp( c.valuestr(), "lz4" ) == 0 )
+                return true;
+        }
+        return false;
+    }
+
     MSGID NextMsgId;
     bool usingClientIds = 0;
     ThreadLocalValue<int> clientId;
@@ -27,7 +27,7 @@ namespace mongo {
 
     class Message;
     class MessagingPort;
-    class PiggyBackData;
+    class WriteBuffer;
     typedef AtomicUInt MSGID;
 
     class Listener {
@@ -101,20 +101,38 @@ namespace mongo {
 
         virtual ~MessagingPort();
 
-        void shutdown();
+        /* virtual: a port may move its messages some other way than the socket, see
+           ShmMessagingPort
+        */
+        virtual void shutdown();
         
         bool connect(SockAddr& farEnd);
 
         /* it's assumed if you reuse a message object, that it doesn't cross MessagingPort's.
            also, the Message data will go out of scope on the subsequent recv call.
         */
-        bool recv(Message& m);
+        virtual bool recv(Message& m);
         void reply(Message& received, Message& response, MSGID responseTo);
         void reply(Message& received, Message& response);
         bool call(Message& toSend, Message& response);
-        void say(Message& toSend, int responseTo = -1);
+        virtual void say(Message& toSend, int responseTo = -1);
+
+        /** queues toSend to go out with whatever is written next, so a pipeline of small
+            messages (e.g. an insert and then its getLastError) costs one send().  the queue
+            is written by the next say(), recv() or flush(), once it holds writeBufferBytes,
+            or at the latest writeBufferMillis after the first message went in.
+        */
+        virtual void piggyBack( Message& toSend , int responseTo = -1 );
+
+        /** sends anything piggyBack() queued */
+        virtual void flush();
 
-        void piggyBack( Message& toSend , int responseTo = -1 );
+        /* 0: size the queue from the socket's SO_SNDBUF.  --writeBufferBytes */
+        static int writeBufferBytes;
+        /* <= 0: piggyBack() is just say().  --writeBufferMillis */
+        static int writeBufferMillis;
+        /* false: recv() mallocs every message, rather than using allocMessageBuffer() */
+        static bool recycleRecvBuffers;
 
         virtual unsigned remotePort() const;
         virtual HostAndPort remote() const;
@@ -123,19 +141,43 @@ namespace mongo {
         void send( const char * data , int len, const char *context );
         void send( const vector< pair< char *, int > > &data, const char *context );
 
+        /** writes as much of data as the socket takes without blocking.
+            @return bytes written - errors are left for the next send() to report
+        */
+        virtual int sendAvailable( const vector< pair< char *, int > > &data );
+
         // recv len or throw SocketException
         void recv( char * data , int len );
         
         int unsafe_recv( char *buf, int max );
+
+        /* for doing the i/o elsewhere, as AsyncClient does.  -1 if messages don't go over it */
+        virtual int getSocket() const { return sock; }
+
+        /** the peer said it decodes dbCompressed (see isMaster negotiation in DBClientConnection):
+            messages we send from now on are compressed when that pays off, and the first one
+            always, which tells the peer to compress its replies too
+        */
+        void setCompression() {
+            _compress = true;
+            _announce = true;
+        }
+        /** true once either side has turned compression on */
+        bool compressing() const { return _compress; }
+
+        /* messages smaller than this are sent as they are */
+        enum { CompressMinSize = 1024 };
     private:
         int sock;
-        PiggyBackData * piggyBackData;
+        WriteBuffer * _out;
+        bool _compress;
+        bool _announce;
     public:
         SockAddr farEnd;
         int _timeout;
         int _logLevel; // passed to log() when logging errors
 
-        friend class PiggyBackData;
+        friend class WriteBuffer;
     };
 
     enum Operations {
@@ -147,7 +189,8 @@ namespace mongo {
         dbQuery = 2004,
         dbGetMore = 2005,
         dbDelete = 2006,
-        dbKillCursors = 2007
+        dbKillCursors = 2007,
+        dbCompressed = 2012 /* another message, compressed - see compressMessage() */
     };
 
     bool doesOpGetAResponse( int op );
@@ -163,6 +206,7 @@ namespace mongo {
         case dbGetMore: return "getmore";
         case dbDelete: return "remove";
         case dbKillCursors: return "killcursors";
+        case dbCompressed: return "compressed";
         default: 
             PRINT(op);
             assert(0); 
@@ -231,15 +275,25 @@ struct OP_GETMORE : public MSGHEADER {
     }
 #pragma pack()
 
+    /** buffers for received messages, recycled rather than freed: a few of each power of two
+        size are cached per thread, and more in a bounded pool all threads share (so a buffer
+        received on one thread and freed on another still comes back).  room for len bytes.
+        free with freeMessageBuffer() - Message::setPooledData() does.
+    */
+    MsgData* allocMessageBuffer( int len );
+    void freeMessageBuffer( MsgData *d );
+    /** number of allocMessageBuffer() calls on this thread that had to malloc */
+    long long messageBufferMallocs();
+
     class Message {
     public:
         // we assume here that a vector with initial size 0 does no allocation (0 is the default, but wanted to make it explicit).
-        Message() : _buf( 0 ), _data( 0 ), _freeIt( false ) {}
+        Message() : _buf( 0 ), _data( 0 ), _freeIt( false ), _pooled( false ), _sent( 0 ) {}
         Message( void * data , bool freeIt ) :
-            _buf( 0 ), _data( 0 ), _freeIt( false ) {
+            _buf( 0 ), _data( 0 ), _freeIt( false ), _pooled( false ), _sent( 0 ) {
             _setData( reinterpret_cast< MsgData* >( data ), freeIt );
         };
-        Message(Message& r) : _buf( 0 ), _data( 0 ), _freeIt( false ) { 
+        Message(Message& r) : _buf( 0 ), _data( 0 ), _freeIt( false ), _pooled( false ), _sent( 0 ) { 
             *this = r;
         }
         ~Message() {
@@ -291,8 +345,33 @@ struct OP_GETMORE : public MSGHEADER {
                 memcpy( p, i->first, i->second );
                 p += i->second;
             }
+            int sent = _sent;
             reset();
             _setData( (MsgData*)buf, true );
+            _sent = sent;
+        }
+
+        /* borrowed buffers - see appendBorrowed() */
+        bool hasBorrowed() const { return !_borrowed.empty(); }
+
+        /** stop referencing borrowed buffers: a fully sent message just drops them (the header
+            stays for the caller to inspect), otherwise everything is copied with concat()
+        */
+        void own() {
+            if ( !hasBorrowed() ) {
+                return;
+            }
+            if ( _sent < size() ) {
+                concat();
+                return;
+            }
+            MsgVec owned;
+            for( unsigned i = 0; i < _data.size(); ++i ) {
+                if ( i >= _borrowed.size() || !_borrowed[ i ] )
+                    owned.push_back( _data[ i ] );
+            }
+            _data.swap( owned );
+            _borrowed.clear();
         }
         
         // vector swap() so this is fast
@@ -303,7 +382,12 @@ struct OP_GETMORE : public MSGHEADER {
             r._buf = 0;
             if ( r._data.size() > 0 ) {
                 _data.swap( r._data );
+                _borrowed.swap( r._borrowed );
             }
+            _sent = r._sent;
+            r._sent = 0;
+            _pooled = r._pooled;
+            r._pooled = false;
             r._freeIt = false;
             _freeIt = true;
             return *this;
@@ -312,15 +396,26 @@ struct OP_GETMORE : public MSGHEADER {
         void reset() {
             if ( _freeIt ) {
                 if ( _buf ) {
-                    free( _buf );
+                    if ( _pooled )
+                        freeMessageBuffer( _buf );
+                    else
+                        free( _buf );
                 }
-                for( vector< pair< char *, int > >::const_iterator i = _data.begin(); i != _data.end(); ++i ) {
-                    free(i->first);
+                for( unsigned i = 0; i < _data.size(); ++i ) {
+                    if ( i < _borrowed.size() && _borrowed[ i ] )
+                        continue;
+                    if ( i == 0 && _pooled )
+                        freeMessageBuffer( (MsgData*) _data[ i ].first );
+                    else
+                        free( _data[ i ].first );
                 }
             }
             _buf = 0;
             _data.clear();
+            _borrowed.clear();
             _freeIt = false;
+            _pooled = false;
+            _sent = 0;
         }
 
         // use to add a buffer
@@ -343,12 +438,31 @@ struct OP_GETMORE : public MSGHEADER {
             _data.push_back( make_pair( d, size ) );
             header()->len += size;
         }
+
+        /** add a buffer the message doesn't own, e.g. a document in a mapped record.
+            it must stay valid until the message is sent or own() is called.
+        */
+        void appendBorrowed(const char *d, int size) {
+            assert( !empty() );
+            if ( size <= 0 ) {
+                return;
+            }
+            appendData( const_cast< char* >( d ), size );
+            _borrowed.resize( _data.size() );
+            _borrowed.back() = true;
+        }
         
         // use to set first buffer if empty
         void setData(MsgData *d, bool freeIt) {
             assert( empty() );
             _setData( d, freeIt );
         }
+        /** as setData(), to a buffer from allocMessageBuffer() which the message frees */
+        void setPooledData(MsgData *d) {
+            assert( empty() );
+            _setData( d, true );
+            _pooled = true;
+        }
         void setData(int operation, const char *msgtxt) {
             setData(operation, msgtxt, strlen(msgtxt)+1);
         }
@@ -367,27 +481,75 @@ struct OP_GETMORE : public MSGHEADER {
         }
 
         void send( MessagingPort &p, const char *context ) {
-            if ( empty() ) {
+            if ( empty() || _sent >= size() ) {
                 return;
             }
             if ( _buf != 0 ) {
-                p.send( (char*)_buf, _buf->len, context );
-            } else {
+                p.send( (char*)_buf + _sent, _buf->len - _sent, context );
+            } else if ( _sent == 0 ) {
                 p.send( _data, context );
+            } else {
+                p.send( unsent(), context );
+            }
+        }
+
+        /** writes whatever the socket takes right now; send() then only sends the rest.
+            the header must be complete (id, responseTo) before calling this.
+        */
+        void sendAvailable( MessagingPort &p ) {
+            if ( empty() || _sent >= size() ) {
+                return;
             }
+            _sent += p.sendAvailable( unsent() );
+        }
+
+        /** bytes already written by sendAvailable() */
+        int sentBytes() const { return _sent; }
+
+        /** appends the buffers still to be sent, to write them out along with other data */
+        void gather( vector< pair< char *, int > > &v ) const {
+            if ( empty() || _sent >= size() ) {
+                return;
+            }
+            MsgVec u = unsent();
+            v.insert( v.end(), u.begin(), u.end() );
         }
 
     private:
         void _setData( MsgData *d, bool freeIt ) {
             _freeIt = freeIt;
+            _pooled = false;
             _buf = d;
         }
+        typedef vector< pair< char*, int > > MsgVec;
+        MsgVec unsent() const {
+            MsgVec v;
+            if ( _buf ) {
+                v.push_back( make_pair( (char*)_buf + _sent, _buf->len - _sent ) );
+                return v;
+            }
+            int skip = _sent;
+            for( MsgVec::const_iterator i = _data.begin(); i != _data.end(); ++i ) {
+                if ( skip >= i->second ) {
+                    skip -= i->second;
+                    continue;
+                }
+                v.push_back( make_pair( i->first + skip, i->second - skip ) );
+                skip = 0;
+            }
+            return v;
+        }
         // if just one buffer, keep it in _buf, otherwise keep a sequence of buffers in _data
         MsgData * _buf;
         // byte buffer(s) - the first must contain at least a full MsgData unless using _buf for storage instead
-        typedef vector< pair< char*, int > > MsgVec;
         MsgVec _data;
+        // _borrowed[ i ] set: _data[ i ] isn't freed by reset().  may be shorter than _data
+        vector< bool > _borrowed;
         bool _freeIt;
+        // the header buffer (_buf, or _data[ 0 ]) is from allocMessageBuffer()
+        bool _pooled;
+        // bytes written ahead of send() by sendAvailable()
+        int _sent;
     };
 
     class SocketException : public DBException {
@@ -397,6 +559,24 @@ struct OP_GETMORE : public MSGHEADER {
 
     MSGID nextMessageId();
 
+    /* dbCompressed body: int original operation, int uncompressed body size, char compressor,
+       then the compressed body of the original message.  the header's id and responseTo are
+       those of the original.
+    */
+    enum WireCompressor { WireCompressorLZ4 = 1 };
+
+    /** @param force compress whatever the size or ratio
+        @return false if m is left as it is: small, or it didn't shrink
+    */
+    bool compressMessage( Message& m, Message& out, bool force = false );
+
+    /** replaces a dbCompressed message with the original.  @return false if it is malformed */
+    bool decompressMessage( Message& m );
+
+    /** isMaster negotiation: request and reply both carry compression : [ <names> ] */
+    void appendWireCompression( BSONObjBuilder& b );
+    bool acceptsWireCompression( const BSONObj& isMaster );
+
     void setClientId( int id );
     int getClientId();
 
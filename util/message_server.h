@@ -38,8 +38,10 @@ namespace mongo {
         struct Options {
             int port;                   // port to bind to
             string ipList;             // addresses to bind to
+            int workers;               // > 0: (linux) one epoll thread for all connections and this many
+                                       // threads to process messages, instead of a thread per connection
 
-            Options() : port(0), ipList(""){} 
+            Options() : port(0), ipList(""), workers(0){} 
         };
 
         virtual ~MessageServer(){}
@@ -21,9 +21,17 @@
 
 #include "message.h"
 #include "message_server.h"
+#include "message_shm.h"
+#include "concurrency/thread_pool.h"
 
 #include "../db/cmdline.h"
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
 namespace mongo {
 
     namespace pms {
@@ -53,6 +61,10 @@ namespace mongo {
                         p->shutdown();
                         break;
                     }
+#if defined(__linux__)
+                    if ( upgradeToSharedMemory( p , m ) )
+                        continue;
+#endif
                     
                     handler->process( m , p.get() );
                 }
@@ -117,7 +129,326 @@ namespace mongo {
     };
 
 
+#if defined(__linux__)
+
+    /* one connection of an EpollMessageServer.  it belongs either to the epoll thread (while
+       armed, EPOLLONESHOT) or to the one worker processing its messages, never both, so none
+       of its state is locked.
+    */
+    class EpollConnection : public AbstractMessagingPort {
+    public:
+        EpollConnection( int sock , const SockAddr& farEnd )
+            : _sock( sock ), _farEnd( farEnd ), _lenHave( 0 ), _in( 0 ), _inHave( 0 ), _outPos( 0 ), _eof( false ), _compress( false ) {
+        }
+        ~EpollConnection() {
+            if ( _in )
+                freeMessageBuffer( _in );
+            for( list<MsgData*>::iterator i = _ready.begin(); i != _ready.end(); ++i )
+                freeMessageBuffer( *i );
+            closesocket( _sock );
+        }
+
+        virtual void reply( Message& received, Message& response ) {
+            reply( received , response , received.header()->id );
+        }
+
+        /* sends what the socket will take now, queues the rest for the epoll thread */
+        virtual void reply( Message& received, Message& response, MSGID responseTo ) {
+            response.header()->id = nextMessageId();
+            response.header()->responseTo = responseTo;
+            Message compressed;
+            if ( _compress )
+                compressMessage( response, compressed );
+            Message &m = compressed.empty() ? response : compressed;
+            m.concat();
+            const char *data = (const char *) m.singleData();
+            int len = m.header()->len;
+            int sent = 0;
+            if ( !pendingOutput() ) {
+                sent = _send( data , len );
+                if ( sent < 0 )
+                    throw SocketException();
+            }
+            _out.append( data + sent , len - sent );
+            // a stream of replies (exhaust) mustn't queue up faster than the client reads
+            while ( _out.size() - _outPos > MaxPendingOutput ) {
+                struct pollfd pfd;
+                pfd.fd = _sock;
+                pfd.events = POLLOUT;
+                if ( ::poll( &pfd , 1 , -1 ) < 0 && errno != EINTR )
+                    throw SocketException();
+                if ( !flush() )
+                    throw SocketException();
+            }
+        }
+
+        virtual HostAndPort remote() const { return _farEnd; }
+        virtual unsigned remotePort() const { return _farEnd.getPort(); }
+
+        int sock() const { return _sock; }
+        string toString() const { return _farEnd.toString(); }
+        bool pendingOutput() const { return _outPos < _out.size(); }
+        bool eof() const { return _eof; }
+
+        /** reads what is available, without blocking, into complete messages.  the peer
+            closing isn't an error: what it sent before is still processed, see eof()
+            @return false if the connection should be closed now
+        */
+        bool readAvailable() {
+            // bounded so one busy connection can't starve the rest
+            for( int round = 0; round < 64 && !_eof; ++round ) {
+                if ( _lenHave < 4 ) {
+                    int r = _recv( (char *) &_len + _lenHave , 4 - _lenHave );
+                    if ( r <= 0 )
+                        return r == 0;
+                    _lenHave += r;
+                    if ( _lenHave < 4 )
+                        return true;
+                    if ( !startMessage() )
+                        return false;
+                    continue;
+                }
+                int r = _recv( (char *) _in + _inHave , _len - _inHave );
+                if ( r <= 0 )
+                    return r == 0;
+                _inHave += r;
+                if ( _inHave == _len ) {
+                    _ready.push_back( _in );
+                    _in = 0;
+                    _lenHave = 0;
+                }
+            }
+            return true;
+        }
+
+        bool hasReady() const { return !_ready.empty(); }
+
+        /** @return false if the message is malformed */
+        bool nextReady( Message& m ) {
+            m.setPooledData( _ready.front() );
+            _ready.pop_front();
+            if ( m.operation() == dbCompressed ) {
+                if ( !decompressMessage( m ) ) {
+                    log() << "bad compressed message from " << toString() << endl;
+                    return false;
+                }
+                // as MessagingPort::recv(): the peer decodes what it sends
+                _compress = true;
+            }
+            return true;
+        }
+
+        /** @return false on a socket error */
+        bool flush() {
+            while( pendingOutput() ) {
+                int sent = _send( _out.data() + _outPos , _out.size() - _outPos );
+                if ( sent < 0 )
+                    return false;
+                if ( sent == 0 )
+                    break;
+                _outPos += sent;
+            }
+            if ( !pendingOutput() ) {
+                _out.clear();
+                _outPos = 0;
+            }
+            return true;
+        }
+
+    private:
+        enum { MaxPendingOutput = 16 * 1024 * 1024 };
+
+        /* as MessagingPort::recv() does for the same lengths */
+        bool startMessage() {
+            if ( _len == -1 ) {
+                // endian check from the database, after connecting, to see what mode server is running in.
+                unsigned foo = 0x10203040;
+                _out.append( (const char *) &foo , 4 );
+                _lenHave = 0;
+                return true;
+            }
+            if ( _len == 542393671 ) {
+                // an http GET: answer best effort, then close
+                log() << "looks like you're trying to access db over http on native driver port.  please add 1000 for webserver" << endl;
+                string msg = "You are trying to access MongoDB on the native driver port. For http diagnostic access, add 1000 to the port number\n";
+                stringstream ss;
+                ss << "HTTP/1.0 200 OK\r\nConnection: close\r\nContent-Type: text/plain\r\nContent-Length: " << msg.size() << "\r\n\r\n" << msg;
+                _out += ss.str();
+                _eof = true;
+                _lenHave = 0;
+                return true;
+            }
+            if ( _len < MsgDataHeaderSize || _len > 16000000 ) {
+                log() << "bad recv() len: " << _len << ' ' << toString() << endl;
+                return false;
+            }
+            _in = allocMessageBuffer( _len );
+            _in->len = _len;
+            _inHave = 4;
+            return true;
+        }
+
+        /* @return bytes read, 0 if none are available now or at eof (which sets _eof), -1 on error */
+        int _recv( char *buf , int len ) {
+            int r = ::recv( _sock , buf , len , MSG_NOSIGNAL );
+            if ( r > 0 )
+                return r;
+            if ( r == 0 ) {
+                _eof = true;
+                return 0;
+            }
+            if ( errno == EAGAIN || errno == EINTR )
+                return 0;
+            _eof = true;
+            return -1;
+        }
+
+        /* @return bytes sent, 0 if the socket is full, -1 on error */
+        int _send( const char *buf , int len ) {
+            int r = ::send( _sock , buf , len , MSG_NOSIGNAL );
+            if ( r >= 0 )
+                return r;
+            if ( errno == EAGAIN || errno == EINTR )
+                return 0;
+            log() << "MessagingPort reply send() " << errnoWithDescription() << ' ' << toString() << endl;
+            return -1;
+        }
+
+        int _sock;
+        SockAddr _farEnd;
+
+        int _len;           // of the message being read
+        int _lenHave;       // bytes of _len read
+        MsgData *_in;       // message being read
+        int _inHave;
+        list<MsgData*> _ready; // complete messages, in order
+
+        string _out;        // replies not yet taken by the socket
+        unsigned _outPos;
+
+        bool _eof;
+        bool _compress;
+    };
+
+    /* event driven variant of PortMessageServer, for many mostly idle connections: one thread
+       waits in epoll for all of them and hands complete messages to a fixed pool of workers.
+       a connection is with at most one worker at a time, so its messages are still processed
+       in order.
+    */
+    class EpollMessageServer : public MessageServer , public Listener {
+    public:
+        EpollMessageServer( const MessageServer::Options& opts, MessageHandler * handler ) :
+            Listener( opts.ipList, opts.port ), _handler( handler ), _pool( opts.workers ) {
+            _epfd = epoll_create( 1024 );
+            massert( 13331 , string( "epoll_create failed: " ) + errnoWithDescription() , _epfd >= 0 );
+        }
+
+        virtual void accepted( int sock, const SockAddr& from ) {
+            if ( ! connTicketHolder.tryAcquire() ){
+                log() << "connection refused because too many open connections" << endl;
+                closesocket( sock );
+                return;
+            }
+            int flags = fcntl( sock , F_GETFL );
+            fcntl( sock , F_SETFL , flags | O_NONBLOCK );
+            EpollConnection *c = new EpollConnection( sock , from );
+            if ( !arm( c , EPOLL_CTL_ADD ) ) {
+                log() << "epoll_ctl failed " << errnoWithDescription() << ", closing connection" << endl;
+                delete c;
+                connTicketHolder.release();
+            }
+        }
+
+        void run(){
+            boost::thread t( boost::bind( &EpollMessageServer::eventLoop , this ) );
+            initAndListen();
+        }
+
+    private:
+        bool arm( EpollConnection *c , int op ) {
+            struct epoll_event ev;
+            memset( &ev , 0 , sizeof( ev ) );
+            // after eof only to finish writing
+            ev.events = ( c->eof() ? 0 : EPOLLIN ) | EPOLLONESHOT;
+            if ( c->pendingOutput() )
+                ev.events |= EPOLLOUT;
+            ev.data.ptr = c;
+            return epoll_ctl( _epfd , op , c->sock() , &ev ) == 0;
+        }
+
+        void close( EpollConnection *c ) {
+            if( !cmdLine.quiet )
+                log() << "end connection " << c->toString() << endl;
+            epoll_ctl( _epfd , EPOLL_CTL_DEL , c->sock() , 0 );
+            _handler->disconnected( c );
+            delete c;
+            connTicketHolder.release();
+        }
+
+        void eventLoop() {
+            const int MaxEvents = 256;
+            struct epoll_event events[ MaxEvents ];
+            while ( ! inShutdown() ) {
+                int n = epoll_wait( _epfd , events , MaxEvents , 100 );
+                if ( n < 0 ) {
+                    if ( errno != EINTR )
+                        log() << "epoll_wait failed " << errnoWithDescription() << endl;
+                    continue;
+                }
+                for( int i = 0; i < n; ++i ) {
+                    EpollConnection *c = (EpollConnection *) events[ i ].data.ptr;
+                    bool ok = c->flush() && c->readAvailable() && c->flush();
+                    if ( !ok )
+                        close( c );
+                    else if ( c->hasReady() )
+                        _pool.schedule( &EpollMessageServer::work , this , c );
+                    else if ( ( c->eof() && !c->pendingOutput() ) || !arm( c , EPOLL_CTL_MOD ) )
+                        close( c );
+                }
+            }
+        }
+
+        /* runs on a worker: processes the messages read so far, then hands the connection back */
+        void work( EpollConnection *c ) {
+            bool ok = true;
+            try {
+                while ( ok && c->hasReady() ) {
+                    Message m;
+                    ok = c->nextReady( m );
+                    if ( !ok )
+                        break;
+                    _handler->process( m , c );
+                    ok = c->flush();
+                }
+            }
+            catch ( const SocketException& ){
+                log() << "unclean socket shutdown from: " << c->toString() << endl;
+                ok = false;
+            }
+            catch ( const std::exception& e ){
+                problem() << "uncaught exception (" << e.what() << ")(" << demangleName( typeid(e) ) <<") in EpollMessageServer::work, closing connection" << endl;
+                ok = false;
+            }
+            catch ( ... ){
+                problem() << "uncaught exception in EpollMessageServer::work, closing connection" << endl;
+                ok = false;
+            }
+            if ( !ok || ( c->eof() && !c->pendingOutput() ) || !arm( c , EPOLL_CTL_MOD ) )
+                close( c );
+        }
+
+        MessageHandler * _handler;
+        ThreadPool _pool;
+        int _epfd;
+    };
+
+#endif
+
     MessageServer * createServer( const MessageServer::Options& opts , MessageHandler * handler ){
+#if defined(__linux__)
+        if ( opts.workers > 0 )
+            return new EpollMessageServer( opts , handler );
+#endif
         return new PortMessageServer( opts , handler );
     }    
 
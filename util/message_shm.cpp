@@ -0,0 +1,376 @@
+// message_shm.cpp
+
+/*    Copyright 2010 10gen Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "pch.h"
+#include "message_shm.h"
+#include "../db/dbmessage.h"
+
+#if defined(__linux__)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <limits.h>
+
+namespace mongo {
+
+    int ShmMessagingPort::ringBytes = 1024 * 1024;
+
+    /* how long a wait spins before it sleeps: a local server usually answers a small query
+       within it, so neither side makes a system call.  on one cpu spinning only keeps the
+       other side from running
+    */
+    static int spinIterations() {
+        static int n = sysconf( _SC_NPROCESSORS_ONLN ) > 1 ? 20000 : 0;
+        return n;
+    }
+
+    static void futexWait( volatile unsigned *word, unsigned seen, int millis ) {
+        struct timespec ts;
+        ts.tv_sec = millis / 1000;
+        ts.tv_nsec = ( millis % 1000 ) * 1000000;
+        syscall( SYS_futex, (int *) word, FUTEX_WAIT, (int) seen, &ts, 0, 0 );
+    }
+
+    static void futexWake( volatile unsigned *word ) {
+        syscall( SYS_futex, (int *) word, FUTEX_WAKE, INT_MAX, 0, 0, 0 );
+    }
+
+    static int ringSpan( int size ) {
+        return sizeof( ShmRing ) + size;
+    }
+
+    int ShmMessagingPort::memBytes( int ringSize ) {
+        return 2 * ringSpan( ringSize );
+    }
+
+    void ShmMessagingPort::initRings( char *mem, int ringSize ) {
+        for( int i = 0; i < 2; ++i ) {
+            ShmRing *r = (ShmRing *) ( mem + i * ringSpan( ringSize ) );
+            memset( r, 0, sizeof( ShmRing ) );
+            r->size = ringSize;
+        }
+    }
+
+    /* the client checks what the server set up.  @return the ring size, 0 if bad */
+    static int validRings( char *mem, long long memSize ) {
+        if ( memSize < 2 * (int) sizeof( ShmRing ) )
+            return 0;
+        unsigned size = ( (ShmRing *) mem )->size;
+        if ( size == 0 || ( size & ( size - 1 ) ) || size > (unsigned) memSize )
+            return 0;
+        if ( ShmMessagingPort::memBytes( size ) != memSize || ( (ShmRing *) ( mem + ringSpan( size ) ) )->size != size )
+            return 0;
+        return size;
+    }
+
+    ShmMessagingPort::ShmMessagingPort( int sock, const SockAddr& farEnd, char *mem, int ringSize, bool server )
+        : MessagingPort( sock, farEnd ), _mem( mem ), _size( ringSize ) {
+        ShmRing *toServer = (ShmRing *) mem;
+        ShmRing *toClient = (ShmRing *) ( mem + ringSpan( ringSize ) );
+        _in = server ? toServer : toClient;
+        _out = server ? toClient : toServer;
+    }
+
+    ShmMessagingPort::~ShmMessagingPort() {
+        shutdown();
+        munmap( _mem, memBytes( _size ) );
+    }
+
+    void ShmMessagingPort::shutdown() {
+        _in->closed = 1;
+        _out->closed = 1;
+        __sync_synchronize();
+        futexWake( &_in->head );
+        futexWake( &_in->tail );
+        futexWake( &_out->head );
+        futexWake( &_out->tail );
+        MessagingPort::shutdown();
+    }
+
+    bool ShmMessagingPort::recv( Message& m ) {
+        try {
+            int len;
+            read( (char *) &len, 4 );
+            if ( len < MsgDataHeaderSize || len > 16000000 ) {
+                log(_logLevel) << "bad shared memory recv() len: " << len << ' ' << farEnd.toString() << endl;
+                return false;
+            }
+            MsgData *md = allocMessageBuffer( len );
+            m.setPooledData( md );
+            md->len = len;
+            read( (char *) &md->id, len - 4 );
+            return true;
+        }
+        catch ( const SocketException& ) {
+            m.reset();
+            return false;
+        }
+    }
+
+    void ShmMessagingPort::say( Message& toSend, int responseTo ) {
+        assert( !toSend.empty() );
+        toSend.header()->id = nextMessageId();
+        toSend.header()->responseTo = responseTo;
+        vector< pair< char *, int > > data;
+        toSend.gather( data );
+        for( vector< pair< char *, int > >::const_iterator i = data.begin(); i != data.end(); ++i )
+            write( i->first, i->second );
+    }
+
+    void ShmMessagingPort::write( const char *data, int len ) {
+        ShmRing *r = _out;
+        while ( len > 0 ) {
+            if ( r->closed )
+                throw SocketException();
+            unsigned head = r->head;
+            unsigned tail = r->tail;
+            if ( head - tail > _size )
+                protocolError( "write" );
+            unsigned space = _size - ( head - tail );
+            if ( space == 0 ) {
+                waitFor( r, &r->tail, tail, &r->writerWaiting );
+                continue;
+            }
+            unsigned n = min( (unsigned) len, space );
+            unsigned at = head & ( _size - 1 );
+            unsigned first = min( n, _size - at );
+            memcpy( r->data() + at, data, first );
+            memcpy( r->data(), data + first, n - first );
+            __sync_synchronize(); // the bytes, then head
+            r->head = head + n;
+            __sync_synchronize(); // head, then whether the reader sleeps
+            if ( r->readerWaiting )
+                futexWake( &r->head );
+            data += n;
+            len -= n;
+        }
+    }
+
+    void ShmMessagingPort::read( char *data, int len ) {
+        ShmRing *r = _in;
+        while ( len > 0 ) {
+            unsigned tail = r->tail;
+            unsigned head = r->head;
+            if ( head == tail ) {
+                // what the peer wrote before it went away is still read
+                if ( r->closed )
+                    throw SocketException();
+                waitFor( r, &r->head, head, &r->readerWaiting );
+                continue;
+            }
+            if ( head - tail > _size )
+                protocolError( "read" );
+            __sync_synchronize(); // head, then the bytes
+            unsigned n = min( (unsigned) len, head - tail );
+            unsigned at = tail & ( _size - 1 );
+            unsigned first = min( n, _size - at );
+            memcpy( data, r->data() + at, first );
+            memcpy( data + first, r->data(), n - first );
+            __sync_synchronize(); // the bytes are out before tail gives their room back
+            r->tail = tail + n;
+            __sync_synchronize();
+            if ( r->writerWaiting )
+                futexWake( &r->tail );
+            data += n;
+            len -= n;
+        }
+    }
+
+    void ShmMessagingPort::protocolError( const char *what ) {
+        log() << "shared memory transport: bad ring on " << what << " from " << farEnd.toString() << ", closing" << endl;
+        shutdown();
+        throw SocketException();
+    }
+
+    void ShmMessagingPort::waitFor( ShmRing *r, volatile unsigned *word, unsigned seen, volatile int *waiting ) {
+        for( int i = spinIterations(); i > 0; --i ) {
+            if ( *word != seen )
+                return;
+        }
+        Timer t;
+        while ( 1 ) {
+            // as the other side: set the flag, then check - so one of us sees the other
+            *waiting = 1;
+            __sync_synchronize();
+            if ( *word == seen )
+                futexWait( word, seen, 100 );
+            *waiting = 0;
+            if ( *word != seen )
+                return;
+            if ( r->closed || peerGone() )
+                throw SocketException();
+            if ( _timeout > 0 && t.seconds() >= _timeout )
+                throw SocketException();
+        }
+    }
+
+    /* the socket carries nothing after the handshake: readable means closed */
+    bool ShmMessagingPort::peerGone() {
+        int sock = MessagingPort::getSocket();
+        if ( sock < 0 )
+            return true;
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if ( poll( &pfd, 1, 0 ) <= 0 )
+            return false;
+        char c;
+        int n = ::recv( sock, &c, 1, MSG_PEEK | MSG_DONTWAIT );
+        return n == 0 || ( n < 0 && errno != EAGAIN && errno != EINTR );
+    }
+
+    /* an unlinked file in tmpfs if there is one: nothing left behind, only the fd passed
+       over the socket opens it
+    */
+    static int makeSharedMemory( int size ) {
+        const char *dirs[] = { "/dev/shm", "/tmp" };
+        for( unsigned i = 0; i < sizeof( dirs ) / sizeof( dirs[ 0 ] ); ++i ) {
+            string path = string( dirs[ i ] ) + "/mongodb-shm-XXXXXX";
+            vector< char > name( path.begin(), path.end() );
+            name.push_back( 0 );
+            int fd = mkstemp( &name[ 0 ] );
+            if ( fd < 0 )
+                continue;
+            unlink( &name[ 0 ] );
+            if ( ftruncate( fd, size ) == 0 )
+                return fd;
+            close( fd );
+        }
+        return -1;
+    }
+
+    static bool sendFd( int sock, int fd ) {
+        char byte = 0;
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+        char control[ CMSG_SPACE( sizeof( int ) ) ];
+        memset( control, 0, sizeof( control ) );
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+        struct cmsghdr *c = CMSG_FIRSTHDR( &msg );
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN( sizeof( int ) );
+        memcpy( CMSG_DATA( c ), &fd, sizeof( int ) );
+        return sendmsg( sock, &msg, MSG_NOSIGNAL ) == 1;
+    }
+
+    static int recvFd( int sock ) {
+        char byte;
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+        char control[ CMSG_SPACE( sizeof( int ) ) ];
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+        if ( recvmsg( sock, &msg, 0 ) != 1 )
+            return -1;
+        struct cmsghdr *c = CMSG_FIRSTHDR( &msg );
+        if ( !c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS )
+            return -1;
+        int fd;
+        memcpy( &fd, CMSG_DATA( c ), sizeof( int ) );
+        return fd;
+    }
+
+    bool upgradeToSharedMemory( auto_ptr<MessagingPort>& p, Message& m ) {
+        if ( p->farEnd.getType() != AF_UNIX || m.operation() != dbQuery )
+            return false;
+        DbMessage d( m );
+        if ( strcmp( d.getns(), "admin.$cmd" ) != 0 )
+            return false;
+        QueryMessage q( d );
+        if ( strcmp( q.query.firstElement().fieldName(), "shmTransport" ) != 0 )
+            return false;
+
+        int ringSize = ShmMessagingPort::ringBytes;
+        int size = ShmMessagingPort::memBytes( ringSize );
+        int fd = makeSharedMemory( size );
+        char *mem = (char *) MAP_FAILED;
+        if ( fd >= 0 )
+            mem = (char *) mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        if ( mem == MAP_FAILED ) {
+            // the client stays on the unix socket
+            string err = errnoWithDescription();
+            log() << "shared memory transport for " << p->farEnd.toString() << " failed: " << err << endl;
+            if ( fd >= 0 )
+                close( fd );
+            BSONObj res = BSON( "ok" << 0 << "errmsg" << "no shared memory: " + err );
+            replyToQuery( 0, p.get(), m, res );
+            return true;
+        }
+        ShmMessagingPort::initRings( mem, ringSize );
+
+        BSONObj res = BSON( "ok" << 1 << "ringBytes" << ringSize );
+        replyToQuery( 0, p.get(), m, res );
+        bool sent = sendFd( p->getSocket(), fd );
+        close( fd );
+        if ( !sent ) {
+            munmap( mem, size );
+            throw SocketException();
+        }
+
+        SockAddr farEnd = p->farEnd;
+        int sock = dup( p->getSocket() );
+        p.reset( new ShmMessagingPort( sock, farEnd, mem, ringSize, true ) );
+        log(1) << "shared memory transport for " << farEnd.toString() << endl;
+        return true;
+    }
+
+    MessagingPort* sharedMemoryPort( MessagingPort& p, int logLevel ) {
+        int fd = recvFd( p.getSocket() );
+        if ( fd < 0 ) {
+            log(logLevel) << "shared memory transport: no fd from " << p.farEnd.toString() << endl;
+            return 0;
+        }
+        struct stat st;
+        char *mem = (char *) MAP_FAILED;
+        if ( fstat( fd, &st ) == 0 && st.st_size < INT_MAX )
+            mem = (char *) mmap( 0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        close( fd );
+        if ( mem == MAP_FAILED ) {
+            log(logLevel) << "shared memory transport: mmap failed " << errnoWithDescription() << endl;
+            return 0;
+        }
+        int ringSize = validRings( mem, st.st_size );
+        if ( !ringSize ) {
+            log(logLevel) << "shared memory transport: bad rings from " << p.farEnd.toString() << endl;
+            munmap( mem, st.st_size );
+            return 0;
+        }
+        ShmMessagingPort *s = new ShmMessagingPort( dup( p.getSocket() ), p.farEnd, mem, ringSize, false );
+        s->_timeout = p._timeout;
+        s->_logLevel = p._logLevel;
+        return s;
+    }
+
+} // namespace mongo
+
+#endif
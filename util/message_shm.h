@@ -0,0 +1,109 @@
+// message_shm.h
+
+/*    Copyright 2010 10gen Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+/**
+   shared memory transport for clients on the same host: messages go through two ring
+   buffers in memory both processes map, so a small query costs no system call while the
+   other side is busy.
+
+   set up over the server's unix socket: the client sends the query admin.$cmd
+   { shmTransport : 1 }, the server answers { ok : 1 } and passes the memory's fd over the
+   socket.  the socket stays open so either side notices when the other goes away.
+
+   linux only (futex for the waits).
+ */
+
+#pragma once
+
+#include "message.h"
+
+#if defined(__linux__)
+
+namespace mongo {
+
+    /** one direction.  head and tail only grow (wrapping), so head - tail is what is in it.
+        each is written by one side only, on its own cache line.  the peer can write all of
+        it: the port checks what it reads and keeps its own copy of size
+    */
+    struct ShmRing {
+        volatile unsigned head;     // bytes ever written
+        volatile int readerWaiting; // the reader is in, or about to be in, futex wait on head
+        char _pad1[ 56 ];
+        volatile unsigned tail;     // bytes ever read
+        volatile int writerWaiting; // the writer waits on tail
+        char _pad2[ 56 ];
+        volatile int closed;        // either side went away
+        unsigned size;              // of the data which follows, a power of two
+        char _pad3[ 56 ];
+
+        char *data() { return (char *) ( this + 1 ); }
+    };
+
+    class ShmMessagingPort : public MessagingPort {
+    public:
+        /** takes over sock, the unix socket, and mem: memBytes( ringSize ) of two rings, the
+            first one is read by the server
+        */
+        ShmMessagingPort( int sock, const SockAddr& farEnd, char *mem, int ringSize, bool server );
+        virtual ~ShmMessagingPort();
+
+        virtual bool recv( Message& m );
+        virtual void say( Message& toSend, int responseTo = -1 );
+        /** no write queue: a message in the ring costs about what queueing it would */
+        virtual void piggyBack( Message& toSend, int responseTo = -1 ) { say( toSend, responseTo ); }
+        virtual void flush() { }
+        /** nothing is written ahead of say() */
+        virtual int sendAvailable( const vector< pair< char *, int > > &data ) { return 0; }
+        virtual int getSocket() const { return -1; }
+        virtual void shutdown();
+
+        /** bytes in each direction */
+        static int ringBytes;
+
+        /** the memory two rings of ringSize take */
+        static int memBytes( int ringSize );
+        /** sets up empty rings in mem - by the side creating it */
+        static void initRings( char *mem, int ringSize );
+
+    private:
+        void write( const char *data, int len );
+        void read( char *data, int len );
+        /* waits until *word isn't seen anymore.  throws SocketException once the peer is gone */
+        void waitFor( ShmRing *r, volatile unsigned *word, unsigned seen, volatile int *waiting );
+        bool peerGone();
+        /* the peer broke the protocol: closes the port and throws SocketException */
+        void protocolError( const char *what );
+
+        char *_mem;
+        unsigned _size;  // of each ring: never read back from the shared memory
+        ShmRing *_in;
+        ShmRing *_out;
+    };
+
+    /** server: if m is the { shmTransport : 1 } request on a unix socket, answers it and
+        replaces p by a ShmMessagingPort.  @return false if m is anything else
+    */
+    bool upgradeToSharedMemory( auto_ptr<MessagingPort>& p, Message& m );
+
+    /** client: once the server answered { shmTransport : 1 } with ok on p, takes the memory
+        it passes over.  @return 0 on failure, p is then unusable
+    */
+    MessagingPort* sharedMemoryPort( MessagingPort& p, int logLevel );
+
+} // namespace mongo
+
+#endif
@@ -79,6 +79,241 @@ namespace mongo {
         return "";
     }
 
+    /* per thread cache of BufBuilder buffers (see bson/util/builder.h).  a few buffers are kept
+       for each power of two size from 512 bytes to 64KB, up to MaxBytes in all - threads are
+       many; anything else goes straight to malloc.
+    */
+    class BufferCache : boost::noncopyable {
+    public:
+        enum { MinShift = 9, MaxShift = 16, PerSize = 8, MaxBytes = 256 * 1024 };
+        BufferCache() : _live(), _active(), _mallocs(), _bytes(), _spareBlock() {
+            for( int i = 0; i <= MaxShift - MinShift; ++i )
+                _n[ i ] = 0;
+        }
+        ~BufferCache() {
+            for( int i = 0; i <= MaxShift - MinShift; ++i )
+                while( _n[ i ] )
+                    free( _bufs[ i ][ --_n[ i ] ] );
+            free( _spareBlock );
+        }
+        void* alloc( int& size ) {
+            if ( _active && size <= BufferArena::MaxBuffer )
+                return _active->alloc( size );
+            int c = sizeClass( size );
+            if ( c < 0 ) {
+                _mallocs++;
+                return malloc( size );
+            }
+            size = 1 << ( c + MinShift );
+            if ( _n[ c ] ) {
+                _bytes -= size;
+                return _bufs[ c ][ --_n[ c ] ];
+            }
+            _mallocs++;
+            return malloc( size );
+        }
+        void release( void *p, int size ) {
+            if ( arenaOwning( p ) )
+                return;
+            int c = sizeClass( size );
+            if ( c >= 0 && size == 1 << ( c + MinShift ) && _n[ c ] < PerSize && _bytes + size <= MaxBytes ) {
+                _bufs[ c ][ _n[ c ]++ ] = p;
+                _bytes += size;
+            }
+            else
+                free( p );
+        }
+        long long mallocs() const { return _mallocs; }
+
+        BufferArena* arenaOwning( const void *p ) const {
+            for( BufferArena *a = _live; a; a = a->_outer )
+                if ( a->owns( p ) )
+                    return a;
+            return 0;
+        }
+
+        /* one arena block is kept between arenas, so an operation using one doesn't malloc */
+        void* takeBlock() {
+            void *b = _spareBlock;
+            _spareBlock = 0;
+            if ( !b ) {
+                _mallocs++;
+                b = malloc( BufferArena::BlockSize );
+            }
+            return b;
+        }
+        void giveBlock( void *b ) {
+            if ( _spareBlock )
+                free( b );
+            else
+                _spareBlock = b;
+        }
+
+        BufferArena *_live;   // innermost arena on this thread
+        BufferArena *_active; // arena allocBuffer() uses, if any
+    private:
+        /* smallest class holding size, or -1 if too big to cache */
+        static int sizeClass( int size ) {
+            int c = 0;
+            while( ( 1 << ( c + MinShift ) ) < size )
+                if ( ++c > MaxShift - MinShift )
+                    return -1;
+            return c;
+        }
+        void *_bufs[ MaxShift - MinShift + 1 ][ PerSize ];
+        int _n[ MaxShift - MinShift + 1 ];
+        long long _mallocs;
+        int _bytes; // in _bufs
+        void *_spareBlock;
+    };
+
+    // BufBuilders may be made and destroyed by other static constructors and destructors
+    static ThreadLocalCache< BufferCache > bufferCaches;
+    static bool bufferCachesReady = bufferCaches.init();
+
+    static BufferCache& bufferCache() {
+        return bufferCaches.get();
+    }
+
+    void* allocCachedBuffer( int& size ) {
+        return bufferCache().alloc( size );
+    }
+
+    void freeCachedBuffer( void *p, int size ) {
+        bufferCache().release( p, size );
+    }
+
+    long long bufferMallocs() {
+        return bufferCache().mallocs();
+    }
+
+    void* reallocCachedBuffer( void *p, int oldSize, int& newSize ) {
+        if ( !bufferCache().arenaOwning( p ) )
+            return realloc( p, newSize );
+        void *q = allocCachedBuffer( newSize );
+        memcpy( q, p, min( oldSize, newSize ) );
+        return q;
+    }
+
+    BufferArena::BufferArena() : _blocks( 0 ), _next( 0 ) {
+        BufferCache& c = bufferCache();
+        _outer = c._live;
+        c._live = this;
+    }
+
+    BufferArena::~BufferArena() {
+        BufferCache& c = bufferCache();
+        assert( c._live == this && c._active != this );
+        c._live = _outer;
+        while( _blocks ) {
+            Block *b = _blocks;
+            _blocks = b->next;
+            c.giveBlock( b );
+        }
+    }
+
+    void* BufferArena::alloc( int size ) {
+        size = ( size + 7 ) & ~7;
+        if ( !_blocks || _next + size > _blocks->end ) {
+            Block *b = (Block *) bufferCache().takeBlock();
+            b->next = _blocks;
+            b->end = (char *) b + BlockSize;
+            _blocks = b;
+            _next = (char *) ( b + 1 );
+        }
+        void *p = _next;
+        _next += size;
+        return p;
+    }
+
+    bool BufferArena::owns( const void *p ) const {
+        for( Block *b = _blocks; b; b = b->next )
+            if ( p > (const void *) b && p < (const void *) b->end )
+                return true;
+        return false;
+    }
+
+    BufferArena::Scope::Scope( BufferArena& a ) {
+        BufferCache& c = bufferCache();
+        _prev = c._active;
+        c._active = &a;
+    }
+
+    BufferArena::Scope::~Scope() {
+        bufferCache()._active = _prev;
+    }
+
+    struct BufferCacheUnitTest : public UnitTest {
+        void run() {
+            int size = 600;
+            void *p = allocBuffer( size );
+            assert( size == 1024 );
+            freeBuffer( p, size );
+            size = 1000;
+            long long before = bufferMallocs();
+            assert( allocBuffer( size ) == p );
+            assert( size == 1024 && bufferMallocs() == before );
+            freeBuffer( p, size );
+
+            size = 100 * 1024;
+            p = allocBuffer( size );
+            assert( size == 100 * 1024 && bufferMallocs() == before + 1 );
+            freeBuffer( p, size );
+
+            // no more than MaxBytes are kept
+            void *big[ BufferCache::PerSize ];
+            size = 1 << BufferCache::MaxShift;
+            for( int i = 0; i < BufferCache::PerSize; ++i )
+                big[ i ] = allocBuffer( size );
+            for( int i = 0; i < BufferCache::PerSize; ++i )
+                freeBuffer( big[ i ], size );
+            before = bufferMallocs();
+            for( int i = 0; i < BufferCache::PerSize; ++i )
+                big[ i ] = allocBuffer( size );
+            assert( bufferMallocs() - before >= BufferCache::PerSize - BufferCache::MaxBytes / size );
+            for( int i = 0; i < BufferCache::PerSize; ++i )
+                freeBuffer( big[ i ], size );
+        }
+    } bufferCacheUnitTest;
+
+    struct BufferArenaUnitTest : public UnitTest {
+        void run() {
+            BufferArena arena;
+            int size = 600;
+            void *p;
+            {
+                BufferArena::Scope s( arena );
+                p = allocBuffer( size );
+                assert( arena.owns( p ) );
+                long long before = bufferMallocs();
+                for( int i = 0; i < 100; ++i ) {
+                    size = 100;
+                    freeBuffer( allocBuffer( size ), size );
+                }
+                assert( bufferMallocs() <= before + 1 );
+
+                // too big for the arena
+                size = BufferArena::MaxBuffer + 1;
+                void *q = allocBuffer( size );
+                assert( !arena.owns( q ) );
+                freeBuffer( q, size );
+
+                // growing out of the arena copies
+                BufBuilder b( 64 );
+                assert( arena.owns( b.buf() ) );
+                b.append( "abc" );
+                b.skip( 2 * BufferArena::MaxBuffer );
+                assert( !arena.owns( b.buf() ) && strcmp( b.buf(), "abc" ) == 0 );
+            }
+            // still valid, and nothing to free, after the scope closes
+            freeBuffer( p, 600 );
+            size = 600;
+            void *q = allocBuffer( size );
+            assert( !arena.owns( q ) );
+            freeBuffer( q, size );
+        }
+    } bufferArenaUnitTest;
+
     vector<UnitTest*> *UnitTest::tests = 0;
     bool UnitTest::running = false;
 